@@ -0,0 +1,452 @@
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "aead.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AEAD_X86 1
+#include <immintrin.h>
+#endif
+
+/* XOR nblocks 64-byte keystream blocks, starting at block counter, into data */
+typedef void (*chacha_blocks_fn)(const uint32_t in[16], uint32_t counter, unsigned char *data, size_t nblocks);
+
+static chacha_blocks_fn blocks_impl;
+static const char *blocks_name;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static uint32_t load32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t load64(const unsigned char *p)
+{
+    return (uint64_t)load32(p) | (uint64_t)load32(p + 4) << 32;
+}
+
+static void store64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+/* ---------------- scalar: one block at a time ---------------- */
+
+#define ROTL32(v, n) ((v) << (n) | (v) >> (32 - (n)))
+#define QR(a, b, c, d)                  \
+    do                                  \
+    {                                   \
+        a += b; d ^= a; d = ROTL32(d, 16); \
+        c += d; b ^= c; b = ROTL32(b, 12); \
+        a += b; d ^= a; d = ROTL32(d, 8);  \
+        c += d; b ^= c; b = ROTL32(b, 7);  \
+    } while (0)
+
+static void chacha_block(const uint32_t in[16], uint32_t counter, unsigned char out[64])
+{
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+    x[12] = counter;
+    for (int i = 0; i < 10; i++)
+    {
+        QR(x[0], x[4], x[8], x[12]);
+        QR(x[1], x[5], x[9], x[13]);
+        QR(x[2], x[6], x[10], x[14]);
+        QR(x[3], x[7], x[11], x[15]);
+        QR(x[0], x[5], x[10], x[15]);
+        QR(x[1], x[6], x[11], x[12]);
+        QR(x[2], x[7], x[8], x[13]);
+        QR(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        uint32_t v = x[i] + (i == 12 ? counter : in[i]);
+        out[4 * i] = (unsigned char)v;
+        out[4 * i + 1] = (unsigned char)(v >> 8);
+        out[4 * i + 2] = (unsigned char)(v >> 16);
+        out[4 * i + 3] = (unsigned char)(v >> 24);
+    }
+}
+
+static void blocks_scalar(const uint32_t in[16], uint32_t counter, unsigned char *data, size_t nblocks)
+{
+    unsigned char ks[64];
+    for (; nblocks > 0; nblocks--, counter++, data += 64)
+    {
+        chacha_block(in, counter, ks);
+        for (int i = 0; i < 64; i++)
+            data[i] ^= ks[i];
+    }
+}
+
+#ifdef AEAD_X86
+
+/* ---------------- sse2: 4 blocks per step, one state word per register ---------------- */
+
+#define ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define QR128(a, b, c, d)                                                     \
+    do                                                                        \
+    {                                                                         \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 16); \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 12); \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 8);  \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 7);  \
+    } while (0)
+
+/* XOR 16 bytes at p with v */
+#define XOR128(p, v) _mm_storeu_si128((__m128i *)(p), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p)), v))
+
+__attribute__((target("sse2")))
+static void blocks_sse2(const uint32_t in[16], uint32_t counter, unsigned char *data, size_t nblocks)
+{
+    for (; nblocks >= 4; nblocks -= 4, counter += 4, data += 256)
+    {
+        __m128i x[16], orig[16];
+        for (int i = 0; i < 16; i++)
+            orig[i] = _mm_set1_epi32((int)in[i]);
+        orig[12] = _mm_add_epi32(_mm_set1_epi32((int)counter), _mm_setr_epi32(0, 1, 2, 3));
+        memcpy(x, orig, sizeof(x));
+
+        for (int i = 0; i < 10; i++)
+        {
+            QR128(x[0], x[4], x[8], x[12]);
+            QR128(x[1], x[5], x[9], x[13]);
+            QR128(x[2], x[6], x[10], x[14]);
+            QR128(x[3], x[7], x[11], x[15]);
+            QR128(x[0], x[5], x[10], x[15]);
+            QR128(x[1], x[6], x[11], x[12]);
+            QR128(x[2], x[7], x[8], x[13]);
+            QR128(x[3], x[4], x[9], x[14]);
+        }
+
+        // Lane j of x[i] is word i of block j: transpose each group of four words back into blocks
+        for (int g = 0; g < 4; g++)
+        {
+            __m128i a = _mm_add_epi32(x[4 * g], orig[4 * g]);
+            __m128i b = _mm_add_epi32(x[4 * g + 1], orig[4 * g + 1]);
+            __m128i c = _mm_add_epi32(x[4 * g + 2], orig[4 * g + 2]);
+            __m128i d = _mm_add_epi32(x[4 * g + 3], orig[4 * g + 3]);
+            __m128i t0 = _mm_unpacklo_epi32(a, b), t1 = _mm_unpacklo_epi32(c, d);
+            __m128i t2 = _mm_unpackhi_epi32(a, b), t3 = _mm_unpackhi_epi32(c, d);
+            XOR128(data + 16 * g, _mm_unpacklo_epi64(t0, t1));
+            XOR128(data + 64 + 16 * g, _mm_unpackhi_epi64(t0, t1));
+            XOR128(data + 128 + 16 * g, _mm_unpacklo_epi64(t2, t3));
+            XOR128(data + 192 + 16 * g, _mm_unpackhi_epi64(t2, t3));
+        }
+    }
+    blocks_scalar(in, counter, data, nblocks);
+}
+
+/* ---------------- avx2: 8 blocks per step, byte shuffles for the 16 and 8-bit rotates ---------------- */
+
+#define ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define QR256(a, b, c, d)                                                                     \
+    do                                                                                        \
+    {                                                                                         \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16); \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 12);          \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8);  \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 7);           \
+    } while (0)
+
+__attribute__((target("avx2")))
+static void blocks_avx2(const uint32_t in[16], uint32_t counter, unsigned char *data, size_t nblocks)
+{
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+    for (; nblocks >= 8; nblocks -= 8, counter += 8, data += 512)
+    {
+        __m256i x[16], orig[16];
+        for (int i = 0; i < 16; i++)
+            orig[i] = _mm256_set1_epi32((int)in[i]);
+        orig[12] = _mm256_add_epi32(_mm256_set1_epi32((int)counter), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        memcpy(x, orig, sizeof(x));
+
+        for (int i = 0; i < 10; i++)
+        {
+            QR256(x[0], x[4], x[8], x[12]);
+            QR256(x[1], x[5], x[9], x[13]);
+            QR256(x[2], x[6], x[10], x[14]);
+            QR256(x[3], x[7], x[11], x[15]);
+            QR256(x[0], x[5], x[10], x[15]);
+            QR256(x[1], x[6], x[11], x[12]);
+            QR256(x[2], x[7], x[8], x[13]);
+            QR256(x[3], x[4], x[9], x[14]);
+        }
+
+        // Unpacks work within 128-bit halves: the low half yields blocks 0-3, the high half blocks 4-7
+        for (int g = 0; g < 4; g++)
+        {
+            __m256i a = _mm256_add_epi32(x[4 * g], orig[4 * g]);
+            __m256i b = _mm256_add_epi32(x[4 * g + 1], orig[4 * g + 1]);
+            __m256i c = _mm256_add_epi32(x[4 * g + 2], orig[4 * g + 2]);
+            __m256i d = _mm256_add_epi32(x[4 * g + 3], orig[4 * g + 3]);
+            __m256i t0 = _mm256_unpacklo_epi32(a, b), t1 = _mm256_unpacklo_epi32(c, d);
+            __m256i t2 = _mm256_unpackhi_epi32(a, b), t3 = _mm256_unpackhi_epi32(c, d);
+            __m256i r[4] = {_mm256_unpacklo_epi64(t0, t1), _mm256_unpackhi_epi64(t0, t1),
+                            _mm256_unpacklo_epi64(t2, t3), _mm256_unpackhi_epi64(t2, t3)};
+            for (int j = 0; j < 4; j++)
+            {
+                XOR128(data + 64 * j + 16 * g, _mm256_castsi256_si128(r[j]));
+                XOR128(data + 64 * (j + 4) + 16 * g, _mm256_extracti128_si256(r[j], 1));
+            }
+        }
+    }
+    blocks_sse2(in, counter, data, nblocks);
+}
+
+#endif
+
+/* One-time setup: pick the widest block implementation the CPU supports */
+static void chacha_init_impl(void)
+{
+    blocks_impl = blocks_scalar;
+    blocks_name = "scalar";
+#ifdef AEAD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        blocks_impl = blocks_avx2;
+        blocks_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        blocks_impl = blocks_sse2;
+        blocks_name = "sse2";
+    }
+#endif
+}
+
+const char *chacha20_impl(void)
+{
+    pthread_once(&init_once, chacha_init_impl);
+    return blocks_name;
+}
+
+void chacha20_init(ChaCha20 *c, const unsigned char key[AEAD_KEY_LEN], const unsigned char nonce[AEAD_NONCE_LEN],
+                   uint32_t counter)
+{
+    c->input[0] = 0x61707865;  // "expand 32-byte k"
+    c->input[1] = 0x3320646e;
+    c->input[2] = 0x79622d32;
+    c->input[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++)
+        c->input[4 + i] = load32(key + 4 * i);
+    c->input[12] = counter;
+    for (int i = 0; i < 3; i++)
+        c->input[13 + i] = load32(nonce + 4 * i);
+}
+
+void chacha20_xor(const ChaCha20 *c, uint64_t pos, unsigned char *data, size_t len)
+{
+    pthread_once(&init_once, chacha_init_impl);
+    uint32_t counter = c->input[12] + (uint32_t)(pos / 64);
+    size_t skip = (size_t)(pos % 64);
+
+    // A start inside a block uses the rest of that block's keystream
+    if (skip > 0 && len > 0)
+    {
+        unsigned char ks[64];
+        size_t n = 64 - skip < len ? 64 - skip : len;
+        chacha_block(c->input, counter++, ks);
+        for (size_t i = 0; i < n; i++)
+            data[i] ^= ks[skip + i];
+        data += n;
+        len -= n;
+    }
+
+    size_t whole = len / 64;
+    blocks_impl(c->input, counter, data, whole);
+    counter += (uint32_t)whole;
+    data += whole * 64;
+    len -= whole * 64;
+
+    if (len > 0)
+    {
+        unsigned char ks[64];
+        chacha_block(c->input, counter, ks);
+        for (size_t i = 0; i < len; i++)
+            data[i] ^= ks[i];
+    }
+}
+
+/* ---------------- Poly1305: 44/44/42-bit limbs ---------------- */
+
+#define MASK44 0xFFFFFFFFFFFULL
+#define MASK42 0x3FFFFFFFFFFULL
+
+void poly1305_init(Poly1305 *p, const unsigned char key[32])
+{
+    uint64_t t0 = load64(key), t1 = load64(key + 8);
+
+    // r is clamped as the RFC requires
+    p->r[0] = t0 & 0xFFC0FFFFFFFULL;
+    p->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xFFFFFC0FFFFULL;
+    p->r[2] = (t1 >> 24) & 0x00FFFFFFC0FULL;
+    p->h[0] = p->h[1] = p->h[2] = 0;
+    p->pad[0] = load64(key + 16);
+    p->pad[1] = load64(key + 24);
+    p->leftover = 0;
+}
+
+/* h = (h + m) * r for each 16-byte block; hibit is 2^128 for full blocks, 0 for the padded last one */
+static void poly1305_blocks(Poly1305 *p, const unsigned char *m, size_t len, uint64_t hibit)
+{
+    const uint64_t r0 = p->r[0], r1 = p->r[1], r2 = p->r[2];
+    const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2];
+
+    for (; len >= 16; len -= 16, m += 16)
+    {
+        uint64_t t0 = load64(m), t1 = load64(m + 8);
+        h0 += t0 & MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+        h2 += ((t1 >> 24) & MASK42) | hibit;
+
+        unsigned __int128 d0 = (unsigned __int128)h0 * r0 + (unsigned __int128)h1 * s2 + (unsigned __int128)h2 * s1;
+        unsigned __int128 d1 = (unsigned __int128)h0 * r1 + (unsigned __int128)h1 * r0 + (unsigned __int128)h2 * s2;
+        unsigned __int128 d2 = (unsigned __int128)h0 * r2 + (unsigned __int128)h1 * r1 + (unsigned __int128)h2 * r0;
+
+        uint64_t c = (uint64_t)(d0 >> 44);
+        h0 = (uint64_t)d0 & MASK44;
+        d1 += c;
+        c = (uint64_t)(d1 >> 44);
+        h1 = (uint64_t)d1 & MASK44;
+        d2 += c;
+        c = (uint64_t)(d2 >> 42);
+        h2 = (uint64_t)d2 & MASK42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= MASK44;
+        h1 += c;
+    }
+
+    p->h[0] = h0;
+    p->h[1] = h1;
+    p->h[2] = h2;
+}
+
+void poly1305_update(Poly1305 *p, const unsigned char *data, size_t len)
+{
+    if (p->leftover > 0)
+    {
+        size_t n = 16 - p->leftover < len ? 16 - p->leftover : len;
+        memcpy(p->buffer + p->leftover, data, n);
+        p->leftover += n;
+        data += n;
+        len -= n;
+        if (p->leftover < 16)
+            return;
+        poly1305_blocks(p, p->buffer, 16, 1ULL << 40);
+        p->leftover = 0;
+    }
+
+    size_t whole = len & ~(size_t)15;
+    poly1305_blocks(p, data, whole, 1ULL << 40);
+    memcpy(p->buffer, data + whole, len - whole);
+    p->leftover = len - whole;
+}
+
+void poly1305_finish(Poly1305 *p, unsigned char tag[AEAD_TAG_LEN])
+{
+    if (p->leftover > 0)
+    {
+        p->buffer[p->leftover] = 1;
+        memset(p->buffer + p->leftover + 1, 0, 16 - p->leftover - 1);
+        poly1305_blocks(p, p->buffer, 16, 0);
+    }
+
+    // Fully carry h
+    uint64_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], c;
+    c = h1 >> 44; h1 &= MASK44;
+    h2 += c; c = h2 >> 42; h2 &= MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+    h1 += c; c = h1 >> 44; h1 &= MASK44;
+    h2 += c; c = h2 >> 42; h2 &= MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+    h1 += c;
+
+    // g = h - (2^130 - 5); keep it if it did not borrow, without branching
+    uint64_t g0 = h0 + 5;
+    c = g0 >> 44; g0 &= MASK44;
+    uint64_t g1 = h1 + c;
+    c = g1 >> 44; g1 &= MASK44;
+    uint64_t g2 = h2 + c - (1ULL << 42);
+    c = (g2 >> 63) - 1;
+    h0 = (h0 & ~c) | (g0 & c);
+    h1 = (h1 & ~c) | (g1 & c);
+    h2 = (h2 & ~c) | (g2 & c);
+
+    // tag = (h + pad) mod 2^128
+    uint64_t t0 = p->pad[0], t1 = p->pad[1];
+    h0 += t0 & MASK44;
+    c = h0 >> 44; h0 &= MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & MASK44) + c;
+    c = h1 >> 44; h1 &= MASK44;
+    h2 += ((t1 >> 24) & MASK42) + c;
+    h2 &= MASK42;
+
+    store64(tag, h0 | (h1 << 44));
+    store64(tag + 8, (h1 >> 20) | (h2 << 24));
+    memset(p, 0, sizeof(*p));
+}
+
+/* ---------------- AEAD stream ---------------- */
+
+static const unsigned char zero_pad[16];
+
+void aead_init(Aead *a, const unsigned char key[AEAD_KEY_LEN], const unsigned char nonce[AEAD_NONCE_LEN],
+               const unsigned char *aad, size_t aad_len)
+{
+    // The one-time Poly1305 key is the first half of keystream block 0; the data starts at block 1
+    unsigned char otk[64] = {0};
+    ChaCha20 block0;
+    chacha20_init(&block0, key, nonce, 0);
+    chacha20_xor(&block0, 0, otk, sizeof(otk));
+    poly1305_init(&a->mac, otk);
+    memset(otk, 0, sizeof(otk));
+
+    chacha20_init(&a->cipher, key, nonce, 1);
+    poly1305_update(&a->mac, aad, aad_len);
+    poly1305_update(&a->mac, zero_pad, (16 - aad_len % 16) % 16);
+    a->aad_len = aad_len;
+    a->len = 0;
+}
+
+void aead_seal(Aead *a, unsigned char *data, size_t len, size_t clear)
+{
+    if (clear < len)
+        chacha20_xor(&a->cipher, a->len + clear, data + clear, len - clear);
+    poly1305_update(&a->mac, data, len);
+    a->len += len;
+}
+
+void aead_open(Aead *a, unsigned char *data, size_t len, size_t clear)
+{
+    poly1305_update(&a->mac, data, len);
+    if (clear < len)
+        chacha20_xor(&a->cipher, a->len + clear, data + clear, len - clear);
+    a->len += len;
+}
+
+void aead_tag(Aead *a, unsigned char tag[AEAD_TAG_LEN])
+{
+    unsigned char lens[16];
+    poly1305_update(&a->mac, zero_pad, (size_t)((16 - a->len % 16) % 16));
+    store64(lens, a->aad_len);
+    store64(lens + 8, a->len);
+    poly1305_update(&a->mac, lens, sizeof(lens));
+    poly1305_finish(&a->mac, tag);
+}
+
+int aead_tag_equal(const unsigned char *a, const unsigned char *b)
+{
+    unsigned char diff = 0;
+    for (int i = 0; i < AEAD_TAG_LEN; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
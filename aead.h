@@ -0,0 +1,75 @@
+#ifndef AEAD_H
+#define AEAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * ChaCha20-Poly1305 (RFC 8439), built to run inside the embed/extract loop.
+ *
+ * ChaCha20 blocks are independent, so the keystream for any byte position
+ * is computed directly; several blocks are generated at once with SSE2 or
+ * AVX2 when the CPU has them. Poly1305 uses 64-bit limbs.
+ *
+ * The AEAD stream authenticates everything passed through it in order.
+ * seal/open may leave a prefix of each piece unencrypted (frame headers
+ * stay readable); those bytes still go through the MAC and still consume
+ * keystream, so the keystream position is always the stream offset.
+ */
+#define AEAD_KEY_LEN    32
+#define AEAD_NONCE_LEN  12
+#define AEAD_TAG_LEN    16
+
+typedef struct _ChaCha20
+{
+    uint32_t input[16];     // Constants, key, counter and nonce
+} ChaCha20;
+
+/* Set up a cipher whose keystream starts at block counter */
+void chacha20_init(ChaCha20 *c, const unsigned char key[AEAD_KEY_LEN], const unsigned char nonce[AEAD_NONCE_LEN],
+                   uint32_t counter);
+
+/* XOR data with keystream bytes [pos, pos + len) */
+void chacha20_xor(const ChaCha20 *c, uint64_t pos, unsigned char *data, size_t len);
+
+/* Name of the block implementation in use ("avx2", "sse2" or "scalar") */
+const char *chacha20_impl(void);
+
+typedef struct _Poly1305
+{
+    uint64_t r[3];
+    uint64_t h[3];
+    uint64_t pad[2];
+    unsigned char buffer[16];
+    size_t leftover;
+} Poly1305;
+
+void poly1305_init(Poly1305 *p, const unsigned char key[32]);
+void poly1305_update(Poly1305 *p, const unsigned char *data, size_t len);
+void poly1305_finish(Poly1305 *p, unsigned char tag[AEAD_TAG_LEN]);
+
+typedef struct _Aead
+{
+    ChaCha20 cipher;        // Payload keystream (block counter 1)
+    Poly1305 mac;
+    uint64_t aad_len;
+    uint64_t len;           // Bytes authenticated so far = keystream position
+} Aead;
+
+/* Start a stream; aad is authenticated but not encrypted */
+void aead_init(Aead *a, const unsigned char key[AEAD_KEY_LEN], const unsigned char nonce[AEAD_NONCE_LEN],
+               const unsigned char *aad, size_t aad_len);
+
+/* Encrypt data[clear, len) in place, then authenticate all len bytes */
+void aead_seal(Aead *a, unsigned char *data, size_t len, size_t clear);
+
+/* Authenticate all len bytes, then decrypt data[clear, len) in place */
+void aead_open(Aead *a, unsigned char *data, size_t len, size_t clear);
+
+/* Finish the stream and produce its tag */
+void aead_tag(Aead *a, unsigned char tag[AEAD_TAG_LEN]);
+
+/* Constant-time tag comparison; non-zero if equal */
+int aead_tag_equal(const unsigned char *a, const unsigned char *b);
+
+#endif
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "threadpool.h"
+#include "log.h"
+
+#define BATCH_LINE_MAX 4096
+
+typedef struct
+{
+    long line;                  // Line number in the jobs file
+    char text[BATCH_LINE_MAX];  // Line buffer; fields point into it
+    char *op, *carrier, *payload, *output;
+    const char *error;          // Set when the line is rejected at load time; the job is not run
+    Status status;
+    double seconds;
+} BatchJob;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Split a line in place on tabs; returns the number of fields found */
+static int split_fields(char *line, char *fields[], int max)
+{
+    int n = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    while (n < max)
+    {
+        fields[n++] = line;
+        char *tab = strchr(line, '\t');
+        if (tab == NULL)
+            break;
+        *tab = '\0';
+        line = tab + 1;
+    }
+    return n;
+}
+
+static void run_job(void *arg)
+{
+    BatchJob *job = arg;
+    double start = now_seconds();
+
+    job->status = e_failure;
+    if (job->error)
+        return;
+    if (strcmp(job->op, "encode") == 0 || strcmp(job->op, "-e") == 0)
+    {
+        EncodeInfo encInfo;
+        char *argv[] = {"batch", "-e", job->carrier, job->payload, job->output, NULL};
+
+        memset(&encInfo, 0, sizeof(encInfo));
+        if (read_and_validate_encode_args(argv, &encInfo) == e_success)
+            job->status = do_encoding(&encInfo);
+    }
+    else if (strcmp(job->op, "decode") == 0 || strcmp(job->op, "-d") == 0)
+    {
+        DecodeInfo decInfo;
+        char *argv[] = {"batch", "-d", job->carrier, job->output, NULL};
+
+        memset(&decInfo, 0, sizeof(decInfo));
+        if (read_and_validate_decode_args(argv, &decInfo) == d_success)
+            job->status = do_decoding(&decInfo) == d_success ? e_success : e_failure;
+    }
+    else
+        fprintf(stderr, "ERROR: line %ld: unknown operation '%s'\n", job->line, job->op);
+
+    job->seconds = now_seconds() - start;
+}
+
+/* Read the jobs file into an array of parsed jobs */
+static BatchJob *load_jobs(FILE *fptr, long *count)
+{
+    BatchJob *jobs = NULL;
+    long n = 0, cap = 0, line = 0;
+    char buf[BATCH_LINE_MAX];
+
+    while (fgets(buf, sizeof(buf), fptr) != NULL)
+    {
+        line++;
+        if (buf[0] == '#' || buf[strspn(buf, " \t\r\n")] == '\0')
+            continue;
+
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            BatchJob *grown = realloc(jobs, (size_t)cap * sizeof(*jobs));
+            if (!grown)
+            {
+                free(jobs);
+                return NULL;
+            }
+            jobs = grown;
+        }
+
+        BatchJob *job = &jobs[n++];
+        char *fields[4];
+        memcpy(job->text, buf, sizeof(buf));
+        job->line = line;
+        job->status = e_failure;
+        job->seconds = 0;
+        int nf = split_fields(job->text, fields, 4);
+        job->op = fields[0];
+        job->carrier = nf > 1 ? fields[1] : "";
+        job->payload = nf > 2 ? fields[2] : "";
+        job->output = nf > 3 ? fields[3] : "";
+        job->error = NULL;
+
+        // Without an output the job would fall back to the CLI default name, shared by every such job
+        if (nf < 4)
+            job->error = "expected op, carrier, payload and output separated by tabs";
+        else if (job->output[0] == '\0' || strcmp(job->output, "-") == 0)
+            job->error = "missing output file name";
+        if (job->error)
+            fprintf(stderr, "ERROR: line %ld: %s\n", line, job->error);
+    }
+
+    *count = n;
+    return jobs ? jobs : calloc(1, sizeof(*jobs));
+}
+
+static int cmp_output(const void *a, const void *b)
+{
+    const BatchJob *ja = *(BatchJob *const *)a, *jb = *(BatchJob *const *)b;
+    int c = strcmp(ja->output, jb->output);
+    return c ? c : (ja->line > jb->line) - (ja->line < jb->line);
+}
+
+/* Two jobs writing one file would race on it: only the first line naming an output runs */
+static Status reject_duplicate_outputs(BatchJob *jobs, long count)
+{
+    BatchJob **order = malloc((size_t)(count ? count : 1) * sizeof(*order));
+    if (order == NULL)
+        return e_failure;
+    for (long i = 0; i < count; i++)
+        order[i] = &jobs[i];
+    qsort(order, (size_t)count, sizeof(*order), cmp_output);
+
+    long first = 0;
+    for (long i = 1; i < count; i++)
+    {
+        if (strcmp(order[i]->output, order[first]->output) != 0)
+        {
+            first = i;
+            continue;
+        }
+        if (order[i]->error == NULL)
+        {
+            order[i]->error = "output already written by an earlier line";
+            fprintf(stderr, "ERROR: line %ld: output %s is also written by line %ld\n", order[i]->line,
+                    order[i]->output, order[first]->line);
+        }
+    }
+    free(order);
+    return e_success;
+}
+
+Status run_batch(const char *jobs_fname, int threads)
+{
+    FILE *fptr = fopen(jobs_fname, "r");
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open batch file %s\n", jobs_fname);
+        return e_failure;
+    }
+
+    long count = 0;
+    BatchJob *jobs = load_jobs(fptr, &count);
+    fclose(fptr);
+    if (jobs != NULL && reject_duplicate_outputs(jobs, count) != e_success)
+    {
+        free(jobs);
+        jobs = NULL;
+    }
+    if (jobs == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to load batch file %s\n", jobs_fname);
+        return e_failure;
+    }
+
+    // Jobs run concurrently: keep the per-step chatter out of the report
+    LogLevel saved_level = steg_log_level;
+    steg_log_level = LOG_LEVEL_ERROR;
+
+    double start = now_seconds();
+    ThreadPool *pool = pool_create(threads);
+    if (pool == NULL)
+    {
+        steg_log_level = saved_level;
+        free(jobs);
+        return e_failure;
+    }
+    for (long i = 0; i < count; i++)
+    {
+        if (pool_submit(pool, run_job, &jobs[i]) != e_success)
+            run_job(&jobs[i]);
+    }
+    pool_wait(pool);
+    pool_destroy(pool);
+    double elapsed = now_seconds() - start;
+    steg_log_level = saved_level;
+
+    // Summary report: one line per job, then totals
+    long failed = 0;
+    printf("line\top\tcarrier\toutput\tstatus\tms\n");
+    for (long i = 0; i < count; i++)
+    {
+        BatchJob *job = &jobs[i];
+        if (job->status != e_success)
+            failed++;
+        printf("%ld\t%s\t%s\t%s\t%s\t%.3f\n", job->line, job->op, job->carrier,
+               job->output[0] ? job->output : "-", job->status == e_success ? "ok" : "FAILED",
+               job->seconds * 1000.0);
+    }
+    printf("Batch: %ld jobs, %ld ok, %ld failed in %.3f s (%d threads)\n",
+           count, count - failed, failed, elapsed, threads < 1 ? 1 : threads);
+
+    free(jobs);
+    return failed ? e_failure : e_success;
+}
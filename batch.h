@@ -0,0 +1,17 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "types.h"
+
+/*
+ * Run every job listed in a TSV file on a bounded worker pool.
+ * Each non-empty, non-# line is:  op <TAB> carrier <TAB> payload <TAB> output
+ *   op = encode | -e : carrier BMP, secret file, stego output
+ *   op = decode | -d : stego BMP, ignored ("-"), decoded output
+ * A line with fewer fields, or an empty or "-" output, fails without running, as does
+ * every line after the first that names the same output file.
+ * A failing job is reported and does not stop the others.
+ */
+Status run_batch(const char *jobs_fname, int threads);
+
+#endif
@@ -0,0 +1,543 @@
+/*
+ * steg_bench: throughput benchmark for the encoder/decoder.
+ *
+ * Generates synthetic 24-bit BMP carriers with random payloads and times
+ * the library calls, every LSB kernel, and each file I/O strategy of the
+ * command line tool. Results are printed as a table and optionally written
+ * as JSON (one result object per line) that a later run can compare against
+ * with --baseline/--threshold.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include "steg.h"
+#include "lsb_kernels.h"
+#include "encode.h"
+#include "decode.h"
+#include "ioq.h"
+#include "log.h"
+
+#define MAX_SIZES 16
+#define MAX_RESULTS 256
+
+typedef struct
+{
+    char name[96];
+    double p50_ms;
+    double p99_ms;
+    double payload_mbps;    // Payload bytes per second at p50, in MB/s
+    double carrier_mbps;    // Carrier bytes per second at p50, in MB/s
+} BenchResult;
+
+typedef struct
+{
+    double sizes_mp[MAX_SIZES];
+    int nsizes;
+    int reps;
+    int threads;
+    const char *tmpdir;
+    const char *json_fname;
+    const char *baseline_fname;
+    double threshold_pct;
+} BenchOptions;
+
+static BenchResult results[MAX_RESULTS];
+static int nresults;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Percentile of a sorted sample set (nearest rank) */
+static double percentile(const double *sorted, int n, double pct)
+{
+    int rank = (int)(pct / 100.0 * n + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > n)
+        rank = n;
+    return sorted[rank - 1];
+}
+
+static void record(const char *name, double *samples, int n, size_t payload_len, size_t carrier_len)
+{
+    if (nresults == MAX_RESULTS)
+        return;
+
+    BenchResult *r = &results[nresults++];
+    qsort(samples, (size_t)n, sizeof(double), cmp_double);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->p50_ms = percentile(samples, n, 50);
+    r->p99_ms = percentile(samples, n, 99);
+    double secs = r->p50_ms > 0 ? r->p50_ms / 1e3 : 1e-9;
+    r->payload_mbps = payload_len / secs / 1e6;
+    r->carrier_mbps = carrier_len / secs / 1e6;
+    printf("%-40s %10.3f %10.3f %12.1f %12.1f\n", r->name, r->p50_ms, r->p99_ms,
+           r->payload_mbps, r->carrier_mbps);
+}
+
+/* xorshift64*: fast deterministic filler for carriers and payloads */
+static void fill_random(unsigned char *buf, size_t len, uint64_t seed)
+{
+    uint64_t x = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        uint64_t v = x * 0x2545F4914F6CDD1DULL;
+        memcpy(buf + i, &v, 8);
+    }
+    for (; i < len; i++)
+        buf[i] = (unsigned char)(x >> (8 * (i & 7)));
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* Build a width x height 24-bit BMP (rows padded to 4 bytes) filled with noise */
+static unsigned char *make_bmp(uint32_t width, uint32_t height, size_t *len)
+{
+    size_t stride = ((size_t)width * 3 + 3) & ~(size_t)3;
+    size_t pixels = stride * height;
+    unsigned char *bmp = malloc(54 + pixels);
+    if (!bmp)
+        return NULL;
+
+    memset(bmp, 0, 54);
+    bmp[0] = 'B';
+    bmp[1] = 'M';
+    put_le32(bmp + 2, (uint32_t)(54 + pixels));
+    put_le32(bmp + 10, 54);
+    put_le32(bmp + 14, 40);
+    put_le32(bmp + 18, width);
+    put_le32(bmp + 22, height);
+    bmp[26] = 1;
+    bmp[28] = 24;
+    put_le32(bmp + 34, (uint32_t)pixels);
+    fill_random(bmp + 54, pixels, width * 31ULL + height);
+
+    *len = 54 + pixels;
+    return bmp;
+}
+
+static int write_file(const char *fname, const unsigned char *buf, size_t len)
+{
+    FILE *fptr = fopen(fname, "wb");
+    if (!fptr)
+        return -1;
+    size_t n = fwrite(buf, 1, len, fptr);
+    fclose(fptr);
+    return n == len ? 0 : -1;
+}
+
+static void bench_library(const char *tag, const unsigned char *carrier, size_t carrier_len,
+                          const unsigned char *payload, size_t payload_len, int reps)
+{
+    unsigned char *stego = malloc(carrier_len);
+    unsigned char *out = malloc(payload_len ? payload_len : 1);
+    double samples[reps];
+    char name[96];
+    size_t out_len;
+
+    if (!stego || !out)
+        goto done;
+
+    for (int r = 0; r < reps; r++)
+    {
+        double t = now_ms();
+        steg_encode_buffer(carrier, carrier_len, payload, payload_len, "bin", stego);
+        samples[r] = now_ms() - t;
+    }
+    snprintf(name, sizeof(name), "lib/encode/%s", tag);
+    record(name, samples, reps, payload_len, carrier_len);
+
+    for (int r = 0; r < reps; r++)
+    {
+        double t = now_ms();
+        steg_decode_buffer(stego, carrier_len, out, payload_len, &out_len, NULL);
+        samples[r] = now_ms() - t;
+    }
+    snprintf(name, sizeof(name), "lib/decode/%s", tag);
+    record(name, samples, reps, payload_len, carrier_len);
+
+    if (memcmp(out, payload, payload_len) != 0)
+        fprintf(stderr, "ERROR: %s: decoded payload does not match\n", tag);
+
+done:
+    free(stego);
+    free(out);
+}
+
+static void bench_kernels(const char *tag, const unsigned char *payload, size_t payload_len, int reps)
+{
+    size_t count;
+    const LsbKernel *kernels = lsb_kernel_list(&count);
+    unsigned char *image = malloc(payload_len * 8 + 1);
+    unsigned char *out = malloc(payload_len + 1);
+    double samples[reps];
+    char name[96];
+
+    if (!image || !out)
+        goto done;
+    fill_random(image, payload_len * 8, 7);
+
+    for (size_t k = 0; k < count; k++)
+    {
+        if (!kernels[k].supported())
+            continue;
+
+        for (int r = 0; r < reps; r++)
+        {
+            double t = now_ms();
+            kernels[k].embed(payload, payload_len, image);
+            samples[r] = now_ms() - t;
+        }
+        snprintf(name, sizeof(name), "kernel/%s/embed/%s", kernels[k].name, tag);
+        record(name, samples, reps, payload_len, payload_len * 8);
+
+        for (int r = 0; r < reps; r++)
+        {
+            double t = now_ms();
+            kernels[k].extract(image, payload_len, out);
+            samples[r] = now_ms() - t;
+        }
+        snprintf(name, sizeof(name), "kernel/%s/extract/%s", kernels[k].name, tag);
+        record(name, samples, reps, payload_len, payload_len * 8);
+
+        if (memcmp(out, payload, payload_len) != 0)
+            fprintf(stderr, "ERROR: kernel %s does not round-trip\n", kernels[k].name);
+    }
+
+    // --bits 2 and 4 have one portable kernel each, reached through lsb_embed_bits/lsb_extract_bits
+    for (int depth = 2; depth <= 4; depth *= 2)
+    {
+        size_t image_len = lsb_carrier_bytes(payload_len, depth);
+
+        for (int r = 0; r < reps; r++)
+        {
+            double t = now_ms();
+            lsb_embed_bits(payload, payload_len, image, depth);
+            samples[r] = now_ms() - t;
+        }
+        snprintf(name, sizeof(name), "kernel/depth%d/embed/%s", depth, tag);
+        record(name, samples, reps, payload_len, image_len);
+
+        for (int r = 0; r < reps; r++)
+        {
+            double t = now_ms();
+            lsb_extract_bits(image, payload_len, out, depth);
+            samples[r] = now_ms() - t;
+        }
+        snprintf(name, sizeof(name), "kernel/depth%d/extract/%s", depth, tag);
+        record(name, samples, reps, payload_len, image_len);
+
+        if (memcmp(out, payload, payload_len) != 0)
+            fprintf(stderr, "ERROR: depth %d kernels do not round-trip\n", depth);
+    }
+
+done:
+    free(image);
+    free(out);
+}
+
+/*
+ * Time the command line encode/decode paths: the payload pipeline on each --io backend
+ * (stdio is the serial loop without a queue), -j threads, and mmap
+ */
+static void bench_io(const char *tag, const BenchOptions *opts, const unsigned char *carrier,
+                     size_t carrier_len, const unsigned char *payload, size_t payload_len)
+{
+    char carrier_fname[512], secret_fname[512], stego_fname[512], out_fname[520];
+    struct { const char *name; const char *backend; int use_mmap; int threads; } modes[] = {
+        {"stdio", "stdio", 0, 0},
+        {"uring", "uring", 0, 0},
+        {"threads", "threads", 0, 0},
+        {"parallel", "auto", 0, opts->threads},
+        {"mmap", "auto", 1, 0},
+    };
+    double samples[opts->reps];
+    char name[96];
+
+    snprintf(carrier_fname, sizeof(carrier_fname), "%s/steg_bench_%d_carrier.bmp", opts->tmpdir, (int)getpid());
+    snprintf(secret_fname, sizeof(secret_fname), "%s/steg_bench_%d_secret.bin", opts->tmpdir, (int)getpid());
+    snprintf(stego_fname, sizeof(stego_fname), "%s/steg_bench_%d_stego.bmp", opts->tmpdir, (int)getpid());
+    snprintf(out_fname, 512, "%s/steg_bench_%d_out", opts->tmpdir, (int)getpid());
+
+    if (write_file(carrier_fname, carrier, carrier_len) != 0 ||
+        write_file(secret_fname, payload, payload_len) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to write benchmark files in %s\n", opts->tmpdir);
+        return;
+    }
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        if (ioq_select_backend(modes[m].backend) != e_success)
+        {
+            fprintf(stderr, "Skipping io/%s/%s\n", modes[m].name, tag);
+            continue;
+        }
+        for (int r = 0; r < opts->reps; r++)
+        {
+            EncodeInfo encInfo;
+            char *argv[] = {"steg_bench", "-e", carrier_fname, secret_fname, stego_fname, NULL};
+
+            memset(&encInfo, 0, sizeof(encInfo));
+            read_and_validate_encode_args(argv, &encInfo);
+            encInfo.use_mmap = modes[m].use_mmap;
+            encInfo.threads = modes[m].threads;
+
+            double t = now_ms();
+            if (do_encoding(&encInfo) != e_success)
+                fprintf(stderr, "ERROR: %s encode failed\n", modes[m].name);
+            samples[r] = now_ms() - t;
+        }
+        snprintf(name, sizeof(name), "io/%s/encode/%s", modes[m].name, tag);
+        record(name, samples, opts->reps, payload_len, carrier_len);
+
+        for (int r = 0; r < opts->reps; r++)
+        {
+            DecodeInfo decInfo;
+            char *argv[] = {"steg_bench", "-d", stego_fname, out_fname, NULL};
+
+            memset(&decInfo, 0, sizeof(decInfo));
+            read_and_validate_decode_args(argv, &decInfo);
+            decInfo.use_mmap = modes[m].use_mmap;
+            decInfo.threads = modes[m].threads;
+
+            double t = now_ms();
+            if (do_decoding(&decInfo) != d_success)
+                fprintf(stderr, "ERROR: %s decode failed\n", modes[m].name);
+            samples[r] = now_ms() - t;
+        }
+        snprintf(name, sizeof(name), "io/%s/decode/%s", modes[m].name, tag);
+        record(name, samples, opts->reps, payload_len, carrier_len);
+    }
+    ioq_select_backend(NULL);
+
+    remove(carrier_fname);
+    remove(secret_fname);
+    remove(stego_fname);
+    strcat(out_fname, ".bin");
+    remove(out_fname);
+}
+
+static int write_json(const char *fname)
+{
+    FILE *fptr = fopen(fname, "w");
+    if (!fptr)
+    {
+        perror("fopen");
+        return -1;
+    }
+    fprintf(fptr, "[\n");
+    for (int i = 0; i < nresults; i++)
+    {
+        BenchResult *r = &results[i];
+        fprintf(fptr, "{\"name\": \"%s\", \"p50_ms\": %.6f, \"p99_ms\": %.6f, "
+                      "\"payload_mbps\": %.3f, \"carrier_mbps\": %.3f}%s\n",
+                r->name, r->p50_ms, r->p99_ms, r->payload_mbps, r->carrier_mbps,
+                i + 1 < nresults ? "," : "");
+    }
+    fprintf(fptr, "]\n");
+    fclose(fptr);
+    return 0;
+}
+
+/*
+ * Compare against a JSON file written by --json; returns the number of regressions and sets
+ * missing to the baseline benchmarks this run did not produce (a gate that compared nothing
+ * must not pass)
+ */
+static int compare_baseline(const char *fname, double threshold_pct, int *missing)
+{
+    FILE *fptr = fopen(fname, "r");
+    char line[512];
+    int regressions = 0, entries = 0;
+
+    *missing = 0;
+    if (!fptr)
+    {
+        perror("fopen");
+        return -1;
+    }
+
+    printf("\nBaseline %s (threshold %.1f%%):\n", fname, threshold_pct);
+    while (fgets(line, sizeof(line), fptr))
+    {
+        char name[96];
+        double base_mbps;
+        char *p = strstr(line, "\"name\": \"");
+        char *q = strstr(line, "\"payload_mbps\": ");
+        if (!p || !q || sscanf(p + 9, "%95[^\"]", name) != 1 || sscanf(q + 16, "%lf", &base_mbps) != 1)
+            continue;
+
+        int found = 0;
+        entries++;
+        for (int i = 0; i < nresults; i++)
+        {
+            if (strcmp(results[i].name, name) != 0)
+                continue;
+            found = 1;
+            double change = base_mbps > 0 ? (results[i].payload_mbps / base_mbps - 1.0) * 100.0 : 0;
+            int regressed = change < -threshold_pct;
+            regressions += regressed;
+            printf("%-40s %12.1f -> %12.1f MB/s %+7.1f%%%s\n", name, base_mbps,
+                   results[i].payload_mbps, change, regressed ? "  REGRESSION" : "");
+        }
+        if (!found)
+        {
+            (*missing)++;
+            printf("%-40s %12.1f -> %12s MB/s           MISSING\n", name, base_mbps, "-");
+        }
+    }
+    fclose(fptr);
+    if (entries == 0)
+    {
+        fprintf(stderr, "ERROR: no benchmarks in baseline %s\n", fname);
+        return -1;
+    }
+    return regressions;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [--sizes=MP[,MP...]] [--reps=N] [-j N] [--tmpdir=DIR]\n"
+           "          [--json=FILE] [--baseline=FILE] [--threshold=PCT]\n"
+           "  --sizes      carrier sizes in megapixels (default 1,4,16; up to 500)\n"
+           "  --reps       repetitions per measurement (default 5)\n"
+           "  -j N         threads for the io/parallel strategy (default 4)\n"
+           "  --json       write results as JSON\n"
+           "  --baseline   compare payload MB/s with an earlier --json file; every\n"
+           "               benchmark in it must be in this run too\n"
+           "  --threshold  allowed slowdown in percent before failing (default 10)\n", prog);
+}
+
+static int parse_args(int argc, char *argv[], BenchOptions *opts)
+{
+    opts->sizes_mp[0] = 1;
+    opts->sizes_mp[1] = 4;
+    opts->sizes_mp[2] = 16;
+    opts->nsizes = 3;
+    opts->reps = 5;
+    opts->threads = 4;
+    opts->tmpdir = "/tmp";
+    opts->threshold_pct = 10.0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--sizes=", 8) == 0)
+        {
+            char *list = argv[i] + 8, *end;
+            opts->nsizes = 0;
+            while (*list && opts->nsizes < MAX_SIZES)
+            {
+                opts->sizes_mp[opts->nsizes++] = strtod(list, &end);
+                list = *end == ',' ? end + 1 : end;
+                if (end == list && *end != '\0')
+                    return -1;
+            }
+        }
+        else if (strncmp(argv[i], "--reps=", 7) == 0)
+            opts->reps = atoi(argv[i] + 7);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            opts->threads = atoi(argv[++i]);
+        else if (strncmp(argv[i], "--tmpdir=", 9) == 0)
+            opts->tmpdir = argv[i] + 9;
+        else if (strncmp(argv[i], "--json=", 7) == 0)
+            opts->json_fname = argv[i] + 7;
+        else if (strncmp(argv[i], "--baseline=", 11) == 0)
+            opts->baseline_fname = argv[i] + 11;
+        else if (strncmp(argv[i], "--threshold=", 12) == 0)
+            opts->threshold_pct = atof(argv[i] + 12);
+        else
+            return -1;
+    }
+    return opts->reps > 0 && opts->nsizes > 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    if (parse_args(argc, argv, &opts) != 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    steg_log_level = LOG_LEVEL_ERROR;
+    printf("Selected kernel: %s\n", lsb_kernel()->name);
+    printf("%-40s %10s %10s %12s %12s\n", "benchmark", "p50 ms", "p99 ms", "payload MB/s", "carrier MB/s");
+
+    for (int s = 0; s < opts.nsizes; s++)
+    {
+        // Roughly 4:3 carriers of the requested pixel count
+        double pixels = opts.sizes_mp[s] * 1e6;
+        uint32_t width = (uint32_t)(pixels > 0 ? sqrt(pixels * 4.0 / 3.0) : 1);
+        uint32_t height = (uint32_t)(pixels / width);
+        size_t carrier_len;
+        char tag[32];
+
+        snprintf(tag, sizeof(tag), "%gMP", opts.sizes_mp[s]);
+        unsigned char *carrier = make_bmp(width ? width : 1, height ? height : 1, &carrier_len);
+        if (!carrier)
+        {
+            fprintf(stderr, "ERROR: Unable to allocate a %s carrier\n", tag);
+            return 1;
+        }
+
+        size_t payload_len = steg_capacity(carrier, carrier_len, 3, NULL);
+        unsigned char *payload = malloc(payload_len ? payload_len : 1);
+        if (!payload)
+        {
+            free(carrier);
+            fprintf(stderr, "ERROR: Unable to allocate a %zu byte payload\n", payload_len);
+            return 1;
+        }
+        fill_random(payload, payload_len, payload_len);
+
+        bench_kernels(tag, payload, payload_len, opts.reps);
+        bench_library(tag, carrier, carrier_len, payload, payload_len, opts.reps);
+        bench_io(tag, &opts, carrier, carrier_len, payload, payload_len);
+
+        free(payload);
+        free(carrier);
+    }
+
+    if (opts.json_fname && write_json(opts.json_fname) != 0)
+        return 1;
+
+    if (opts.baseline_fname)
+    {
+        int missing;
+        int regressions = compare_baseline(opts.baseline_fname, opts.threshold_pct, &missing);
+        if (regressions > 0)
+            printf("%d benchmark(s) regressed by more than %.1f%%\n", regressions, opts.threshold_pct);
+        if (missing > 0)
+            printf("%d baseline benchmark(s) missing from this run (same --sizes?)\n", missing);
+        if (regressions != 0 || missing != 0)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include <string.h>
+#include "bmp.h"
+
+#define BMP_BI_RGB       0
+#define BMP_BI_BITFIELDS 3
+
+static uint32_t read_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t read_le16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+/* The legacy layout: one span over width * height * 3 bytes after the 54-byte header */
+static Status parse_flat(const unsigned char *image, uint64_t file_len, BmpLayout *layout)
+{
+    if (file_len < BMP_HEADER_SIZE)
+        return e_failure;
+
+    // Height is read unsigned as before, so negative heights simply clip to the file
+    uint64_t capacity = (uint64_t)layout->width * read_le32(image + 22) * 3;
+    if (capacity > file_len - BMP_HEADER_SIZE)
+        capacity = file_len - BMP_HEADER_SIZE;
+
+    layout->data_offset = BMP_HEADER_SIZE;
+    layout->capacity = capacity;
+    layout->identity = 1;
+    layout->nspans = 1;
+    layout->span_len = capacity;
+    return e_success;
+}
+
+Status bmp_parse(const unsigned char *image, size_t len, uint64_t file_len, BmpLayoutKind kind,
+                 BmpLayout *layout)
+{
+    memset(layout, 0, sizeof(*layout));
+    if (image == NULL || len < BMP_HEADER_SIZE || image[0] != 'B' || image[1] != 'M')
+        return e_failure;
+
+    int32_t height = (int32_t)read_le32(image + 22);
+    layout->kind = kind;
+    layout->width = read_le32(image + 18);
+    layout->bpp = read_le16(image + 28);
+    layout->top_down = height < 0;
+    layout->height = height < 0 ? 0u - (uint32_t)height : (uint32_t)height;
+    if (kind == bmp_layout_flat)
+        return parse_flat(image, file_len, layout);
+
+    uint32_t info_size = read_le32(image + 14);
+    uint32_t compression = read_le32(image + 30);
+    layout->data_offset = read_le32(image + 10);
+    if (info_size < 40 || (int32_t)layout->width <= 0 || layout->height == 0 || read_le16(image + 26) != 1)
+        return e_failure;
+    if (layout->bpp != 32 && (layout->bpp != 24 || kind == bmp_layout_no_alpha))
+        return e_failure;
+    if (compression != BMP_BI_RGB && (compression != BMP_BI_BITFIELDS || layout->bpp != 32))
+        return e_failure;
+    if (layout->data_offset < BMP_HEADER_SIZE || layout->data_offset > file_len)
+        return e_failure;
+
+    // Rows are padded to a multiple of 4 bytes; a trailing partial row is not used
+    uint64_t row_bytes = (uint64_t)layout->width * (layout->bpp / 8);
+    uint64_t avail = file_len - layout->data_offset;
+    uint64_t rows;
+    layout->stride = (row_bytes + 3) & ~(uint64_t)3;
+    rows = avail / layout->stride + (avail % layout->stride >= row_bytes);
+    if (rows > layout->height)
+        rows = layout->height;
+
+    layout->skip = kind == bmp_layout_no_alpha;
+    uint64_t row_len = layout->skip ? (uint64_t)layout->width * 3 : row_bytes;
+    layout->capacity = rows * row_len;
+
+    // Unpadded rows are one contiguous run
+    int coalesce = !layout->skip && layout->stride == row_bytes;
+    layout->nspans = rows == 0 ? 0 : coalesce ? 1 : rows;
+    layout->span_len = coalesce ? layout->capacity : row_len;
+
+    layout->identity = !layout->skip && layout->data_offset == BMP_HEADER_SIZE && layout->nspans <= 1;
+    return e_success;
+}
+
+void bmp_free(BmpLayout *layout)
+{
+    layout->nspans = 0;
+}
+
+/* Span holding a logical offset: every span but a coalesced one is one row long */
+static uint64_t span_index(const BmpLayout *layout, uint64_t logical)
+{
+    return layout->nspans > 1 ? logical / layout->span_len : 0;
+}
+
+/* Span i: row i from bfOffBits, or the single run of a coalesced or flat layout */
+static BmpSpan span_at(const BmpLayout *layout, uint64_t i)
+{
+    return (BmpSpan){layout->data_offset + i * layout->stride, i * layout->span_len, layout->span_len};
+}
+
+/* File offset of the j-th embeddable byte of a span */
+static uint64_t span_offset(const BmpLayout *layout, const BmpSpan *span, uint64_t j)
+{
+    return span->file_off + (layout->skip ? j / 3 * 4 + j % 3 : j);
+}
+
+uint64_t bmp_file_offset(const BmpLayout *layout, uint64_t logical)
+{
+    BmpSpan span = span_at(layout, span_index(layout, logical));
+    return span_offset(layout, &span, logical - span.logical);
+}
+
+void bmp_window(const BmpLayout *layout, uint64_t logical, uint64_t n, uint64_t *start, uint64_t *end)
+{
+    *start = bmp_file_offset(layout, logical);
+    if (logical + n < layout->capacity)
+        *end = bmp_file_offset(layout, logical + n);
+    else
+        *end = bmp_file_offset(layout, logical + n - 1) + 1;
+}
+
+/* Copy n bytes between a run and the span bytes starting at the j-th of a span */
+static void copy_span(const BmpLayout *layout, unsigned char *file, uint64_t j, unsigned char *run,
+                      size_t n, int to_file)
+{
+    if (!layout->skip)
+    {
+        if (to_file)
+            memcpy(file, run, n);
+        else
+            memcpy(run, file, n);
+        return;
+    }
+
+    // Step over the alpha byte after every third colour byte
+    unsigned c = (unsigned)(j % 3);
+    for (size_t k = 0; k < n; k++)
+    {
+        if (to_file)
+            *file = run[k];
+        else
+            run[k] = *file;
+        file++;
+        if (++c == 3)
+        {
+            c = 0;
+            file++;
+        }
+    }
+}
+
+static void walk_spans(const BmpLayout *layout, unsigned char *buf, uint64_t buf_off,
+                       uint64_t logical, size_t n, unsigned char *run, int to_file)
+{
+    for (uint64_t i = span_index(layout, logical); n > 0; i++)
+    {
+        BmpSpan span = span_at(layout, i);
+        uint64_t j = logical - span.logical;
+        size_t take = span.len - j < n ? (size_t)(span.len - j) : n;
+
+        copy_span(layout, buf + (span_offset(layout, &span, j) - buf_off), j, run, take, to_file);
+        run += take;
+        logical += take;
+        n -= take;
+    }
+}
+
+void bmp_gather(const BmpLayout *layout, const unsigned char *buf, uint64_t buf_off,
+                uint64_t logical, size_t n, unsigned char *out)
+{
+    walk_spans(layout, (unsigned char *)buf, buf_off, logical, n, out, 0);
+}
+
+void bmp_scatter(const BmpLayout *layout, unsigned char *buf, uint64_t buf_off,
+                 uint64_t logical, size_t n, const unsigned char *in)
+{
+    walk_spans(layout, buf, buf_off, logical, n, (unsigned char *)in, 1);
+}
@@ -0,0 +1,85 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "common.h"
+
+/*
+ * BMP carrier layout: which file bytes hold payload bits and in what order.
+ *
+ * Payload bits are addressed by a logical carrier offset. The spans map it
+ * to file offsets: each span is a run of pixel bytes that is contiguous in
+ * the logical order. Rows without padding coalesce into a single span;
+ * padded rows are one span each, all the same length one stride apart, so
+ * a span is computed from its number rather than stored and a layout costs
+ * the same whatever height the header claims. When the alpha channel is
+ * skipped, only the first 3 of every 4 bytes of a span are embeddable.
+ *
+ * Rows are walked in file order, so top-down images need no special case.
+ */
+typedef enum
+{
+    bmp_layout_flat,        // Legacy: every byte after the 54-byte header, width * height * 3 of them
+    bmp_layout_pixels,      // Pixel bytes of each row from bfOffBits, padding skipped
+    bmp_layout_no_alpha     // As bmp_layout_pixels, also skipping the alpha byte of 32-bpp pixels
+} BmpLayoutKind;
+
+typedef struct _BmpSpan
+{
+    uint64_t file_off;      // File offset of the first byte
+    uint64_t logical;       // Logical offset of the first embeddable byte
+    uint64_t len;           // Embeddable bytes in the span
+} BmpSpan;
+
+typedef struct _BmpLayout
+{
+    BmpLayoutKind kind;
+    uint64_t data_offset;   // bfOffBits (BMP_HEADER_SIZE for the flat layout)
+    uint32_t width;
+    uint32_t height;        // Rows, whatever the sign of biHeight
+    int top_down;           // biHeight was negative
+    int bpp;                // Bits per pixel
+    uint64_t stride;        // Row size in the file, padding included
+    uint64_t capacity;      // Embeddable carrier bytes
+    int identity;           // Logical offset i is file offset BMP_HEADER_SIZE + i (legacy layout)
+    int skip;               // Alpha skipped: 3 embeddable bytes per 4 file bytes
+    uint64_t span_len;      // Embeddable bytes per span (all of them when there is one span)
+    uint64_t nspans;        // 1 when rows coalesce (and for the flat layout), else one per row
+} BmpLayout;
+
+/*
+ * Parse the BMP header at image (len bytes, at least BMP_HEADER_SIZE) into the
+ * given layout. file_len is the full file size, used to clip truncated images
+ * (UINT64_MAX if unknown). Fails for images the layout
+ * cannot describe, e.g. bmp_layout_pixels needs an uncompressed 24 or 32-bpp image.
+ */
+Status bmp_parse(const unsigned char *image, size_t len, uint64_t file_len, BmpLayoutKind kind,
+                 BmpLayout *layout);
+
+/* Forget a parsed layout (it holds no memory of its own) */
+void bmp_free(BmpLayout *layout);
+
+/* File offset of the carrier byte at a logical offset (< capacity) */
+uint64_t bmp_file_offset(const BmpLayout *layout, uint64_t logical);
+
+/*
+ * File bytes [*start, *end) holding the n > 0 carrier bytes at a logical offset,
+ * plus any padding or alpha bytes up to the next carrier byte. Consecutive
+ * windows tile the pixel array, so streaming them in order copies every byte.
+ */
+void bmp_window(const BmpLayout *layout, uint64_t logical, uint64_t n, uint64_t *start, uint64_t *end);
+
+/*
+ * Copy the n carrier bytes at a logical offset out of buf, which holds the
+ * file bytes from file offset buf_off on, into a contiguous run at out.
+ */
+void bmp_gather(const BmpLayout *layout, const unsigned char *buf, uint64_t buf_off,
+                uint64_t logical, size_t n, unsigned char *out);
+
+/* Inverse of bmp_gather: store n contiguous carrier bytes back into buf */
+void bmp_scatter(const BmpLayout *layout, unsigned char *buf, uint64_t buf_off,
+                 uint64_t logical, size_t n, const unsigned char *in);
+
+#endif
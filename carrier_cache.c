@@ -0,0 +1,273 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "carrier_cache.h"
+#include "common.h"
+#include "pio.h"
+
+struct _CarrierCache
+{
+    pthread_mutex_t lock;
+    CarrierEntry *head, *tail;      // Most recently used first
+    size_t budget;
+    CarrierCacheStats stats;
+};
+
+CarrierCache *carrier_cache_create(size_t budget)
+{
+    CarrierCache *cache = calloc(1, sizeof(*cache));
+    if (cache == NULL)
+        return NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->budget = budget;
+    cache->stats.budget = budget;
+    return cache;
+}
+
+static void entry_free(CarrierEntry *e)
+{
+    for (int k = 0; k < 3; k++)
+        bmp_free(&e->layouts[k]);
+    free(e->path);
+    free(e->data);
+    free(e);
+}
+
+static int entry_current(const CarrierEntry *e, const struct stat *st)
+{
+    return e->dev == st->st_dev && e->ino == st->st_ino && e->size == st->st_size &&
+           e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void entry_detach(CarrierCache *cache, CarrierEntry *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        cache->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        cache->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+/* Take e off the LRU list (lock held); it is freed now or by its last release */
+static void entry_unlink(CarrierCache *cache, CarrierEntry *e)
+{
+    entry_detach(cache, e);
+    e->cached = 0;
+    cache->stats.entries--;
+    cache->stats.bytes -= e->len;
+    if (e->refs == 0)
+        entry_free(e);
+}
+
+static void entry_push_front(CarrierCache *cache, CarrierEntry *e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+    if (cache->head)
+        cache->head->prev = e;
+    else
+        cache->tail = e;
+    cache->head = e;
+}
+
+static CarrierEntry *entry_find(CarrierCache *cache, const char *path)
+{
+    for (CarrierEntry *e = cache->head; e != NULL; e = e->next)
+    {
+        if (strcmp(e->path, path) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+/* Keep a layout under its kind, unless one is there already */
+static void entry_keep(CarrierEntry *e, BmpLayout *layout)
+{
+    if (!(e->have & 1u << layout->kind))
+    {
+        e->have |= 1u << layout->kind;
+        e->layouts[layout->kind] = *layout;
+    }
+    else
+        bmp_free(layout);
+}
+
+/* Parse every layout a request may use */
+static StegStatus entry_parse(CarrierEntry *e)
+{
+    StegEncodeOptions no_alpha = {.skip_alpha = 1};
+    BmpLayout layout;
+    uint32_t word;
+
+    StegStatus status = steg_carrier_layout(e->data, e->len, e->len, NULL, &layout);
+    if (status != steg_ok)
+        return status;
+    e->carrier_kind = layout.kind;
+    entry_keep(e, &layout);
+    if (steg_carrier_layout(e->data, e->len, e->len, &no_alpha, &layout) == steg_ok)
+        entry_keep(e, &layout);
+    e->stego_status = steg_detect_layout(e->data, e->len, e->len, &layout, &word);
+    if (e->stego_status == steg_ok)
+    {
+        e->stego_kind = layout.kind;
+        entry_keep(e, &layout);
+    }
+    return steg_ok;
+}
+
+const BmpLayout *carrier_entry_layout(const CarrierEntry *entry, const StegEncodeOptions *opts, StegStatus *status)
+{
+    BmpLayoutKind kind = opts && opts->skip_alpha ? bmp_layout_no_alpha : entry->carrier_kind;
+    *status = (entry->have & 1u << kind) ? steg_ok : steg_err_format;
+    return *status == steg_ok ? &entry->layouts[kind] : NULL;
+}
+
+const BmpLayout *carrier_entry_stego_layout(const CarrierEntry *entry, StegStatus *status)
+{
+    *status = entry->stego_status;
+    return entry->stego_status == steg_ok ? &entry->layouts[entry->stego_kind] : NULL;
+}
+
+/* Read and validate the image at path; the key comes from the open file, not an earlier stat */
+static CarrierEntry *entry_load(const char *path, struct stat *st, StegStatus *status)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, st) != 0 || !S_ISREG(st->st_mode) || st->st_size < BMP_HEADER_SIZE)
+    {
+        if (fd >= 0)
+            close(fd);
+        *status = steg_err_invalid;
+        return NULL;
+    }
+
+    CarrierEntry *e = calloc(1, sizeof(*e));
+    *status = steg_err_nomem;
+    if (e == NULL || (e->path = strdup(path)) == NULL || (e->data = malloc((size_t)st->st_size)) == NULL)
+        goto fail;
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtime = st->st_mtim;
+    e->len = (size_t)st->st_size;
+    *status = steg_err_invalid;
+    if (pread_full(fd, e->data, e->len, 0) != e_success)
+        goto fail;
+    close(fd);
+
+    // Parse the header once here, so a bad file fails before any request work starts
+    *status = entry_parse(e);
+    if (*status != steg_ok)
+    {
+        entry_free(e);
+        return NULL;
+    }
+    return e;
+
+fail:
+    close(fd);
+    if (e)
+        entry_free(e);
+    return NULL;
+}
+
+CarrierEntry *carrier_cache_get(CarrierCache *cache, const char *path, StegStatus *status)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        *status = steg_err_invalid;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    CarrierEntry *e = entry_find(cache, path);
+    if (e && entry_current(e, &st))
+    {
+        cache->stats.hits++;
+        e->refs++;
+        entry_detach(cache, e);
+        entry_push_front(cache, e);
+        pthread_mutex_unlock(&cache->lock);
+        *status = steg_ok;
+        return e;
+    }
+    if (e)
+        entry_unlink(cache, e);     // Changed on disk
+    cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Read outside the lock so other requests are not held up by the disk
+    CarrierEntry *loaded = entry_load(path, &st, status);
+    if (loaded == NULL)
+        return NULL;
+    loaded->refs = 1;
+    *status = steg_ok;
+
+    pthread_mutex_lock(&cache->lock);
+    e = entry_find(cache, path);
+    if (e && entry_current(e, &st))
+    {
+        // Another request read the same image meanwhile: share its copy
+        e->refs++;
+        pthread_mutex_unlock(&cache->lock);
+        entry_free(loaded);
+        return e;
+    }
+    if (e)
+        entry_unlink(cache, e);
+
+    // Make room from the cold end, skipping entries still in use; an image over the whole budget evicts nothing
+    CarrierEntry *victim = loaded->len <= cache->budget ? cache->tail : NULL;
+    while (victim && cache->stats.bytes + loaded->len > cache->budget)
+    {
+        CarrierEntry *prev = victim->prev;
+        if (victim->refs == 0)
+        {
+            entry_unlink(cache, victim);
+            cache->stats.evictions++;
+        }
+        victim = prev;
+    }
+    if (cache->stats.bytes + loaded->len <= cache->budget)
+    {
+        loaded->cached = 1;
+        entry_push_front(cache, loaded);
+        cache->stats.entries++;
+        cache->stats.bytes += loaded->len;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return loaded;
+}
+
+void carrier_cache_release(CarrierCache *cache, CarrierEntry *entry)
+{
+    pthread_mutex_lock(&cache->lock);
+    int last = --entry->refs == 0 && !entry->cached;
+    pthread_mutex_unlock(&cache->lock);
+    if (last)
+        entry_free(entry);
+}
+
+void carrier_cache_stats(CarrierCache *cache, CarrierCacheStats *stats)
+{
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void carrier_cache_destroy(CarrierCache *cache)
+{
+    if (cache == NULL)
+        return;
+    while (cache->head)
+        entry_unlink(cache, cache->head);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
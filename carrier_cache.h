@@ -0,0 +1,80 @@
+#ifndef CARRIER_CACHE_H
+#define CARRIER_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "steg.h"
+
+/*
+ * LRU cache of carrier images read into memory, for stegd.
+ *
+ * Entries are keyed by path and checked against the file's device, inode,
+ * size and modification time on every lookup, so an image replaced or
+ * rewritten on disk is read again rather than served stale. Each image is
+ * validated as a BMP carrier once, when it is read, and the layouts requests
+ * need (the encoder's, with and without alpha, and that of an embedded
+ * payload) are parsed then and kept with it. The cache holds at most budget
+ * bytes of image data; the least recently used entries are dropped
+ * to make room, and an image larger than the whole budget is read for the
+ * one request and not kept. Lookups take a reference: an entry stays valid
+ * until carrier_cache_release, even if it is evicted in the meantime.
+ * All calls are thread-safe.
+ */
+typedef struct _CarrierEntry
+{
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned char *data;    // The whole image file
+    size_t len;
+    BmpLayout layouts[3];   // Parsed layouts by BmpLayoutKind
+    unsigned have;          // Bit k set: layouts[k] is parsed
+    BmpLayoutKind carrier_kind;     // Layout an encoder uses without skip-alpha
+    StegStatus stego_status;        // steg_detect_layout result: steg_ok if a payload is embedded
+    BmpLayoutKind stego_kind;
+    int refs;               // Requests still using the entry
+    int cached;             // On the LRU list (else freed by the last release)
+    struct _CarrierEntry *prev, *next;
+} CarrierEntry;
+
+typedef struct _CarrierCache CarrierCache;
+
+/* Counters since the cache was created, and its current size */
+typedef struct
+{
+    uint64_t hits;          // Lookups served from memory
+    uint64_t misses;        // Lookups that read the file (first use, changed on disk or evicted)
+    uint64_t evictions;     // Entries dropped to stay within the budget
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t budget;
+} CarrierCacheStats;
+
+CarrierCache *carrier_cache_create(size_t budget);
+
+/*
+ * Get the image at path, reading it on a miss. Returns NULL with *status set
+ * (steg_err_invalid for a missing or unreadable file, steg_err_format for a
+ * file that is not a usable BMP, steg_err_nomem) on failure.
+ */
+CarrierEntry *carrier_cache_get(CarrierCache *cache, const char *path, StegStatus *status);
+
+/* Layout to encode into the entry with opts (NULL with steg_err_format if there is none) */
+const BmpLayout *carrier_entry_layout(const CarrierEntry *entry, const StegEncodeOptions *opts, StegStatus *status);
+
+/* Layout the entry's payload was embedded with (NULL with the detection status if there is none) */
+const BmpLayout *carrier_entry_stego_layout(const CarrierEntry *entry, StegStatus *status);
+
+/* Drop a reference taken by carrier_cache_get */
+void carrier_cache_release(CarrierCache *cache, CarrierEntry *entry);
+
+void carrier_cache_stats(CarrierCache *cache, CarrierCacheStats *stats);
+
+/* Free the cache; no entry may still be referenced */
+void carrier_cache_destroy(CarrierCache *cache);
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include "carrier_io.h"
+#include "lsb_kernels.h"
+#include "pio.h"
+#include "common.h"
+
+void carrier_open(CarrierStream *cs, FILE *in, FILE *out, const BmpLayout *layout, uint64_t pos,
+                  unsigned char *prefix, size_t prefix_len)
+{
+    memset(cs, 0, sizeof(*cs));
+    cs->in = in;
+    cs->out = out;
+    cs->layout = layout;
+    cs->pos = pos;
+    cs->prefix = prefix;
+    cs->prefix_len = prefix_len;
+}
+
+void carrier_close(CarrierStream *cs)
+{
+    free(cs->prefix);
+    free(cs->window);
+    free(cs->run);
+    free(cs->orig);
+    cs->prefix = cs->window = cs->run = cs->orig = NULL;
+    cs->prefix_len = cs->window_cap = cs->run_cap = cs->orig_cap = 0;
+}
+
+static Status reserve(unsigned char **buf, size_t *cap, size_t len)
+{
+    if (len <= *cap)
+        return e_success;
+    unsigned char *p = realloc(*buf, len);
+    if (p == NULL)
+        return e_failure;
+    *buf = p;
+    *cap = len;
+    return e_success;
+}
+
+/*
+ * Load the window holding span carrier bytes at logical into cs->window and point
+ * *carrier at them: straight into the window for the flat layout, else gathered into cs->run.
+ * *lo is the file offset of window[0].
+ */
+static Status load_window(CarrierStream *cs, uint64_t logical, size_t span, uint64_t *lo, uint64_t *end,
+                          unsigned char **carrier)
+{
+    const BmpLayout *layout = cs->layout;
+    uint64_t start;
+
+    if (span == 0 || logical > layout->capacity || span > layout->capacity - logical)
+        return e_failure;
+    bmp_window(layout, logical, span, &start, end);
+
+    // Bytes before pos can only come from the read-ahead prefix (never when writing)
+    *lo = start < cs->pos ? start : cs->pos;
+    if (*lo < cs->pos && (cs->out != NULL || cs->pos > cs->prefix_len))
+        return e_failure;
+    if (reserve(&cs->window, &cs->window_cap, (size_t)(*end - *lo)) != e_success)
+        return e_failure;
+
+    uint64_t from_prefix = (*end < cs->pos ? *end : cs->pos) - *lo;
+    if (from_prefix > 0)
+        memcpy(cs->window, cs->prefix + *lo, (size_t)from_prefix);
+    if (*end > cs->pos)
+    {
+        size_t n = (size_t)(*end - cs->pos);
+        unsigned char *dst = cs->window + (cs->pos - *lo);
+        if (cs->out == cs->in ? pread_full(fileno(cs->in), dst, n, (off_t)cs->pos) != e_success
+                              : fread(dst, 1, n, cs->in) != n)
+            return e_failure;
+    }
+
+    if (layout->identity)
+    {
+        *carrier = cs->window + (start - *lo);
+        return e_success;
+    }
+    if (reserve(&cs->run, &cs->run_cap, span) != e_success)
+        return e_failure;
+    bmp_gather(layout, cs->window, *lo, logical, span, cs->run);
+    *carrier = cs->run;
+    return e_success;
+}
+
+/* Write back the dirty blocks of the window at file offset lo, merging neighbours into one pwrite */
+static Status write_changed(CarrierStream *cs, uint64_t lo, size_t n)
+{
+    int fd = fileno(cs->in);
+    size_t i = 0;
+
+    while (i < n)
+    {
+        // Blocks are aligned to file offsets, so they match the pages the kernel writes back
+        size_t len = CARRIER_DIRTY_BLOCK - (size_t)((lo + i) % CARRIER_DIRTY_BLOCK);
+        if (len > n - i)
+            len = n - i;
+        if (memcmp(cs->window + i, cs->orig + i, len) == 0)
+        {
+            i += len;
+            continue;
+        }
+
+        size_t first = i;
+        for (i += len; i < n; i += len)
+        {
+            len = n - i < CARRIER_DIRTY_BLOCK ? n - i : CARRIER_DIRTY_BLOCK;
+            if (memcmp(cs->window + i, cs->orig + i, len) == 0)
+                break;
+        }
+        if (pwrite_full(fd, cs->window + first, i - first, (off_t)(lo + first)) != e_success)
+            return e_failure;
+        cs->written += i - first;
+    }
+    return e_success;
+}
+
+Status carrier_embed(CarrierStream *cs, uint64_t logical, const unsigned char *data, size_t len, int depth)
+{
+    uint64_t lo, end;
+    unsigned char *carrier;
+    size_t span = lsb_carrier_bytes(len, depth);
+
+    if (len == 0)
+        return e_success;
+    if (load_window(cs, logical, span, &lo, &end, &carrier) != e_success)
+        return e_failure;
+
+    size_t n = (size_t)(end - lo);
+    int in_place = cs->out == cs->in;
+    if (in_place)
+    {
+        if (reserve(&cs->orig, &cs->orig_cap, n) != e_success)
+            return e_failure;
+        memcpy(cs->orig, cs->window, n);
+    }
+
+    lsb_embed_bits(data, len, carrier, depth);
+    if (!cs->layout->identity)
+        bmp_scatter(cs->layout, cs->window, lo, logical, span, carrier);
+
+    if (in_place ? write_changed(cs, lo, n) != e_success : fwrite(cs->window, 1, n, cs->out) != n)
+        return e_failure;
+    cs->pos = end;
+    return e_success;
+}
+
+Status carrier_extract(CarrierStream *cs, uint64_t logical, size_t len, unsigned char *data, int depth)
+{
+    uint64_t lo, end;
+    unsigned char *carrier;
+
+    if (len == 0)
+        return e_success;
+    if (load_window(cs, logical, lsb_carrier_bytes(len, depth), &lo, &end, &carrier) != e_success)
+        return e_failure;
+
+    lsb_extract_bits(carrier, len, data, depth);
+    if (end > cs->pos)
+        cs->pos = end;
+    return e_success;
+}
+
+Status carrier_seek(CarrierStream *cs, uint64_t pos)
+{
+    // In place, every read and write is positional
+    if (cs->out == cs->in)
+    {
+        cs->pos = pos;
+        return e_success;
+    }
+    if (fseeko(cs->in, (off_t)pos, SEEK_SET) == 0 && (cs->out == NULL || fseeko(cs->out, (off_t)pos, SEEK_SET) == 0))
+    {
+        cs->pos = pos;
+        return e_success;
+    }
+
+    // A piped image that is only read can still move forward by reading past the bytes
+    if (cs->out != NULL || pos < cs->pos || reserve(&cs->window, &cs->window_cap, STEG_CHUNK_SIZE) != e_success)
+        return e_failure;
+    while (cs->pos < pos)
+    {
+        size_t n = pos - cs->pos < STEG_CHUNK_SIZE ? (size_t)(pos - cs->pos) : STEG_CHUNK_SIZE;
+        if (fread(cs->window, 1, n, cs->in) != n)
+            return e_failure;
+        cs->pos += n;
+    }
+    return e_success;
+}
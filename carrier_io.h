@@ -0,0 +1,57 @@
+#ifndef CARRIER_IO_H
+#define CARRIER_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * Sequential stdio access to the carrier bytes of a BMP layout.
+ *
+ * Each call reads the file window holding the requested carrier bytes (see
+ * bmp_window) from in, embeds or extracts over the gathered run and, when
+ * out is set, writes the whole window back out, padding included. pos is
+ * the file offset of both streams; windows must come in order unless the
+ * streams are moved with carrier_seek. Bytes before pos that were read
+ * ahead (e.g. while probing the header) can be handed over as prefix.
+ *
+ * With out == in the image is updated in place: windows are read with
+ * pread and only the CARRIER_DIRTY_BLOCK-sized file blocks whose bytes
+ * changed are written back with pwrite, so the rest is never rewritten.
+ */
+#define CARRIER_DIRTY_BLOCK 4096
+typedef struct _CarrierStream
+{
+    FILE *in;                   // Source carrier (encode) or stego image (decode)
+    FILE *out;                  // Stego image being written, NULL when only extracting
+    const BmpLayout *layout;
+    uint64_t pos;               // File offset of the next byte of in (and out)
+    unsigned char *prefix;      // File bytes [0, prefix_len) already read from in (owned)
+    size_t prefix_len;
+    unsigned char *window;      // Work buffers, grown on demand
+    size_t window_cap;
+    unsigned char *run;
+    size_t run_cap;
+    unsigned char *orig;        // Window before embedding (in place only)
+    size_t orig_cap;
+    uint64_t written;           // Bytes written back in place
+} CarrierStream;
+
+/* Start a stream at file offset pos; prefix (may be NULL) is taken over and freed by carrier_close */
+void carrier_open(CarrierStream *cs, FILE *in, FILE *out, const BmpLayout *layout, uint64_t pos,
+                  unsigned char *prefix, size_t prefix_len);
+
+/* Embed len data bytes at logical carrier offset logical, copying the window from in to out */
+Status carrier_embed(CarrierStream *cs, uint64_t logical, const unsigned char *data, size_t len, int depth);
+
+/* Extract len data bytes from logical carrier offset logical */
+Status carrier_extract(CarrierStream *cs, uint64_t logical, size_t len, unsigned char *data, int depth);
+
+/* Move both streams to a file offset; a stream that is only read may also skip forward through a pipe */
+Status carrier_seek(CarrierStream *cs, uint64_t pos);
+
+/* Free the buffers */
+void carrier_close(CarrierStream *cs);
+
+#endif
@@ -4,4 +4,18 @@
 /* Magic string to identify stego file */
 #define MAGIC_STRING "#*"
 
+/* Carrier block size used by the streaming encode pipeline (bytes) */
+#ifndef STEG_CHUNK_SIZE
+#define STEG_CHUNK_SIZE (256 * 1024)
+#endif
+
+/* Longest file name accepted for carriers and outputs */
+#define STEG_PATH_MAX 256
+
+/* Offset of the pixel array in the 24-bit BMPs we handle */
+#define BMP_HEADER_SIZE 54
+
+/* Carriers at least this large are mapped with a huge page hint */
+#define STEG_HUGEPAGE_MIN (64UL * 1024 * 1024)
+
 #endif
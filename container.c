@@ -0,0 +1,101 @@
+#include <string.h>
+#include "container.h"
+
+static void put_be(unsigned char *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = (unsigned char)(v >> (8 * (bytes - 1 - i)));
+}
+
+static uint64_t get_be(const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v = v << 8 | p[i];
+    return v;
+}
+
+size_t container_toc_size(const ContainerEntry *entries, uint32_t count)
+{
+    size_t size = CONTAINER_TOC_FIXED;
+    for (uint32_t i = 0; i < count; i++)
+        size += 1 + strlen(entries[i].name) + 16;
+    return size;
+}
+
+void container_write_toc(const ContainerEntry *entries, uint32_t count, unsigned char *out)
+{
+    put_be(out, container_toc_size(entries, count), 4);
+    put_be(out + 4, count, 4);
+    unsigned char *p = out + CONTAINER_TOC_FIXED;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        size_t len = strlen(entries[i].name);
+        *p++ = (unsigned char)len;
+        memcpy(p, entries[i].name, len);
+        p += len;
+        put_be(p, entries[i].offset, 8);
+        put_be(p + 8, entries[i].length, 8);
+        p += 16;
+    }
+}
+
+uint32_t container_toc_length(const unsigned char *toc)
+{
+    return (uint32_t)get_be(toc, 4);
+}
+
+Status container_check_toc(const unsigned char *toc, size_t len, uint64_t data_len, uint32_t *count)
+{
+    if (len < CONTAINER_TOC_FIXED || container_toc_length(toc) != len)
+        return e_failure;
+
+    uint32_t n = (uint32_t)get_be(toc + 4, 4);
+    size_t pos = CONTAINER_TOC_FIXED;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (len - pos < 1 || len - pos - 1 < (size_t)toc[pos] + 16)
+            return e_failure;
+        pos += 1 + toc[pos];
+        uint64_t offset = get_be(toc + pos, 8), length = get_be(toc + pos + 8, 8);
+        if (offset > data_len || length > data_len - offset)
+            return e_failure;
+        pos += 16;
+    }
+    if (pos != len)
+        return e_failure;
+    *count = n;
+    return e_success;
+}
+
+/* Decode the entry at pos of a checked table; returns the position of the next one */
+static size_t read_entry(const unsigned char *toc, size_t pos, ContainerEntry *entry)
+{
+    size_t len = toc[pos];
+    memcpy(entry->name, toc + pos + 1, len);
+    entry->name[len] = '\0';
+    entry->offset = get_be(toc + pos + 1 + len, 8);
+    entry->length = get_be(toc + pos + 1 + len + 8, 8);
+    return pos + 1 + len + 16;
+}
+
+void container_entry(const unsigned char *toc, uint32_t index, ContainerEntry *entry)
+{
+    size_t pos = CONTAINER_TOC_FIXED;
+    while (index-- > 0)
+        pos += 1 + toc[pos] + 16;
+    read_entry(toc, pos, entry);
+}
+
+Status container_find(const unsigned char *toc, const char *name, ContainerEntry *entry)
+{
+    uint32_t count = (uint32_t)get_be(toc + 4, 4);
+    size_t pos = CONTAINER_TOC_FIXED;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        pos = read_entry(toc, pos, entry);
+        if (strcmp(entry->name, name) == 0)
+            return e_success;
+    }
+    return e_failure;
+}
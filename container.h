@@ -0,0 +1,51 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Multi-entry payload (STEG_F_CONTAINER): a table of contents followed by
+ * the entry bytes back to back, stored uncompressed so that entry byte i
+ * sits at a fixed carrier offset and can be read without decoding the
+ * entries before it.
+ *
+ *   toc length (u32 BE, whole table) | entry count (u32 BE) |
+ *   per entry: name length (u8) | name | offset (u64 BE) | length (u64 BE)
+ *
+ * Offsets count from the first byte after the table.
+ */
+#define CONTAINER_NAME_MAX  255
+#define CONTAINER_TOC_MAX   (1024 * 1024)   // Largest table a decoder accepts
+#define CONTAINER_TOC_FIXED 8               // Length and count fields
+
+typedef struct _ContainerEntry
+{
+    char name[CONTAINER_NAME_MAX + 1];
+    uint64_t offset;        // From the end of the table
+    uint64_t length;
+} ContainerEntry;
+
+/* Table size for count entries */
+size_t container_toc_size(const ContainerEntry *entries, uint32_t count);
+
+/* Write the table for count entries to out (container_toc_size bytes) */
+void container_write_toc(const ContainerEntry *entries, uint32_t count, unsigned char *out);
+
+/* Table length from its first 4 bytes */
+uint32_t container_toc_length(const unsigned char *toc);
+
+/*
+ * Check a table of len bytes against the data that follows it (data_len bytes)
+ * and return its entry count; fails if any entry runs past the data.
+ */
+Status container_check_toc(const unsigned char *toc, size_t len, uint64_t data_len, uint32_t *count);
+
+/* Entry index of a checked table */
+void container_entry(const unsigned char *toc, uint32_t index, ContainerEntry *entry);
+
+/* Find an entry of a checked table by name */
+Status container_find(const unsigned char *toc, const char *name, ContainerEntry *entry);
+
+#endif
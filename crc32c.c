@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#define CRC_X86 1
+#include <immintrin.h>
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const unsigned char *p, size_t len);
+
+static uint32_t table[8][256];
+static crc32c_fn impl;
+static const char *impl_name;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/* ---------------- table: slicing-by-8 ---------------- */
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *p, size_t len)
+{
+    for (; len > 0 && ((uintptr_t)p & 7); len--)
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        // Eight table lookups per word, independent of each other
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+              table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+    }
+
+    for (; len > 0; len--)
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CRC_X86
+
+/* ---------------- sse4.2: crc32 instruction, 8 bytes per step ---------------- */
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    for (; len > 0 && ((uintptr_t)p & 7); len--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    uint64_t c = crc;
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (uint32_t)c;
+
+    for (; len > 0; len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+#endif
+
+/* One-time setup: tables for the fallback and CPU feature detection */
+static void crc32c_init(void)
+{
+    for (uint32_t v = 0; v < 256; v++)
+    {
+        uint32_t c = v;
+        for (int i = 0; i < 8; i++)
+            c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+        table[0][v] = c;
+    }
+    for (uint32_t v = 0; v < 256; v++)
+        for (int k = 1; k < 8; k++)
+            table[k][v] = table[0][table[k - 1][v] & 0xFF] ^ (table[k - 1][v] >> 8);
+
+    impl = crc32c_table;
+    impl_name = "table";
+#ifdef CRC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        impl = crc32c_sse42;
+        impl_name = "sse4.2";
+    }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&init_once, crc32c_init);
+    return ~impl(~crc, data, len);
+}
+
+const char *crc32c_impl(void)
+{
+    pthread_once(&init_once, crc32c_init);
+    return impl_name;
+}
+
+void crc_chunks_init(CrcChunks *acc, size_t chunk)
+{
+    memset(acc, 0, sizeof(*acc));
+    acc->chunk = chunk;
+}
+
+/* Append the current chunk's CRC to the table and start the next chunk */
+static void close_chunk(CrcChunks *acc)
+{
+    if (acc->count == acc->cap)
+    {
+        size_t cap = acc->cap ? acc->cap * 2 : 64;
+        uint32_t *crcs = realloc(acc->crcs, cap * sizeof(*crcs));
+        if (crcs == NULL)
+        {
+            acc->nomem = 1;
+            return;
+        }
+        acc->crcs = crcs;
+        acc->cap = cap;
+    }
+    acc->crcs[acc->count++] = acc->crc;
+    acc->crc = 0;
+    acc->fill = 0;
+}
+
+void crc_chunks_update(CrcChunks *acc, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    while (len > 0 && !acc->nomem)
+    {
+        size_t n = acc->chunk - acc->fill < len ? acc->chunk - acc->fill : len;
+        acc->crc = crc32c(acc->crc, p, n);
+        acc->fill += n;
+        p += n;
+        len -= n;
+        if (acc->fill == acc->chunk)
+            close_chunk(acc);
+    }
+}
+
+Status crc_chunks_finish(CrcChunks *acc)
+{
+    if (acc->fill > 0 && !acc->nomem)
+        close_chunk(acc);
+    return acc->nomem ? e_failure : e_success;
+}
+
+void crc_chunks_free(CrcChunks *acc)
+{
+    free(acc->crcs);
+    acc->crcs = NULL;
+    acc->count = acc->cap = 0;
+}
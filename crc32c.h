@@ -0,0 +1,44 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * CRC32C (Castagnoli polynomial, as used by iSCSI and ext4).
+ * Runs on the SSE4.2 crc32 instruction when the CPU has it, otherwise
+ * on slicing-by-8 tables. Both give the same result.
+ */
+
+/* Continue crc (0 to start) over len bytes; chain calls to cover a buffer in pieces */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/* Name of the implementation in use ("sse4.2" or "table") */
+const char *crc32c_impl(void);
+
+/*
+ * Running checksums of a byte stream cut into fixed-size chunks: one CRC32C
+ * per chunk of chunk bytes, the last chunk possibly shorter. Bytes may be
+ * fed in pieces of any size; the table grows as chunks complete.
+ */
+typedef struct _CrcChunks
+{
+    uint32_t *crcs;         // One CRC per completed chunk
+    size_t count;
+    size_t cap;
+    size_t chunk;           // Chunk size in bytes
+    size_t fill;            // Bytes of the current chunk seen so far
+    uint32_t crc;           // CRC of the current chunk so far
+    int nomem;              // Set if the table could not grow
+} CrcChunks;
+
+void crc_chunks_init(CrcChunks *acc, size_t chunk);
+void crc_chunks_update(CrcChunks *acc, const void *data, size_t len);
+
+/* Close the last partial chunk; fails if the table could not be allocated */
+Status crc_chunks_finish(CrcChunks *acc);
+
+void crc_chunks_free(CrcChunks *acc);
+
+#endif
@@ -1,66 +1,56 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "decode.h"
 #include "types.h"
+#include "log.h"
 #include "common.h"
+#include "mmap_io.h"
+#include "lsb_kernels.h"
+#include "parallel.h"
+#include "pio.h"
+#include "steg.h"
+#include "format.h"
+#include "lz.h"
+#include "container.h"
+#include "crc32c.h"
+#include "threadpool.h"
+#include "pipeline.h"
 
-/* Helper decode function: Decode 1 byte of secret data from the LSBs of 8 bytes of image data */
-Status_d decode_byte_from_lsb(char *data, char *image_buffer)
-{
-    if (data == NULL || image_buffer == NULL)
-        return d_failure;
-
-    char decoded_byte = 0;
-    
-    // Iterate through the 8 bytes of the image buffer
-    for (int i = 0; i < 8; i++)
-    {
-        // 1. Shift the decoded_byte one position to the left.
-        decoded_byte = decoded_byte << 1;
-        
-        // 2. Extract the LSB from the current image_buffer byte (image_buffer[i] & 0x01).
-        // 3. Combine the extracted LSB with the decoded_byte using bitwise OR.
-        decoded_byte |= (image_buffer[i] & 0x01);
-    }
-    
-    // Store the resulting decoded byte
-    *data = decoded_byte;
-
-    return d_success;
-}
-
-/* Helper decode function: Extract a 32-bit integer from 32 LSBs */
-Status_d decode_size_from_lsb(int *size, char *imageBuffer)
-{
-    int value = 0;
-    for (int i = 0; i < 32; i++)
-    {
-        value = value << 1;
-        value |= (imageBuffer[i] & 0x01);
-    }
-    *size = value;
-    return d_success;
-}
+/* Read-ahead limit for the BMP header and first carrier bytes of a stego image */
+#define STEG_PROBE_MAX (1024 * 1024)
 
+/* First read of a probe; holds the whole header region of all but unusual images */
+#define STEG_INFO_READ 4096
 
 /* Read and validate decode arguments */
 Status_d read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 {
-    // Validate stego image filename
-    if (strlen(argv[2]) < 4)
+    // Validate stego image filename ("-" reads the image from stdin)
+    if (!is_stdio_name(argv[2]))
     {
-        printf("ERROR: Invalid source file name length.\n");
-        return d_failure;
+        if (strlen(argv[2]) < 4)
+        {
+            fprintf(stderr, "ERROR: Invalid source file name length.\n");
+            return d_failure;
+        }
+
+        char *src_ext = argv[2] + strlen(argv[2]) - 4;
+        if (strcmp(src_ext, ".bmp") != 0)
+        {
+            fprintf(stderr, "ERROR: Invalid source file. Use .bmp files.\n");
+            return d_failure;
+        }
     }
 
-    char *src_ext = argv[2] + strlen(argv[2]) - 4;
-    if (strcmp(src_ext, ".bmp") != 0)
+    if (strlen(argv[2]) >= sizeof(decInfo->stego_image_fname))
     {
-        printf("ERROR: Invalid source file. Use .bmp files.\n");
+        fprintf(stderr, "ERROR: Source file name is too long.\n");
         return d_failure;
     }
-
     strcpy(decInfo->stego_image_fname, argv[2]);
 
     // Handle output argument
@@ -84,7 +74,7 @@ Status_d read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 /* Open files */
 Status_d open_decode_files(DecodeInfo *decInfo)
 {
-    decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "rb");
+    decInfo->fptr_stego_image = open_stream(decInfo->stego_image_fname, "rb");
     if (decInfo->fptr_stego_image == NULL)
     {
         perror("fopen");
@@ -94,58 +84,113 @@ Status_d open_decode_files(DecodeInfo *decInfo)
     return d_success;
 }
 
+/* Extract len bytes at the current carrier offset and step past them */
+static Status_d decode_field(DecodeInfo *decInfo, void *data, size_t len, int depth)
+{
+    if (carrier_extract(&decInfo->carrier, decInfo->carrier_off, len, data, depth) != e_success)
+        return d_failure;
+    decInfo->carrier_off += lsb_carrier_bytes(len, depth);
+    return d_success;
+}
+
+/* 32-bit header value, most significant byte first */
+static Status_d decode_u32(DecodeInfo *decInfo, uint32_t *value)
+{
+    unsigned char be[4];
+    if (decode_field(decInfo, be, sizeof(be), 1) != d_success)
+        return d_failure;
+    *value = (uint32_t)be[0] << 24 | (uint32_t)be[1] << 16 | (uint32_t)be[2] << 8 | be[3];
+    return d_success;
+}
+
+/* Release the stego image along with its layout */
+static void close_stego(DecodeInfo *decInfo)
+{
+    close_stream(decInfo->fptr_stego_image);
+    decInfo->fptr_stego_image = NULL;
+    carrier_close(&decInfo->carrier);
+    bmp_free(&decInfo->layout);
+    memset(&decInfo->aead, 0, sizeof(decInfo->aead));
+}
+
 /* Decode the magic string to verify hidden data */
 Status_d decode_magic_string(DecodeInfo *decInfo)
 {
-    char imageBuffer[8];
-    char ch;
-    
-    // Allocate buffer for magic string + NULL terminator
-    char magic[strlen(MAGIC_STRING) + 1]; 
-    
-    // Skip BMP header (54 bytes)
-    fseek(decInfo->fptr_stego_image, 54, SEEK_SET); 
+    char magic[strlen(MAGIC_STRING) + 1];
 
-    for (int i = 0; i < strlen(MAGIC_STRING); i++)
+    // Read the BMP header and the first carrier bytes of every layout up front, so a piped image works too
+    unsigned char bmp_header[BMP_HEADER_SIZE];
+    if (fread(bmp_header, 1, BMP_HEADER_SIZE, decInfo->fptr_stego_image) != BMP_HEADER_SIZE)
     {
-        if (fread(imageBuffer, 1, 8, decInfo->fptr_stego_image) != 8)
-        {
-            fprintf(stderr, "ERROR: Failed to read image data for magic string.\n");
-            return d_failure;
-        }
-        
-        if (decode_byte_from_lsb(&ch, imageBuffer) == d_failure)
-            return d_failure;
-            
-        magic[i] = ch;
+        fprintf(stderr, "ERROR: Failed to read BMP header.\n");
+        return d_failure;
     }
-    magic[strlen(MAGIC_STRING)] = '\0'; // Null-terminate
 
-    if (strcmp(magic, MAGIC_STRING) == 0)
+    uint64_t file_len = decInfo->image_len ? decInfo->image_len : stream_size(decInfo->fptr_stego_image);
+    uint64_t probe_len = steg_probe_length(bmp_header, BMP_HEADER_SIZE, file_len);
+    if (probe_len > STEG_PROBE_MAX)
     {
-        printf("Magic string verified: %s\n", magic);
-        return d_success;
+        fprintf(stderr, "ERROR: BMP header is too large (pixel data at byte %llu).\n", (unsigned long long)probe_len);
+        return d_failure;
     }
-    else
+    unsigned char *probe = malloc((size_t)probe_len);
+    if (probe == NULL)
     {
-        fprintf(stderr, "ERROR: Magic string mismatch! No hidden data found.\n");
+        fprintf(stderr, "ERROR: Unable to allocate header buffer.\n");
         return d_failure;
     }
+    memcpy(probe, bmp_header, BMP_HEADER_SIZE);
+    size_t got = BMP_HEADER_SIZE + fread(probe + BMP_HEADER_SIZE, 1, (size_t)probe_len - BMP_HEADER_SIZE,
+                                         decInfo->fptr_stego_image);
+
+    // Try each pixel layout until one holds the magic string and a matching header word
+    uint32_t word;
+    StegStatus status = steg_detect_layout(probe, got, file_len, &decInfo->layout, &word);
+    if (status != steg_ok)
+    {
+        free(probe);
+        if (status == steg_err_no_payload)
+            fprintf(stderr, "ERROR: Magic string mismatch! No hidden data found.\n");
+        else
+            fprintf(stderr, "ERROR: %s\n", steg_strerror(status));
+        return d_failure;
+    }
+
+    // The carrier stream serves the bytes read so far from the probe buffer
+    carrier_open(&decInfo->carrier, decInfo->fptr_stego_image, NULL, &decInfo->layout, got, probe, got);
+    decInfo->carrier_off = 0;
+    if (decode_field(decInfo, magic, strlen(MAGIC_STRING), 1) != d_success)
+    {
+        fprintf(stderr, "ERROR: Failed to read image data for magic string.\n");
+        return d_failure;
+    }
+    magic[strlen(MAGIC_STRING)] = '\0';
+    LOG_INFO("Magic string verified: %s\n", magic);
+    return d_success;
 }
 
 /* Decode size of file extension (32 bits) */
 Status_d decode_secret_file_extn_size(DecodeInfo *decInfo, int *extn_size)
 {
-    char imageBuffer[32];
-    
-    if (fread(imageBuffer, 1, 32, decInfo->fptr_stego_image) != 32)
+    uint32_t word;
+    if (decode_u32(decInfo, &word) != d_success)
     {
         fprintf(stderr, "ERROR: Failed to read image data for extension size.\n");
         return d_failure;
     }
-    
-    if (decode_size_from_lsb(extn_size, imageBuffer) == d_failure)
+    *extn_size = (int)word;
+
+    // A v2 header packs the format version and flags next to the extension size
+    uint32_t extn_len, version, flags;
+    if (!steg_unpack_extn_word((uint32_t)*extn_size, &extn_len, &version, &flags))
+    {
+        fprintf(stderr, "ERROR: Unsupported stego format (header word 0x%08x).\n", (unsigned)*extn_size);
         return d_failure;
+    }
+    *extn_size = (int)extn_len;
+    decInfo->version = (int)version;
+    decInfo->flags = flags;
+    decInfo->depth = steg_flags_depth(flags);
 
     // Use the constant defined in decode.h (10) for maximum check
     if (*extn_size >= sizeof(decInfo->extn_secret_file) || *extn_size < 0) 
@@ -154,16 +199,13 @@ Status_d decode_secret_file_extn_size(DecodeInfo *decInfo, int *extn_size)
         return d_failure;
     }
 
-    printf("Extension size decoded: %d\n", *extn_size);
+    LOG_INFO("Extension size decoded: %d\n", *extn_size);
     return d_success;
 }
 
 /* Decode extension string (8 bits per char) */
 Status_d decode_secret_file_extn(DecodeInfo *decInfo, char *extn, int extn_size)
 {
-    char imageBuffer[8];
-    char ch;
-
     // The size check is redundant if decode_secret_file_extn_size passed, but kept for safety.
     if (extn_size >= sizeof(decInfo->extn_secret_file) || extn_size < 0)
     {
@@ -171,18 +213,10 @@ Status_d decode_secret_file_extn(DecodeInfo *decInfo, char *extn, int extn_size)
         return d_failure;
     }
     
-    for (int i = 0; i < extn_size; i++)
+    if (decode_field(decInfo, extn, (size_t)extn_size, 1) != d_success)
     {
-        if (fread(imageBuffer, 1, 8, decInfo->fptr_stego_image) != 8)
-        {
-            fprintf(stderr, "ERROR: Failed to read image data for extension string.\n");
-            return d_failure;
-        }
-        
-        if (decode_byte_from_lsb(&ch, imageBuffer) == d_failure)
-            return d_failure;
-            
-        extn[i] = ch;
+        fprintf(stderr, "ERROR: Failed to read image data for extension string.\n");
+        return d_failure;
     }
 
     extn[extn_size] = '\0';
@@ -190,40 +224,56 @@ Status_d decode_secret_file_extn(DecodeInfo *decInfo, char *extn, int extn_size)
     strncpy(decInfo->extn_secret_file, extn, sizeof(decInfo->extn_secret_file) - 1);
     decInfo->extn_secret_file[sizeof(decInfo->extn_secret_file) - 1] = '\0';
 
-    printf("Extension decoded: %s\n", decInfo->extn_secret_file);
+    LOG_INFO("Extension decoded: %s\n", decInfo->extn_secret_file);
     return d_success;
 }
 
-/* Decode secret file size (32 bits) */
-Status_d decode_secret_file_size(DecodeInfo *decInfo, long *file_size)
+/* Decode secret file size (32 bits, or 64 with STEG_F_SIZE64) */
+Status_d decode_secret_file_size(DecodeInfo *decInfo, off_t *file_size)
 {
-    char imageBuffer[32];
-    
-    if (fread(imageBuffer, 1, 32, decInfo->fptr_stego_image) != 32)
+    size_t bits = (size_t)steg_size_bits(decInfo->flags);
+
+    // The 64-bit field is the high word followed by the low word
+    uint64_t size = 0;
+    for (size_t i = 0; i < bits; i += 32)
     {
-        fprintf(stderr, "ERROR: Failed to read image data for secret file size.\n");
-        return d_failure;
+        uint32_t word;
+        if (decode_u32(decInfo, &word) != d_success)
+        {
+            fprintf(stderr, "ERROR: Failed to read image data for secret file size.\n");
+            return d_failure;
+        }
+        size = (size << 32) | word;
     }
-    
-    int temp_size;
 
-    if (decode_size_from_lsb(&temp_size, imageBuffer) == d_failure)
+    // A v1 image stores a signed 32-bit size; negative values are corrupt, as are sizes past the pixel data
+    uint64_t room = (decInfo->layout.capacity - decInfo->carrier_off) / lsb_carrier_bytes(1, decInfo->depth);
+    if (size > (uint64_t)INT64_MAX || (bits == 32 && size > STEG_SIZE32_MAX) || size > room)
+    {
+        fprintf(stderr, "ERROR: Secret file size is out of range.\n");
         return d_failure;
-
-    // Cast the read integer size to long for safety with large files
-    *file_size = (long)temp_size; 
+    }
+    *file_size = (off_t)size;
+    decInfo->size_secret_file = size;
     
-    printf("Secret file size decoded: %ld bytes\n", *file_size);
+    LOG_INFO("Secret file size decoded: %llu bytes\n", (unsigned long long)size);
     return d_success; 
 }
 
-/* Decode the actual secret data and write to file */
-Status_d decode_secret_file_data(DecodeInfo *decInfo, long file_size)
+/* Build the output file name, appending the decoded extension if needed */
+Status_d build_output_fname(DecodeInfo *decInfo, char *output_fname_final, size_t size)
 {
-    char imageBuffer[8];
-    char ch;
-    char output_fname_final[100];
-    char temp_output[100];
+    char temp_output[STEG_PATH_MAX];
+
+    if (size < sizeof(temp_output) + 12)
+        return d_failure;
+
+    // "-" writes to stdout, so there is no file name to add an extension to
+    if (is_stdio_name(decInfo->output_fname))
+    {
+        strcpy(output_fname_final, STEG_STDIO_NAME);
+        return d_success;
+    }
 
     // 1. Prepare filename for output
     strncpy(temp_output, decInfo->output_fname, sizeof(temp_output) - 1);
@@ -263,8 +313,413 @@ Status_d decode_secret_file_data(DecodeInfo *decInfo, long file_size)
         // Decoded extension is empty (file had no extension), use output_fname as is.
         strcpy(output_fname_final, temp_output);
     }
-    
-    decInfo->fptr_output = fopen(output_fname_final, "wb");
+    return d_success;
+}
+
+/*
+ * Extract stored payload bytes at the current carrier offset, checksumming them if crc is set
+ * and decrypting all but the first clear bytes of a sealed payload
+ */
+static Status_d decode_payload(DecodeInfo *decInfo, void *data, size_t len, size_t clear, int depth, CrcChunks *crc)
+{
+    if (decode_field(decInfo, data, len, depth) != d_success)
+        return d_failure;
+    if (crc)
+        crc_chunks_update(crc, data, len);
+    if (decInfo->flags & STEG_F_ENCRYPTED)
+        aead_open(&decInfo->aead, data, len, clear);
+    return d_success;
+}
+
+/* Checksum and decrypt a block on the pipeline's compute stage, as decode_payload does */
+typedef struct
+{
+    DecodeInfo *decInfo;
+    CrcChunks *crc;
+} OpenBlock;
+
+static void open_block(void *ctx, unsigned char *data, size_t len)
+{
+    OpenBlock *ob = ctx;
+    if (ob->crc)
+        crc_chunks_update(ob->crc, data, len);
+    if (ob->decInfo->flags & STEG_F_ENCRYPTED)
+        aead_open(&ob->decInfo->aead, data, len, 0);
+}
+
+/* Extract the payload region through the I/O queue, then resume the carrier stream after it */
+static Status_d decode_pipelined(DecodeInfo *decInfo, IoQueue *q, off_t file_size, int depth, size_t block,
+                                 CrcChunks *crc)
+{
+    OpenBlock ob = {decInfo, crc};
+    off_t out_off = ftello(decInfo->fptr_output);
+    uint64_t pos = decInfo->carrier.pos;
+
+    if (out_off < 0 || fflush(decInfo->fptr_output) != 0 ||
+        pipeline_extract(q, fileno(decInfo->fptr_stego_image), fileno(decInfo->fptr_output), out_off,
+                         &decInfo->layout, decInfo->carrier_off, (uint64_t)file_size, depth, block, open_block, &ob,
+                         &pos) != e_success)
+    {
+        fprintf(stderr, "ERROR: Failed to extract the secret file content.\n");
+        return d_failure;
+    }
+    LOG_INFO("Payload extracted through the %s pipeline.\n", ioq_backend(q));
+    opstats_io(decInfo->stats, ioq_backend(q));
+
+    decInfo->carrier_off += lsb_carrier_bytes((size_t)file_size, depth);
+    if (fseeko(decInfo->fptr_output, out_off + file_size, SEEK_SET) != 0 ||
+        carrier_seek(&decInfo->carrier, pos) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to seek past the payload region.\n");
+        return d_failure;
+    }
+    return d_success;
+}
+
+/* Read the nonce in front of a sealed payload and start opening it */
+static Status_d decode_nonce(DecodeInfo *decInfo)
+{
+    unsigned char nonce[AEAD_NONCE_LEN], aad[4 + sizeof(decInfo->extn_secret_file)];
+    size_t extn_len = strlen(decInfo->extn_secret_file);
+
+    if (!decInfo->has_key)
+    {
+        fprintf(stderr, "ERROR: Payload is encrypted; give its key with --key FILE.\n");
+        return d_failure;
+    }
+    if (decInfo->has_range || (decInfo->flags & STEG_F_CONTAINER))
+    {
+        fprintf(stderr, "ERROR: An encrypted payload only authenticates as a whole (no --offset/--length).\n");
+        return d_failure;
+    }
+    if (decode_field(decInfo, nonce, sizeof(nonce), decInfo->depth ? decInfo->depth : 1) != d_success)
+    {
+        fprintf(stderr, "ERROR: Failed to read the payload nonce.\n");
+        return d_failure;
+    }
+    uint32_t word = steg_pack_extn_word((uint32_t)extn_len, decInfo->flags);
+    aead_init(&decInfo->aead, decInfo->key, nonce, aad, steg_header_aad(word, decInfo->extn_secret_file, extn_len, aad));
+    return d_success;
+}
+
+/* Compare the tag after the stored payload with the one computed while decoding */
+static Status_d check_tag(DecodeInfo *decInfo)
+{
+    unsigned char tag[AEAD_TAG_LEN], expect[AEAD_TAG_LEN];
+    if (decode_field(decInfo, expect, sizeof(expect), decInfo->depth ? decInfo->depth : 1) != d_success)
+    {
+        fprintf(stderr, "ERROR: Failed to read the payload tag.\n");
+        return d_failure;
+    }
+    aead_tag(&decInfo->aead, tag);
+    if (!aead_tag_equal(tag, expect))
+    {
+        fprintf(stderr, "ERROR: %s\n", steg_strerror(steg_err_auth));
+        return d_failure;
+    }
+    LOG_INFO("Payload authenticated (chacha20 %s).\n", chacha20_impl());
+    return d_success;
+}
+
+/*
+ * Read count entries of the checksum table from the current carrier offset and compare them
+ * with crcs[0..count); base is the chunk number of the first
+ */
+static Status_d check_crc_table(DecodeInfo *decInfo, const uint32_t *crcs, size_t count, size_t base)
+{
+    int depth = decInfo->depth ? decInfo->depth : 1;
+    size_t bad = 0, first_bad = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned char be[4];
+        if (decode_field(decInfo, be, sizeof(be), depth) != d_success)
+        {
+            fprintf(stderr, "ERROR: Failed to read the payload checksums.\n");
+            return d_failure;
+        }
+        uint32_t stored = (uint32_t)be[0] << 24 | (uint32_t)be[1] << 16 | (uint32_t)be[2] << 8 | be[3];
+        if (stored != crcs[i] && bad++ == 0)
+            first_bad = i;
+    }
+
+    if (bad > 0)
+    {
+        fprintf(stderr, "ERROR: Payload checksum mismatch in %zu of %zu chunks (first at stored byte %llu); "
+                        "the output is damaged.\n", bad, count, (unsigned long long)(base + first_bad) * STEG_CRC_CHUNK);
+        return d_failure;
+    }
+    LOG_INFO("Payload checksums verified: %zu chunks\n", count);
+    return d_success;
+}
+
+/* check_crc_table over the checksums gathered while decoding */
+static Status_d check_crc_chunks(DecodeInfo *decInfo, CrcChunks *crc)
+{
+    if (crc_chunks_finish(crc) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate the checksum table.\n");
+        return d_failure;
+    }
+    return check_crc_table(decInfo, crc->crcs, crc->count, 0);
+}
+
+/* Move the stream to a logical carrier offset */
+static Status_d seek_carrier(DecodeInfo *decInfo, uint64_t logical)
+{
+    decInfo->carrier_off = logical;
+    if (carrier_seek(&decInfo->carrier, bmp_file_offset(&decInfo->layout, logical)) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to seek in the stego image.\n");
+        return d_failure;
+    }
+    return d_success;
+}
+
+/*
+ * Write stored bytes [start, start + len) of a plain payload of stored_len bytes at carrier offset
+ * payload_off, checking its checksums: the chunks the selection touches are decoded in full, so
+ * their table entries can be compared, and only the selected part of them is written
+ */
+static Status_d decode_checked_range(DecodeInfo *decInfo, uint64_t payload_off, uint64_t stored_len, uint64_t start,
+                                     uint64_t len)
+{
+    int depth = decInfo->depth ? decInfo->depth : 1;
+    size_t first = (size_t)(start / STEG_CRC_CHUNK), count = (size_t)((start + len - 1) / STEG_CRC_CHUNK) - first + 1;
+    unsigned char *chunk = malloc(STEG_CRC_CHUNK);
+    uint32_t *crcs = malloc(count * sizeof(*crcs));
+    Status_d ret = d_failure;
+
+    if (chunk == NULL || crcs == NULL)
+        fprintf(stderr, "ERROR: Unable to allocate decode buffers.\n");
+    else if (seek_carrier(decInfo, payload_off + lsb_carrier_bytes(first * (size_t)STEG_CRC_CHUNK, depth)) == d_success)
+    {
+        ret = d_success;
+        for (size_t i = 0; ret == d_success && i < count; i++)
+        {
+            uint64_t pos = (uint64_t)(first + i) * STEG_CRC_CHUNK;
+            size_t n = stored_len - pos < STEG_CRC_CHUNK ? (size_t)(stored_len - pos) : STEG_CRC_CHUNK;
+            uint64_t lo = pos > start ? pos : start;
+            uint64_t hi = pos + n < start + len ? pos + n : start + len;
+            if (decode_field(decInfo, chunk, n, depth) != d_success)
+            {
+                fprintf(stderr, "ERROR: Failed to read image data for secret file content at byte %llu.\n",
+                        (unsigned long long)pos);
+                ret = d_failure;
+            }
+            else if (fwrite(chunk + (lo - pos), 1, (size_t)(hi - lo), decInfo->fptr_output) != hi - lo)
+            {
+                fprintf(stderr, "ERROR: Failed to write byte %llu to output file.\n", (unsigned long long)lo);
+                ret = d_failure;
+            }
+            crcs[i] = crc32c(0, chunk, n);
+        }
+
+        // The table follows the stored payload, one entry per chunk
+        uint64_t table_off = payload_off + lsb_carrier_bytes((size_t)stored_len, depth);
+        if (ret == d_success)
+            ret = seek_carrier(decInfo, table_off + lsb_carrier_bytes(first * 4, depth));
+        if (ret == d_success)
+            ret = check_crc_table(decInfo, crcs, count, first);
+    }
+    free(chunk);
+    free(crcs);
+    return ret;
+}
+
+/* Extract (and decompress) frames until the end frame, writing the raw bytes out */
+static Status_d decode_frames(DecodeInfo *decInfo, off_t stored_size, CrcChunks *crc)
+{
+    int depth = decInfo->depth ? decInfo->depth : 1;
+    unsigned char *stored = malloc(LZ_BLOCK_SIZE);
+    unsigned char *raw = malloc(LZ_BLOCK_SIZE);
+    if (!stored || !raw)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate frame buffers.\n");
+        free(stored);
+        free(raw);
+        return d_failure;
+    }
+
+    Status_d ret = d_success;
+    off_t pos = 0, total = 0;
+    for (;;)
+    {
+        unsigned char fh[LZ_FRAME_HEADER];
+        uint32_t raw_len, stored_len;
+
+        if (stored_size - pos < LZ_FRAME_HEADER ||
+            decode_payload(decInfo, fh, LZ_FRAME_HEADER, LZ_FRAME_HEADER, depth, crc) != d_success)
+        {
+            fprintf(stderr, "ERROR: Compressed payload is truncated at byte %lld.\n", (long long)pos);
+            ret = d_failure;
+            break;
+        }
+        pos += LZ_FRAME_HEADER;
+        if (!lz_get_frame_header(fh, &raw_len, &stored_len) || stored_len > stored_size - pos)
+        {
+            fprintf(stderr, "ERROR: Compressed payload is corrupt at byte %lld.\n", (long long)pos);
+            ret = d_failure;
+            break;
+        }
+        if (raw_len == 0)
+            break;
+
+        if (decode_payload(decInfo, stored, stored_len, 0, depth, crc) != d_success)
+        {
+            fprintf(stderr, "ERROR: Compressed payload is truncated at byte %lld.\n", (long long)pos);
+            ret = d_failure;
+            break;
+        }
+        if (lz_decode_frame(stored, stored_len, raw, raw_len) != e_success)
+        {
+            fprintf(stderr, "ERROR: Compressed payload is corrupt at byte %lld.\n", (long long)pos);
+            ret = d_failure;
+            break;
+        }
+        if (fwrite(raw, 1, raw_len, decInfo->fptr_output) != raw_len)
+        {
+            fprintf(stderr, "ERROR: Failed to write byte %lld to output file.\n", (long long)total);
+            ret = d_failure;
+            break;
+        }
+        pos += stored_len;
+        total += raw_len;
+    }
+
+    free(stored);
+    free(raw);
+    if (ret == d_success && (decInfo->flags & STEG_F_COMPRESSED))
+        LOG_INFO("Decompressed %lld bytes to %lld bytes.\n", (long long)pos, (long long)total);
+    return ret;
+}
+
+/* Read and check the table of contents at the start of a container payload of file_size bytes */
+static Status_d read_toc(DecodeInfo *decInfo, off_t file_size, unsigned char **toc_out, uint32_t *count)
+{
+    int depth = decInfo->depth ? decInfo->depth : 1;
+    unsigned char head[4];
+
+    if (file_size < CONTAINER_TOC_FIXED || decode_field(decInfo, head, sizeof(head), depth) != d_success)
+    {
+        fprintf(stderr, "ERROR: Failed to read the container table of contents.\n");
+        return d_failure;
+    }
+    uint32_t len = container_toc_length(head);
+    if (len < CONTAINER_TOC_FIXED || len > CONTAINER_TOC_MAX || len > (uint64_t)file_size)
+    {
+        fprintf(stderr, "ERROR: Container table of contents is corrupt.\n");
+        return d_failure;
+    }
+
+    unsigned char *toc = malloc(len);
+    if (toc == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate the table of contents.\n");
+        return d_failure;
+    }
+    memcpy(toc, head, sizeof(head));
+    if (decode_field(decInfo, toc + sizeof(head), len - sizeof(head), depth) != d_success ||
+        container_check_toc(toc, len, (uint64_t)file_size - len, count) != e_success)
+    {
+        fprintf(stderr, "ERROR: Container table of contents is corrupt.\n");
+        free(toc);
+        return d_failure;
+    }
+    *toc_out = toc;
+    return d_success;
+}
+
+/* Look up the requested entry and seek straight to its first carrier byte */
+static Status_d select_entry(DecodeInfo *decInfo, off_t *file_size)
+{
+    unsigned char *toc;
+    uint32_t count;
+    ContainerEntry entry;
+
+    if (decInfo->entry == NULL)
+    {
+        fprintf(stderr, "ERROR: Image holds a container; extract one entry with --entry NAME (list them with -l).\n");
+        return d_failure;
+    }
+    if (read_toc(decInfo, *file_size, &toc, &count) != d_success)
+        return d_failure;
+
+    Status found = container_find(toc, decInfo->entry, &entry);
+    free(toc);
+    if (found != e_success)
+    {
+        fprintf(stderr, "ERROR: Container has no entry named %s.\n", decInfo->entry);
+        return d_failure;
+    }
+
+    // Entry byte i sits at a fixed carrier offset, so nothing before it is decoded
+    decInfo->carrier_off += lsb_carrier_bytes((size_t)entry.offset, decInfo->depth);
+    if (entry.length > 0 &&
+        carrier_seek(&decInfo->carrier, bmp_file_offset(&decInfo->layout, decInfo->carrier_off)) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to seek to container entry %s.\n", entry.name);
+        return d_failure;
+    }
+    LOG_INFO("Container entry %s: %llu bytes\n", entry.name, (unsigned long long)entry.length);
+    *file_size = (off_t)entry.length;
+    return d_success;
+}
+
+/* Narrow the payload (or container entry) to the requested byte range and seek to its start */
+static Status_d select_range(DecodeInfo *decInfo, off_t *file_size)
+{
+    if (decInfo->flags & STEG_F_FRAMED)
+    {
+        fprintf(stderr, "ERROR: --offset/--length need an uncompressed payload of known size.\n");
+        return d_failure;
+    }
+    if (decInfo->range_offset > (uint64_t)*file_size)
+    {
+        fprintf(stderr, "ERROR: Offset %llu is past the end of the %lld byte payload.\n",
+                (unsigned long long)decInfo->range_offset, (long long)*file_size);
+        return d_failure;
+    }
+
+    uint64_t length = (uint64_t)*file_size - decInfo->range_offset;
+    if (decInfo->range_length > 0 && decInfo->range_length < length)
+        length = decInfo->range_length;
+
+    // Payload byte i lives 8 / depth carrier bytes per byte past the start, so seek straight there
+    decInfo->carrier_off += lsb_carrier_bytes((size_t)decInfo->range_offset, decInfo->depth);
+    if (length > 0 &&
+        carrier_seek(&decInfo->carrier, bmp_file_offset(&decInfo->layout, decInfo->carrier_off)) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to seek to payload byte %llu.\n", (unsigned long long)decInfo->range_offset);
+        return d_failure;
+    }
+    LOG_INFO("Decoding bytes %llu-%llu of the payload\n", (unsigned long long)decInfo->range_offset,
+             (unsigned long long)(decInfo->range_offset + length));
+    *file_size = (off_t)length;
+    return d_success;
+}
+
+/* Decode the actual secret data and write to file */
+Status_d decode_secret_file_data(DecodeInfo *decInfo, off_t file_size)
+{
+    char output_fname_final[STEG_PATH_MAX + 16];
+
+    int sealed = (decInfo->flags & STEG_F_ENCRYPTED) != 0;
+    if (sealed && decode_nonce(decInfo) != d_success)
+        return d_failure;
+    uint64_t payload_off = decInfo->carrier_off;
+    uint64_t stored_len = (uint64_t)file_size;
+
+    // A container holds several entries: read its table and move straight to the one asked for
+    if ((decInfo->flags & STEG_F_CONTAINER) && select_entry(decInfo, &file_size) != d_success)
+        return d_failure;
+    if (decInfo->has_range && select_range(decInfo, &file_size) != d_success)
+        return d_failure;
+
+    if (build_output_fname(decInfo, output_fname_final, sizeof(output_fname_final)) != d_success)
+        return d_failure;
+
+    decInfo->fptr_output = open_stream(output_fname_final, "wb");
     if (decInfo->fptr_output == NULL)
     {
         perror("fopen");
@@ -272,38 +727,429 @@ Status_d decode_secret_file_data(DecodeInfo *decInfo, long file_size)
         return d_failure;
     }
 
-    // Decode and write the secret data byte by byte
-    for (long i = 0; i < file_size; i++)
+    int depth = decInfo->depth ? decInfo->depth : 1;
+    size_t block = STEG_CHUNK_SIZE / lsb_carrier_bytes(1, depth);
+
+    // The checksums cover the whole stored payload; an entry or a byte range is checked chunk by chunk
+    CrcChunks crc;
+    crc_chunks_init(&crc, STEG_CRC_CHUNK);
+    CrcChunks *acc = NULL;
+    IoQueue *q;
+    int partial = (decInfo->flags & STEG_F_CONTAINER) || decInfo->has_range;
+    if ((decInfo->flags & STEG_F_CRC) && !partial)
+        acc = &crc;
+    Status_d ret = d_success;
+
+    if ((decInfo->flags & STEG_F_CRC) && partial)
+    {
+        // Selections are whole payload bytes, so the carrier offset step gives their start
+        uint64_t start = (decInfo->carrier_off - payload_off) / lsb_carrier_bytes(1, depth);
+        if (file_size > 0)
+            ret = decode_checked_range(decInfo, payload_off, stored_len, start, (uint64_t)file_size);
+    }
+    else if (decInfo->flags & STEG_F_FRAMED)
     {
-        if (fread(imageBuffer, 1, 8, decInfo->fptr_stego_image) != 8)
+        // Framed payloads are decoded frame by frame on this thread; a chunked one ends at its end frame
+        ret = decode_frames(decInfo, (decInfo->flags & STEG_F_CHUNKED) ? (off_t)INT64_MAX : file_size, acc);
+    }
+    else if (decInfo->threads > 1 && !sealed && stream_seekable(decInfo->fptr_stego_image) && stream_seekable(decInfo->fptr_output))
+    {
+        // Split the payload region across worker threads (pread/pwrite need regular files); each range checksums its chunks
+        opstats_io(decInfo->stats, "pread/pwrite");
+        size_t count = acc ? (size_t)steg_crc_count((uint64_t)file_size) : 0;
+        uint32_t *crcs = count ? malloc(count * sizeof(*crcs)) : NULL;
+        if (count && crcs == NULL)
         {
-            fprintf(stderr, "ERROR: Failed to read image data for secret file content at byte %ld.\n", i);
-            fclose(decInfo->fptr_output);
-            return d_failure;
+            fprintf(stderr, "ERROR: Unable to allocate the checksum table.\n");
+            ret = d_failure;
         }
-        
-        if (decode_byte_from_lsb(&ch, imageBuffer) == d_failure)
+        else if (file_size > 0 &&
+                 parallel_extract(fileno(decInfo->fptr_stego_image), fileno(decInfo->fptr_output), &decInfo->layout,
+                                  decInfo->carrier_off, file_size, depth, STEG_CHUNK_SIZE, decInfo->threads,
+                                  crcs) != e_success)
+            ret = d_failure;
+        else if (count)
         {
-            fprintf(stderr, "ERROR: Failed to decode byte %ld.\n", i);
-            fclose(decInfo->fptr_output);
-            return d_failure;
+            // The checksum table follows the payload region
+            decInfo->carrier_off += lsb_carrier_bytes((size_t)file_size, depth);
+            if (carrier_seek(&decInfo->carrier, bmp_file_offset(&decInfo->layout, decInfo->carrier_off)) != e_success)
+            {
+                fprintf(stderr, "ERROR: Unable to seek to the payload checksums.\n");
+                ret = d_failure;
+            }
+            else
+                ret = check_crc_table(decInfo, crcs, count, 0);
+        }
+        free(crcs);
+        acc = NULL;
+    }
+    else if (file_size >= (off_t)(2 * block) && stream_seekable(decInfo->fptr_stego_image) &&
+             stream_seekable(decInfo->fptr_output) && (q = ioq_open()) != NULL)
+    {
+        // Between regular files, reading the next windows and writing the output overlap the extraction
+        ret = decode_pipelined(decInfo, q, file_size, depth, block, acc);
+        opstats_queue(decInfo->stats, q);
+        ioq_close(q);
+    }
+    else
+    {
+        // Decode and write the secret data a block at a time
+        char *data_buf = malloc(block);
+        if (!data_buf)
+        {
+            fprintf(stderr, "ERROR: Unable to allocate decode buffers.\n");
+            ret = d_failure;
         }
-        
-        if (fputc(ch, decInfo->fptr_output) == EOF)
+
+        for (off_t i = 0; data_buf && i < file_size; )
         {
-            fprintf(stderr, "ERROR: Failed to write byte %ld to output file.\n", i);
-            fclose(decInfo->fptr_output);
-            return d_failure;
+            size_t n = (size_t)(file_size - i) < block ? (size_t)(file_size - i) : block;
+
+            if (decode_payload(decInfo, data_buf, n, 0, depth, acc) != d_success)
+            {
+                fprintf(stderr, "ERROR: Failed to read image data for secret file content at byte %lld.\n", (long long)i);
+                ret = d_failure;
+                break;
+            }
+
+            if (fwrite(data_buf, 1, n, decInfo->fptr_output) != n)
+            {
+                fprintf(stderr, "ERROR: Failed to write byte %lld to output file.\n", (long long)i);
+                ret = d_failure;
+                break;
+            }
+            i += (off_t)n;
         }
+        free(data_buf);
     }
 
-    fclose(decInfo->fptr_output);
-    printf("Secret file successfully decoded and saved as '%s'\n", output_fname_final);
-    return d_success;
+    // The tag sits between the stored bytes and the checksum table
+    if (ret == d_success && sealed)
+        ret = check_tag(decInfo);
+    if (ret == d_success && acc)
+        ret = check_crc_chunks(decInfo, acc);
+    crc_chunks_free(&crc);
+    close_stream(decInfo->fptr_output);
+
+    // Plaintext that did not authenticate is not left behind
+    if (ret != d_success && sealed && !is_stdio_name(output_fname_final))
+        unlink(output_fname_final);
+    if (ret == d_success)
+        LOG_INFO("Secret file successfully decoded and saved as '%s'\n", output_fname_final);
+    return ret;
 }
 
-/* Full decoding workflow */
-Status_d do_decoding(DecodeInfo *decInfo)
+/* Full decoding workflow over a memory-mapped stego image */
+Status_d do_decoding_mmap(DecodeInfo *decInfo)
+{
+    if (is_stdio_name(decInfo->stego_image_fname) || is_stdio_name(decInfo->output_fname))
+    {
+        fprintf(stderr, "ERROR: --mmap and scattered images need regular files, not stdin/stdout\n");
+        return d_failure;
+    }
+
+    if (open_decode_files(decInfo) != d_success)
+    {
+        fprintf(stderr, "ERROR: Opening stego image failed\n");
+        return d_failure;
+    }
+
+    MappedFile stego, output;
+    if (map_file_read(decInfo->fptr_stego_image, &stego) != e_success)
+    {
+        close_stream(decInfo->fptr_stego_image);
+        return d_failure;
+    }
+    LOG_INFO("Stego image mapped (%zu bytes).\n", stego.len);
+    opstats_io(decInfo->stats, "mmap");
+    if (decInfo->stats)
+        decInfo->stats->image_bytes = stego.len;
+    opstats_phase(decInfo->stats, "map_files");
+
+    Status_d ret = d_failure;
+    StegHeader hdr;
+    size_t out_len;
+    char output_fname_final[STEG_PATH_MAX + 16];
+
+    StegStatus status = steg_read_header_key((const unsigned char *)stego.addr, stego.len,
+                                             decInfo->has_key ? decInfo->key : NULL, &hdr);
+    if (status != steg_ok)
+    {
+        fprintf(stderr, "ERROR: %s\n", steg_strerror(status));
+        goto out;
+    }
+    if (hdr.flags & STEG_F_CONTAINER)
+    {
+        fprintf(stderr, "ERROR: Image holds a container; extract one entry with --entry NAME (list them with -l).\n");
+        goto out;
+    }
+    if (hdr.flags & STEG_F_SHARD)
+    {
+        fprintf(stderr, "ERROR: Image holds one shard of a split payload; reassemble it with --join.\n");
+        goto out;
+    }
+    if ((hdr.flags & STEG_F_ENCRYPTED) && (!decInfo->has_key || decInfo->has_range))
+    {
+        fprintf(stderr, "ERROR: %s\n", decInfo->has_key ? "An encrypted payload only authenticates as a whole (no --offset/--length)"
+                                                          : "Payload is encrypted; give its key with --key FILE");
+        goto out;
+    }
+    strcpy(decInfo->extn_secret_file, hdr.extn);
+    decInfo->size_secret_file = hdr.payload_len;
+    opstats_phase(decInfo->stats, "decode_header");
+    LOG_INFO("Extension decoded: %s\n", decInfo->extn_secret_file);
+    LOG_INFO("Secret file size decoded: %zu bytes\n", hdr.payload_len);
+
+    // A byte range only needs that part of the output
+    size_t out_size = hdr.payload_len;
+    if (decInfo->has_range)
+    {
+        if ((hdr.flags & STEG_F_FRAMED) || decInfo->range_offset > hdr.payload_len)
+        {
+            fprintf(stderr, "ERROR: %s\n", (hdr.flags & STEG_F_FRAMED) ? "--offset/--length need an uncompressed payload of known size"
+                                                                     : "offset is past the end of the payload");
+            goto out;
+        }
+        out_size = hdr.payload_len - (size_t)decInfo->range_offset;
+        if (decInfo->range_length > 0 && decInfo->range_length < out_size)
+            out_size = (size_t)decInfo->range_length;
+    }
+
+    if (build_output_fname(decInfo, output_fname_final, sizeof(output_fname_final)) != d_success)
+        goto out;
+
+    decInfo->fptr_output = fopen(output_fname_final, "w+b");
+    if (decInfo->fptr_output == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open output file for writing: %s\n", output_fname_final);
+        goto out;
+    }
+
+    // Extract straight into the mapped output file
+    if (map_file_write(decInfo->fptr_output, out_size, &output) == e_success)
+    {
+        if (decInfo->has_range)
+            status = steg_decode_range((const unsigned char *)stego.addr, stego.len, decInfo->range_offset,
+                                       out_size, (unsigned char *)output.addr, output.len, &out_len, NULL);
+        else
+            status = steg_decrypt_buffer((const unsigned char *)stego.addr, stego.len,
+                                         decInfo->has_key ? decInfo->key : NULL,
+                                         (unsigned char *)output.addr, output.len, &out_len, NULL);
+        unmap_file(&output);
+        opstats_phase(decInfo->stats, "decode_secret_file_data");
+        if (status == steg_ok)
+        {
+            ret = d_success;
+            if (decInfo->stats)
+                decInfo->stats->payload_bytes = out_len;
+        }
+        else
+            fprintf(stderr, "ERROR: %s\n", steg_strerror(status));
+    }
+    close_stream(decInfo->fptr_output);
+    if (ret != d_success && (hdr.flags & STEG_F_ENCRYPTED))
+        unlink(output_fname_final);
+
+    if (ret == d_success)
+    {
+        LOG_INFO("Secret file successfully decoded and saved as '%s'\n", output_fname_final);
+        LOG_INFO("Decoding completed successfully!\n");
+    }
+
+out:
+    unmap_file(&stego);
+    close_stream(decInfo->fptr_stego_image);
+    opstats_phase(decInfo->stats, "close_files");
+    return ret;
+}
+
+Status_d do_probe(DecodeInfo *decInfo, int *found)
+{
+    const char *fname = decInfo->stego_image_fname;
+    unsigned char first[STEG_INFO_READ];
+    unsigned char *buf = first;
+    Status_d ret = d_failure;
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open stego image %s\n", fname);
+        return d_failure;
+    }
+
+    // One positioned read normally covers the header; a large bfOffBits or very narrow rows need a second
+    struct stat st;
+    ssize_t got = fstat(fd, &st) == 0 ? pread_upto(fd, first, sizeof(first), 0) : -1;
+    if (got >= BMP_HEADER_SIZE)
+    {
+        decInfo->image_len = (uint64_t)st.st_size;
+        uint64_t need = steg_header_length(first, (size_t)got, decInfo->image_len);
+        if (need > (uint64_t)got && got == (ssize_t)sizeof(first) && need <= STEG_PROBE_MAX &&
+            (buf = malloc((size_t)need)) != NULL)
+        {
+            memcpy(buf, first, (size_t)got);
+            ssize_t more = pread_upto(fd, buf + got, (size_t)need - (size_t)got, got);
+            got = more < 0 ? -1 : got + more;
+        }
+    }
+    close(fd);
+    if (buf == NULL || got < 0)
+    {
+        fprintf(stderr, "ERROR: Failed to read the header of %s\n", fname);
+        return d_failure;
+    }
+
+    // A plain image is an answer, not an error; a file that is no BMP at all is one
+    BmpLayout layout;
+    uint32_t word;
+    StegStatus status = steg_detect_layout(buf, (size_t)got, decInfo->image_len, &layout, &word);
+    *found = status == steg_ok;
+    if (status == steg_ok)
+        bmp_free(&layout);
+
+    // Run the stream decoder's header stages over the bytes in memory
+    decInfo->fptr_stego_image = status == steg_ok ? fmemopen(buf, (size_t)got, "rb") : NULL;
+    int extn_size;
+    char extn[10];
+    off_t file_size;
+    if (status == steg_err_no_payload)
+    {
+        printf("%s\tmagic=none\tno payload\n", fname);
+        ret = d_success;
+    }
+    else if (status != steg_ok && status != steg_err_corrupt)
+        fprintf(stderr, "ERROR: %s: %s\n", fname, steg_strerror(status));
+    else if (decInfo->fptr_stego_image == NULL || decode_magic_string(decInfo) != d_success ||
+             decode_secret_file_extn_size(decInfo, &extn_size) != d_success ||
+             decode_secret_file_extn(decInfo, extn, extn_size) != d_success ||
+             decode_secret_file_size(decInfo, &file_size) != d_success)
+        printf("%s\tmagic=ok\tstatus=corrupt\n", fname);
+    else
+    {
+        // For framed payloads the size field is the stored length (0 if it was not known up front)
+        printf("%s\tmagic=ok\tversion=%d\textn=%s\tsize=%lld\tdepth=%d\tflags=0x%04x\n", fname,
+               decInfo->version, decInfo->extn_secret_file, (long long)file_size, decInfo->depth, decInfo->flags);
+        ret = d_success;
+    }
+
+    close_stego(decInfo);
+    if (buf != first)
+        free(buf);
+    return ret;
+}
+
+/* One slice of the checksum chunks of an image, checked by one pool task */
+typedef struct
+{
+    const unsigned char *stego;
+    size_t stego_len;
+    size_t first;       // First chunk of the slice
+    size_t count;       // Chunks in the slice
+    size_t bad;         // Chunks that do not match their checksum
+    StegStatus status;
+} VerifySlice;
+
+static void verify_slice(void *arg)
+{
+    VerifySlice *slice = arg;
+    slice->bad = 0;
+    slice->status = steg_verify_buffer(slice->stego, slice->stego_len, slice->first, slice->count, &slice->bad, NULL);
+}
+
+Status_d do_verify(DecodeInfo *decInfo)
+{
+    const char *fname = decInfo->stego_image_fname;
+    MappedFile stego;
+    StegHeader hdr;
+    Status_d ret = d_failure;
+
+    if (is_stdio_name(fname))
+    {
+        fprintf(stderr, "ERROR: --verify needs a regular file, not stdin\n");
+        return d_failure;
+    }
+    if (open_decode_files(decInfo) != d_success)
+        return d_failure;
+    if (map_file_read(decInfo->fptr_stego_image, &stego) != e_success)
+    {
+        close_stego(decInfo);
+        return d_failure;
+    }
+
+    StegStatus status = steg_read_header((const unsigned char *)stego.addr, stego.len, &hdr);
+    if (status != steg_ok)
+    {
+        fprintf(stderr, "ERROR: %s: %s\n", fname, steg_strerror(status));
+        goto out;
+    }
+    if (!(hdr.flags & STEG_F_CRC))
+    {
+        fprintf(stderr, "ERROR: %s carries no checksums (encode with --crc).\n", fname);
+        goto out;
+    }
+
+    // Chunks are independent, so cut them into one slice per thread
+    size_t chunks = (size_t)steg_crc_count(hdr.stored_len);
+    int threads = decInfo->threads;
+    if (threads < 1)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    size_t nslices = chunks < (size_t)threads ? (chunks ? chunks : 1) : (size_t)threads;
+    size_t per = (chunks + nslices - 1) / nslices;
+
+    VerifySlice *slices = calloc(nslices, sizeof(*slices));
+    ThreadPool *pool = slices ? pool_create(threads) : NULL;
+    if (pool == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to start %d worker threads\n", threads);
+        free(slices);
+        goto out;
+    }
+    for (size_t i = 0; i < nslices; i++)
+    {
+        slices[i] = (VerifySlice){(const unsigned char *)stego.addr, stego.len, i * per, per, 0, steg_ok};
+        if (slices[i].first >= chunks)
+            slices[i].count = 0;
+        else if (slices[i].count > chunks - slices[i].first)
+            slices[i].count = chunks - slices[i].first;
+        if (slices[i].count > 0 && pool_submit(pool, verify_slice, &slices[i]) != e_success)
+            slices[i].status = steg_err_nomem;
+    }
+    pool_wait(pool);
+    pool_destroy(pool);
+
+    size_t bad = 0;
+    status = steg_ok;
+    for (size_t i = 0; i < nslices; i++)
+    {
+        bad += slices[i].bad;
+        if (slices[i].status != steg_ok && slices[i].status != steg_err_checksum)
+            status = slices[i].status;
+    }
+    free(slices);
+
+    if (status != steg_ok)
+        fprintf(stderr, "ERROR: %s: %s\n", fname, steg_strerror(status));
+    else if (bad > 0)
+        printf("%s\tcorrupt\tbad=%zu/%zu\n", fname, bad, chunks);
+    else
+    {
+        printf("%s\tok\tchunks=%zu\n", fname, chunks);
+        ret = d_success;
+    }
+
+out:
+    unmap_file(&stego);
+    close_stego(decInfo);
+    return ret;
+}
+
+/* Steps 1-5 of the stream workflow: open the image and decode every header field */
+static Status_d decode_header(DecodeInfo *decInfo, off_t *file_size)
 {
     // 1. Open stego image
     if (open_decode_files(decInfo) != d_success)
@@ -311,48 +1157,99 @@ Status_d do_decoding(DecodeInfo *decInfo)
         fprintf(stderr, "ERROR: Opening stego image failed\n");
         return d_failure;
     }
-    printf("Stego image opened successfully.\n");
+    LOG_INFO("Stego image opened successfully.\n");
+    opstats_phase(decInfo->stats, "open_files");
 
     // 2. Decode magic string
     if (decode_magic_string(decInfo) != d_success)
-    {
-        fclose(decInfo->fptr_stego_image);
         return d_failure;
-    }
 
     // 3. Decode extension size
     int extn_size;
     if (decode_secret_file_extn_size(decInfo, &extn_size) != d_success)
-    {
-        fclose(decInfo->fptr_stego_image);
-        return d_failure; 
-    }
-    
+        return d_failure;
+
     // 4. Decode extension string
     char extn[10];
     if (decode_secret_file_extn(decInfo, extn, extn_size) != d_success)
+        return d_failure;
+
+    // 5. Decode file size
+    return decode_secret_file_size(decInfo, file_size);
+}
+
+Status_d do_list(DecodeInfo *decInfo)
+{
+    off_t file_size;
+    unsigned char *toc = NULL;
+    uint32_t count;
+    Status_d ret = d_failure;
+
+    if (decode_header(decInfo, &file_size) == d_success)
     {
-        fclose(decInfo->fptr_stego_image);
-        return d_failure; 
+        if (!(decInfo->flags & STEG_F_CONTAINER))
+            fprintf(stderr, "ERROR: Image holds a single .%s payload, not a container.\n", decInfo->extn_secret_file);
+        else if (read_toc(decInfo, file_size, &toc, &count) == d_success)
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                ContainerEntry entry;
+                container_entry(toc, i, &entry);
+                printf("%s\t%llu\n", entry.name, (unsigned long long)entry.length);
+            }
+            free(toc);
+            ret = d_success;
+        }
     }
+    close_stego(decInfo);
+    return ret;
+}
 
-    // 5. Decode file size
-    long file_size;
-    if (decode_secret_file_size(decInfo, &file_size) != d_success)
+/* Full decoding workflow */
+Status_d do_decoding(DecodeInfo *decInfo)
+{
+    // Container entries are reached by seeking the stream, so they skip the mmap path
+    if (decInfo->use_mmap && decInfo->entry == NULL)
+        return do_decoding_mmap(decInfo);
+
+    off_t file_size;
+    if (decode_header(decInfo, &file_size) != d_success)
     {
-        fclose(decInfo->fptr_stego_image);
+        close_stego(decInfo);
         return d_failure;
     }
+    opstats_phase(decInfo->stats, "decode_header");
+    if (decInfo->stats)
+    {
+        uint64_t image_len = stream_size(decInfo->fptr_stego_image);
+        decInfo->stats->image_bytes = image_len == UINT64_MAX ? 0 : image_len;
+    }
 
-    // 6. Decode secret data
-    if (decode_secret_file_data(decInfo, file_size) != d_success)
+    if (decInfo->flags & STEG_F_SHARD)
     {
-        fclose(decInfo->fptr_stego_image);
+        fprintf(stderr, "ERROR: Image holds one shard of a split payload; reassemble it with --join.\n");
+        close_stego(decInfo);
         return d_failure;
     }
 
+    // A scattered payload is not a sequential run, so it is read from a mapping of the whole image
+    if (decInfo->flags & STEG_F_SCATTER)
+    {
+        close_stego(decInfo);
+        return do_decoding_mmap(decInfo);
+    }
+
+    // 6. Decode secret data
+    Status_d ret = decode_secret_file_data(decInfo, file_size);
+    opstats_phase(decInfo->stats, "decode_secret_file_data");
+    if (decInfo->stats && ret == d_success)
+        decInfo->stats->payload_bytes = decInfo->size_secret_file;
+
     // The decode_secret_file_data closes the output file.
-    fclose(decInfo->fptr_stego_image);
-    printf("Decoding completed successfully!\n");
+    close_stego(decInfo);
+    opstats_phase(decInfo->stats, "close_files");
+    if (ret != d_success)
+        return d_failure;
+    LOG_INFO("Decoding completed successfully!\n");
     return d_success;
-}
\ No newline at end of file
+}
@@ -1,24 +1,51 @@
 #ifndef DECODE_H
 #define DECODE_H
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include "types.h"
 #include "common.h" // Added to ensure MAGIC_STRING is available if needed
+#include "bmp.h"
+#include "carrier_io.h"
+#include "aead.h"
+#include "opstats.h"
 
 /* Structure to store decoding information */
 typedef struct _DecodeInfo
 {
     /* File names */
-    char stego_image_fname[50];
-    char output_fname[50];
+    char stego_image_fname[STEG_PATH_MAX];
+    char output_fname[STEG_PATH_MAX];
 
     /* File pointers */
     FILE *fptr_stego_image;
     FILE *fptr_output;
 
+    /* Carrier layout, found by decode_magic_string */
+    BmpLayout layout;
+    CarrierStream carrier;
+    uint64_t carrier_off;      // Logical carrier offset of the next header field or payload byte
+    uint64_t image_len;        // Stego image size when its header is decoded from a buffer (0: ask the stream)
+
     /* Decoded data */
     char extn_secret_file[10]; // Increased size for flexibility
-    uint size_secret_file;
+    uint64_t size_secret_file;
     char magic_string[10];
+    int version;               // Stego format version (1 or 2)
+    uint flags;                // v2 feature flags from the extension word
+    int depth;                 // LSBs per carrier byte used by the payload
+
+    /* Options */
+    int use_mmap;              // Extract directly from a memory-mapped stego image
+    int threads;               // Worker threads for the payload region (<= 1 = single-threaded)
+    OpStats *stats;            // --stats: phase timings and I/O path of this decode (NULL = off)
+    const char *entry;         // Container entry to extract (--entry NAME)
+    int has_range;             // Extract only payload bytes [range_offset, range_offset + range_length)
+    uint64_t range_offset;     // --offset
+    uint64_t range_length;     // --length (0 = to the end of the payload)
+    int has_key;               // --key was given
+    unsigned char key[AEAD_KEY_LEN];
+    Aead aead;                 // Opening state of an encrypted payload
 
 } DecodeInfo;
 
@@ -33,19 +60,29 @@ Status_d open_decode_files(DecodeInfo *decInfo);
 /* Perform the decoding process */
 Status_d do_decoding(DecodeInfo *decInfo);
 
+/* List the entries of a container image */
+Status_d do_list(DecodeInfo *decInfo);
+
+/*
+ * Print a one-line summary of the embedded header, reading only the header region.
+ * A readable image without a payload succeeds with *found = 0.
+ */
+Status_d do_probe(DecodeInfo *decInfo, int *found);
+
+/* Check every payload checksum of a --crc image on a thread pool, writing nothing */
+Status_d do_verify(DecodeInfo *decInfo);
+
+/* Perform the decoding on memory-mapped files */
+Status_d do_decoding_mmap(DecodeInfo *decInfo);
+
+/* Build the output file name, appending the decoded extension if needed */
+Status_d build_output_fname(DecodeInfo *decInfo, char *fname, size_t size);
+
 /* Decode operations */
 Status_d decode_magic_string(DecodeInfo *decInfo);
 Status_d decode_secret_file_extn_size(DecodeInfo *decInfo, int *extn_size);
 Status_d decode_secret_file_extn(DecodeInfo *decInfo, char *extn, int extn_size);
-Status_d decode_secret_file_size(DecodeInfo *decInfo, long *file_size);
-Status_d decode_secret_file_data(DecodeInfo *decInfo, long file_size);
-
-/* Helper decode functions */
-Status_d decode_byte_from_lsb(char *data, char *image_buffer);
-Status_d decode_size_from_lsb(int *size, char *image_buffer);
-
-/* (Optional) You can add more helpers if needed later */
-Status_d decode_int_from_lsb(int *value, char *image_buffer);
-Status_d decode_data_from_image(char *data, int size, FILE *fptr_stego_image);
+Status_d decode_secret_file_size(DecodeInfo *decInfo, off_t *file_size);
+Status_d decode_secret_file_data(DecodeInfo *decInfo, off_t file_size);
 
 #endif
\ No newline at end of file
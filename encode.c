@@ -3,75 +3,67 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <sys/stat.h>
 #include "encode.h"
+#include "mmap_io.h"
+#include "lsb_kernels.h"
+#include "parallel.h"
+#include "pio.h"
+#include "steg.h"
+#include "format.h"
+#include "lz.h"
+#include "container.h"
+#include "shard.h"
+#include "pipeline.h"
 #include "types.h"
+#include "log.h"
+#include "common.h"
 
-#define MAGIC_STRING "#*"   // Define a proper magic string
 #define MAX_FILE_NAME 256
 #define MAX_EXTN_SIZE 8
 
-/* Read file size using fseek/ftell */
-uint get_image_size_for_bmp(FILE *fptr_image)
+off_t get_file_size(FILE *fptr)
 {
-    uint32_t width = 0, height = 0;
-
-    // Seek to 18th byte (width is stored at offset 18 in little-endian BMP)
-    fseek(fptr_image, 18, SEEK_SET);
-
-    // Read the width (an int)
-    fread(&width, sizeof(uint32_t), 1, fptr_image);
-
-    // Read the height (an int)
-    fread(&height, sizeof(uint32_t), 1, fptr_image);
-
-    // Return image capacity (3 bytes per pixel for 24-bit BMP)
-    uint64_t bytes_capacity = (uint64_t)width * (uint64_t)height * 3ULL;
-    return (uint)bytes_capacity;
-}
-
-uint get_file_size(FILE *fptr)
-{
-    uint size = 0;
-    long cur_pos = ftell(fptr);
-    if (cur_pos == -1L)
+    off_t size = 0;
+    off_t cur_pos = ftello(fptr);
+    if (cur_pos == -1)
         cur_pos = 0;
 
     // Move to end, tell, then restore
-    fseek(fptr, 0, SEEK_END);
-    long sz = ftell(fptr);
-    if (sz == -1L)
-        size = 0;
-    else
-        size = (uint)sz;
+    fseeko(fptr, 0, SEEK_END);
+    off_t sz = ftello(fptr);
+    if (sz != -1)
+        size = sz;
 
-    fseek(fptr, cur_pos, SEEK_SET);
+    fseeko(fptr, cur_pos, SEEK_SET);
     return size;
 }
 
 /* Validate and read arguments */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
-    printf("INFO: Checking source image extension\n");
-    if (strcmp(strstr(argv[2], ".bmp"), ".bmp") != 0)
+    LOG_INFO("INFO: Checking source image extension\n");
+    const char *bmp_ext = strstr(argv[2], ".bmp");
+    if (!is_stdio_name(argv[2]) && (bmp_ext == NULL || strcmp(bmp_ext, ".bmp") != 0))
     {
-        printf("ERROR: Source image file must be .bmp\n");
+        fprintf(stderr, "ERROR: Source image file must be .bmp\n");
         return e_failure;
     }
-    printf("SUCCESS: Valid extension\n");
+    LOG_INFO("SUCCESS: Valid extension\n");
     encInfo->src_image_fname = argv[2];
 
-    printf("INFO: Checking for secret message file\n");
+    LOG_INFO("INFO: Checking for secret message file\n");
     if (argv[3] != NULL)
         encInfo->secret_fname = argv[3];
     else
     {
-        printf("ERROR: Secret file not provided\n");
+        fprintf(stderr, "ERROR: Secret file not provided\n");
         return e_failure;
     }
-    printf("SUCCESS: Secret message found\n");
+    LOG_INFO("SUCCESS: Secret message found\n");
 
     // Extract secret file extension
-    printf("INFO: Extracting secret file extension\n");
+    LOG_INFO("INFO: Extracting secret file extension\n");
     const char *secret_fname = encInfo->secret_fname;
     const char *dot = strrchr(secret_fname, '.');
     
@@ -81,13 +73,13 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
         // Copy the extension (starting after the dot)
         strncpy(encInfo->extn_secret_file, dot + 1, sizeof(encInfo->extn_secret_file) - 1); 
         encInfo->extn_secret_file[sizeof(encInfo->extn_secret_file) - 1] = '\0';
-        printf("SUCCESS: Secret file extension verified as .%s\n", encInfo->extn_secret_file);
+        LOG_INFO("SUCCESS: Secret file extension verified as .%s\n", encInfo->extn_secret_file);
     }
     else
     {
         // If no dot or dot is the first character, use an empty string as the extension.
         encInfo->extn_secret_file[0] = '\0';
-        printf("INFO: Secret file has no extension or is a dotfile (using empty extension).\n");
+        LOG_INFO("INFO: Secret file has no extension or is a dotfile (using empty extension).\n");
         // Removed the previous ERROR and return e_failure. This allows files without extensions.
     }
 
@@ -100,9 +92,62 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     return e_success;
 }
 
+Status read_and_validate_container_args(int argc, char *argv[], EncodeInfo *encInfo)
+{
+    const char *bmp_ext = strstr(argv[2], ".bmp");
+    if (!is_stdio_name(argv[2]) && (bmp_ext == NULL || strcmp(bmp_ext, ".bmp") != 0))
+    {
+        fprintf(stderr, "ERROR: Source image file must be .bmp\n");
+        return e_failure;
+    }
+    if (argc < 5)
+    {
+        fprintf(stderr, "ERROR: No container entries given\n");
+        return e_failure;
+    }
+
+    // The first entry stands in as the secret file for open_files; the table lists them all
+    encInfo->src_image_fname = argv[2];
+    encInfo->stego_image_fname = argv[3];
+    encInfo->secret_fname = argv[4];
+    encInfo->entry_fnames = argv + 4;
+    encInfo->nentries = argc - 4;
+    return e_success;
+}
+
 Status open_files(EncodeInfo *encInfo)
 {
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb");
+    // Scattered payloads are written out of order, so they go through the mapped library path
+    if (encInfo->scatter && !encInfo->encrypt)
+    {
+        fprintf(stderr, "ERROR: --scatter needs --key (the key seeds the block permutation)\n");
+        return e_failure;
+    }
+    if (encInfo->scatter)
+        encInfo->use_mmap = 1;
+
+    // In place, the carrier is opened read/write and also stands in as the stego image
+    if (encInfo->same_size)
+        encInfo->in_place = 1;
+    if (encInfo->in_place && (encInfo->use_mmap || is_stdio_name(encInfo->src_image_fname)))
+    {
+        fprintf(stderr, "ERROR: --in-place updates a regular carrier file through stdio (no --mmap, --scatter or stdin)\n");
+        return e_failure;
+    }
+
+    if (is_stdio_name(encInfo->src_image_fname) && is_stdio_name(encInfo->secret_fname))
+    {
+        fprintf(stderr, "ERROR: Only one of the source image and secret file can be read from stdin\n");
+        return e_failure;
+    }
+    if (encInfo->use_mmap && (is_stdio_name(encInfo->src_image_fname) || is_stdio_name(encInfo->secret_fname) ||
+                              is_stdio_name(encInfo->stego_image_fname)))
+    {
+        fprintf(stderr, "ERROR: --mmap and --scatter need regular files, not stdin/stdout\n");
+        return e_failure;
+    }
+
+    encInfo->fptr_src_image = open_stream(encInfo->src_image_fname, encInfo->in_place ? "r+b" : "rb");
     if (encInfo->fptr_src_image == NULL)
     {
         perror("fopen");
@@ -110,35 +155,161 @@ Status open_files(EncodeInfo *encInfo)
         return e_failure;
     }
 
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "rb");
+    encInfo->fptr_secret = open_stream(encInfo->secret_fname, "rb");
     if (encInfo->fptr_secret == NULL)
     {
         perror("fopen");
         fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
-        fclose(encInfo->fptr_src_image);
+        close_stream(encInfo->fptr_src_image);
         return e_failure;
     }
 
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "wb");
+    // The mmap path maps the stego file shared, which needs read/write access
+    if (encInfo->in_place)
+        encInfo->fptr_stego_image = encInfo->fptr_src_image;
+    else
+        encInfo->fptr_stego_image = open_stream(encInfo->stego_image_fname, encInfo->use_mmap ? "w+b" : "wb");
     if (encInfo->fptr_stego_image == NULL)
     {
         perror("fopen");
         fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
-        fclose(encInfo->fptr_src_image);
-        fclose(encInfo->fptr_secret);
+        close_stream(encInfo->fptr_src_image);
+        close_stream(encInfo->fptr_secret);
+        return e_failure;
+    }
+
+    // Read the BMP header up front so a piped carrier never has to seek back for it
+    if (fread(encInfo->bmp_header, 1, BMP_HEADER_SIZE, encInfo->fptr_src_image) != BMP_HEADER_SIZE)
+    {
+        fprintf(stderr, "ERROR: Unable to read BMP header\n");
+        close_files(encInfo);
         return e_failure;
     }
 
     return e_success;
 }
 
+/* Size the entries of a container and build its table of contents */
+static Status plan_container(EncodeInfo *encInfo)
+{
+    if (encInfo->compress || encInfo->use_mmap || encInfo->encrypt)
+    {
+        fprintf(stderr, "ERROR: Containers are stored uncompressed and unencrypted through stdio (no -z, --mmap or --key)\n");
+        return e_failure;
+    }
+
+    ContainerEntry *entries = calloc((size_t)encInfo->nentries, sizeof(*entries));
+    encInfo->entry_sizes = calloc((size_t)encInfo->nentries, sizeof(*encInfo->entry_sizes));
+    if (!entries || !encInfo->entry_sizes)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate the table of contents.\n");
+        free(entries);
+        return e_failure;
+    }
+
+    // Entries are named by their base name, laid out back to back after the table
+    Status ret = e_success;
+    uint64_t offset = 0;
+    for (int i = 0; i < encInfo->nentries && ret == e_success; i++)
+    {
+        const char *fname = encInfo->entry_fnames[i];
+        const char *base = strrchr(fname, '/') ? strrchr(fname, '/') + 1 : fname;
+        struct stat st;
+
+        ret = e_failure;
+        if (is_stdio_name(fname) || stat(fname, &st) != 0 || !S_ISREG(st.st_mode))
+            fprintf(stderr, "ERROR: Container entry %s is not a regular file\n", fname);
+        else if (strlen(base) == 0 || strlen(base) > CONTAINER_NAME_MAX)
+            fprintf(stderr, "ERROR: Container entry name %s is empty or too long\n", base);
+        else
+        {
+            ret = e_success;
+            for (int j = 0; j < i; j++)
+            {
+                if (strcmp(entries[j].name, base) == 0)
+                {
+                    fprintf(stderr, "ERROR: Duplicate container entry name %s\n", base);
+                    ret = e_failure;
+                }
+            }
+        }
+        if (ret != e_success)
+            break;
+
+        strcpy(entries[i].name, base);
+        entries[i].offset = offset;
+        entries[i].length = (uint64_t)st.st_size;
+        encInfo->entry_sizes[i] = (uint64_t)st.st_size;
+        offset += (uint64_t)st.st_size;
+    }
+
+    if (ret == e_success)
+    {
+        encInfo->toc_len = container_toc_size(entries, (uint32_t)encInfo->nentries);
+        encInfo->toc = malloc(encInfo->toc_len);
+        if (encInfo->toc == NULL)
+            ret = e_failure;
+        else
+            container_write_toc(entries, (uint32_t)encInfo->nentries, encInfo->toc);
+    }
+    free(entries);
+    if (ret != e_success)
+        return e_failure;
+
+    // The table and entries form one plain payload; entry names replace the extension
+    encInfo->size_secret_file = (off_t)(encInfo->toc_len + offset);
+    encInfo->extn_secret_file[0] = '\0';
+    encInfo->chunked = 0;
+    encInfo->threads = 1;
+    LOG_INFO("Container: %d entries, %llu bytes with the table of contents\n", encInfo->nentries,
+             (unsigned long long)encInfo->size_secret_file);
+    return e_success;
+}
+
 Status check_capacity(EncodeInfo *encInfo)
 {
     if (!encInfo || !encInfo->fptr_src_image || !encInfo->fptr_secret)
         return e_failure;
 
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    // Index the pixel spans once: bfOffBits, row padding, top-down rows and 32-bpp alpha
+    uint64_t file_len = stream_size(encInfo->fptr_src_image);
+    StegEncodeOptions layout_opts = {0};
+    layout_opts.skip_alpha = encInfo->skip_alpha;
+    bmp_free(&encInfo->layout);
+    if (steg_carrier_layout(encInfo->bmp_header, BMP_HEADER_SIZE, file_len, &layout_opts, &encInfo->layout) != steg_ok)
+    {
+        fprintf(stderr, "ERROR: Unsupported BMP image%s\n", encInfo->skip_alpha ? " (--skip-alpha needs 32 bits per pixel)" : "");
+        return e_failure;
+    }
+    encInfo->image_capacity = encInfo->layout.capacity;
+
+    // A piped secret has no size yet; it is embedded as a chunked stream instead
+    if (is_stdio_name(encInfo->secret_fname) || !stream_seekable(encInfo->fptr_secret))
+    {
+        encInfo->size_secret_file = 0;
+        encInfo->chunked = 1;
+    }
+    else
+        encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+
+    // Compressed sizes are patched in afterwards, which needs a seekable carrier and output
+    if (encInfo->compress && !(stream_seekable(encInfo->fptr_src_image) && stream_seekable(encInfo->fptr_stego_image)))
+        encInfo->chunked = 1;
+
+    // A framed payload only finds out it does not fit while embedding, and in place that
+    // would leave the old payload half overwritten; its size has to be checked before any write
+    if (encInfo->in_place && (encInfo->compress || encInfo->chunked))
+    {
+        fprintf(stderr, "ERROR: --in-place and --same-size need the payload size up front (no -z or piped secret)\n");
+        return e_failure;
+    }
+
+    // Worker threads use pread/pwrite, so every stream has to be a regular file;
+    // sealing is one MAC over the whole stream, so it runs on this thread;
+    // in place, only this thread's carrier stream knows which blocks changed
+    if (encInfo->threads > 1 && (encInfo->encrypt || encInfo->in_place || !(stream_seekable(encInfo->fptr_src_image) && stream_seekable(encInfo->fptr_secret) &&
+                                  stream_seekable(encInfo->fptr_stego_image))))
+        encInfo->threads = 1;
 
     const char *secret = encInfo->secret_fname;
     const char *dot = strrchr(secret, '.');
@@ -154,210 +325,716 @@ Status check_capacity(EncodeInfo *encInfo)
         encInfo->extn_secret_file[0] = '\0';
     }
 
+    if (encInfo->nentries > 0 && plan_container(encInfo) != e_success)
+        return e_failure;
+
+    // A shard is its header plus a slice read straight out of the secret file
+    if (encInfo->shard_hdr)
+    {
+        if (encInfo->chunked || encInfo->compress || encInfo->use_mmap ||
+            encInfo->slice_offset + encInfo->slice_len > (uint64_t)encInfo->size_secret_file)
+        {
+            fprintf(stderr, "ERROR: Shards are uncompressed slices of a regular file (no -z, --mmap or pipes)\n");
+            return e_failure;
+        }
+        encInfo->size_secret_file = (off_t)(SHARD_HEADER_LEN + encInfo->slice_len);
+        encInfo->threads = 1;
+    }
+
     uint magic_bits = strlen(MAGIC_STRING) * 8;
     // Calculate required bits based on the *actual* determined extension length
     uint extn_len = strlen(encInfo->extn_secret_file); 
     
-    // Required bits: Magic (16) + Extn Size (32) + Extn Data (Extn Len * 8) + File Size (32) + File Data (File Size * 8)
-    uint64_t required_bits = (uint64_t)magic_bits + 32 + (uint64_t)(extn_len * 8) + 32 + (uint64_t)encInfo->size_secret_file * 8;
+    if (encInfo->depth == 0)
+        encInfo->depth = 1;
+    if (!steg_valid_depth(encInfo->depth))
+    {
+        fprintf(stderr, "ERROR: Unsupported LSB depth %d (use 1, 2 or 4)\n", encInfo->depth);
+        return e_failure;
+    }
+
+    // A framed payload's size is only known while embedding; up front, require room for the end frame
+    uint64_t data_bytes = (encInfo->compress || encInfo->chunked) ? LZ_FRAME_HEADER : (uint64_t)encInfo->size_secret_file;
+    uint32_t trailer_flags = (encInfo->crc ? STEG_F_CRC : 0) | (encInfo->encrypt ? STEG_F_ENCRYPTED : 0);
+    data_bytes += steg_nonce_len(trailer_flags) + steg_trailer_len(data_bytes, trailer_flags);
 
-    // Check if image capacity (in bytes) is sufficient for required bits (in bytes)
-    // Note: Capacity is in bytes (3 bytes per pixel * W * H), required_bits is in bits.
-    // The image capacity is the *total number of LSBs available*, which is equal to the byte count.
-    if (encInfo->image_capacity >= (required_bits / 8.0) + 1) // Required bits / 8 + 1 for safety margin
+    // Sizes past the 32-bit field (allowing for frame headers when compressing) need the 64-bit field
+    uint64_t max_stored = (uint64_t)encInfo->size_secret_file;
+    if (encInfo->compress)
+        max_stored += (max_stored / LZ_BLOCK_SIZE + 2) * LZ_FRAME_HEADER;
+    encInfo->size64 = !encInfo->chunked && max_stored > STEG_SIZE32_MAX;
+    if (encInfo->encrypt && !encInfo->chunked && max_stored > STEG_SEALED_MAX)
+    {
+        fprintf(stderr, "ERROR: Payloads over %llu bytes cannot be sealed under one nonce\n",
+                (unsigned long long)STEG_SEALED_MAX);
+        return e_failure;
+    }
+    uint size_bits = encInfo->size64 ? 64 : 32;
+
+    // Required bits: Magic (16) + Extn Size (32) + Extn Data (Extn Len * 8) + File Size (32 or 64)
+    // + File Data (File Size * 8, spread over File Size * 8 / depth carrier bytes)
+    uint64_t required_bits = (uint64_t)magic_bits + 32 + (uint64_t)(extn_len * 8) + size_bits +
+                             data_bytes * (8 / encInfo->depth);
+
+    // Each carrier byte holds one LSB, so the image needs one byte per required bit
+    if (encInfo->image_capacity >= required_bits)
+    {
+        crc_chunks_init(&encInfo->crcs, STEG_CRC_CHUNK);
+        carrier_open(&encInfo->carrier, encInfo->fptr_src_image, encInfo->fptr_stego_image, &encInfo->layout,
+                     BMP_HEADER_SIZE, NULL, 0);
+        encInfo->carrier_off = 0;
         return e_success;
+    }
 
-    fprintf(stderr, "ERROR: Insufficient image capacity. Image capacity (bytes): %u, Required (bytes): %lu\n",
-            encInfo->image_capacity, (unsigned long)(required_bits / 8.0) + 1);
+    fprintf(stderr, "ERROR: Insufficient image capacity. Image capacity (bytes): %llu, Required (bytes): %llu\n",
+            (unsigned long long)encInfo->image_capacity, (unsigned long long)required_bits);
     return e_failure;
 }
 
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+uint header_flags(const EncodeInfo *encInfo)
 {
-    if (!fptr_src_image || !fptr_dest_image)
-        return e_failure;
+    uint flags = 0;
+    if (encInfo->depth > 1)
+        flags |= (uint)(encInfo->depth - 1);
+    if (encInfo->compress)
+        flags |= STEG_F_COMPRESSED;
+    if (encInfo->chunked)
+        flags |= STEG_F_CHUNKED;
+    if (encInfo->size64)
+        flags |= STEG_F_SIZE64;
+    if (encInfo->nentries > 0)
+        flags |= STEG_F_CONTAINER;
+    if (encInfo->crc)
+        flags |= STEG_F_CRC;
+    if (encInfo->encrypt)
+        flags |= STEG_F_ENCRYPTED;
+    if (encInfo->shard_hdr)
+        flags |= STEG_F_SHARD;
+    return flags | steg_layout_flags(&encInfo->layout);
+}
 
-    rewind(fptr_src_image);
-    unsigned char header[54];
-    size_t read = fread(header, 1, 54, fptr_src_image);
-    if (read != 54)
+/* Embed len bytes at the current carrier offset and step past them */
+static Status embed_field(EncodeInfo *encInfo, const void *data, size_t len, int depth)
+{
+    if (carrier_embed(&encInfo->carrier, encInfo->carrier_off, data, len, depth) != e_success)
     {
-        fprintf(stderr, "ERROR: Unable to read BMP header\n");
+        fprintf(stderr, "ERROR: Could not embed %zu bytes at carrier byte %llu.\n", len,
+                (unsigned long long)encInfo->carrier_off);
         return e_failure;
     }
+    encInfo->carrier_off += lsb_carrier_bytes(len, depth);
+    return e_success;
+}
 
-    size_t written = fwrite(header, 1, 54, fptr_dest_image);
-    if (written != 54)
+/* 32-bit header value, most significant byte first */
+static Status embed_u32(EncodeInfo *encInfo, uint32_t value)
+{
+    unsigned char be[4] = {value >> 24, value >> 16, value >> 8, value};
+    return embed_field(encInfo, be, sizeof(be), 1);
+}
+
+/*
+ * Embed stored payload bytes: seal them in place (all but the first clear bytes) and
+ * fold them into the chunk checksums while they are cache-hot
+ */
+static Status embed_payload(EncodeInfo *encInfo, void *data, size_t len, size_t clear, int depth)
+{
+    if (encInfo->encrypt)
+        aead_seal(&encInfo->aead, data, len, clear);
+    if (encInfo->crc)
+        crc_chunks_update(&encInfo->crcs, data, len);
+    return embed_field(encInfo, data, len, depth);
+}
+
+/* Start the sealing stream and embed its nonce in front of the stored payload */
+static Status encode_nonce(EncodeInfo *encInfo, uint32_t extn_word)
+{
+    unsigned char aad[4 + sizeof(encInfo->extn_secret_file)];
+    size_t extn_len = strlen(encInfo->extn_secret_file);
+
+    if (random_bytes(encInfo->nonce, sizeof(encInfo->nonce)) != e_success)
     {
-        fprintf(stderr, "ERROR: Unable to write BMP header to dest\n");
+        fprintf(stderr, "ERROR: Unable to generate a nonce.\n");
         return e_failure;
     }
+    aead_init(&encInfo->aead, encInfo->key, encInfo->nonce, aad,
+              steg_header_aad(extn_word, encInfo->extn_secret_file, extn_len, aad));
+    return embed_field(encInfo, encInfo->nonce, sizeof(encInfo->nonce), encInfo->depth ? encInfo->depth : 1);
+}
 
-    return e_success;
+/* Embed the authentication tag right after the stored payload */
+static Status encode_tag(EncodeInfo *encInfo)
+{
+    unsigned char tag[AEAD_TAG_LEN];
+    aead_tag(&encInfo->aead, tag);
+    LOG_INFO("Payload sealed (chacha20 %s).\n", chacha20_impl());
+    return embed_field(encInfo, tag, sizeof(tag), encInfo->depth ? encInfo->depth : 1);
 }
 
-Status encode_byte_to_lsb(char data, char *image_buffer)
+/* Embed the checksum table right after the stored payload (and tag) */
+static Status encode_crc_table(EncodeInfo *encInfo)
 {
-    if (!image_buffer)
+    int depth = encInfo->depth ? encInfo->depth : 1;
+    CrcChunks *acc = &encInfo->crcs;
+    if (crc_chunks_finish(acc) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate the checksum table.\n");
         return e_failure;
+    }
 
-    for (int i = 0; i < 8; ++i)
+    unsigned char be[256 * 4];
+    for (size_t i = 0; i < acc->count; )
     {
-        image_buffer[i] &= 0xFE;
-        char bit = (data >> (7 - i)) & 0x01;
-        image_buffer[i] |= bit;
+        size_t n = acc->count - i < 256 ? acc->count - i : 256;
+        for (size_t k = 0; k < n; k++)
+        {
+            uint32_t c = acc->crcs[i + k];
+            be[4 * k] = c >> 24;
+            be[4 * k + 1] = c >> 16;
+            be[4 * k + 2] = c >> 8;
+            be[4 * k + 3] = c;
+        }
+        if (embed_field(encInfo, be, n * 4, depth) != e_success)
+            return e_failure;
+        i += n;
     }
+    LOG_INFO("Checksums encoded: %zu CRC32C (%s)\n", acc->count, crc32c_impl());
     return e_success;
 }
 
-Status encode_size_to_lsb(int size, char *imageBuffer)
+Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 {
-    if (!imageBuffer)
+    if (!magic_string || !encInfo)
         return e_failure;
 
-    for (int i = 0; i < 32; ++i)
+    return embed_field(encInfo, magic_string, strlen(magic_string), 1);
+}
+
+Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
+{
+    return embed_u32(encInfo, (uint32_t)size);
+}
+
+Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+{
+    return embed_field(encInfo, file_extn, strlen(file_extn), 1);
+}
+
+Status encode_secret_file_size(off_t file_size, EncodeInfo *encInfo)
+{
+    uint64_t size = (uint64_t)file_size;
+
+    // The 64-bit field is the high word followed by the low word
+    if (encInfo->size64 && embed_u32(encInfo, (uint32_t)(size >> 32)) != e_success)
+        return e_failure;
+    return embed_u32(encInfo, (uint32_t)size);
+}
+
+/* Embed the payload region on a thread pool with positional I/O */
+static Status encode_secret_file_data_parallel(EncodeInfo *encInfo, size_t chunk)
+{
+    off_t data_size = encInfo->size_secret_file;
+
+    // The header fields went out through stdio; flush them before switching to pwrite
+    if (fflush(encInfo->fptr_stego_image) != 0)
+    {
+        perror("fflush");
+        return e_failure;
+    }
+
+    if (data_size == 0)
+        return e_success;
+
+    // Each range checksums its own chunks into their slots of the table
+    uint32_t *crcs = NULL;
+    size_t count = (size_t)steg_crc_count((uint64_t)data_size);
+    if (encInfo->crc && (crcs = malloc(count * sizeof(*crcs))) == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate the checksum table.\n");
+        return e_failure;
+    }
+
+    uint64_t data_off = encInfo->carrier_off;
+    Status ret = parallel_embed(fileno(encInfo->fptr_secret), fileno(encInfo->fptr_src_image),
+                                fileno(encInfo->fptr_stego_image), &encInfo->layout, data_off, data_size,
+                                encInfo->depth, chunk, encInfo->threads, crcs);
+    if (crcs)
+    {
+        crc_chunks_free(&encInfo->crcs);
+        encInfo->crcs.crcs = crcs;
+        encInfo->crcs.count = encInfo->crcs.cap = count;
+    }
+    if (ret != e_success)
+        return e_failure;
+
+    // Resume both streams right after the window of the payload region
+    uint64_t span = lsb_carrier_bytes((size_t)data_size, encInfo->depth), data_start, data_end;
+    bmp_window(&encInfo->layout, data_off, span, &data_start, &data_end);
+    encInfo->carrier_off += span;
+    if (carrier_seek(&encInfo->carrier, data_end) != e_success)
     {
-        imageBuffer[i] &= 0xFE;
-        char bit = (size >> (31 - i)) & 0x01;
-        imageBuffer[i] |= bit;
+        fprintf(stderr, "ERROR: Unable to seek past the payload region.\n");
+        return e_failure;
     }
     return e_success;
 }
 
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+/* Payload bytes that fit after the header fields at the configured depth */
+static off_t payload_capacity(const EncodeInfo *encInfo)
 {
-    if (!magic_string || !encInfo)
+    off_t header = (off_t)(strlen(MAGIC_STRING) + strlen(encInfo->extn_secret_file)) * 8 + 32 +
+                   (encInfo->size64 ? 64 : 32);
+    off_t avail = (off_t)encInfo->image_capacity - header;
+    off_t room = avail > 0 ? avail / (off_t)lsb_carrier_bytes(1, encInfo->depth) : 0;
+    off_t nonce = encInfo->encrypt ? STEG_NONCE_LEN : 0;
+    return room > nonce ? room - nonce : 0;
+}
+
+/* Read the secret file frame by frame (compressing if asked) and embed each frame as it is produced */
+static Status encode_secret_file_data_framed(EncodeInfo *encInfo)
+{
+    int depth = encInfo->depth ? encInfo->depth : 1;
+    off_t capacity = payload_capacity(encInfo);
+    unsigned char *raw = malloc(LZ_BLOCK_SIZE);
+    unsigned char *frame = malloc(LZ_FRAME_MAX);
+    if (!raw || !frame)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate frame buffers.\n");
+        free(raw);
+        free(frame);
         return e_failure;
+    }
 
-    size_t len = strlen(magic_string);
-    char imageBuffer[8];
+    if (stream_seekable(encInfo->fptr_secret))
+        rewind(encInfo->fptr_secret);
 
-    for (size_t i = 0; i < len; ++i)
+    Status ret = e_success;
+    off_t stored = 0, total = 0;
+    for (;;)
     {
-        fread(imageBuffer, 1, 8, encInfo->fptr_src_image);
-        encode_byte_to_lsb(magic_string[i], imageBuffer);
-        fwrite(imageBuffer, 1, 8, encInfo->fptr_stego_image);
+        size_t n = fread(raw, 1, LZ_BLOCK_SIZE, encInfo->fptr_secret);
+        if (n == 0 && ferror(encInfo->fptr_secret))
+        {
+            fprintf(stderr, "ERROR: Could not read secret bytes after byte %lld.\n", (long long)total);
+            ret = e_failure;
+            break;
+        }
+
+        // An empty frame marks the end of the payload
+        size_t frame_len = LZ_FRAME_HEADER;
+        if (n > 0)
+            frame_len = encInfo->compress ? lz_encode_frame(raw, n, frame) : lz_store_frame(raw, n, frame);
+        else
+            lz_put_frame_header(frame, 0, 0);
+
+        off_t table = (off_t)steg_trailer_len((uint64_t)(stored + (off_t)frame_len), header_flags(encInfo));
+        if ((off_t)frame_len + table > capacity - stored)
+        {
+            fprintf(stderr, "ERROR: Insufficient image capacity for the payload after %lld bytes. "
+                            "Capacity (bytes): %lld\n", (long long)total, (long long)capacity);
+            ret = e_failure;
+            break;
+        }
+
+        // Frame headers stay readable so the stored length can be found without the key
+        if (embed_payload(encInfo, frame, frame_len, LZ_FRAME_HEADER, depth) != e_success)
+        {
+            ret = e_failure;
+            break;
+        }
+
+        stored += (off_t)frame_len;
+        total += (off_t)n;
+        if (n == 0)
+            break;
     }
 
+    free(raw);
+    free(frame);
+    if (ret != e_success)
+        return ret;
+
+    encInfo->size_secret_file = total;
+    encInfo->size_stored = stored;
+    if (encInfo->compress)
+        LOG_INFO("Compressed %lld bytes to %lld bytes.\n", (long long)total, (long long)stored);
     return e_success;
 }
 
-Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
+/* Go back and fill in the size field once the compressed length is known */
+static Status encode_stored_size(EncodeInfo *encInfo, uint64_t size_off)
 {
-    char imageBuffer[32];
-    fread(imageBuffer, 1, 32, encInfo->fptr_src_image);
-    encode_size_to_lsb(size, imageBuffer);
-    fwrite(imageBuffer, 1, 32, encInfo->fptr_stego_image);
+    uint64_t data_end = encInfo->carrier.pos, data_off = encInfo->carrier_off;
+    if (carrier_seek(&encInfo->carrier, bmp_file_offset(&encInfo->layout, size_off)) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to seek back to the size field.\n");
+        return e_failure;
+    }
+
+    encInfo->carrier_off = size_off;
+    if (encode_secret_file_size(encInfo->size_stored, encInfo) != e_success)
+        return e_failure;
+
+    encInfo->carrier_off = data_off;
+    if (carrier_seek(&encInfo->carrier, data_end) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to seek past the payload region.\n");
+        return e_failure;
+    }
     return e_success;
 }
 
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+/* Seal and checksum a block on the pipeline's compute stage, as embed_payload does */
+static void seal_block(void *ctx, unsigned char *data, size_t len)
 {
-    size_t len = strlen(file_extn);
-    char imageBuffer[8];
+    EncodeInfo *encInfo = ctx;
+    if (encInfo->encrypt)
+        aead_seal(&encInfo->aead, data, len, 0);
+    if (encInfo->crc)
+        crc_chunks_update(&encInfo->crcs, data, len);
+}
 
-    for (size_t i = 0; i < len; ++i)
+/* embed_stream over regular files: reads and writes run on the I/O queue, overlapping the embedding */
+static Status embed_stream_pipelined(EncodeInfo *encInfo, IoQueue *q, FILE *src, off_t size, size_t block, int depth)
+{
+    // The header fields went out through stdio; flush them before the queue writes behind them
+    off_t secret_off = ftello(src);
+    if (secret_off < 0 || fflush(encInfo->fptr_stego_image) != 0)
     {
-        fread(imageBuffer, 1, 8, encInfo->fptr_src_image);
-        encode_byte_to_lsb(file_extn[i], imageBuffer);
-        fwrite(imageBuffer, 1, 8, encInfo->fptr_stego_image);
+        perror("fflush");
+        return e_failure;
     }
 
-    return e_success;
-}
+    uint64_t pos = encInfo->carrier.pos;
+    if (pipeline_embed(q, fileno(src), secret_off, fileno(encInfo->fptr_src_image), fileno(encInfo->fptr_stego_image),
+                       &encInfo->layout, encInfo->carrier_off, (uint64_t)size, depth, block, seal_block, encInfo,
+                       &pos) != e_success)
+    {
+        fprintf(stderr, "ERROR: Could not embed secret bytes %lld-%lld.\n", (long long)secret_off,
+                (long long)(secret_off + size - 1));
+        return e_failure;
+    }
+    LOG_INFO("Payload embedded through the %s pipeline.\n", ioq_backend(q));
+    opstats_io(encInfo->stats, ioq_backend(q));
 
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
-{
-    char imageBuffer[32];
-    fread(imageBuffer, 1, 32, encInfo->fptr_src_image);
-    encode_size_to_lsb((int)file_size, imageBuffer);
-    fwrite(imageBuffer, 1, 32, encInfo->fptr_stego_image);
+    // Resume the streams right after the last window
+    encInfo->carrier_off += lsb_carrier_bytes((size_t)size, depth);
+    if (fseeko(src, secret_off + size, SEEK_SET) != 0 || carrier_seek(&encInfo->carrier, pos) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to seek past the payload region.\n");
+        return e_failure;
+    }
     return e_success;
 }
 
-Status encode_secret_file_data(EncodeInfo *encInfo)
+/* Embed size bytes read from src at the current carrier offset, a block at a time */
+static Status embed_stream(EncodeInfo *encInfo, FILE *src, off_t size, size_t block, int depth)
 {
-    uint data_size = encInfo->size_secret_file;
-    // Removed malloc/free for simplicity and efficiency, reading directly from file
-    
-    char secret_byte;
-    char imageBuffer[8];
-    rewind(encInfo->fptr_secret); // Ensure we start from the beginning of the secret file
+    // Payloads of several blocks between regular files are pipelined; in place, the carrier stream diffs each window
+    if (size >= (off_t)(2 * block) && !encInfo->in_place && stream_seekable(src) &&
+        stream_seekable(encInfo->fptr_src_image) && stream_seekable(encInfo->fptr_stego_image))
+    {
+        IoQueue *q = ioq_open();
+        if (q != NULL)
+        {
+            Status ret = embed_stream_pipelined(encInfo, q, src, size, block, depth);
+            opstats_queue(encInfo->stats, q);
+            ioq_close(q);
+            return ret;
+        }
+    }
 
-    for (uint i = 0; i < data_size; ++i)
+    char *secret_buf = malloc(block);
+    if (!secret_buf)
     {
-        // Read 1 byte from secret file
-        if (fread(&secret_byte, 1, 1, encInfo->fptr_secret) != 1)
+        fprintf(stderr, "ERROR: Unable to allocate a %zu byte encode buffer.\n", block);
+        return e_failure;
+    }
+
+    Status ret = e_success;
+    for (off_t done = 0; done < size; )
+    {
+        size_t n = (size_t)(size - done) < block ? (size_t)(size - done) : block;
+
+        // Read a block of secret bytes
+        if (fread(secret_buf, 1, n, src) != n)
         {
-            fprintf(stderr, "ERROR: Could not read secret byte %u.\n", i);
-            return e_failure;
+            fprintf(stderr, "ERROR: Could not read secret bytes %lld-%lld.\n", (long long)done, (long long)done + (long long)n - 1);
+            ret = e_failure;
+            break;
         }
-        
-        // Read 8 bytes from source image
-        if (fread(imageBuffer, 1, 8, encInfo->fptr_src_image) != 8)
+
+        // Embed the block into the matching carrier window (8 / depth carrier bytes per secret byte)
+        if (embed_payload(encInfo, secret_buf, n, 0, depth) != e_success)
         {
-            fprintf(stderr, "ERROR: Could not read 8 bytes from source image for byte %u.\n", i);
-            return e_failure;
+            ret = e_failure;
+            break;
         }
-        
-        // Encode the secret byte into LSBs of the 8 image bytes
-        encode_byte_to_lsb(secret_byte, imageBuffer);
-        
-        // Write the 8 stego image bytes to the stego file
-        if (fwrite(imageBuffer, 1, 8, encInfo->fptr_stego_image) != 8)
+
+        done += (off_t)n;
+    }
+
+    free(secret_buf);
+    return ret;
+}
+
+/* Embed the table of contents, then each entry file in turn */
+static Status encode_container_data(EncodeInfo *encInfo, size_t block, int depth)
+{
+    if (embed_payload(encInfo, encInfo->toc, encInfo->toc_len, 0, depth) != e_success)
+        return e_failure;
+
+    for (int i = 0; i < encInfo->nentries; i++)
+    {
+        FILE *fptr = fopen(encInfo->entry_fnames[i], "rb");
+        if (fptr == NULL)
         {
-            fprintf(stderr, "ERROR: Could not write 8 stego bytes for byte %u.\n", i);
+            perror("fopen");
+            fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->entry_fnames[i]);
             return e_failure;
         }
+        Status ret = embed_stream(encInfo, fptr, (off_t)encInfo->entry_sizes[i], block, depth);
+        fclose(fptr);
+        if (ret != e_success)
+            return e_failure;
+        LOG_INFO("Entry %s encoded: %llu bytes\n", encInfo->entry_fnames[i], (unsigned long long)encInfo->entry_sizes[i]);
     }
-
     return e_success;
 }
 
+/* Embed the shard header, then the slice of the secret file it describes */
+static Status encode_shard_data(EncodeInfo *encInfo, size_t block, int depth)
+{
+    // embed_payload seals in place, so the shared header is copied first
+    unsigned char hdr[SHARD_HEADER_LEN];
+    memcpy(hdr, encInfo->shard_hdr, sizeof(hdr));
+    if (embed_payload(encInfo, hdr, sizeof(hdr), 0, depth) != e_success)
+        return e_failure;
+
+    if (fseeko(encInfo->fptr_secret, (off_t)encInfo->slice_offset, SEEK_SET) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to seek to secret byte %llu.\n", (unsigned long long)encInfo->slice_offset);
+        return e_failure;
+    }
+    return embed_stream(encInfo, encInfo->fptr_secret, (off_t)encInfo->slice_len, block, depth);
+}
+
+Status encode_secret_file_data(EncodeInfo *encInfo)
+{
+    off_t data_size = encInfo->size_secret_file;
+
+    // Work in fixed-size blocks: chunk carrier bytes hold chunk / (8 / depth) secret bytes
+    int depth = encInfo->depth ? encInfo->depth : 1;
+    size_t chunk = encInfo->chunk_size ? encInfo->chunk_size : STEG_CHUNK_SIZE;
+    size_t block = chunk / lsb_carrier_bytes(1, depth);
+    if (block == 0)
+        block = 1;
+
+    if (encInfo->nentries > 0)
+        return encode_container_data(encInfo, block, depth);
+    if (encInfo->shard_hdr)
+        return encode_shard_data(encInfo, block, depth);
+
+    // Frames are produced one after another, so compression and chunking run on this thread
+    if (encInfo->compress || encInfo->chunked)
+        return encode_secret_file_data_framed(encInfo);
+    if (encInfo->threads > 1)
+    {
+        opstats_io(encInfo->stats, "pread/pwrite");
+        return encode_secret_file_data_parallel(encInfo, chunk);
+    }
+
+    rewind(encInfo->fptr_secret); // Ensure we start from the beginning of the secret file
+    return embed_stream(encInfo, encInfo->fptr_secret, data_size, block, depth);
+}
+
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
 {
-    int ch;
-    while ((ch = fgetc(fptr_src)) != EOF)
-        fputc(ch, fptr_dest);
-    return e_success;
+    // Between regular files the tail never passes through this process (see copy_range)
+    uint64_t src_size = stream_size(fptr_src);
+    if (src_size != UINT64_MAX && stream_seekable(fptr_dest) && fflush(fptr_dest) == 0)
+    {
+        off_t in_off = ftello(fptr_src), out_off = ftello(fptr_dest);
+        if (in_off >= 0 && out_off >= 0 && (uint64_t)in_off <= src_size)
+        {
+            const char *method;
+            uint64_t len = src_size - (uint64_t)in_off;
+            if (copy_range(fileno(fptr_src), in_off, fileno(fptr_dest), out_off, len, &method) != e_success ||
+                fseeko(fptr_src, (off_t)src_size, SEEK_SET) != 0 || fseeko(fptr_dest, out_off + (off_t)len, SEEK_SET) != 0)
+            {
+                perror("copy_range");
+                fprintf(stderr, "ERROR: Could not copy remaining image data.\n");
+                return e_failure;
+            }
+            LOG_INFO("Remaining image data: %llu bytes (%s).\n", (unsigned long long)len, method);
+            return e_success;
+        }
+    }
+
+    char *buf = malloc(STEG_CHUNK_SIZE);
+    if (!buf)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate copy buffer.\n");
+        return e_failure;
+    }
+
+    Status ret = e_success;
+    size_t n;
+    while ((n = fread(buf, 1, STEG_CHUNK_SIZE, fptr_src)) > 0)
+    {
+        if (fwrite(buf, 1, n, fptr_dest) != n)
+        {
+            fprintf(stderr, "ERROR: Could not write remaining image data.\n");
+            ret = e_failure;
+            break;
+        }
+    }
+    if (ferror(fptr_src))
+    {
+        fprintf(stderr, "ERROR: Could not read remaining image data.\n");
+        ret = e_failure;
+    }
+    if (ret == e_success)
+        LOG_INFO("Remaining image data copied (stdio).\n");
+
+    free(buf);
+    return ret;
 }
 
-Status do_encoding(EncodeInfo *encInfo)
+Status do_encoding_mmap(EncodeInfo *encInfo)
 {
-    if (open_files(encInfo) != e_success)
+    MappedFile src, secret, stego;
+    if (map_file_read(encInfo->fptr_src_image, &src) != e_success)
+        return e_failure;
+    if (map_file_read(encInfo->fptr_secret, &secret) != e_success)
     {
-        fprintf(stderr, "ERROR: Opening files failed\n");
+        unmap_file(&src);
         return e_failure;
     }
+    if (map_file_write(encInfo->fptr_stego_image, src.len, &stego) != e_success)
+    {
+        unmap_file(&secret);
+        unmap_file(&src);
+        return e_failure;
+    }
+    LOG_INFO("Files mapped (%zu bytes).\n", src.len);
+    opstats_io(encInfo->stats, "mmap");
+    opstats_phase(encInfo->stats, "map_files");
 
-    printf("Files opened successfully.\n");
+    // The library embeds straight from the source mapping into the stego mapping
+    StegEncodeOptions opts = {encInfo->depth, encInfo->compress, encInfo->skip_alpha, encInfo->crc,
+                              encInfo->encrypt ? encInfo->key : NULL, encInfo->nonce, encInfo->scatter};
+    if (encInfo->encrypt && random_bytes(encInfo->nonce, sizeof(encInfo->nonce)) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to generate a nonce.\n");
+        unmap_file(&stego);
+        unmap_file(&secret);
+        unmap_file(&src);
+        return e_failure;
+    }
+    StegStatus status = steg_encode_buffer_opts((const unsigned char *)src.addr, src.len,
+                                                (const unsigned char *)secret.addr, secret.len,
+                                                encInfo->extn_secret_file, &opts,
+                                                (unsigned char *)stego.addr);
+    opstats_phase(encInfo->stats, "encode_secret_file_data");
+
+    unmap_file(&stego);
+    unmap_file(&secret);
+    unmap_file(&src);
 
-    if (check_capacity(encInfo) != e_success)
+    if (status != steg_ok)
     {
-        // check_capacity prints the detailed error
+        fprintf(stderr, "ERROR: %s\n", steg_strerror(status));
         return e_failure;
     }
+    LOG_INFO("Secret file data encoded.\n");
+    return e_success;
+}
+
+void close_files(EncodeInfo *encInfo)
+{
+    close_stream(encInfo->fptr_src_image);
+    close_stream(encInfo->fptr_secret);
+    if (encInfo->fptr_stego_image != encInfo->fptr_src_image)
+        close_stream(encInfo->fptr_stego_image);
+    encInfo->fptr_src_image = encInfo->fptr_secret = encInfo->fptr_stego_image = NULL;
+    carrier_close(&encInfo->carrier);
+    bmp_free(&encInfo->layout);
+    free(encInfo->toc);
+    free(encInfo->entry_sizes);
+    crc_chunks_free(&encInfo->crcs);
+    memset(&encInfo->aead, 0, sizeof(encInfo->aead));
+    encInfo->toc = NULL;
+    encInfo->entry_sizes = NULL;
+}
+
+/*
+ * --same-size: the carrier must already hold a header identical to the one about to be
+ * written (extension, flags and size), so the re-embed covers exactly the old payload's
+ * carrier bytes and only the blocks whose payload bytes differ are rewritten
+ */
+static Status check_same_header(EncodeInfo *encInfo, uint32_t extn_word)
+{
+    unsigned char want[sizeof(MAGIC_STRING) - 1 + 4 + sizeof(encInfo->extn_secret_file) + 8];
+    unsigned char got[sizeof(want)];
+    size_t magic_len = strlen(MAGIC_STRING), extn_len = strlen(encInfo->extn_secret_file), n = 0;
+    uint64_t size = (uint64_t)encInfo->size_secret_file;
 
-    printf("Image has enough capacity.\n");
+    memcpy(want, MAGIC_STRING, magic_len);
+    n += magic_len;
+    for (int i = 0; i < 4; i++)
+        want[n++] = (unsigned char)(extn_word >> (24 - 8 * i));
+    memcpy(want + n, encInfo->extn_secret_file, extn_len);
+    n += extn_len;
+    for (int i = encInfo->size64 ? 7 : 3; i >= 0; i--)
+        want[n++] = (unsigned char)(size >> (8 * i));
 
-    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) != e_success)
+    uint64_t start = encInfo->carrier.pos;
+    if (carrier_extract(&encInfo->carrier, 0, n, got, 1) != e_success ||
+        carrier_seek(&encInfo->carrier, start) != e_success)
     {
+        fprintf(stderr, "ERROR: Unable to read the existing header.\n");
+        return e_failure;
+    }
+    if (memcmp(want, got, n) != 0)
+    {
+        fprintf(stderr, "ERROR: --same-size: %s does not hold a payload with the same extension, size and options\n",
+                encInfo->src_image_fname);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Stream the header, payload and tail through stdio (in place: write back only what changed) */
+static Status do_encoding_stream(EncodeInfo *encInfo)
+{
+    int extn_size = strlen(encInfo->extn_secret_file);
+    uint32_t extn_word = steg_pack_extn_word((uint32_t)extn_size, header_flags(encInfo));
+    if (encInfo->same_size && check_same_header(encInfo, extn_word) != e_success)
+    {
+        return e_failure;
+    }
+
+    if (encInfo->in_place)
+        LOG_INFO("Updating %s in place.\n", encInfo->src_image_fname);
+    else if (fwrite(encInfo->bmp_header, 1, BMP_HEADER_SIZE, encInfo->fptr_stego_image) != BMP_HEADER_SIZE)
+    {
+        fprintf(stderr, "ERROR: Unable to write BMP header to dest\n");
         return e_failure;
     }
-    printf("BMP header copied.\n");
 
     if (encode_magic_string(MAGIC_STRING, encInfo) != e_success)
     {
         return e_failure;
     }
-    printf("Magic string encoded.\n");
+    LOG_INFO("Magic string encoded.\n");
 
-    int extn_size = strlen(encInfo->extn_secret_file);
-    if (encode_secret_file_extn_size(extn_size, encInfo) != e_success)
+    // The extension size field also carries the v2 format flags, if any
+    if (encode_secret_file_extn_size((int)extn_word, encInfo) != e_success)
     {
         return e_failure;
     }
-    printf("Extension size encoded: %d\n", extn_size);
+    LOG_INFO("Extension size encoded: %d\n", extn_size);
 
     if (extn_size > 0)
     {
@@ -365,30 +1042,85 @@ Status do_encoding(EncodeInfo *encInfo)
         {
             return e_failure;
         }
-        printf("Extension encoded: %s\n", encInfo->extn_secret_file);
+        LOG_INFO("Extension encoded: %s\n", encInfo->extn_secret_file);
     }
 
-    if (encode_secret_file_size(encInfo->size_secret_file, encInfo) != e_success)
+    // A compressed payload gets its size field filled in after the data; a chunked one keeps 0
+    uint64_t size_off = encInfo->carrier_off;
+    int framed = encInfo->compress || encInfo->chunked;
+    encInfo->size_stored = encInfo->size_secret_file;
+    if (encode_secret_file_size(framed ? 0 : encInfo->size_secret_file, encInfo) != e_success)
+    {
+        return e_failure;
+    }
+    if (encInfo->encrypt && encode_nonce(encInfo, extn_word) != e_success)
     {
         return e_failure;
     }
-    printf("Secret file size encoded: %ld bytes\n", encInfo->size_secret_file);
+    opstats_phase(encInfo->stats, "encode_header");
 
     if (encode_secret_file_data(encInfo) != e_success)
     {
         return e_failure;
     }
-    printf("Secret file data encoded.\n");
+    if (encInfo->encrypt && encode_tag(encInfo) != e_success)
+    {
+        return e_failure;
+    }
+    if (encInfo->crc && encode_crc_table(encInfo) != e_success)
+    {
+        return e_failure;
+    }
+    if (encInfo->compress && !encInfo->chunked && encode_stored_size(encInfo, size_off) != e_success)
+    {
+        return e_failure;
+    }
+    LOG_INFO("Secret file size encoded: %lld bytes\n", (long long)encInfo->size_stored);
+    LOG_INFO("Secret file data encoded.\n");
+    opstats_phase(encInfo->stats, "encode_secret_file_data");
+
+    if (encInfo->in_place)
+    {
+        LOG_INFO("Carrier bytes rewritten in place: %llu\n", (unsigned long long)encInfo->carrier.written);
+        return e_success;
+    }
 
     if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) != e_success)
     {
         return e_failure;
     }
-    printf("Remaining image data copied.\n");
-
-    fclose(encInfo->fptr_src_image);
-    fclose(encInfo->fptr_secret);
-    fclose(encInfo->fptr_stego_image);
+    opstats_phase(encInfo->stats, "copy_remaining_img_data");
 
     return e_success;
+}
+
+Status do_encoding(EncodeInfo *encInfo)
+{
+    if (open_files(encInfo) != e_success)
+    {
+        fprintf(stderr, "ERROR: Opening files failed\n");
+        return e_failure;
+    }
+
+    LOG_INFO("Files opened successfully.\n");
+    opstats_phase(encInfo->stats, "open_files");
+
+    Status ret = check_capacity(encInfo); // check_capacity prints the detailed error
+    opstats_phase(encInfo->stats, "check_capacity");
+    if (ret == e_success)
+    {
+        LOG_INFO("Image has enough capacity.\n");
+        ret = encInfo->use_mmap ? do_encoding_mmap(encInfo) : do_encoding_stream(encInfo);
+    }
+    if (encInfo->stats)
+    {
+        encInfo->stats->payload_bytes = (uint64_t)encInfo->size_secret_file;
+        uint64_t image_len = stream_size(encInfo->fptr_src_image);
+        encInfo->stats->image_bytes = image_len == UINT64_MAX ? 0 : image_len;
+    }
+
+    // Always release the files so long-running callers (batch mode) do not leak them
+    close_files(encInfo);
+    opstats_phase(encInfo->stats, "close_files");
+    return ret;
 }
\ No newline at end of file
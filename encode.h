@@ -2,7 +2,15 @@
 #define ENCODE_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include "types.h" // Contains user-defined types
+#include "common.h"
+#include "bmp.h"
+#include "carrier_io.h"
+#include "crc32c.h"
+#include "aead.h"
+#include "opstats.h"
 
 /*
  * Structure to store information required for
@@ -16,19 +24,58 @@ typedef struct _EncodeInfo
     /* Source Image info */
     char *src_image_fname;   // To store the source image name
     FILE *fptr_src_image;    // To store the address of the source image
-    uint image_capacity;     // To store the size of image
+    uint64_t image_capacity; // Embeddable carrier bytes (from the layout)
+    unsigned char bmp_header[BMP_HEADER_SIZE]; // Header read once by open_files (works on pipes)
+    BmpLayout layout;        // Pixel spans of the source image, built by check_capacity
 
     /* Secret File Info */
     char *secret_fname;          // To store the secret file name
     FILE *fptr_secret;           // To store the secret file address
     char extn_secret_file[10];   // To store the secret file extension (Increased size for flexibility)
     char secret_data[100];       // To store the secret data
-    long size_secret_file;       // To store the size of the secret data
+    off_t size_secret_file;      // To store the size of the secret data
 
     /* Stego Image Info */
     char *stego_image_fname;     // To store the destination (stego) image name
     FILE *fptr_stego_image;      // To store the address of the stego image
 
+    /* Pipeline tuning */
+    CarrierStream carrier;       // Source -> stego window stream over the layout
+    uint64_t carrier_off;        // Logical carrier offset of the next header field or payload byte
+    size_t chunk_size;           // Carrier bytes processed per block (0 = STEG_CHUNK_SIZE)
+    int use_mmap;                // Embed directly in memory-mapped carrier/stego files
+    int threads;                 // Worker threads for the payload region (<= 1 = single-threaded)
+    int in_place;                // Update the carrier itself, writing back only the blocks that change
+    int same_size;               // In place over a payload with the same header (see check_same_header)
+    OpStats *stats;              // --stats: phase timings and I/O path of this encode (NULL = off)
+
+    /* Format options */
+    int depth;                   // LSBs per carrier byte for the payload: 1 (default), 2 or 4
+    int compress;                // LZ-compress the payload while embedding it
+    int skip_alpha;              // Leave the alpha bytes of 32-bpp carriers untouched
+    off_t size_stored;           // Payload bytes actually embedded (compressed size if compress)
+    int chunked;                 // Payload length not known up front: embed as a framed stream
+    int size64;                  // Write a 64-bit size field (set by check_capacity for >= 2 GiB)
+    int crc;                     // Follow the payload with a CRC32C per STEG_CRC_CHUNK stored bytes
+    CrcChunks crcs;              // Checksums of the stored bytes embedded so far
+    int encrypt;                 // Seal the stored bytes with ChaCha20-Poly1305 under key
+    unsigned char key[AEAD_KEY_LEN];
+    unsigned char nonce[AEAD_NONCE_LEN]; // Fresh per encode, embedded after the size field
+    Aead aead;                   // Sealing state, started once the header fields are known
+    int scatter;                 // Spread the payload in key-permuted blocks (library path, needs encrypt)
+
+    /* Container (-c): several named entries behind a table of contents */
+    char **entry_fnames;         // Entry files, in payload order
+    int nentries;                // 0 = plain single-file payload
+    uint64_t *entry_sizes;       // Entry lengths, from check_capacity
+    unsigned char *toc;          // Table of contents (see container.h)
+    size_t toc_len;
+
+    /* Shard (--shard): one slice of the secret file behind a shard header */
+    const unsigned char *shard_hdr; // SHARD_HEADER_LEN bytes, NULL = not a shard
+    uint64_t slice_offset;       // First secret byte of the slice
+    uint64_t slice_len;          // Secret bytes in the slice
+
 } EncodeInfo;
 
 /* Encoding function prototypes */
@@ -36,23 +83,26 @@ typedef struct _EncodeInfo
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
 
+/* Read and validate "-c carrier output entry..." args */
+Status read_and_validate_container_args(int argc, char *argv[], EncodeInfo *encInfo);
+
 /* Perform the encoding */
 Status do_encoding(EncodeInfo *encInfo);
 
+/* Embed into memory-mapped views of the files opened by open_files */
+Status do_encoding_mmap(EncodeInfo *encInfo);
+
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Close the files opened by open_files */
+void close_files(EncodeInfo *encInfo);
+
 /* Check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
-
 /* Get file size */
-uint get_file_size(FILE *fptr);
-
-/* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+off_t get_file_size(FILE *fptr);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
@@ -64,16 +114,13 @@ Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
 /* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
+Status encode_secret_file_size(off_t file_size, EncodeInfo *encInfo);
 
 /* Encode secret file data */
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
-/* Encode a byte into LSB of image data array */
-Status encode_byte_to_lsb(char data, char *image_buffer);
-
-/* Encode a size into LSB */
-Status encode_size_to_lsb(int size, char *imageBuffer);
+/* Flags for the v2 extension word (0 = plain v1 header) */
+uint header_flags(const EncodeInfo *encInfo);
 
 /* Copy remaining image bytes from src to stego image after encoding */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
@@ -0,0 +1,171 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+
+/*
+ * Stego header, embedded in the first carrier bytes at 1 LSB per carrier byte:
+ *
+ *   magic string      8 carrier bytes per char
+ *   extension word    32 carrier bytes
+ *   extension         8 carrier bytes per char
+ *   payload size      32 carrier bytes (64 with STEG_F_SIZE64)
+ *   payload           8 / depth carrier bytes per byte
+ *
+ * With STEG_F_COMPRESSED or STEG_F_CHUNKED the payload is a stream of
+ * frames (see lz.h) ending in an empty frame. The size field holds the
+ * stored stream length, or 0 with STEG_F_CHUNKED when the length was not
+ * known before the data was written (piped payload or output).
+ *
+ * Format v1 stores the plain extension length in the extension word.
+ * Format v2 sets STEG_HDR_EXTENDED and packs a version and feature flags
+ * next to the length:
+ *
+ *   bit 31 extended | bits 16-30 flags | bits 8-15 version | bits 0-7 length
+ *
+ * Carrier bytes are the pixel bytes of the image in file order (see bmp.h).
+ * Images whose pixel bytes are not simply all bytes after the 54-byte
+ * header (row padding, a larger header, skipped alpha) set STEG_F_SPANS;
+ * everything else matches the legacy flat layout and needs no flag.
+ *
+ * STEG_F_CONTAINER payloads hold several named entries behind a table of
+ * contents (see container.h); the extension is empty and the size field
+ * covers the table and all entries.
+ *
+ * STEG_F_CRC payloads are followed by a checksum table at the payload depth:
+ * one CRC32C (u32, most significant byte first) per STEG_CRC_CHUNK bytes of
+ * the stored payload, the last chunk possibly shorter. The table covers the
+ * bytes as embedded (frames included), so any chunk can be checked on its own.
+ *
+ * STEG_F_ENCRYPTED payloads are ChaCha20-Poly1305 sealed (see aead.h): a
+ * 12-byte nonce sits between the size field and the stored bytes, and the
+ * 16-byte tag follows them (before any checksum table). The extension word
+ * and extension are the associated data. Frame headers stay in clear so the
+ * stored length can be found without the key; the tag covers them too.
+ *
+ * STEG_F_SCATTER images (always also encrypted) store everything after the
+ * nonce through a keyed block permutation of the remaining carrier bytes
+ * (see scatter.h), so the payload is not a sequential run from the header.
+ *
+ * v1 decoders reject v2 images as having an oversized extension. Encoders
+ * only write v2 when a feature needs it, so plain encodes stay v1.
+ */
+#define STEG_HDR_EXTENDED   0x80000000u
+#define STEG_FORMAT_V1      1
+#define STEG_FORMAT_V2      2
+
+/* v2 feature flags */
+#define STEG_F_DEPTH_MASK   0x0003u     // LSB depth - 1 (1, 2 or 4 bits per carrier byte)
+#define STEG_F_COMPRESSED   0x0004u     // Payload is LZ-compressed
+#define STEG_F_CHUNKED      0x0008u     // Payload length unknown up front: size field is 0
+#define STEG_F_SIZE64       0x0010u     // Size field is 64 bits (payloads of 2 GiB and more)
+#define STEG_F_SPANS        0x0020u     // Carrier bytes follow the pixel spans, not the legacy flat layout
+#define STEG_F_NO_ALPHA     0x0040u     // 32-bpp carrier with the alpha bytes left untouched
+#define STEG_F_CONTAINER    0x0080u     // Payload is a multi-entry container with a table of contents
+#define STEG_F_CRC          0x0100u     // Stored payload is followed by a per-chunk CRC32C table
+#define STEG_F_ENCRYPTED    0x0200u     // Stored payload is ChaCha20-Poly1305 sealed
+#define STEG_F_SCATTER      0x0400u     // Payload carrier bytes are permuted in key-seeded blocks
+#define STEG_F_SHARD        0x0800u     // Payload is one slice of a larger payload (see shard.h)
+
+/* Payloads stored as a frame stream rather than plain bytes */
+#define STEG_F_FRAMED       (STEG_F_COMPRESSED | STEG_F_CHUNKED)
+
+/* Flags this build understands; images using any other flag are rejected */
+#define STEG_F_KNOWN        (STEG_F_DEPTH_MASK | STEG_F_COMPRESSED | STEG_F_CHUNKED | STEG_F_SIZE64 | \
+                             STEG_F_SPANS | STEG_F_NO_ALPHA | STEG_F_CONTAINER | STEG_F_CRC | \
+                             STEG_F_ENCRYPTED | STEG_F_SCATTER | STEG_F_SHARD)
+
+/* Largest size a 32-bit size field holds (v1 decoders read it as a signed int) */
+#define STEG_SIZE32_MAX     0x7FFFFFFFULL
+
+/* Stored payload bytes per checksum with STEG_F_CRC */
+#define STEG_CRC_CHUNK      (64 * 1024)
+
+/* Checksums covering stored payload bytes */
+static inline uint64_t steg_crc_count(uint64_t stored)
+{
+    return (stored + STEG_CRC_CHUNK - 1) / STEG_CRC_CHUNK;
+}
+
+/* Bytes of the checksum table that follows stored bytes with STEG_F_CRC (0 without) */
+static inline uint64_t steg_crc_table_len(uint64_t stored, uint32_t flags)
+{
+    return (flags & STEG_F_CRC) ? steg_crc_count(stored) * 4 : 0;
+}
+
+/* Nonce before and tag after the stored bytes with STEG_F_ENCRYPTED */
+#define STEG_NONCE_LEN      12
+#define STEG_TAG_LEN        16
+
+/* Largest stored payload one nonce can seal: 2^32 - 1 keystream blocks of 64 bytes */
+#define STEG_SEALED_MAX     ((((uint64_t)1 << 32) - 1) * 64)
+
+static inline uint64_t steg_nonce_len(uint32_t flags)
+{
+    return (flags & STEG_F_ENCRYPTED) ? STEG_NONCE_LEN : 0;
+}
+
+/* Payload-depth bytes after the stored bytes: the tag, then the checksum table */
+static inline uint64_t steg_trailer_len(uint64_t stored, uint32_t flags)
+{
+    return ((flags & STEG_F_ENCRYPTED) ? STEG_TAG_LEN : 0) + steg_crc_table_len(stored, flags);
+}
+
+/* Bits in the size field for a flags value */
+static inline int steg_size_bits(uint32_t flags)
+{
+    return (flags & STEG_F_SIZE64) ? 64 : 32;
+}
+
+/* Depth (bits per carrier byte) stored in a flags value */
+static inline int steg_flags_depth(uint32_t flags)
+{
+    return (int)(flags & STEG_F_DEPTH_MASK) + 1;
+}
+
+/* Depths whose carrier bytes hold whole fractions of a payload byte */
+static inline int steg_valid_depth(int depth)
+{
+    return depth == 1 || depth == 2 || depth == 4;
+}
+
+/* Build the extension word; without flags this is the plain v1 length */
+static inline uint32_t steg_pack_extn_word(uint32_t extn_len, uint32_t flags)
+{
+    if (flags == 0)
+        return extn_len;
+    return STEG_HDR_EXTENDED | (flags & 0x7FFFu) << 16 | (uint32_t)STEG_FORMAT_V2 << 8 | (extn_len & 0xFFu);
+}
+
+/* Split an extension word; returns 0 for unknown versions, flags or depths */
+static inline int steg_unpack_extn_word(uint32_t word, uint32_t *extn_len, uint32_t *version, uint32_t *flags)
+{
+    if (!(word & STEG_HDR_EXTENDED))
+    {
+        *extn_len = word;
+        *version = STEG_FORMAT_V1;
+        *flags = 0;
+        return 1;
+    }
+
+    *extn_len = word & 0xFFu;
+    *version = (word >> 8) & 0xFFu;
+    *flags = (word >> 16) & 0x7FFFu;
+    return *version == STEG_FORMAT_V2 && (*flags & ~STEG_F_KNOWN) == 0 &&
+           steg_valid_depth(steg_flags_depth(*flags));
+}
+
+/* Associated data of a sealed payload: the extension word (MSB first), then the extension; returns its length */
+static inline size_t steg_header_aad(uint32_t word, const char *extn, size_t extn_len, unsigned char *aad)
+{
+    aad[0] = word >> 24;
+    aad[1] = word >> 16;
+    aad[2] = word >> 8;
+    aad[3] = word;
+    memcpy(aad + 4, extn, extn_len);
+    return 4 + extn_len;
+}
+
+#endif
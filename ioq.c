@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "ioq.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define IOQ_URING 1
+#include <linux/io_uring.h>
+#endif
+
+/* Submission ring size: the pipeline keeps at most a dozen requests in flight */
+#define IOQ_ENTRIES     64
+
+/* Largest single transfer handed to the kernel */
+#define IOQ_MAX_XFER    (1u << 30)
+
+typedef enum
+{
+    IOQ_AUTO,
+    IOQ_MODE_URING,
+    IOQ_MODE_THREADS,
+    IOQ_MODE_STDIO
+} IoMode;
+
+static IoMode mode = IOQ_AUTO;
+
+#ifdef IOQ_URING
+typedef struct
+{
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+} Uring;
+#endif
+
+/* One pread or pwrite thread with its own request list */
+typedef struct
+{
+    struct _IoQueue *q;
+    pthread_t thread;
+    int started;
+    IoOp *head, *tail;
+} IoWorker;
+
+struct _IoQueue
+{
+    int uring;                  // io_uring backend in use
+#ifdef IOQ_URING
+    Uring ring;
+#endif
+    pthread_mutex_t lock;       // Thread backend: request lists and completion flags
+    pthread_cond_t work;        // A request was queued, or stop
+    pthread_cond_t done;        // A request completed
+    int stop;
+    IoWorker reader, writer;
+    uint64_t submitted[2];      // Requests queued, indexed by IoOp.write
+    uint64_t submitted_bytes[2];
+};
+
+/* ---------------- io_uring ---------------- */
+
+#ifdef IOQ_URING
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_free(Uring *r)
+{
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED)
+        munmap(r->sq_ptr, r->sq_len);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+/* Non-zero if the kernel supports the read and write opcodes */
+static int uring_has_rw(int fd)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    int ok = 0;
+    if (probe && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+        ok = probe->last_op >= IORING_OP_WRITE && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+             (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+static Status uring_init(Uring *r)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = uring_setup(IOQ_ENTRIES, &p);
+    if (r->fd < 0 || !uring_has_rw(r->fd))
+    {
+        uring_free(r);
+        return e_failure;
+    }
+
+    // Map the two rings (one mapping on kernels with IORING_FEAT_SINGLE_MMAP) and the entries
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_len = r->cq_len = r->sq_len > r->cq_len ? r->sq_len : r->cq_len;
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+    {
+        uring_free(r);
+        return e_failure;
+    }
+    r->cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP)
+                    ? r->sq_ptr
+                    : mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->cq_ptr == MAP_FAILED || r->sqes == MAP_FAILED)
+    {
+        uring_free(r);
+        return e_failure;
+    }
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return e_success;
+}
+
+/* Queue the rest of a request and hand it to the kernel */
+static void uring_push(Uring *r, IoOp *op)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    size_t len = op->len - op->done < IOQ_MAX_XFER ? op->len - op->done : IOQ_MAX_XFER;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = op->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(op->buf + op->done);
+    sqe->len = (unsigned)len;
+    sqe->off = (uint64_t)(op->off + (off_t)op->done);
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int ret;
+    while ((ret = uring_enter(r->fd, 1, 0, 0)) < 0 && errno == EINTR)
+        ;
+    if (ret < 0)
+    {
+        // Take the entry back and fail the request
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+        op->error = errno;
+        op->complete = 1;
+    }
+}
+
+/* Handle every completion posted so far */
+static void uring_reap(Uring *r)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        IoOp *op = (IoOp *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        if (res == -EINTR || res == -EAGAIN)
+            uring_push(r, op);
+        else if (res <= 0)
+        {
+            op->error = res < 0 ? -res : EIO;
+            op->complete = 1;
+        }
+        else if ((op->done += (size_t)res) < op->len)
+            uring_push(r, op);
+        else
+            op->complete = 1;
+    }
+}
+
+#endif
+
+/* ---------------- thread pair ---------------- */
+
+static void *worker_main(void *arg)
+{
+    IoWorker *w = arg;
+    IoQueue *q = w->q;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;)
+    {
+        while (w->head == NULL && !q->stop)
+            pthread_cond_wait(&q->work, &q->lock);
+        if (w->head == NULL)
+            break;
+
+        IoOp *op = w->head;
+        w->head = op->next;
+        if (w->head == NULL)
+            w->tail = NULL;
+        pthread_mutex_unlock(&q->lock);
+
+        while (op->done < op->len && op->error == 0)
+        {
+            size_t len = op->len - op->done;
+            off_t off = op->off + (off_t)op->done;
+            ssize_t n = op->write ? pwrite(op->fd, op->buf + op->done, len, off)
+                                  : pread(op->fd, op->buf + op->done, len, off);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                op->error = n < 0 ? errno : EIO;
+            else
+                op->done += (size_t)n;
+        }
+
+        pthread_mutex_lock(&q->lock);
+        op->complete = 1;
+        pthread_cond_broadcast(&q->done);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+static Status threads_init(IoQueue *q)
+{
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->work, NULL);
+    pthread_cond_init(&q->done, NULL);
+    q->reader.q = q->writer.q = q;
+    if (pthread_create(&q->reader.thread, NULL, worker_main, &q->reader) != 0)
+        return e_failure;
+    q->reader.started = 1;
+    if (pthread_create(&q->writer.thread, NULL, worker_main, &q->writer) != 0)
+        return e_failure;
+    q->writer.started = 1;
+    return e_success;
+}
+
+static void threads_stop(IoQueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_broadcast(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    if (q->reader.started)
+        pthread_join(q->reader.thread, NULL);
+    if (q->writer.started)
+        pthread_join(q->writer.thread, NULL);
+    pthread_cond_destroy(&q->done);
+    pthread_cond_destroy(&q->work);
+    pthread_mutex_destroy(&q->lock);
+}
+
+/* ---------------- queue ---------------- */
+
+Status ioq_select_backend(const char *name)
+{
+    if (name == NULL || strcmp(name, "auto") == 0)
+        mode = IOQ_AUTO;
+    else if (strcmp(name, "threads") == 0)
+        mode = IOQ_MODE_THREADS;
+    else if (strcmp(name, "stdio") == 0)
+        mode = IOQ_MODE_STDIO;
+    else if (strcmp(name, "uring") == 0)
+    {
+#ifdef IOQ_URING
+        Uring r;
+        if (uring_init(&r) == e_success)
+        {
+            uring_free(&r);
+            mode = IOQ_MODE_URING;
+            return e_success;
+        }
+#endif
+        fprintf(stderr, "ERROR: io_uring is not available on this system\n");
+        return e_failure;
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unknown I/O backend %s. Available: auto uring threads stdio\n", name);
+        return e_failure;
+    }
+    return e_success;
+}
+
+IoQueue *ioq_open(void)
+{
+    if (mode == IOQ_MODE_STDIO)
+        return NULL;
+    IoQueue *q = calloc(1, sizeof(*q));
+    if (q == NULL)
+        return NULL;
+
+#ifdef IOQ_URING
+    if (mode != IOQ_MODE_THREADS && uring_init(&q->ring) == e_success)
+    {
+        q->uring = 1;
+        return q;
+    }
+#endif
+
+    if (threads_init(q) != e_success)
+    {
+        threads_stop(q);
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+const char *ioq_backend(const IoQueue *q)
+{
+    return q->uring ? "io_uring" : "threads";
+}
+
+void ioq_counts(const IoQueue *q, uint64_t *reads, uint64_t *read_bytes, uint64_t *writes, uint64_t *write_bytes)
+{
+    *reads = q->submitted[0];
+    *read_bytes = q->submitted_bytes[0];
+    *writes = q->submitted[1];
+    *write_bytes = q->submitted_bytes[1];
+}
+
+void ioq_prep(IoOp *op, int fd, int write, void *buf, size_t len, off_t off)
+{
+    memset(op, 0, sizeof(*op));
+    op->fd = fd;
+    op->write = write;
+    op->buf = buf;
+    op->len = len;
+    op->off = off;
+}
+
+void ioq_submit(IoQueue *q, IoOp *op)
+{
+    op->done = 0;
+    op->error = 0;
+    op->complete = op->len == 0;
+    if (op->complete)
+        return;
+    q->submitted[op->write != 0]++;
+    q->submitted_bytes[op->write != 0] += op->len;
+
+#ifdef IOQ_URING
+    if (q->uring)
+    {
+        uring_push(&q->ring, op);
+        return;
+    }
+#endif
+
+    IoWorker *w = op->write ? &q->writer : &q->reader;
+    op->next = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (w->tail)
+        w->tail->next = op;
+    else
+        w->head = op;
+    w->tail = op;
+    pthread_cond_broadcast(&q->work);
+    pthread_mutex_unlock(&q->lock);
+}
+
+Status ioq_wait(IoQueue *q, IoOp *op)
+{
+#ifdef IOQ_URING
+    if (q->uring)
+    {
+        uring_reap(&q->ring);
+        while (!op->complete)
+        {
+            if (uring_enter(q->ring.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            {
+                op->error = errno;
+                break;
+            }
+            uring_reap(&q->ring);
+        }
+        return op->error == 0 && op->done == op->len ? e_success : e_failure;
+    }
+#endif
+
+    pthread_mutex_lock(&q->lock);
+    while (!op->complete)
+        pthread_cond_wait(&q->done, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+    return op->error == 0 && op->done == op->len ? e_success : e_failure;
+}
+
+void ioq_close(IoQueue *q)
+{
+    if (q == NULL)
+        return;
+#ifdef IOQ_URING
+    if (q->uring)
+    {
+        uring_free(&q->ring);
+        free(q);
+        return;
+    }
+#endif
+    threads_stop(q);
+    free(q);
+}
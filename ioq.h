@@ -0,0 +1,62 @@
+#ifndef IOQ_H
+#define IOQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h"
+
+/*
+ * Asynchronous positional I/O queue for the encode/decode pipeline.
+ *
+ * Requests are queued with ioq_submit and complete in the background while
+ * the caller computes; ioq_wait blocks until one of them is done. The queue
+ * runs on io_uring when the kernel offers it (IORING_OP_READ/WRITE, 5.6+),
+ * otherwise on a reader and a writer thread doing pread/pwrite. Short
+ * transfers are continued until the whole request is done or fails.
+ * A queue is driven from one thread.
+ */
+typedef struct _IoOp
+{
+    int fd;
+    int write;              // Non-zero: pwrite, else pread
+    unsigned char *buf;
+    size_t len;
+    off_t off;
+    size_t done;            // Bytes transferred so far
+    int error;              // errno of a failed transfer (EIO for end of file), 0 if none
+    int complete;
+    struct _IoOp *next;     // Worker queue link (thread backend)
+} IoOp;
+
+typedef struct _IoQueue IoQueue;
+
+/*
+ * Pick the backend once, like lsb_select_kernel: "uring", "threads", "stdio"
+ * (no queue: callers keep their serial stdio loops) or NULL / "auto".
+ * Fails if the name is unknown or io_uring was asked for and is unavailable.
+ */
+Status ioq_select_backend(const char *name);
+
+/* Open a queue on the selected backend; NULL for "stdio" or if neither backend starts */
+IoQueue *ioq_open(void);
+
+/* Backend of a queue ("io_uring" or "threads") */
+const char *ioq_backend(const IoQueue *q);
+
+/* Requests and bytes submitted to a queue so far (instrumentation for --stats) */
+void ioq_counts(const IoQueue *q, uint64_t *reads, uint64_t *read_bytes, uint64_t *writes, uint64_t *write_bytes);
+
+/* Fill in a request for [off, off + len) of fd */
+void ioq_prep(IoOp *op, int fd, int write, void *buf, size_t len, off_t off);
+
+/* Start a prepared request; buf must stay valid until ioq_wait returns for it */
+void ioq_submit(IoQueue *q, IoOp *op);
+
+/* Wait for a submitted request to finish; fails if it did not transfer all len bytes */
+Status ioq_wait(IoQueue *q, IoOp *op);
+
+/* Stop the queue; every submitted request must have been waited for */
+void ioq_close(IoQueue *q);
+
+#endif
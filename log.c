@@ -0,0 +1,4 @@
+#include "log.h"
+
+/* Process-wide verbosity; set once before any work starts */
+LogLevel steg_log_level = LOG_LEVEL_INFO;
@@ -0,0 +1,23 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+
+/* Verbosity of the progress output printed by the encode/decode stages */
+typedef enum
+{
+    LOG_LEVEL_ERROR,    // Errors only (stderr)
+    LOG_LEVEL_INFO      // Errors plus step-by-step progress (stdout)
+} LogLevel;
+
+extern LogLevel steg_log_level;
+
+/* Progress chatter: no formatting at all below LOG_LEVEL_INFO */
+#define LOG_INFO(...)                                   \
+    do                                                  \
+    {                                                   \
+        if (steg_log_level >= LOG_LEVEL_INFO)           \
+            printf(__VA_ARGS__);                        \
+    } while (0)
+
+#endif
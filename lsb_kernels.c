@@ -0,0 +1,375 @@
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "lsb_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LSB_X86 1
+#include <immintrin.h>
+#endif
+
+/* Byte-reverse pattern for each 8-byte group (used by shuffle based extract) */
+#define REV8_LO 0x0001020304050607LL
+#define REV8_HI 0x08090A0B0C0D0E0FLL
+
+/* Byte i of every 8-byte group selects bit (7 - i) */
+#define BIT_SELECT 0x0102040810204080LL
+
+static int always_supported(void)
+{
+    return 1;
+}
+
+/* ---------------- scalar: reference bit-by-bit loop ---------------- */
+
+static void embed_scalar(const unsigned char *data, size_t len, unsigned char *image)
+{
+    for (size_t n = 0; n < len; n++, image += 8)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            image[i] &= 0xFE;
+            image[i] |= (data[n] >> (7 - i)) & 0x01;
+        }
+    }
+}
+
+static void extract_scalar(const unsigned char *image, size_t len, unsigned char *data)
+{
+    for (size_t n = 0; n < len; n++, image += 8)
+    {
+        unsigned char byte = 0;
+        for (int i = 0; i < 8; i++)
+            byte = (byte << 1) | (image[i] & 0x01);
+        data[n] = byte;
+    }
+}
+
+/* ---------------- swar: one 64-bit word per data byte ---------------- */
+
+static void embed_swar(const unsigned char *data, size_t len, unsigned char *image)
+{
+    for (size_t n = 0; n < len; n++)
+        lsb_embed_byte(data[n], image + n * 8);
+}
+
+static void extract_swar(const unsigned char *image, size_t len, unsigned char *data)
+{
+    for (size_t n = 0; n < len; n++)
+        data[n] = lsb_extract_byte(image + n * 8);
+}
+
+#ifdef LSB_X86
+
+/* ---------------- bmi2: pdep/pext ---------------- */
+
+static int bmi2_supported(void)
+{
+    return __builtin_cpu_supports("bmi2");
+}
+
+__attribute__((target("bmi2")))
+static void embed_bmi2(const unsigned char *data, size_t len, unsigned char *image)
+{
+    for (size_t n = 0; n < len; n++, image += 8)
+    {
+        uint64_t img;
+        // pdep puts bit i in byte i; bswap flips it to the MSB-first layout
+        uint64_t bits = __builtin_bswap64(_pdep_u64(data[n], 0x0101010101010101ULL));
+        memcpy(&img, image, 8);
+        img = (img & 0xFEFEFEFEFEFEFEFEULL) | bits;
+        memcpy(image, &img, 8);
+    }
+}
+
+__attribute__((target("bmi2")))
+static void extract_bmi2(const unsigned char *image, size_t len, unsigned char *data)
+{
+    for (size_t n = 0; n < len; n++, image += 8)
+    {
+        uint64_t img;
+        memcpy(&img, image, 8);
+        data[n] = (unsigned char)_pext_u64(__builtin_bswap64(img), 0x0101010101010101ULL);
+    }
+}
+
+/* ---------------- sse2: 16 image bytes per vector ---------------- */
+
+static int sse2_supported(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+/* Bit-reverse table for the movemask based extract, filled by lsb_init */
+static unsigned char rev8[256];
+
+__attribute__((target("sse2")))
+static void embed_sse2(const unsigned char *data, size_t len, unsigned char *image)
+{
+    const __m128i select = _mm_set1_epi64x(BIT_SELECT);
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i keep = _mm_set1_epi8((char)0xFE);
+    size_t n = 0;
+
+    for (; n + 2 <= len; n += 2, image += 16)
+    {
+        // Replicate data[n] into bytes 0-7 and data[n + 1] into bytes 8-15
+        __m128i d = _mm_cvtsi32_si128(data[n] | (data[n + 1] << 8));
+        d = _mm_unpacklo_epi8(d, d);
+        d = _mm_unpacklo_epi16(d, d);
+        d = _mm_unpacklo_epi32(d, d);
+
+        __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(d, select), select), ones);
+        __m128i img = _mm_loadu_si128((const __m128i *)image);
+        _mm_storeu_si128((__m128i *)image, _mm_or_si128(_mm_and_si128(img, keep), bits));
+    }
+    embed_swar(data + n, len - n, image);
+}
+
+__attribute__((target("sse2")))
+static void extract_sse2(const unsigned char *image, size_t len, unsigned char *data)
+{
+    const unsigned char *rev = rev8;
+    size_t n = 0;
+
+    for (; n + 2 <= len; n += 2, image += 16)
+    {
+        // Move each LSB into the sign bit, then gather the 16 sign bits
+        __m128i img = _mm_loadu_si128((const __m128i *)image);
+        int mask = _mm_movemask_epi8(_mm_slli_epi64(img, 7));
+        data[n] = rev[mask & 0xFF];
+        data[n + 1] = rev[(mask >> 8) & 0xFF];
+    }
+    extract_swar(image, len - n, data + n);
+}
+
+/* ---------------- avx2: 32 image bytes per vector ---------------- */
+
+static int avx2_supported(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void embed_avx2(const unsigned char *data, size_t len, unsigned char *image)
+{
+    const __m256i spread = _mm256_set_epi64x(0x0303030303030303LL, 0x0202020202020202LL,
+                                             0x0101010101010101LL, 0);
+    const __m256i select = _mm256_set1_epi64x(BIT_SELECT);
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i keep = _mm256_set1_epi8((char)0xFE);
+    size_t n = 0;
+
+    for (; n + 4 <= len; n += 4, image += 32)
+    {
+        uint32_t word;
+        memcpy(&word, data + n, 4);
+
+        // Byte 8k + i of the vector holds data[n + k]; keep only its bit (7 - i)
+        __m256i d = _mm256_shuffle_epi8(_mm256_set1_epi32((int)word), spread);
+        __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(d, select), select), ones);
+        __m256i img = _mm256_loadu_si256((const __m256i *)image);
+        _mm256_storeu_si256((__m256i *)image, _mm256_or_si256(_mm256_and_si256(img, keep), bits));
+    }
+    embed_swar(data + n, len - n, image);
+}
+
+__attribute__((target("avx2")))
+static void extract_avx2(const unsigned char *image, size_t len, unsigned char *data)
+{
+    const __m256i reverse = _mm256_set_epi64x(REV8_HI, REV8_LO, REV8_HI, REV8_LO);
+    size_t n = 0;
+
+    for (; n + 4 <= len; n += 4, image += 32)
+    {
+        // Reverse each 8-byte group so movemask yields the data bytes MSB first
+        __m256i img = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)image), reverse);
+        uint32_t word = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi64(img, 7));
+        memcpy(data + n, &word, 4);
+    }
+    extract_swar(image, len - n, data + n);
+}
+
+/* ---------------- avx512bw: 64 image bytes per vector ---------------- */
+
+static int avx512bw_supported(void)
+{
+    return __builtin_cpu_supports("avx512bw");
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void embed_avx512bw(const unsigned char *data, size_t len, unsigned char *image)
+{
+    const __m512i spread = _mm512_set_epi64(0x0707070707070707LL, 0x0606060606060606LL,
+                                            0x0505050505050505LL, 0x0404040404040404LL,
+                                            0x0303030303030303LL, 0x0202020202020202LL,
+                                            0x0101010101010101LL, 0);
+    const __m512i select = _mm512_set1_epi64(BIT_SELECT);
+    const __m512i ones = _mm512_set1_epi8(1);
+    const __m512i keep = _mm512_set1_epi8((char)0xFE);
+    size_t n = 0;
+
+    for (; n + 8 <= len; n += 8, image += 64)
+    {
+        uint64_t word;
+        memcpy(&word, data + n, 8);
+
+        __m512i d = _mm512_shuffle_epi8(_mm512_set1_epi64((long long)word), spread);
+        __mmask64 bits = _mm512_test_epi8_mask(d, select);
+        __m512i img = _mm512_loadu_si512((const void *)image);
+        img = _mm512_or_si512(_mm512_and_si512(img, keep), _mm512_maskz_mov_epi8(bits, ones));
+        _mm512_storeu_si512((void *)image, img);
+    }
+    embed_swar(data + n, len - n, image);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void extract_avx512bw(const unsigned char *image, size_t len, unsigned char *data)
+{
+    const __m512i reverse = _mm512_set_epi64(REV8_HI, REV8_LO, REV8_HI, REV8_LO,
+                                             REV8_HI, REV8_LO, REV8_HI, REV8_LO);
+    const __m512i ones = _mm512_set1_epi8(1);
+    size_t n = 0;
+
+    for (; n + 8 <= len; n += 8, image += 64)
+    {
+        __m512i img = _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)image), reverse);
+        uint64_t word = (uint64_t)_mm512_test_epi8_mask(img, ones);
+        memcpy(data + n, &word, 8);
+    }
+    extract_swar(image, len - n, data + n);
+}
+
+#endif /* LSB_X86 */
+
+/* ---------------- multi-bit depths: 2 and 4 LSBs per image byte ---------------- */
+
+static void embed_depth2(const unsigned char *data, size_t len, unsigned char *image)
+{
+    for (size_t n = 0; n < len; n++, image += 4)
+    {
+        uint32_t img, d = data[n];
+        // Bit pairs of d, most significant first, into the low 2 bits of 4 image bytes
+        uint32_t bits = (d >> 6) | ((d >> 4) & 3) << 8 | ((d >> 2) & 3) << 16 | (d & 3) << 24;
+        memcpy(&img, image, 4);
+        img = (img & 0xFCFCFCFCu) | bits;
+        memcpy(image, &img, 4);
+    }
+}
+
+static void extract_depth2(const unsigned char *image, size_t len, unsigned char *data)
+{
+    for (size_t n = 0; n < len; n++, image += 4)
+    {
+        uint32_t img;
+        memcpy(&img, image, 4);
+        img &= 0x03030303u;
+        data[n] = (unsigned char)((img & 3) << 6 | ((img >> 8) & 3) << 4 | ((img >> 16) & 3) << 2 | img >> 24);
+    }
+}
+
+static void embed_depth4(const unsigned char *data, size_t len, unsigned char *image)
+{
+    for (size_t n = 0; n < len; n++, image += 2)
+    {
+        image[0] = (image[0] & 0xF0) | (data[n] >> 4);
+        image[1] = (image[1] & 0xF0) | (data[n] & 0x0F);
+    }
+}
+
+static void extract_depth4(const unsigned char *image, size_t len, unsigned char *data)
+{
+    for (size_t n = 0; n < len; n++, image += 2)
+        data[n] = (unsigned char)((image[0] & 0x0F) << 4 | (image[1] & 0x0F));
+}
+
+/* Ordered fastest first: "auto" picks the first supported entry */
+static const LsbKernel kernels[] = {
+#ifdef LSB_X86
+    {"avx512bw", embed_avx512bw, extract_avx512bw, avx512bw_supported},
+    {"avx2", embed_avx2, extract_avx2, avx2_supported},
+    {"sse2", embed_sse2, extract_sse2, sse2_supported},
+    {"bmi2", embed_bmi2, extract_bmi2, bmi2_supported},
+#endif
+    {"swar", embed_swar, extract_swar, always_supported},
+    {"scalar", embed_scalar, extract_scalar, always_supported},
+};
+
+static const LsbKernel *selected;     // Read and written atomically
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/* One-time setup: CPU feature detection, tables and the default kernel */
+static void lsb_init(void)
+{
+#ifdef LSB_X86
+    __builtin_cpu_init();
+    for (int v = 0; v < 256; v++)
+    {
+        unsigned char r = 0;
+        for (int i = 0; i < 8; i++)
+            r |= ((v >> i) & 1) << (7 - i);
+        rev8[v] = r;
+    }
+#endif
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+        if (kernels[i].supported())
+        {
+            __atomic_store_n(&selected, &kernels[i], __ATOMIC_RELEASE);
+            break;
+        }
+    }
+}
+
+const LsbKernel *lsb_kernel_list(size_t *count)
+{
+    pthread_once(&init_once, lsb_init);
+    *count = sizeof(kernels) / sizeof(kernels[0]);
+    return kernels;
+}
+
+Status lsb_select_kernel(const char *name)
+{
+    size_t count = sizeof(kernels) / sizeof(kernels[0]);
+
+    pthread_once(&init_once, lsb_init);
+    if (name == NULL || strcmp(name, "auto") == 0)
+        return lsb_kernel() ? e_success : e_failure;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strcmp(kernels[i].name, name) != 0)
+            continue;
+        if (!kernels[i].supported())
+            return e_failure;
+        __atomic_store_n(&selected, &kernels[i], __ATOMIC_RELEASE);
+        return e_success;
+    }
+    return e_failure;
+}
+
+const LsbKernel *lsb_kernel(void)
+{
+    pthread_once(&init_once, lsb_init);
+    return __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+}
+
+void lsb_embed_bits(const unsigned char *data, size_t len, unsigned char *image, int depth)
+{
+    if (depth == 4)
+        embed_depth4(data, len, image);
+    else if (depth == 2)
+        embed_depth2(data, len, image);
+    else
+        lsb_kernel()->embed(data, len, image);
+}
+
+void lsb_extract_bits(const unsigned char *image, size_t len, unsigned char *data, int depth)
+{
+    if (depth == 4)
+        extract_depth4(image, len, data);
+    else if (depth == 2)
+        extract_depth2(image, len, data);
+    else
+        lsb_kernel()->extract(image, len, data);
+}
@@ -0,0 +1,76 @@
+#ifndef LSB_KERNELS_H
+#define LSB_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "types.h"
+
+/*
+ * Block LSB kernels.
+ * embed:   write the bits of len data bytes into the LSBs of len * 8 image bytes (MSB first)
+ * extract: rebuild len data bytes from the LSBs of len * 8 image bytes
+ */
+typedef void (*lsb_embed_fn)(const unsigned char *data, size_t len, unsigned char *image);
+typedef void (*lsb_extract_fn)(const unsigned char *image, size_t len, unsigned char *data);
+
+typedef struct _LsbKernel
+{
+    const char *name;           // Name accepted by --kernel=
+    lsb_embed_fn embed;
+    lsb_extract_fn extract;
+    int (*supported)(void);     // Non-zero if this CPU can run the kernel
+} LsbKernel;
+
+/*
+ * Select a kernel by name ("auto" or NULL keeps the fastest supported one).
+ * Fails, printing nothing, if the name is unknown or the CPU cannot run it;
+ * lsb_kernel_list tells the two apart. The choice is process-wide and is
+ * swapped atomically, but a call made while other threads embed or extract
+ * takes effect for them at an unspecified point, so make it at startup.
+ */
+Status lsb_select_kernel(const char *name);
+
+/* Currently selected kernel (selects "auto" on first use) */
+const LsbKernel *lsb_kernel(void);
+
+/* All kernels compiled into this binary */
+const LsbKernel *lsb_kernel_list(size_t *count);
+
+/* Carrier bytes holding len payload bytes at the given LSB depth (1, 2 or 4) */
+static inline size_t lsb_carrier_bytes(size_t len, int depth)
+{
+    return len * (size_t)(8 / depth);
+}
+
+/* Embed/extract at 1, 2 or 4 LSBs per image byte (depth 1 uses the selected kernel) */
+void lsb_embed_bits(const unsigned char *data, size_t len, unsigned char *image, int depth);
+void lsb_extract_bits(const unsigned char *image, size_t len, unsigned char *data, int depth);
+
+/* Single-byte helpers: 64-bit SWAR, shared by the header field code */
+static inline uint64_t lsb_spread_byte(unsigned char data)
+{
+    // Copy data into every byte, keep bit (7 - i) in byte i, then turn non-zero bytes into 0x01
+    uint64_t v = ((uint64_t)data * 0x0101010101010101ULL) & 0x0102040810204080ULL;
+    return ((v + 0x7F7F7F7F7F7F7F7FULL) & 0x8080808080808080ULL) >> 7;
+}
+
+static inline void lsb_embed_byte(unsigned char data, unsigned char *image)
+{
+    uint64_t img;
+
+    memcpy(&img, image, 8);
+    img = (img & 0xFEFEFEFEFEFEFEFEULL) | lsb_spread_byte(data);
+    memcpy(image, &img, 8);
+}
+
+static inline unsigned char lsb_extract_byte(const unsigned char *image)
+{
+    uint64_t img;
+
+    memcpy(&img, image, 8);
+    // Gather the 8 LSBs into one byte, image[0] landing in bit 7
+    return (unsigned char)(((img & 0x0101010101010101ULL) * 0x8040201008040201ULL) >> 56);
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include <string.h>
+#include <stdint.h>
+#include "lz.h"
+
+#define LZ_MIN_MATCH     4
+#define LZ_LAST_LITERALS 5      // Matches stop this many bytes before the end of a block
+#define LZ_MAX_OFFSET    65535
+#define LZ_HASH_BITS     12
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Append the 255-run extension of a length that did not fit in its token nibble */
+static unsigned char *put_length(unsigned char *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* Emit one sequence (offset 0 = literals only); returns NULL if dst would overflow */
+static unsigned char *put_sequence(unsigned char *op, const unsigned char *end, const unsigned char *lit,
+                                   size_t lit_len, size_t offset, size_t match_len)
+{
+    size_t ml = offset ? match_len - LZ_MIN_MATCH : 0;
+    size_t need = 1 + lit_len + lit_len / 255 + 1 + (offset ? 2 + ml / 255 + 1 : 0);
+    if (need > (size_t)(end - op))
+        return NULL;
+
+    *op++ = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4 | (ml < 15 ? ml : 15));
+    if (lit_len >= 15)
+        op = put_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (offset)
+    {
+        *op++ = (unsigned char)(offset & 0xFF);
+        *op++ = (unsigned char)(offset >> 8);
+        if (ml >= 15)
+            op = put_length(op, ml - 15);
+    }
+    return op;
+}
+
+size_t lz_compress(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_cap)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    unsigned char *op = dst;
+    const unsigned char *end = dst + dst_cap;
+    size_t anchor = 0, i = 0;
+
+    memset(table, 0xFF, sizeof(table));
+
+    if (src_len > LZ_MIN_MATCH + LZ_LAST_LITERALS)
+    {
+        size_t limit = src_len - LZ_LAST_LITERALS - LZ_MIN_MATCH + 1;
+        while (i < limit)
+        {
+            uint32_t v = read32(src + i);
+            uint32_t h = hash4(v);
+            uint32_t cand = table[h];
+            table[h] = (uint32_t)i;
+
+            if (cand == UINT32_MAX || i - cand > LZ_MAX_OFFSET || read32(src + cand) != v)
+            {
+                // Step faster through data that keeps failing to match
+                i += 1 + ((i - anchor) >> 6);
+                continue;
+            }
+
+            size_t len = LZ_MIN_MATCH, max = src_len - LZ_LAST_LITERALS - i;
+            while (len < max && src[cand + len] == src[i + len])
+                len++;
+
+            op = put_sequence(op, end, src + anchor, i - anchor, i - cand, len);
+            if (op == NULL)
+                return 0;
+            i += len;
+            anchor = i;
+        }
+    }
+
+    op = put_sequence(op, end, src + anchor, src_len - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+/* Read a 255-run length extension and add it to *len */
+static int get_length(const unsigned char **ip, const unsigned char *iend, size_t *len, size_t limit)
+{
+    unsigned char b;
+    do
+    {
+        if (*ip >= iend || *len > limit)
+            return 0;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+Status lz_decompress(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_len)
+{
+    const unsigned char *ip = src, *iend = src + src_len;
+    unsigned char *op = dst, *oend = dst + dst_len;
+
+    while (ip < iend)
+    {
+        unsigned token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_length(&ip, iend, &lit, dst_len))
+            return e_failure;
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+            return e_failure;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        // The last sequence has no match part
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return e_failure;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+
+        size_t ml = token & 15;
+        if (ml == 15 && !get_length(&ip, iend, &ml, dst_len))
+            return e_failure;
+        ml += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) || ml > (size_t)(oend - op))
+            return e_failure;
+
+        // Overlapping matches (offset < length) repeat the last offset bytes
+        const unsigned char *match = op - offset;
+        if (offset >= ml)
+            memcpy(op, match, ml);
+        else
+            for (size_t k = 0; k < ml; k++)
+                op[k] = match[k];
+        op += ml;
+    }
+
+    return op == oend ? e_success : e_failure;
+}
+
+size_t lz_encode_frame(const unsigned char *raw, size_t raw_len, unsigned char *frame)
+{
+    // Keep the block raw unless compression saves at least one byte
+    size_t stored = raw_len > 1 ? lz_compress(raw, raw_len, frame + LZ_FRAME_HEADER, raw_len - 1) : 0;
+    if (stored == 0)
+    {
+        memcpy(frame + LZ_FRAME_HEADER, raw, raw_len);
+        stored = raw_len;
+    }
+
+    lz_put_frame_header(frame, (uint32_t)raw_len, (uint32_t)stored);
+    return LZ_FRAME_HEADER + stored;
+}
+
+size_t lz_store_frame(const unsigned char *raw, size_t raw_len, unsigned char *frame)
+{
+    memcpy(frame + LZ_FRAME_HEADER, raw, raw_len);
+    lz_put_frame_header(frame, (uint32_t)raw_len, (uint32_t)raw_len);
+    return LZ_FRAME_HEADER + raw_len;
+}
+
+Status lz_decode_frame(const unsigned char *stored, size_t stored_len, unsigned char *raw, size_t raw_len)
+{
+    if (stored_len == raw_len)
+    {
+        memcpy(raw, stored, raw_len);
+        return e_success;
+    }
+    return lz_decompress(stored, stored_len, raw, raw_len);
+}
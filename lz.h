@@ -0,0 +1,60 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Small LZ77 block codec in the LZ4 style: a token byte holds a literal
+ * run length and a match length (4 bits each, extended with 255-runs),
+ * followed by the literals and a 2-byte little-endian match offset.
+ * The last sequence of a block carries literals only.
+ *
+ * A compressed payload is a stream of independent frames:
+ *
+ *   raw length (u32 BE) | stored length (u32 BE) | stored bytes
+ *
+ * stored length == raw length means the block was kept uncompressed.
+ * A frame with raw length 0 ends the stream.
+ */
+#define LZ_BLOCK_SIZE    (64 * 1024)    // Raw bytes per frame
+#define LZ_FRAME_HEADER  8
+#define LZ_FRAME_MAX     (LZ_FRAME_HEADER + LZ_BLOCK_SIZE)
+
+static inline void lz_put_frame_header(unsigned char *p, uint32_t raw_len, uint32_t stored_len)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = (unsigned char)(raw_len >> (24 - 8 * i));
+        p[4 + i] = (unsigned char)(stored_len >> (24 - 8 * i));
+    }
+}
+
+/* Parse a frame header; returns 0 if the lengths are out of range */
+static inline int lz_get_frame_header(const unsigned char *p, uint32_t *raw_len, uint32_t *stored_len)
+{
+    *raw_len = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    *stored_len = (uint32_t)p[4] << 24 | (uint32_t)p[5] << 16 | (uint32_t)p[6] << 8 | p[7];
+    return *raw_len <= LZ_BLOCK_SIZE && *stored_len <= *raw_len;
+}
+
+/* Compress src into dst; returns the compressed size, or 0 if it does not fit in dst_cap */
+size_t lz_compress(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_cap);
+
+/* Decompress src into exactly dst_len bytes at dst */
+Status lz_decompress(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_len);
+
+/*
+ * Build a complete frame (header included) for raw_len <= LZ_BLOCK_SIZE bytes.
+ * frame must hold LZ_FRAME_HEADER + raw_len bytes. Returns the frame size.
+ */
+size_t lz_encode_frame(const unsigned char *raw, size_t raw_len, unsigned char *frame);
+
+/* Build a frame that stores raw_len <= LZ_BLOCK_SIZE bytes uncompressed */
+size_t lz_store_frame(const unsigned char *raw, size_t raw_len, unsigned char *frame);
+
+/* Rebuild raw_len bytes from the stored bytes of one frame */
+Status lz_decode_frame(const unsigned char *stored, size_t stored_len, unsigned char *raw, size_t raw_len);
+
+#endif
@@ -10,10 +10,119 @@ Description: The Steganography project involves both encoding and decoding proce
 */
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include "encode.h"
 #include "decode.h"
 #include "types.h"
 #include "common.h"
+#include "lsb_kernels.h"
+#include "ioq.h"
+#include "batch.h"
+#include "scan.h"
+#include "sharding.h"
+#include "pio.h"
+#include "opstats.h"
+#include "log.h"
+
+/* Command line options shared by encode and decode */
+typedef struct
+{
+    int use_mmap;          // --mmap: work on memory-mapped files
+    const char *kernel;    // --kernel=NAME: force an LSB kernel
+    const char *io;        // --io=NAME: I/O backend of the payload pipeline
+    int threads;           // -j N: worker threads for the payload region (or batch jobs)
+    const char *batch;     // --batch FILE: run the jobs listed in a TSV file
+    const char *scan;      // --scan DIR: look for stego images under a directory
+    int depth;             // --bits K: LSBs per carrier byte used for the payload
+    int compress;          // -z / --compress: LZ-compress the payload before embedding
+    int skip_alpha;        // --skip-alpha: leave the alpha bytes of 32-bpp carriers untouched
+    const char *entry;     // --entry NAME: container entry to extract
+    int has_range;         // --offset / --length given
+    uint64_t offset;       // --offset N: first payload byte to extract
+    uint64_t length;       // --length N: payload bytes to extract (0 = to the end)
+    int crc;               // --crc: store per-chunk CRC32C checksums after the payload
+    int verify;            // --verify: check the checksums of the images given instead of decoding
+    const char *key_file;  // --key FILE: seal (or open) the payload with the 32-byte key in FILE
+    int scatter;           // --scatter: spread the payload over the carrier in key-permuted blocks
+    int shard;             // --shard: stripe a secret over the carriers given
+    int join;              // --join: reassemble a payload from the shard images given
+    int in_place;          // --in-place: embed into the carrier file itself, writing only changed blocks
+    int same_size;         // --same-size: --in-place over a payload with the same header
+    int quiet;             // -q / --quiet: errors only, no progress messages
+    const char *stats;     // --stats=FORMAT: per-operation timings and counters ("json")
+} CliOptions;
+
+// Strip --options out of argv, leaving the positional arguments in order. Returns the new argc.
+int parse_options(int argc, char *argv[], CliOptions *opts)
+{
+    int n = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--mmap") == 0)
+            opts->use_mmap = 1;
+        else if (strncmp(argv[i], "--kernel=", 9) == 0)
+            opts->kernel = argv[i] + 9;
+        else if (strncmp(argv[i], "--io=", 5) == 0)
+            opts->io = argv[i] + 5;
+        else if (strncmp(argv[i], "--stats=", 8) == 0)
+            opts->stats = argv[i] + 8;
+        else if (strcmp(argv[i], "--quiet") == 0 || strcmp(argv[i], "-q") == 0)
+            opts->quiet = 1;
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            opts->batch = argv[++i];
+        else if (strcmp(argv[i], "--scan") == 0 && i + 1 < argc)
+            opts->scan = argv[++i];
+        else if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc)
+            opts->depth = atoi(argv[++i]);
+        else if (strncmp(argv[i], "--bits=", 7) == 0)
+            opts->depth = atoi(argv[i] + 7);
+        else if (strcmp(argv[i], "--compress") == 0 || strcmp(argv[i], "-z") == 0)
+            opts->compress = 1;
+        else if (strcmp(argv[i], "--crc") == 0)
+            opts->crc = 1;
+        else if (strcmp(argv[i], "--verify") == 0)
+            opts->verify = 1;
+        else if (strcmp(argv[i], "--skip-alpha") == 0)
+            opts->skip_alpha = 1;
+        else if (strcmp(argv[i], "--scatter") == 0)
+            opts->scatter = 1;
+        else if (strcmp(argv[i], "--in-place") == 0)
+            opts->in_place = 1;
+        else if (strcmp(argv[i], "--same-size") == 0)
+            opts->same_size = 1;
+        else if (strcmp(argv[i], "--shard") == 0)
+            opts->shard = 1;
+        else if (strcmp(argv[i], "--join") == 0)
+            opts->join = 1;
+        else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+            opts->key_file = argv[++i];
+        else if (strcmp(argv[i], "--entry") == 0 && i + 1 < argc)
+            opts->entry = argv[++i];
+        else if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc)
+        {
+            opts->offset = strtoull(argv[++i], NULL, 0);
+            opts->has_range = 1;
+        }
+        else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc)
+        {
+            opts->length = strtoull(argv[++i], NULL, 0);
+            opts->has_range = 1;
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            opts->threads = atoi(argv[++i]);
+        else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0')
+            opts->threads = atoi(argv[i] + 2);
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return -1;
+        }
+        else
+            argv[n++] = argv[i];
+    }
+    argv[n] = NULL;
+    return n;
+}
 
 // Function to check whether the operation is encode or decode
 OperationType check_operation_type(char *argv[])
@@ -22,24 +131,189 @@ OperationType check_operation_type(char *argv[])
         return e_encode;
     else if (strcmp(argv[1], "-d") == 0)
         return e_decode;
+    else if (strcmp(argv[1], "-i") == 0)
+        return e_probe;
+    else if (strcmp(argv[1], "-c") == 0)
+        return e_container;
+    else if (strcmp(argv[1], "-l") == 0)
+        return e_list;
     else
         return e_unsupported;
 }
 
+// Explain why lsb_select_kernel refused a --kernel= name; the library itself prints nothing
+void report_kernel_error(const char *name)
+{
+    size_t count;
+    const LsbKernel *kernels = lsb_kernel_list(&count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strcmp(kernels[i].name, name) == 0)
+        {
+            fprintf(stderr, "ERROR: Kernel %s is not supported on this CPU\n", name);
+            return;
+        }
+    }
+    fprintf(stderr, "ERROR: Unknown kernel %s. Available:", name);
+    for (size_t i = 0; i < count; i++)
+        fprintf(stderr, " %s", kernels[i].name);
+    fprintf(stderr, "\n");
+}
+
 int main(int argc, char *argv[])
 {
+    CliOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    argc = parse_options(argc, argv, &opts);
+
+    // Pick the LSB kernel once, from CPUID unless overridden
+    if (lsb_select_kernel(opts.kernel) != e_success)
+    {
+        report_kernel_error(opts.kernel);
+        return 1;
+    }
+    if (ioq_select_backend(opts.io) != e_success)
+        return 1;
+    if (opts.stats && strcmp(opts.stats, "json") != 0)
+    {
+        fprintf(stderr, "ERROR: Unknown stats format %s. Available: json\n", opts.stats);
+        return 1;
+    }
+    if (opts.quiet)
+        steg_log_level = LOG_LEVEL_ERROR;
+
+    // Batch mode: -j sets how many jobs run at once
+    if (opts.batch)
+        return run_batch(opts.batch, opts.threads) == e_success ? 0 : 1;
+
+    // Scan mode: -j sets the walker threads (default one per CPU)
+    if (opts.scan)
+        return run_scan(opts.scan, opts.threads) == e_success ? 0 : 1;
+
+    // Verify mode: every positional argument is an image, checked on -j threads
+    if (opts.verify)
+    {
+        int ret = 0;
+        steg_log_level = LOG_LEVEL_ERROR;
+        if (argc < 2)
+        {
+            printf("Usage: %s --verify <stego.bmp> [more.bmp ...] [-j N]\n", argv[0]);
+            return 1;
+        }
+        for (int i = 1; i < argc; i++)
+        {
+            DecodeInfo verInfo;
+            memset(&verInfo, 0, sizeof(verInfo));
+            verInfo.threads = opts.threads;
+            if (strlen(argv[i]) >= sizeof(verInfo.stego_image_fname))
+            {
+                fprintf(stderr, "ERROR: Source file name is too long.\n");
+                ret = 1;
+                continue;
+            }
+            strcpy(verInfo.stego_image_fname, argv[i]);
+            if (do_verify(&verInfo) != d_success)
+                ret = 1;
+        }
+        return ret;
+    }
+
+    // Shard and join take their own positional arguments; too few is an error, not a request for help
+    if (opts.shard && argc < 4)
+    {
+        printf("Usage: %s --shard <secret> <out_prefix> <carrier.bmp>... [-j N] [--bits 1|2|4] [--crc] [--key FILE]\n", argv[0]);
+        return 1;
+    }
+    if (opts.join && argc < 3)
+    {
+        printf("Usage: %s --join <output> <shard.bmp>... [-j N] [--key FILE]\n", argv[0]);
+        return 1;
+    }
+
     if (argc < 3)
     {
         printf("Usage:\n");
-        printf("For encoding: %s -e <.bmp file> <secret.txt> [output.bmp]\n", argv[0]); // Updated Usage
-        printf("For decoding: %s -d <stego.bmp> <output.txt>\n", argv[0]);
+        printf("For encoding: %s -e <.bmp file> <secret.txt> [output.bmp] [--mmap] [--kernel=NAME] [--io=NAME] [-j N] [--bits 1|2|4] [-z] [--skip-alpha] [--crc] [--key FILE [--scatter]] [--stats=json] [-q]\n", argv[0]); // Updated Usage
+        printf("For in-place: %s -e <.bmp file> <secret> --in-place|--same-size [--bits 1|2|4] [--crc] [--key FILE]\n", argv[0]);
+        printf("For decoding: %s -d <stego.bmp> <output.txt> [--mmap] [--kernel=NAME] [--io=NAME] [-j N] [--offset N] [--length N] [--key FILE] [--stats=json] [-q]\n", argv[0]);
+        printf("For a container: %s -c <.bmp file> <output.bmp> <file>... [--bits 1|2|4] [--crc]\n", argv[0]);
+        printf("For one entry  : %s -d <stego.bmp> <output> --entry NAME  (list entries with -l <stego.bmp>)\n", argv[0]);
+        printf("For header info: %s -i <stego.bmp> [more.bmp ...]\n", argv[0]);
+        printf("For checksums  : %s --verify <stego.bmp> [more.bmp ...] [-j N]\n", argv[0]);
+        printf("For sharding   : %s --shard <secret> <out_prefix> <carrier.bmp>... [-j N] [--bits 1|2|4] [--crc] [--key FILE]\n", argv[0]);
+        printf("For joining    : %s --join <output> <shard.bmp>... [-j N] [--key FILE]\n", argv[0]);
+        printf("For batch jobs: %s --batch <jobs.tsv> [-j N]\n", argv[0]);
+        printf("For a tree scan: %s --scan <dir> [-j N]\n", argv[0]);
+        printf("Use - in place of a file name to read from stdin or write to stdout.\n");
         return 0;
     }
 
     OperationType opt = check_operation_type(argv);
+    int ret = 1;
+
+    // When stdout carries image or payload data, keep progress messages off it
+    const char *data_out = NULL;
+    if (opt == e_encode && argc > 4)
+        data_out = argv[4];
+    else if (opt == e_container)
+        data_out = argv[3];
+    else if (opt == e_decode && argc > 3)
+        data_out = argv[3];
+    int quiet = is_stdio_name(data_out) || opts.quiet;
+
+    // --stats=json: one record per operation on stdout, which then carries nothing else
+    // (stderr if stdout carries the data)
+    OpStats op_stats, *stats = opts.stats ? &op_stats : NULL;
+    FILE *stats_out = is_stdio_name(data_out) ? stderr : stdout;
+    if (stats)
+        quiet = 1;
+    if (quiet)
+        steg_log_level = LOG_LEVEL_ERROR;
 
     EncodeInfo encInfo;
     DecodeInfo decInfo;
+    memset(&encInfo, 0, sizeof(encInfo));
+    memset(&decInfo, 0, sizeof(decInfo));
+    encInfo.use_mmap = opts.use_mmap;
+    decInfo.use_mmap = opts.use_mmap;
+    encInfo.threads = opts.threads;
+    encInfo.depth = opts.depth;
+    encInfo.compress = opts.compress;
+    encInfo.skip_alpha = opts.skip_alpha;
+    encInfo.crc = opts.crc;
+    encInfo.scatter = opts.scatter;
+    encInfo.in_place = opts.in_place || opts.same_size;
+    encInfo.same_size = opts.same_size;
+    encInfo.stats = stats;
+    decInfo.stats = stats;
+    decInfo.threads = opts.threads;
+    decInfo.entry = opts.entry;
+    decInfo.has_range = opts.has_range;
+    decInfo.range_offset = opts.offset;
+    decInfo.range_length = opts.length;
+    if (opts.key_file)
+    {
+        if (load_key_file(opts.key_file, encInfo.key, sizeof(encInfo.key)) != e_success)
+        {
+            fprintf(stderr, "ERROR: %s must hold a 32-byte key (raw, or 64 hex digits)\n", opts.key_file);
+            return 1;
+        }
+        memcpy(decInfo.key, encInfo.key, sizeof(decInfo.key));
+        encInfo.encrypt = decInfo.has_key = 1;
+    }
+
+    // Shard and join modes: the positional arguments are files, run as jobs on -j threads
+    if (opts.shard || opts.join)
+    {
+        if (opts.shard)
+            ret = run_shard(argv[1], argv[2], argv + 3, argc - 3, &encInfo, opts.threads) == e_success ? 0 : 1;
+        else
+            ret = run_join(argv[1], argv + 2, argc - 2, decInfo.has_key ? decInfo.key : NULL, opts.threads) == e_success ? 0 : 1;
+        memset(encInfo.key, 0, sizeof(encInfo.key));
+        memset(decInfo.key, 0, sizeof(decInfo.key));
+        return ret;
+    }
 
     switch (opt)
     {
@@ -52,27 +326,44 @@ int main(int argc, char *argv[])
             return 0;
         }
 
+        if (encInfo.in_place && argc == 5)
+        {
+            printf("--in-place writes into the source image; no output file is taken.\n");
+            return 0;
+        }
+
         // Determine the output filename for printing info
-        char *output_filename = (argc == 5) ? argv[4] : "steg.bmp (default)";
+        char *output_filename = encInfo.in_place ? argv[2] : (argc == 5) ? argv[4] : "steg.bmp (default)";
 
-        printf("Selected encoding operation.\n");
-        printf("Input BMP file   : %s\n", argv[2]);
-        printf("Secret text file : %s\n", argv[3]);
-        printf("Output BMP file  : %s\n", output_filename); // Print determined name
+        if (!quiet)
+        {
+            printf("Selected encoding operation.\n");
+            printf("Input BMP file   : %s\n", argv[2]);
+            printf("Secret text file : %s\n", argv[3]);
+            printf("Output BMP file  : %s\n", output_filename); // Print determined name
+        }
 
         // Pass arguments to validation function
         if (read_and_validate_encode_args(argv, &encInfo) == e_success)
         {
-            if (do_encoding(&encInfo) == e_success)
+            if (stats)
+                opstats_begin(stats);
+            Status status = do_encoding(&encInfo);
+            if (stats)
+                opstats_emit(stats, stats_out, "encode", status == e_success, encInfo.threads);
+            if (status == e_success)
             {
                 // Print the *actual* final filename stored in encInfo, which handles the default
-                printf("Encoding completed successfully.\nOutput file saved as: %s\n", encInfo.stego_image_fname);
+                if (!quiet)
+                    printf("Encoding completed successfully.\nOutput file saved as: %s\n",
+                           encInfo.in_place ? encInfo.src_image_fname : encInfo.stego_image_fname);
+                ret = 0;
             }
             else
-                printf("ERROR: Encoding failed.\n");
+                fprintf(stderr, "ERROR: Encoding failed.\n");
         }
         else
-            printf("ERROR: Invalid encoding arguments.\n");
+            fprintf(stderr, "ERROR: Invalid encoding arguments.\n");
         break;
 
     case e_decode:
@@ -83,25 +374,95 @@ int main(int argc, char *argv[])
             return 0;
         }
 
-        printf("Selected decoding operation.\n");
-        printf("Stego BMP file   : %s\n", argv[2]);
-        printf("Output text file : %s\n", argv[3]);
+        if (!quiet)
+        {
+            printf("Selected decoding operation.\n");
+            printf("Stego BMP file   : %s\n", argv[2]);
+            printf("Output text file : %s\n", argv[3]);
+        }
 
-        if (read_and_validate_decode_args(argv, &decInfo) == e_success)
+        if (read_and_validate_decode_args(argv, &decInfo) == d_success)
         {
-            if (do_decoding(&decInfo) == e_success)
-                printf("Decoding completed successfully.\nOutput file saved as: %s\n", argv[3]);
+            if (stats)
+                opstats_begin(stats);
+            Status_d status = do_decoding(&decInfo);
+            if (stats)
+                opstats_emit(stats, stats_out, "decode", status == d_success, decInfo.threads);
+            if (status == d_success)
+            {
+                if (!quiet)
+                    printf("Decoding completed successfully.\nOutput file saved as: %s\n", argv[3]);
+                ret = 0;
+            }
             else
-                printf("ERROR: Decoding failed.\n");
+                fprintf(stderr, "ERROR: Decoding failed.\n");
+        }
+        else
+            fprintf(stderr, "ERROR: Invalid decoding arguments.\n");
+        break;
+
+    case e_container:
+        if (argc < 5)
+        {
+            printf("Usage: %s -c <.bmp file> <output.bmp> <file>...\n", argv[0]);
+            return 0;
+        }
+        if (read_and_validate_container_args(argc, argv, &encInfo) != e_success)
+        {
+            fprintf(stderr, "ERROR: Encoding failed.\n");
+            break;
+        }
+        if (stats)
+            opstats_begin(stats);
+        Status status = do_encoding(&encInfo);
+        if (stats)
+            opstats_emit(stats, stats_out, "container", status == e_success, encInfo.threads);
+        if (status == e_success)
+        {
+            if (!quiet)
+                printf("Container of %d entries saved as: %s\n", encInfo.nentries, encInfo.stego_image_fname);
+            ret = 0;
         }
         else
-            printf("ERROR: Invalid decoding arguments.\n");
+            fprintf(stderr, "ERROR: Encoding failed.\n");
+        break;
+
+    case e_list:
+        steg_log_level = LOG_LEVEL_ERROR;
+        strncpy(decInfo.stego_image_fname, argv[2], sizeof(decInfo.stego_image_fname) - 1);
+        ret = do_list(&decInfo) == d_success ? 0 : 1;
+        break;
+
+    case e_probe:
+        // One tab-separated line per image on stdout; progress and per-stage messages stay off.
+        // Exit 0 if every image holds a payload, 1 if some hold none, 2 if any could not be read
+        steg_log_level = LOG_LEVEL_ERROR;
+        ret = 0;
+        for (int i = 2; i < argc; i++)
+        {
+            int found = 0;
+            memset(&decInfo, 0, sizeof(decInfo));
+            if (strlen(argv[i]) >= sizeof(decInfo.stego_image_fname))
+            {
+                fprintf(stderr, "ERROR: Source file name is too long.\n");
+                ret = 2;
+                continue;
+            }
+            strcpy(decInfo.stego_image_fname, argv[i]);
+            if (do_probe(&decInfo, &found) != d_success)
+                ret = 2;
+            else if (!found && ret == 0)
+                ret = 1;
+        }
         break;
 
     default:
-        printf("Unsupported operation. Use -e for encoding or -d for decoding.\n");
+        printf("Unsupported operation. Use -e for encoding, -d for decoding, -c/-l for containers or -i for header info.\n");
         break;
     }
 
-    return 0;
+    memset(encInfo.key, 0, sizeof(encInfo.key));
+    memset(decInfo.key, 0, sizeof(decInfo.key));
+
+    return ret;
 }
\ No newline at end of file
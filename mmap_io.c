@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mmap_io.h"
+#include "common.h"
+
+/* Tell the kernel the mapping is streamed once, front to back */
+static void advise_sequential(MappedFile *map)
+{
+    madvise(map->addr, map->len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    // Large carriers: ask for huge pages to cut TLB misses (best effort)
+    if (map->len >= STEG_HUGEPAGE_MIN)
+        madvise(map->addr, map->len, MADV_HUGEPAGE);
+#endif
+}
+
+Status map_file_read(FILE *fptr, MappedFile *map)
+{
+    struct stat st;
+
+    map->addr = NULL;
+    map->len = 0;
+    if (fstat(fileno(fptr), &st) != 0)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+    if (st.st_size == 0)
+        return e_success;
+
+    void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(fptr), 0);
+    if (addr == MAP_FAILED)
+    {
+        perror("mmap");
+        return e_failure;
+    }
+
+    map->addr = addr;
+    map->len = (size_t)st.st_size;
+    advise_sequential(map);
+    return e_success;
+}
+
+Status map_file_write(FILE *fptr, size_t len, MappedFile *map)
+{
+    map->addr = NULL;
+    map->len = 0;
+    if (ftruncate(fileno(fptr), (off_t)len) != 0)
+    {
+        perror("ftruncate");
+        return e_failure;
+    }
+    if (len == 0)
+        return e_success;
+
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fptr), 0);
+    if (addr == MAP_FAILED)
+    {
+        perror("mmap");
+        return e_failure;
+    }
+
+    map->addr = addr;
+    map->len = len;
+    advise_sequential(map);
+    return e_success;
+}
+
+void unmap_file(MappedFile *map)
+{
+    if (map->addr)
+        munmap(map->addr, map->len);
+    map->addr = NULL;
+    map->len = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef MMAP_IO_H
+#define MMAP_IO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h"
+
+/* A whole-file memory mapping */
+typedef struct _MappedFile
+{
+    char *addr;     // Start of the mapping (NULL for empty files)
+    size_t len;     // Length of the mapping in bytes
+} MappedFile;
+
+/* Map an open file read-only for a single sequential pass */
+Status map_file_read(FILE *fptr, MappedFile *map);
+
+/* Resize an open (read/write) file to len bytes and map it shared read/write */
+Status map_file_write(FILE *fptr, size_t len, MappedFile *map);
+
+/* Release a mapping created by map_file_read/map_file_write */
+void unmap_file(MappedFile *map);
+
+#endif
@@ -0,0 +1,121 @@
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "opstats.h"
+#include "lsb_kernels.h"
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void read_counters(OpCounters *c)
+{
+    memset(c, 0, sizeof(*c));
+
+    FILE *fptr = fopen("/proc/self/io", "r");
+    if (fptr != NULL)
+    {
+        char key[32];
+        unsigned long long value;
+        int found = 0;
+        while (fscanf(fptr, "%31[^:]: %llu ", key, &value) == 2)
+        {
+            if (strcmp(key, "rchar") == 0)
+                c->rchar = value, found++;
+            else if (strcmp(key, "wchar") == 0)
+                c->wchar = value, found++;
+            else if (strcmp(key, "syscr") == 0)
+                c->syscr = value, found++;
+            else if (strcmp(key, "syscw") == 0)
+                c->syscw = value, found++;
+        }
+        fclose(fptr);
+        c->io_ok = found == 4;
+    }
+
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+    {
+        c->user_ms = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3;
+        c->sys_ms = ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+        c->minflt = ru.ru_minflt;
+        c->majflt = ru.ru_majflt;
+    }
+}
+
+void opstats_begin(OpStats *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->io = "stdio";
+    read_counters(&st->base);
+    st->start = st->mark = now_ms();
+}
+
+void opstats_phase(OpStats *st, const char *name)
+{
+    if (st == NULL)
+        return;
+    double now = now_ms();
+    int i = 0;
+    while (i < st->nphases && strcmp(st->phases[i].name, name) != 0)
+        i++;
+    if (i == st->nphases && i < OPSTATS_MAX_PHASES)
+    {
+        st->phases[i].name = name;
+        st->phases[i].ms = 0;
+        st->nphases++;
+    }
+    if (i < st->nphases)
+        st->phases[i].ms += now - st->mark;
+    st->mark = now;
+}
+
+void opstats_io(OpStats *st, const char *io)
+{
+    if (st != NULL)
+        st->io = io;
+}
+
+void opstats_queue(OpStats *st, const IoQueue *q)
+{
+    uint64_t reads, read_bytes, writes, write_bytes;
+    if (st == NULL)
+        return;
+    ioq_counts(q, &reads, &read_bytes, &writes, &write_bytes);
+    st->queue_ops[0] += reads;
+    st->queue_bytes[0] += read_bytes;
+    st->queue_ops[1] += writes;
+    st->queue_bytes[1] += write_bytes;
+}
+
+void opstats_emit(OpStats *st, FILE *out, const char *op, int ok, int threads)
+{
+    double total = now_ms() - st->start;
+    OpCounters now;
+    read_counters(&now);
+
+    fprintf(out, "{\"op\":\"%s\",\"ok\":%s,\"kernel\":\"%s\",\"io\":\"%s\",\"threads\":%d,"
+                 "\"payload_bytes\":%llu,\"image_bytes\":%llu,\"total_ms\":%.3f,\"phases\":{",
+            op, ok ? "true" : "false", lsb_kernel()->name, st->io, threads < 1 ? 1 : threads,
+            (unsigned long long)st->payload_bytes, (unsigned long long)st->image_bytes, total);
+    for (int i = 0; i < st->nphases; i++)
+        fprintf(out, "%s\"%s\":%.3f", i ? "," : "", st->phases[i].name, st->phases[i].ms);
+    fprintf(out, "},");
+
+    if (now.io_ok && st->base.io_ok)
+        fprintf(out, "\"read_bytes\":%llu,\"write_bytes\":%llu,\"read_syscalls\":%llu,\"write_syscalls\":%llu,",
+                (unsigned long long)(now.rchar - st->base.rchar), (unsigned long long)(now.wchar - st->base.wchar),
+                (unsigned long long)(now.syscr - st->base.syscr), (unsigned long long)(now.syscw - st->base.syscw));
+    else
+        fprintf(out, "\"read_bytes\":null,\"write_bytes\":null,\"read_syscalls\":null,\"write_syscalls\":null,");
+    fprintf(out, "\"queue_reads\":%llu,\"queue_read_bytes\":%llu,\"queue_writes\":%llu,\"queue_write_bytes\":%llu,",
+            (unsigned long long)st->queue_ops[0], (unsigned long long)st->queue_bytes[0],
+            (unsigned long long)st->queue_ops[1], (unsigned long long)st->queue_bytes[1]);
+    fprintf(out, "\"user_ms\":%.3f,\"sys_ms\":%.3f,\"minor_faults\":%ld,\"major_faults\":%ld}\n",
+            now.user_ms - st->base.user_ms, now.sys_ms - st->base.sys_ms, now.minflt - st->base.minflt,
+            now.majflt - st->base.majflt);
+    fflush(out);
+}
@@ -0,0 +1,73 @@
+#ifndef OPSTATS_H
+#define OPSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "ioq.h"
+
+/*
+ * Per-operation instrumentation for --stats=json.
+ *
+ * An encode or decode carries an OpStats pointer (NULL when off, so the
+ * calls below cost a test and nothing else). opstats_phase closes the span
+ * since the previous mark on the monotonic clock and books it under a phase
+ * name; a name seen again adds to its total. The I/O counters come from
+ * /proc/self/io (bytes and calls of the read and write syscall families)
+ * and getrusage (CPU time, page faults, which cover mapped I/O) and are
+ * taken as deltas between opstats_begin and opstats_emit. They are
+ * process-wide, so they only describe one operation when it runs alone.
+ * Transfers done through io_uring do not show up there, so the payload
+ * pipeline also reports the requests it queued (opstats_queue).
+ */
+#define OPSTATS_MAX_PHASES 12
+
+typedef struct
+{
+    const char *name;
+    double ms;
+} OpPhase;
+
+/* Process counters; io_ok is 0 where /proc/self/io is unavailable */
+typedef struct
+{
+    int io_ok;
+    uint64_t rchar, wchar, syscr, syscw;
+    double user_ms, sys_ms;
+    long minflt, majflt;
+} OpCounters;
+
+typedef struct _OpStats
+{
+    double start, mark;             // Monotonic clock (ms) at opstats_begin and at the last phase boundary
+    OpPhase phases[OPSTATS_MAX_PHASES];
+    int nphases;
+    const char *io;                 // Payload I/O path taken (stdio, mmap, pread/pwrite, io_uring, threads)
+    uint64_t payload_bytes;         // Secret bytes embedded or extracted
+    uint64_t image_bytes;           // Size of the carrier or stego image
+    uint64_t queue_ops[2];          // Pipeline requests queued: reads, writes
+    uint64_t queue_bytes[2];
+    OpCounters base;
+} OpStats;
+
+void opstats_begin(OpStats *st);
+
+/* Book the time since the last mark as phase name */
+void opstats_phase(OpStats *st, const char *name);
+
+/* Record the payload I/O path; the last call wins */
+void opstats_io(OpStats *st, const char *io);
+
+/* Add the requests queued on q; call before ioq_close */
+void opstats_queue(OpStats *st, const IoQueue *q);
+
+/*
+ * Write one JSON object (a single line) for the operation:
+ *   {"op":"encode","ok":true,"kernel":"avx2","io":"io_uring","threads":1,"payload_bytes":...,
+ *    "image_bytes":...,"total_ms":...,"phases":{"open_files":0.041,...},"read_bytes":...,
+ *    "write_bytes":...,"read_syscalls":...,"write_syscalls":...,"queue_reads":...,"queue_read_bytes":...,
+ *    "queue_writes":...,"queue_write_bytes":...,"user_ms":...,"sys_ms":...,"minor_faults":...,"major_faults":...}
+ * The four /proc/self/io fields are null where it is unavailable.
+ */
+void opstats_emit(OpStats *st, FILE *out, const char *op, int ok, int threads);
+
+#endif
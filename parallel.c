@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "parallel.h"
+#include "threadpool.h"
+#include "pio.h"
+#include "lsb_kernels.h"
+#include "common.h"
+#include "format.h"
+#include "crc32c.h"
+
+/* State shared by all ranges of one embed/extract run */
+typedef struct
+{
+    int fd_in;          // Secret (embed) or stego image (extract)
+    int fd_carrier;     // Source image (embed only)
+    int fd_out;         // Stego image (embed) or output file (extract)
+    const BmpLayout *layout;
+    uint64_t data_off;  // Logical carrier offset of payload byte 0
+    off_t size;         // Payload bytes
+    size_t block;       // Payload bytes per range
+    int depth;          // LSBs per carrier byte
+    uint32_t *crcs;     // CRC32C per STEG_CRC_CHUNK payload bytes, or NULL
+    int failed;         // Set by any range that hits an I/O error
+} ParallelJob;
+
+typedef struct
+{
+    ParallelJob *job;
+    off_t start;        // First payload byte of this range
+} ParallelRange;
+
+/* Checksum the payload bytes of one range into their table slots (ranges are whole chunks) */
+static void range_crcs(const ParallelJob *job, off_t start, const unsigned char *data, size_t n)
+{
+    if (job->crcs == NULL)
+        return;
+    for (size_t pos = 0; pos < n; pos += STEG_CRC_CHUNK)
+    {
+        size_t len = n - pos < STEG_CRC_CHUNK ? n - pos : STEG_CRC_CHUNK;
+        job->crcs[((size_t)start + pos) / STEG_CRC_CHUNK] = crc32c(0, data + pos, len);
+    }
+}
+
+static void embed_range(void *arg)
+{
+    ParallelRange *range = arg;
+    ParallelJob *job = range->job;
+    size_t n = (size_t)(job->size - range->start) < job->block ? (size_t)(job->size - range->start) : job->block;
+    size_t span = lsb_carrier_bytes(n, job->depth);
+    uint64_t logical = job->data_off + (uint64_t)range->start * lsb_carrier_bytes(1, job->depth);
+    uint64_t lo, end;
+    bmp_window(job->layout, logical, span, &lo, &end);
+
+    unsigned char *data = malloc(n);
+    unsigned char *image = malloc((size_t)(end - lo));
+    unsigned char *run = job->layout->identity ? image : malloc(span);
+    if (!data || !image || !run ||
+        pread_full(job->fd_in, data, n, (off_t)range->start) != e_success ||
+        pread_full(job->fd_carrier, image, (size_t)(end - lo), (off_t)lo) != e_success)
+    {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    range_crcs(job, range->start, data, n);
+    if (run != image)
+        bmp_gather(job->layout, image, lo, logical, span, run);
+    lsb_embed_bits(data, n, run, job->depth);
+    if (run != image)
+        bmp_scatter(job->layout, image, lo, logical, span, run);
+
+    if (pwrite_full(job->fd_out, image, (size_t)(end - lo), (off_t)lo) != e_success)
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+
+out:
+    if (run != image)
+        free(run);
+    free(data);
+    free(image);
+}
+
+static void extract_range(void *arg)
+{
+    ParallelRange *range = arg;
+    ParallelJob *job = range->job;
+    size_t n = (size_t)(job->size - range->start) < job->block ? (size_t)(job->size - range->start) : job->block;
+
+    size_t span = lsb_carrier_bytes(n, job->depth);
+    uint64_t logical = job->data_off + (uint64_t)range->start * lsb_carrier_bytes(1, job->depth);
+    uint64_t lo, end;
+    bmp_window(job->layout, logical, span, &lo, &end);
+
+    unsigned char *data = malloc(n);
+    unsigned char *image = malloc((size_t)(end - lo));
+    unsigned char *run = job->layout->identity ? image : malloc(span);
+    if (!data || !image || !run || pread_full(job->fd_in, image, (size_t)(end - lo), (off_t)lo) != e_success)
+    {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    if (run != image)
+        bmp_gather(job->layout, image, lo, logical, span, run);
+    lsb_extract_bits(run, n, data, job->depth);
+    range_crcs(job, range->start, data, n);
+
+    if (pwrite_full(job->fd_out, data, n, (off_t)range->start) != e_success)
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+
+out:
+    if (run != image)
+        free(run);
+    free(data);
+    free(image);
+}
+
+/* Cut the payload into block-sized ranges and run fn over them on a pool */
+static Status run_ranges(ParallelJob *job, pool_task_fn fn, int threads)
+{
+    off_t count = (job->size + (off_t)job->block - 1) / (off_t)job->block;
+    if (count == 0)
+        return e_success;
+
+    ParallelRange *ranges = malloc((size_t)count * sizeof(*ranges));
+    ThreadPool *pool = pool_create(threads);
+    if (!ranges || !pool)
+    {
+        fprintf(stderr, "ERROR: Unable to start %d worker threads\n", threads);
+        free(ranges);
+        pool_destroy(pool);
+        return e_failure;
+    }
+
+    for (off_t i = 0; i < count; i++)
+    {
+        ranges[i].job = job;
+        ranges[i].start = i * (off_t)job->block;
+        if (pool_submit(pool, fn, &ranges[i]) != e_success)
+        {
+            job->failed = 1;
+            break;
+        }
+    }
+    pool_wait(pool);
+    pool_destroy(pool);
+    free(ranges);
+
+    return job->failed ? e_failure : e_success;
+}
+
+/* Payload bytes per range: chunk carrier bytes' worth, rounded up to whole checksum chunks if needed */
+static size_t range_block(size_t chunk, const uint32_t *crcs)
+{
+    size_t block = chunk / 8 ? chunk / 8 : 1;
+    if (crcs)
+        block = (block + STEG_CRC_CHUNK - 1) / STEG_CRC_CHUNK * STEG_CRC_CHUNK;
+    return block;
+}
+
+Status parallel_embed(int fd_secret, int fd_src, int fd_stego, const BmpLayout *layout, uint64_t data_off,
+                      off_t size, int depth, size_t chunk, int threads, uint32_t *crcs)
+{
+    ParallelJob job = {fd_secret, fd_src, fd_stego, layout, data_off, size, range_block(chunk, crcs), depth, crcs, 0};
+
+    if (run_ranges(&job, embed_range, threads) != e_success)
+    {
+        fprintf(stderr, "ERROR: Parallel embed of %lld bytes failed\n", (long long)size);
+        return e_failure;
+    }
+    return e_success;
+}
+
+Status parallel_extract(int fd_stego, int fd_out, const BmpLayout *layout, uint64_t data_off, off_t size,
+                        int depth, size_t chunk, int threads, uint32_t *crcs)
+{
+    ParallelJob job = {fd_stego, -1, fd_out, layout, data_off, size, range_block(chunk, crcs), depth, crcs, 0};
+
+    if (run_ranges(&job, extract_range, threads) != e_success)
+    {
+        fprintf(stderr, "ERROR: Parallel extract of %lld bytes failed\n", (long long)size);
+        return e_failure;
+    }
+    return e_success;
+}
@@ -0,0 +1,28 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * Payload byte i lives in the 8 / depth carrier bytes at logical offset
+ * data_off + i * 8 / depth, so the payload region can be split into disjoint
+ * ranges and processed on a thread pool with positional I/O (no shared FILE*
+ * or file offset). Each range reads and writes its whole layout window, so
+ * padding between ranges is copied too.
+ *
+ * crcs (NULL to skip) receives one CRC32C per STEG_CRC_CHUNK payload bytes,
+ * steg_crc_count(size) entries, computed by each range on the bytes it moves.
+ */
+
+/* Embed size bytes of fd_secret into the carrier bytes of fd_src at data_off, writing them to fd_stego */
+Status parallel_embed(int fd_secret, int fd_src, int fd_stego, const BmpLayout *layout, uint64_t data_off,
+                      off_t size, int depth, size_t chunk, int threads, uint32_t *crcs);
+
+/* Extract size payload bytes from fd_stego at data_off into fd_out */
+Status parallel_extract(int fd_stego, int fd_out, const BmpLayout *layout, uint64_t data_off, off_t size,
+                        int depth, size_t chunk, int threads, uint32_t *crcs);
+
+#endif
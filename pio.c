@@ -0,0 +1,259 @@
+#define _GNU_SOURCE // copy_file_range
+#include <errno.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include "pio.h"
+
+/* Buffer for copies the kernel cannot do by itself */
+#define COPY_BUFFER_SIZE    (1 << 20)
+
+/* Largest request handed to copy_file_range or sendfile at once */
+#define COPY_KERNEL_MAX     (1 << 30)
+
+Status pread_full(int fd, void *buf, size_t len, off_t off)
+{
+    char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, p, len, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return e_failure;
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return e_success;
+}
+
+ssize_t pread_upto(int fd, void *buf, size_t len, off_t off)
+{
+    char *p = buf;
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pread(fd, p + done, len - done, off + (off_t)done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+Status pwrite_full(int fd, const void *buf, size_t len, off_t off)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return e_failure;
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return e_success;
+}
+
+FILE *open_stream(const char *fname, const char *mode)
+{
+    if (is_stdio_name(fname))
+        return strchr(mode, 'r') && !strchr(mode, '+') ? stdin : stdout;
+    return fopen(fname, mode);
+}
+
+int close_stream(FILE *fptr)
+{
+    if (fptr == NULL)
+        return 0;
+    if (fptr == stdin)
+        return 0;
+    if (fptr == stdout)
+        return fflush(stdout);
+    return fclose(fptr);
+}
+
+int stream_seekable(FILE *fptr)
+{
+    struct stat st;
+    return fptr != NULL && fstat(fileno(fptr), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+uint64_t stream_size(FILE *fptr)
+{
+    struct stat st;
+    if (fptr == NULL || fstat(fileno(fptr), &st) != 0 || !S_ISREG(st.st_mode))
+        return UINT64_MAX;
+    return (uint64_t)st.st_size;
+}
+
+Status random_bytes(void *buf, size_t len)
+{
+    unsigned char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = getrandom(p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return e_failure;
+        p += n;
+        len -= (size_t)n;
+    }
+    return e_success;
+}
+
+static int hex_value(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c = tolower(c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+Status load_key_file(const char *fname, unsigned char *key, size_t len)
+{
+    FILE *fptr = fopen(fname, "rb");
+    if (fptr == NULL)
+        return e_failure;
+
+    // Room for a hex key, its line ending and one byte more to catch oversized files
+    unsigned char buf[160];
+    size_t n = fread(buf, 1, sizeof(buf), fptr);
+    fclose(fptr);
+
+    Status ret = e_failure;
+    if (n == len)
+    {
+        memcpy(key, buf, len);
+        ret = e_success;
+    }
+    else
+    {
+        while (n > 0 && isspace(buf[n - 1]))
+            n--;
+        if (n == 2 * len)
+        {
+            ret = e_success;
+            for (size_t i = 0; i < len && ret == e_success; i++)
+            {
+                int hi = hex_value(buf[2 * i]), lo = hex_value(buf[2 * i + 1]);
+                if (hi < 0 || lo < 0)
+                    ret = e_failure;
+                else
+                    key[i] = (unsigned char)(hi << 4 | lo);
+            }
+        }
+    }
+    memset(buf, 0, sizeof(buf));
+    return ret;
+}
+
+/* Copy in the kernel: copy_file_range, then sendfile. Returns the bytes copied before both gave up */
+static uint64_t copy_in_kernel(int fd_in, off_t in_off, int fd_out, off_t out_off, uint64_t len, const char **method)
+{
+    uint64_t done = 0;
+    while (done < len)
+    {
+        loff_t src = in_off + (off_t)done, dst = out_off + (off_t)done;
+        size_t n = len - done < COPY_KERNEL_MAX ? (size_t)(len - done) : COPY_KERNEL_MAX;
+        ssize_t got = copy_file_range(fd_in, &src, fd_out, &dst, n, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        done += (uint64_t)got;
+        *method = "copy_file_range";
+    }
+
+    // sendfile writes at the output's file offset
+    if (done < len && lseek(fd_out, out_off + (off_t)done, SEEK_SET) < 0)
+        return done;
+    while (done < len)
+    {
+        off_t src = in_off + (off_t)done;
+        size_t n = len - done < COPY_KERNEL_MAX ? (size_t)(len - done) : COPY_KERNEL_MAX;
+        ssize_t got = sendfile(fd_out, fd_in, &src, n);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        done += (uint64_t)got;
+        *method = "sendfile";
+    }
+    return done;
+}
+
+/* Copy a range in the kernel if it can, otherwise through a large buffer */
+static Status copy_piece(int fd_in, off_t in_off, int fd_out, off_t out_off, uint64_t len, const char **method)
+{
+    uint64_t done = copy_in_kernel(fd_in, in_off, fd_out, out_off, len, method);
+    if (done == len)
+        return e_success;
+
+    char *buf = malloc(COPY_BUFFER_SIZE);
+    if (buf == NULL)
+        return e_failure;
+    Status ret = e_success;
+    while (done < len && ret == e_success)
+    {
+        size_t n = len - done < COPY_BUFFER_SIZE ? (size_t)(len - done) : COPY_BUFFER_SIZE;
+        if (pread_full(fd_in, buf, n, in_off + (off_t)done) != e_success ||
+            pwrite_full(fd_out, buf, n, out_off + (off_t)done) != e_success)
+            ret = e_failure;
+        done += n;
+        *method = "read/write";
+    }
+    free(buf);
+    return ret;
+}
+
+Status copy_range(int fd_in, off_t in_off, int fd_out, off_t out_off, uint64_t len, const char **method)
+{
+    uint64_t head = len, cloned = 0;
+    const char *used = "none";
+
+#ifdef FICLONERANGE
+    // Reflinks share whole filesystem blocks: clone the aligned middle (up to the end of the
+    // input if the range reaches it), then copy the unaligned head and tail
+    struct stat st;
+    if (len > 0 && fstat(fd_in, &st) == 0 && st.st_blksize > 0)
+    {
+        uint64_t blk = (uint64_t)st.st_blksize;
+        uint64_t skip = (blk - (uint64_t)in_off % blk) % blk;
+        if ((uint64_t)in_off % blk == (uint64_t)out_off % blk && len > skip)
+        {
+            uint64_t rest = len - skip;
+            uint64_t clone = (uint64_t)in_off + len == (uint64_t)st.st_size ? rest : rest / blk * blk;
+            struct file_clone_range range = {fd_in, (uint64_t)in_off + skip, clone, (uint64_t)out_off + skip};
+            if (clone > 0 && ioctl(fd_out, FICLONERANGE, &range) == 0)
+            {
+                head = skip;
+                cloned = clone;
+            }
+        }
+    }
+#endif
+
+    uint64_t tail = head + cloned;
+    if (copy_piece(fd_in, in_off, fd_out, out_off, head, &used) != e_success ||
+        copy_piece(fd_in, in_off + (off_t)tail, fd_out, out_off + (off_t)tail, len - tail, &used) != e_success)
+        return e_failure;
+
+    if (method)
+        *method = cloned ? "reflink" : used;
+    return e_success;
+}
@@ -0,0 +1,55 @@
+#ifndef PIO_H
+#define PIO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h"
+
+/* File name that stands for stdin (when reading) or stdout (when writing) */
+#define STEG_STDIO_NAME "-"
+
+static inline int is_stdio_name(const char *fname)
+{
+    return fname != NULL && strcmp(fname, STEG_STDIO_NAME) == 0;
+}
+
+/* Read exactly len bytes at off, retrying short reads */
+Status pread_full(int fd, void *buf, size_t len, off_t off);
+
+/* Read up to len bytes at off; returns the count read (short only at end of file), or -1 */
+ssize_t pread_upto(int fd, void *buf, size_t len, off_t off);
+
+/* Write exactly len bytes at off, retrying short writes */
+Status pwrite_full(int fd, const void *buf, size_t len, off_t off);
+
+/*
+ * Copy len bytes from fd_in at in_off to fd_out at out_off without moving them through user
+ * space where possible: a FICLONERANGE reflink shares the blocks on filesystems that support
+ * it (btrfs, XFS), copy_file_range copies inside the kernel, sendfile covers kernels and file
+ * systems without it, and a 1 MiB pread/pwrite loop is the last resort. *method (may be NULL)
+ * names the mechanism that moved the bulk of the bytes.
+ */
+Status copy_range(int fd_in, off_t in_off, int fd_out, off_t out_off, uint64_t len, const char **method);
+
+/* fopen, except that "-" returns stdin or stdout depending on mode */
+FILE *open_stream(const char *fname, const char *mode);
+
+/* fclose for open_stream results; stdin and stdout are only flushed */
+int close_stream(FILE *fptr);
+
+/* Non-zero if fptr can seek (a regular file rather than a pipe or terminal) */
+int stream_seekable(FILE *fptr);
+
+/* Size of a regular file, or UINT64_MAX if fptr is a pipe or terminal */
+uint64_t stream_size(FILE *fptr);
+
+/* Fill buf with len bytes from the kernel CSPRNG */
+Status random_bytes(void *buf, size_t len);
+
+/* Read a len-byte key from a file holding either the raw bytes or 2 * len hex digits */
+Status load_key_file(const char *fname, unsigned char *key, size_t len);
+
+#endif
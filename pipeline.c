@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pipeline.h"
+#include "lsb_kernels.h"
+
+/* Buffers and requests of one block in the ring */
+typedef struct
+{
+    IoOp data_io;           // Secret read (embed) or output write (extract)
+    IoOp window_io;         // Carrier window read
+    IoOp write_io;          // Stego window write (embed)
+    int reading;            // data_io and window_io (embed) or window_io (extract) in flight
+    int writing;            // write_io (embed) or data_io (extract) in flight
+    unsigned char *data;    // Payload bytes of the block
+    unsigned char *window;  // File bytes [lo, end)
+    size_t window_cap;
+    unsigned char *run;     // Carrier bytes gathered out of the window (span layouts)
+    uint64_t logical;       // Logical carrier offset of the block
+    uint64_t start, lo, end;
+    size_t n;               // Payload bytes in the block
+} PipeSlot;
+
+typedef struct
+{
+    IoQueue *q;
+    const BmpLayout *layout;
+    uint64_t logical;       // Logical carrier offset of payload byte 0
+    uint64_t size;
+    int depth;
+    size_t block;
+    uint64_t next_lo;       // Where the next embed window starts (windows tile the file)
+    PipeSlot slots[PIPELINE_SLOTS];
+} Pipe;
+
+static void pipe_free(Pipe *p)
+{
+    for (int i = 0; i < PIPELINE_SLOTS; i++)
+    {
+        free(p->slots[i].data);
+        free(p->slots[i].window);
+        free(p->slots[i].run);
+    }
+}
+
+static Status pipe_init(Pipe *p, IoQueue *q, const BmpLayout *layout, uint64_t logical, uint64_t size, int depth,
+                        size_t block, uint64_t pos)
+{
+    memset(p, 0, sizeof(*p));
+    p->q = q;
+    p->layout = layout;
+    p->logical = logical;
+    p->size = size;
+    p->depth = depth;
+    p->block = block;
+    p->next_lo = pos;
+    for (int i = 0; i < PIPELINE_SLOTS; i++)
+    {
+        PipeSlot *s = &p->slots[i];
+        s->data = malloc(block);
+        s->run = layout->identity ? NULL : malloc(lsb_carrier_bytes(block, depth));
+        if (s->data == NULL || (!layout->identity && s->run == NULL))
+        {
+            pipe_free(p);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/* Place block b in slot s: its payload length and the file window holding its carrier bytes */
+static Status pipe_window(Pipe *p, PipeSlot *s, uint64_t b, int tile)
+{
+    uint64_t first = b * p->block;
+    s->n = p->size - first < p->block ? (size_t)(p->size - first) : p->block;
+    s->logical = p->logical + first * lsb_carrier_bytes(1, p->depth);
+    bmp_window(p->layout, s->logical, lsb_carrier_bytes(s->n, p->depth), &s->start, &s->end);
+
+    // An embed copies every file byte, so its windows also take any gap since the last one
+    s->lo = tile && p->next_lo < s->start ? p->next_lo : s->start;
+    if (tile)
+        p->next_lo = s->end;
+
+    size_t len = (size_t)(s->end - s->lo);
+    if (len > s->window_cap)
+    {
+        unsigned char *w = realloc(s->window, len);
+        if (w == NULL)
+            return e_failure;
+        s->window = w;
+        s->window_cap = len;
+    }
+    return e_success;
+}
+
+/* Carrier bytes of the block in slot s: in the window itself, or gathered into the run */
+static unsigned char *pipe_carrier(Pipe *p, PipeSlot *s)
+{
+    if (p->layout->identity)
+        return s->window + (s->start - s->lo);
+    bmp_gather(p->layout, s->window, s->lo, s->logical, lsb_carrier_bytes(s->n, p->depth), s->run);
+    return s->run;
+}
+
+/* Wait for every request still in flight; buffers can only be freed after this */
+static Status pipe_drain(Pipe *p, int embed)
+{
+    Status ret = e_success;
+    for (int i = 0; i < PIPELINE_SLOTS; i++)
+    {
+        PipeSlot *s = &p->slots[i];
+        if (s->reading)
+        {
+            if (embed)
+                ioq_wait(p->q, &s->data_io);
+            ioq_wait(p->q, &s->window_io);
+            s->reading = 0;
+        }
+        if (s->writing && ioq_wait(p->q, embed ? &s->write_io : &s->data_io) != e_success)
+            ret = e_failure;
+        s->writing = 0;
+    }
+    return ret;
+}
+
+Status pipeline_embed(IoQueue *q, int fd_secret, off_t secret_off, int fd_src, int fd_stego, const BmpLayout *layout,
+                      uint64_t logical, uint64_t size, int depth, size_t block, PipelineHook hook, void *ctx,
+                      uint64_t *pos)
+{
+    Pipe p;
+    if (pipe_init(&p, q, layout, logical, size, depth, block, *pos) != e_success)
+        return e_failure;
+
+    uint64_t nblocks = (size + block - 1) / block, issued = 0, done = 0;
+    Status ret = e_success;
+    while (done < nblocks && ret == e_success)
+    {
+        // Read stage: start reading the blocks ahead once their slot's previous write is out
+        while (issued < nblocks && issued - done < PIPELINE_SLOTS)
+        {
+            PipeSlot *s = &p.slots[issued % PIPELINE_SLOTS];
+            if (s->writing)
+            {
+                s->writing = 0;
+                if (ioq_wait(q, &s->write_io) != e_success)
+                    ret = e_failure;
+            }
+            if (ret != e_success || pipe_window(&p, s, issued, 1) != e_success)
+            {
+                ret = e_failure;
+                break;
+            }
+            ioq_prep(&s->data_io, fd_secret, 0, s->data, s->n, secret_off + (off_t)(issued * block));
+            ioq_prep(&s->window_io, fd_src, 0, s->window, (size_t)(s->end - s->lo), (off_t)s->lo);
+            ioq_submit(q, &s->data_io);
+            ioq_submit(q, &s->window_io);
+            s->reading = 1;
+            issued++;
+        }
+        if (ret != e_success)
+            break;
+
+        // Compute stage: this block, in payload order
+        PipeSlot *s = &p.slots[done % PIPELINE_SLOTS];
+        Status got_data = ioq_wait(q, &s->data_io);
+        Status got_window = ioq_wait(q, &s->window_io);
+        s->reading = 0;
+        if (got_data != e_success || got_window != e_success)
+        {
+            ret = e_failure;
+            break;
+        }
+        if (hook)
+            hook(ctx, s->data, s->n);
+        unsigned char *carrier = pipe_carrier(&p, s);
+        lsb_embed_bits(s->data, s->n, carrier, depth);
+        if (!layout->identity)
+            bmp_scatter(layout, s->window, s->lo, s->logical, lsb_carrier_bytes(s->n, depth), carrier);
+
+        // Write stage: the whole window goes back out, padding included
+        ioq_prep(&s->write_io, fd_stego, 1, s->window, (size_t)(s->end - s->lo), (off_t)s->lo);
+        ioq_submit(q, &s->write_io);
+        s->writing = 1;
+        done++;
+    }
+
+    if (pipe_drain(&p, 1) != e_success)
+        ret = e_failure;
+    if (ret == e_success)
+        *pos = p.next_lo;
+    pipe_free(&p);
+    return ret;
+}
+
+Status pipeline_extract(IoQueue *q, int fd_stego, int fd_out, off_t out_off, const BmpLayout *layout,
+                        uint64_t logical, uint64_t size, int depth, size_t block, PipelineHook hook, void *ctx,
+                        uint64_t *pos)
+{
+    Pipe p;
+    if (pipe_init(&p, q, layout, logical, size, depth, block, *pos) != e_success)
+        return e_failure;
+
+    uint64_t nblocks = (size + block - 1) / block, issued = 0, done = 0, end = *pos;
+    Status ret = e_success;
+    while (done < nblocks && ret == e_success)
+    {
+        // Read stage: start reading the windows ahead once their slot's output is written
+        while (issued < nblocks && issued - done < PIPELINE_SLOTS)
+        {
+            PipeSlot *s = &p.slots[issued % PIPELINE_SLOTS];
+            if (s->writing)
+            {
+                s->writing = 0;
+                if (ioq_wait(q, &s->data_io) != e_success)
+                    ret = e_failure;
+            }
+            if (ret != e_success || pipe_window(&p, s, issued, 0) != e_success)
+            {
+                ret = e_failure;
+                break;
+            }
+            ioq_prep(&s->window_io, fd_stego, 0, s->window, (size_t)(s->end - s->lo), (off_t)s->lo);
+            ioq_submit(q, &s->window_io);
+            s->reading = 1;
+            issued++;
+        }
+        if (ret != e_success)
+            break;
+
+        // Compute stage: this block, in payload order
+        PipeSlot *s = &p.slots[done % PIPELINE_SLOTS];
+        s->reading = 0;
+        if (ioq_wait(q, &s->window_io) != e_success)
+        {
+            ret = e_failure;
+            break;
+        }
+        lsb_extract_bits(pipe_carrier(&p, s), s->n, s->data, depth);
+        if (hook)
+            hook(ctx, s->data, s->n);
+        if (s->end > end)
+            end = s->end;
+
+        // Write stage
+        ioq_prep(&s->data_io, fd_out, 1, s->data, s->n, out_off + (off_t)(done * block));
+        ioq_submit(q, &s->data_io);
+        s->writing = 1;
+        done++;
+    }
+
+    if (pipe_drain(&p, 0) != e_success)
+        ret = e_failure;
+    if (ret == e_success)
+        *pos = end;
+    pipe_free(&p);
+    return ret;
+}
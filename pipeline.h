@@ -0,0 +1,41 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h"
+#include "bmp.h"
+#include "ioq.h"
+
+/*
+ * Three-stage pipeline over the payload region of a carrier: the reads of
+ * the next blocks (secret bytes and carrier windows) and the writes of the
+ * finished ones run on an I/O queue (see ioq.h) while the calling thread
+ * embeds or extracts the current block. PIPELINE_SLOTS blocks rotate
+ * through a ring of buffers, so up to PIPELINE_SLOTS - 1 blocks are read
+ * ahead and written behind the one being worked on.
+ *
+ * Blocks are handled in payload order on one thread, so hook can carry
+ * sequential state (the AEAD stream, running checksums). On embed it sees
+ * the secret bytes before they are embedded; on extract it sees the
+ * extracted bytes before they are written.
+ *
+ * *pos is the file offset where the first window may start (the carrier
+ * stream's position); it is set to the end of the last window, where the
+ * streams resume.
+ */
+#define PIPELINE_SLOTS 4
+
+typedef void (*PipelineHook)(void *ctx, unsigned char *data, size_t len);
+
+/* Embed size bytes of fd_secret from secret_off into the carrier bytes of fd_src at logical, writing fd_stego */
+Status pipeline_embed(IoQueue *q, int fd_secret, off_t secret_off, int fd_src, int fd_stego, const BmpLayout *layout,
+                      uint64_t logical, uint64_t size, int depth, size_t block, PipelineHook hook, void *ctx,
+                      uint64_t *pos);
+
+/* Extract size payload bytes from fd_stego at logical and write them to fd_out from out_off */
+Status pipeline_extract(IoQueue *q, int fd_stego, int fd_out, off_t out_off, const BmpLayout *layout,
+                        uint64_t logical, uint64_t size, int depth, size_t block, PipelineHook hook, void *ctx,
+                        uint64_t *pos);
+
+#endif
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "scan.h"
+#include "threadpool.h"
+#include "pio.h"
+#include "steg.h"
+#include "format.h"
+#include "common.h"
+
+/* First read of each file; covers the header and magic of ordinary BMPs */
+#define SCAN_READ 512
+
+/* Files checked per pool task, so one huge directory still spreads over the workers */
+#define SCAN_BATCH 256
+
+/* Longest BMP header (bfOffBits) read ahead to reach the magic string */
+#define SCAN_PROBE_MAX (1024 * 1024)
+
+/* Totals shared by all tasks of a scan (updated atomically) */
+typedef struct
+{
+    ThreadPool *pool;
+    unsigned long files;        // Regular files looked at
+    unsigned long images;       // BMP images among them
+    unsigned long found;        // Images carrying a payload
+    unsigned long errors;       // Files or directories that could not be read
+    unsigned long long bytes;   // Bytes read from files
+} ScanState;
+
+typedef struct
+{
+    ScanState *scan;
+    char *path;
+} ScanDir;
+
+typedef struct
+{
+    ScanState *scan;
+    int count;
+    char *paths[SCAN_BATCH];
+} ScanBatch;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void count(unsigned long *counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+/* Write path as a JSON string body */
+static void put_json_string(FILE *out, const char *s)
+{
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            putc(c, out);
+    }
+}
+
+/* Read the BMP header and first carrier bytes of path and look for the magic string */
+static void check_file(ScanState *scan, const char *path)
+{
+    unsigned char first[SCAN_READ];
+    unsigned char *buf = first;
+    struct stat st;
+
+    count(&scan->files);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        count(&scan->errors);
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    ssize_t got = pread_upto(fd, first, sizeof(first), 0);
+    if (got >= BMP_HEADER_SIZE && first[0] == 'B' && first[1] == 'M')
+    {
+        // A large bfOffBits puts the magic string past the first read
+        uint64_t need = steg_probe_length(first, (size_t)got, (uint64_t)st.st_size);
+        if (need > (uint64_t)got && got == (ssize_t)sizeof(first) && need <= SCAN_PROBE_MAX &&
+            (buf = malloc((size_t)need)) != NULL)
+        {
+            memcpy(buf, first, (size_t)got);
+            ssize_t more = pread_upto(fd, buf + got, (size_t)need - (size_t)got, got);
+            got = more < 0 ? -1 : got + more;
+        }
+    }
+    close(fd);
+    if (buf == NULL || got < 0)
+    {
+        count(&scan->errors);
+        return;
+    }
+    __atomic_fetch_add(&scan->bytes, (unsigned long long)got, __ATOMIC_RELAXED);
+
+    BmpLayout layout;
+    uint32_t word, extn_len, version = 0, flags = 0;
+    StegStatus status = steg_detect_layout(buf, (size_t)got, (uint64_t)st.st_size, &layout, &word);
+    if (buf != first)
+        free(buf);
+    if (status == steg_err_format)
+        return;
+    count(&scan->images);
+    if (status == steg_ok)
+    {
+        bmp_free(&layout);
+        steg_unpack_extn_word(word, &extn_len, &version, &flags);
+        count(&scan->found);
+    }
+
+    // One line per image; the lock keeps lines from different workers whole
+    flockfile(stdout);
+    fputs("{\"path\":\"", stdout);
+    put_json_string(stdout, path);
+    if (status == steg_ok)
+        printf("\",\"stego\":true,\"version\":%u,\"flags\":%u}\n", version, flags);
+    else
+        printf("\",\"stego\":false%s}\n", status == steg_err_corrupt ? ",\"corrupt\":true" : "");
+    funlockfile(stdout);
+}
+
+static void scan_batch(void *arg)
+{
+    ScanBatch *batch = arg;
+    for (int i = 0; i < batch->count; i++)
+    {
+        check_file(batch->scan, batch->paths[i]);
+        free(batch->paths[i]);
+    }
+    free(batch);
+}
+
+/* Hand a batch to the pool, or check it here if the pool cannot take it */
+static void submit_batch(ScanBatch *batch)
+{
+    if (batch->count > 0 && pool_submit(batch->scan->pool, scan_batch, batch) == e_success)
+        return;
+    scan_batch(batch);
+}
+
+static void scan_dir(void *arg);
+
+static void submit_dir(ScanState *scan, char *path)
+{
+    ScanDir *dir = malloc(sizeof(*dir));
+    if (dir == NULL)
+    {
+        count(&scan->errors);
+        free(path);
+        return;
+    }
+    dir->scan = scan;
+    dir->path = path;
+    if (pool_submit(scan->pool, scan_dir, dir) != e_success)
+        scan_dir(dir);
+}
+
+/* List one directory: subdirectories become new tasks, files are checked in batches */
+static void scan_dir(void *arg)
+{
+    ScanDir *dir = arg;
+    ScanState *scan = dir->scan;
+    ScanBatch *batch = NULL;
+
+    DIR *dp = opendir(dir->path);
+    if (dp == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to open directory %s\n", dir->path);
+        count(&scan->errors);
+        goto out;
+    }
+
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        size_t len = strlen(dir->path) + strlen(de->d_name) + 2;
+        char *path = malloc(len);
+        if (path == NULL)
+        {
+            count(&scan->errors);
+            continue;
+        }
+        snprintf(path, len, "%s/%s", dir->path, de->d_name);
+
+        // Symbolic links are not followed; d_type saves a stat on most file systems
+        unsigned char type = de->d_type;
+        struct stat st;
+        if (type == DT_UNKNOWN && fstatat(dirfd(dp), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+
+        if (type == DT_DIR)
+        {
+            submit_dir(scan, path);
+            continue;
+        }
+        if (type != DT_REG)
+        {
+            free(path);
+            continue;
+        }
+
+        if (batch == NULL && (batch = calloc(1, sizeof(*batch))) == NULL)
+        {
+            check_file(scan, path);
+            free(path);
+            continue;
+        }
+        batch->scan = scan;
+        batch->paths[batch->count++] = path;
+        if (batch->count == SCAN_BATCH)
+        {
+            submit_batch(batch);
+            batch = NULL;
+        }
+    }
+    closedir(dp);
+    if (batch != NULL)
+        submit_batch(batch);
+
+out:
+    free(dir->path);
+    free(dir);
+}
+
+Status run_scan(const char *root, int threads)
+{
+    ScanState scan;
+    struct stat st;
+
+    if (stat(root, &st) != 0)
+    {
+        perror("stat");
+        fprintf(stderr, "ERROR: Unable to scan %s\n", root);
+        return e_failure;
+    }
+    if (threads < 1)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    memset(&scan, 0, sizeof(scan));
+    scan.pool = pool_create(threads);
+    if (scan.pool == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to start %d worker threads\n", threads);
+        return e_failure;
+    }
+
+    double start = now_seconds();
+    if (S_ISDIR(st.st_mode))
+    {
+        char *path = strdup(root);
+        if (path != NULL)
+            submit_dir(&scan, path);
+    }
+    else
+        check_file(&scan, root);
+
+    // Directory tasks queue more work as they go; wait until the whole tree is done
+    pool_wait(scan.pool);
+    pool_destroy(scan.pool);
+    double elapsed = now_seconds() - start;
+    fflush(stdout);
+
+    fprintf(stderr, "Scan: %lu files, %lu BMP images, %lu with payload, %lu errors; %llu bytes read in %.3f s "
+                    "(%.0f files/s, %d threads)\n",
+            scan.files, scan.images, scan.found, scan.errors, scan.bytes, elapsed,
+            elapsed > 0 ? scan.files / elapsed : 0.0, threads);
+    return scan.errors ? e_failure : e_success;
+}
@@ -0,0 +1,18 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "types.h"
+
+/*
+ * Walk the tree under root on a worker pool and check every regular file
+ * for an embedded payload, reading only the BMP header and the first
+ * carrier bytes (magic string and header word) of each one.
+ *
+ * One NDJSON object per BMP goes to stdout as it is checked:
+ *   {"path":"a/b.bmp","stego":true,"version":2,"flags":32}
+ * Files that are not BMP images are counted but not listed. A summary with
+ * files/s and bytes read goes to stderr. threads < 1 uses one per CPU.
+ */
+Status run_scan(const char *root, int threads);
+
+#endif
@@ -0,0 +1,85 @@
+#include <string.h>
+#include <stdint.h>
+#include "scatter.h"
+
+/* Distinct nonce so the scatter keys never share keystream with a sealed payload */
+static const unsigned char scatter_nonce[AEAD_NONCE_LEN] = {'s', 't', 'e', 'g', '-', 's', 'c', 'a', 't', 't', 'e', 'r'};
+
+/* splitmix64 finaliser: cheap, and every input bit reaches every output bit */
+static uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t load64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+void scatter_init(ScatterMap *map, const unsigned char key[AEAD_KEY_LEN], uint64_t base, uint64_t capacity)
+{
+    // Round keys are the first keystream bytes under the payload key and a fixed nonce
+    unsigned char stream[8 * (SCATTER_ROUNDS + 1)];
+    ChaCha20 cipher;
+    memset(stream, 0, sizeof(stream));
+    chacha20_init(&cipher, key, scatter_nonce, 0);
+    chacha20_xor(&cipher, 0, stream, sizeof(stream));
+
+    memset(map, 0, sizeof(*map));
+    map->base = base;
+    map->nblocks = capacity > base ? (capacity - base) / SCATTER_BLOCK : 0;
+    map->half_bits = 1;
+    while (map->half_bits < 32 && ((uint64_t)1 << (2 * map->half_bits)) < map->nblocks)
+        map->half_bits++;
+    for (int r = 0; r < SCATTER_ROUNDS; r++)
+        map->keys[r] = load64(stream + 8 * r);
+    map->line_key = load64(stream + 8 * SCATTER_ROUNDS);
+
+    memset(stream, 0, sizeof(stream));
+    memset(&cipher, 0, sizeof(cipher));
+}
+
+/* One pass of the balanced Feistel network over 2 * half_bits bits */
+static uint64_t feistel(const ScatterMap *map, uint64_t x)
+{
+    const unsigned h = map->half_bits;
+    const uint64_t mask = ((uint64_t)1 << h) - 1;
+    uint64_t left = x >> h, right = x & mask;
+    for (int r = 0; r < SCATTER_ROUNDS; r++)
+    {
+        uint64_t next = left ^ (mix64(right + map->keys[r]) & mask);
+        left = right;
+        right = next;
+    }
+    return left << h | right;
+}
+
+uint64_t scatter_block(const ScatterMap *map, uint64_t b)
+{
+    // Cycle-walk: the Feistel domain is at most 4x nblocks, so this takes a few passes on average
+    do
+        b = feistel(map, b);
+    while (b >= map->nblocks);
+    return b;
+}
+
+unsigned scatter_line_mask(const ScatterMap *map, uint64_t b)
+{
+    return (unsigned)(mix64(b ^ map->line_key) & (SCATTER_LINES - 1));
+}
+
+uint64_t scatter_map(const ScatterMap *map, uint64_t logical)
+{
+    uint64_t rel = logical - map->base;
+    if (logical < map->base || rel / SCATTER_BLOCK >= map->nblocks)
+        return logical;
+
+    uint64_t b = rel / SCATTER_BLOCK, in = rel % SCATTER_BLOCK;
+    uint64_t line = (in / SCATTER_LINE) ^ scatter_line_mask(map, b);
+    return map->base + scatter_block(map, b) * SCATTER_BLOCK + line * SCATTER_LINE + in % SCATTER_LINE;
+}
@@ -0,0 +1,49 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "aead.h"
+
+/*
+ * Keyed position mapper for scattered payloads (STEG_F_SCATTER).
+ *
+ * The carrier bytes of the scattered region are cut into blocks of
+ * SCATTER_BLOCK logical bytes. Logical block b is stored in physical
+ * block perm(b), where perm is a keyed Feistel permutation over the
+ * number of whole blocks (no table, O(1) per block). Inside a block the
+ * SCATTER_LINE-byte lines are reordered by XOR-ing the line index with
+ * a keyed per-block mask.
+ *
+ * Lines stay contiguous, so a block is moved with 64 short copies that all
+ * land in the same page. Offsets before the region and past its last whole
+ * block map to themselves. Every block maps on its own, so any range can
+ * be embedded or extracted independently of the others.
+ */
+#define SCATTER_LINE    64                      // Carrier bytes kept contiguous
+#define SCATTER_BLOCK   4096                    // Carrier bytes per permuted block
+#define SCATTER_LINES   (SCATTER_BLOCK / SCATTER_LINE)
+#define SCATTER_ROUNDS  4
+
+typedef struct _ScatterMap
+{
+    uint64_t base;                  // Logical offset of the first scattered carrier byte
+    uint64_t nblocks;               // Whole blocks in the region
+    unsigned half_bits;             // Feistel half width: 2^(2 * half_bits) >= nblocks
+    uint64_t keys[SCATTER_ROUNDS];  // Round keys
+    uint64_t line_key;              // Seeds the in-block line masks
+} ScatterMap;
+
+/* Scatter the carrier bytes [base, capacity) under key */
+void scatter_init(ScatterMap *map, const unsigned char key[AEAD_KEY_LEN], uint64_t base, uint64_t capacity);
+
+/* Physical block holding logical block b (< nblocks) */
+uint64_t scatter_block(const ScatterMap *map, uint64_t b);
+
+/* Mask XOR-ed into the line indices of logical block b */
+unsigned scatter_line_mask(const ScatterMap *map, uint64_t b);
+
+/* Logical offset where the carrier byte at a logical offset is actually stored */
+uint64_t scatter_map(const ScatterMap *map, uint64_t logical);
+
+#endif
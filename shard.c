@@ -0,0 +1,42 @@
+#include <string.h>
+#include "shard.h"
+
+static void put_be(unsigned char *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = (unsigned char)(v >> (8 * (bytes - 1 - i)));
+}
+
+static uint64_t get_be(const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v = v << 8 | p[i];
+    return v;
+}
+
+void shard_write_header(const ShardHeader *hdr, unsigned char *out)
+{
+    memcpy(out, hdr->id, SHARD_ID_LEN);
+    put_be(out + SHARD_ID_LEN, hdr->seq, 4);
+    put_be(out + SHARD_ID_LEN + 4, hdr->count, 4);
+    put_be(out + SHARD_ID_LEN + 8, hdr->offset, 8);
+    put_be(out + SHARD_ID_LEN + 16, hdr->total, 8);
+}
+
+Status shard_read_header(const unsigned char *in, uint64_t payload_len, ShardHeader *hdr)
+{
+    if (payload_len < SHARD_HEADER_LEN)
+        return e_failure;
+
+    memcpy(hdr->id, in, SHARD_ID_LEN);
+    hdr->seq = (uint32_t)get_be(in + SHARD_ID_LEN, 4);
+    hdr->count = (uint32_t)get_be(in + SHARD_ID_LEN + 4, 4);
+    hdr->offset = get_be(in + SHARD_ID_LEN + 8, 8);
+    hdr->total = get_be(in + SHARD_ID_LEN + 16, 8);
+
+    uint64_t slice = payload_len - SHARD_HEADER_LEN;
+    if (hdr->count == 0 || hdr->seq >= hdr->count || hdr->offset > hdr->total || slice > hdr->total - hdr->offset)
+        return e_failure;
+    return e_success;
+}
@@ -0,0 +1,40 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Sharded payload (STEG_F_SHARD): one slice of a payload too large for a
+ * single carrier. The stored payload of each shard starts with a fixed
+ * header, followed by the slice bytes:
+ *
+ *   payload id (16 bytes) | sequence (u32 BE) | shard count (u32 BE) |
+ *   slice offset (u64 BE) | whole payload length (u64 BE)
+ *
+ * Shards of one payload share the id, count and length; the offset says
+ * where the slice goes, so shards can be joined in any order.
+ */
+#define SHARD_ID_LEN        16
+#define SHARD_HEADER_LEN    (SHARD_ID_LEN + 4 + 4 + 8 + 8)
+
+typedef struct _ShardHeader
+{
+    unsigned char id[SHARD_ID_LEN];
+    uint32_t seq;           // 0 .. count - 1
+    uint32_t count;
+    uint64_t offset;        // First payload byte of the slice
+    uint64_t total;         // Length of the whole payload
+} ShardHeader;
+
+/* Write a header (SHARD_HEADER_LEN bytes) to out */
+void shard_write_header(const ShardHeader *hdr, unsigned char *out);
+
+/*
+ * Parse the header at the start of a shard payload of payload_len bytes;
+ * fails if the fields are inconsistent or the slice runs past the payload.
+ */
+Status shard_read_header(const unsigned char *in, uint64_t payload_len, ShardHeader *hdr);
+
+#endif
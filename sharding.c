@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sharding.h"
+#include "shard.h"
+#include "steg.h"
+#include "format.h"
+#include "mmap_io.h"
+#include "threadpool.h"
+#include "pio.h"
+#include "log.h"
+#include "common.h"
+
+typedef struct
+{
+    EncodeInfo enc;                         // One encode of a slice into a carrier
+    unsigned char hdr[SHARD_HEADER_LEN];
+    char output[STEG_PATH_MAX];
+    Status status;
+} ShardJob;
+
+typedef struct
+{
+    const char *fname;
+    const unsigned char *key;
+    int fd;                                 // Shared output file
+    ShardHeader hdr;
+    uint64_t slice_len;
+    Status status;
+} JoinJob;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int default_threads(int threads)
+{
+    if (threads < 1)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    return threads;
+}
+
+/* Most secret bytes a carrier holds as one shard with these options, 0 if none */
+static uint64_t shard_room(const char *carrier, const EncodeInfo *proto, size_t extn_len)
+{
+    FILE *fptr = fopen(carrier, "rb");
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open carrier %s\n", carrier);
+        return 0;
+    }
+
+    unsigned char header[BMP_HEADER_SIZE];
+    StegEncodeOptions opts = {0};
+    BmpLayout layout;
+    memset(&layout, 0, sizeof(layout));
+    opts.skip_alpha = proto->skip_alpha;
+    int ok = fread(header, 1, sizeof(header), fptr) == sizeof(header) &&
+             steg_carrier_layout(header, sizeof(header), stream_size(fptr), &opts, &layout) == steg_ok;
+    fclose(fptr);
+    if (!ok)
+    {
+        fprintf(stderr, "ERROR: Unsupported BMP image %s\n", carrier);
+        return 0;
+    }
+    uint64_t capacity = layout.capacity;
+    bmp_free(&layout);
+
+    // Header fields take one carrier byte per bit; the payload region packs depth bits per byte
+    int depth = proto->depth ? proto->depth : 1;
+    uint64_t header_bits = (strlen(MAGIC_STRING) + extn_len) * 8 + 32 + 32;
+    if (capacity <= header_bits)
+        return 0;
+    uint64_t room = (capacity - header_bits) / (8 / depth);
+
+    uint32_t flags = proto->encrypt ? STEG_F_ENCRYPTED : 0;
+    uint64_t fixed = steg_nonce_len(flags) + steg_trailer_len(0, flags);
+    if (room <= fixed)
+        return 0;
+    room -= fixed;
+
+    // Every started STEG_CRC_CHUNK of stored bytes adds a 4-byte checksum
+    if (proto->crc)
+    {
+        uint64_t full = room / (STEG_CRC_CHUNK + 4), rem = room % (STEG_CRC_CHUNK + 4);
+        room = full * STEG_CRC_CHUNK + (rem > 4 ? rem - 4 : 0);
+    }
+
+    // Keep every shard within the 32-bit size field
+    if (room > STEG_SIZE32_MAX)
+        room = STEG_SIZE32_MAX;
+    return room > SHARD_HEADER_LEN ? room - SHARD_HEADER_LEN : 0;
+}
+
+static void run_shard_job(void *arg)
+{
+    ShardJob *job = arg;
+    job->status = do_encoding(&job->enc);
+}
+
+Status run_shard(const char *secret, const char *prefix, char **carriers, int ncarriers,
+                 const EncodeInfo *proto, int threads)
+{
+    struct stat st;
+    if (stat(secret, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "ERROR: %s is not a regular file; shards are read from it at their offsets\n", secret);
+        return e_failure;
+    }
+    if (proto->compress || proto->scatter)
+    {
+        fprintf(stderr, "ERROR: Shards are stored uncompressed and unscattered (no -z or --scatter)\n");
+        return e_failure;
+    }
+
+    // The same extension goes into every shard header, as check_capacity derives it
+    const char *dot = strrchr(secret, '.');
+    size_t extn_len = dot && dot != secret ? strlen(dot + 1) : 0;
+    if (extn_len > sizeof(proto->extn_secret_file) - 1)
+        extn_len = sizeof(proto->extn_secret_file) - 1;
+
+    ShardJob *jobs = calloc((size_t)ncarriers, sizeof(*jobs));
+    uint64_t *room = calloc((size_t)ncarriers, sizeof(*room));
+    if (jobs == NULL || room == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        free(jobs);
+        free(room);
+        return e_failure;
+    }
+
+    uint64_t total = (uint64_t)st.st_size, sum = 0;
+    for (int i = 0; i < ncarriers; i++)
+    {
+        sum += room[i] = shard_room(carriers[i], proto, extn_len);
+        if (room[i] == 0)
+        {
+            fprintf(stderr, "ERROR: %s cannot hold a shard\n", carriers[i]);
+            free(jobs);
+            free(room);
+            return e_failure;
+        }
+    }
+    if (sum < total)
+    {
+        fprintf(stderr, "ERROR: Insufficient capacity. Carriers hold %llu bytes as shards, payload is %llu bytes\n",
+                (unsigned long long)sum, (unsigned long long)total);
+        free(jobs);
+        free(room);
+        return e_failure;
+    }
+
+    ShardHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if (random_bytes(hdr.id, sizeof(hdr.id)) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to generate a payload id\n");
+        free(jobs);
+        free(room);
+        return e_failure;
+    }
+    hdr.count = (uint32_t)ncarriers;
+    hdr.total = total;
+
+    // Slices in proportion to capacity, so every carrier fills to the same fraction;
+    // the rounding remainder goes to the first carriers with room to spare
+    uint64_t assigned = 0;
+    for (int i = 0; i < ncarriers; i++)
+    {
+        jobs[i].enc.slice_len = (uint64_t)((unsigned __int128)total * room[i] / sum);
+        assigned += jobs[i].enc.slice_len;
+    }
+    for (int i = 0; i < ncarriers && assigned < total; i++)
+    {
+        uint64_t extra = room[i] - jobs[i].enc.slice_len;
+        if (extra > total - assigned)
+            extra = total - assigned;
+        jobs[i].enc.slice_len += extra;
+        assigned += extra;
+    }
+    free(room);
+
+    Status ret = e_success;
+    uint64_t offset = 0;
+    for (int i = 0; i < ncarriers; i++)
+    {
+        ShardJob *job = &jobs[i];
+        uint64_t slice_len = job->enc.slice_len;
+
+        if (snprintf(job->output, sizeof(job->output), "%s.%03d.bmp", prefix, i) >= (int)sizeof(job->output))
+        {
+            fprintf(stderr, "ERROR: Output prefix %s is too long\n", prefix);
+            ret = e_failure;
+            break;
+        }
+        hdr.seq = (uint32_t)i;
+        hdr.offset = offset;
+        shard_write_header(&hdr, job->hdr);
+
+        // Each shard is a plain single-threaded encode; the pool runs the shards side by side
+        job->enc = *proto;
+        job->enc.src_image_fname = carriers[i];
+        job->enc.secret_fname = (char *)secret;
+        job->enc.stego_image_fname = job->output;
+        job->enc.use_mmap = 0;
+        job->enc.threads = 1;
+        job->enc.shard_hdr = job->hdr;
+        job->enc.slice_offset = offset;
+        job->enc.slice_len = slice_len;
+        job->status = e_failure;
+        offset += slice_len;
+    }
+    if (ret != e_success)
+    {
+        free(jobs);
+        return ret;
+    }
+
+    LogLevel saved_level = steg_log_level;
+    steg_log_level = LOG_LEVEL_ERROR;
+    threads = default_threads(threads);
+    double start = now_seconds();
+    ThreadPool *pool = pool_create(threads);
+    if (pool == NULL)
+    {
+        steg_log_level = saved_level;
+        fprintf(stderr, "ERROR: Unable to start %d worker threads\n", threads);
+        free(jobs);
+        return e_failure;
+    }
+    for (int i = 0; i < ncarriers; i++)
+    {
+        if (pool_submit(pool, run_shard_job, &jobs[i]) != e_success)
+            run_shard_job(&jobs[i]);
+    }
+    pool_wait(pool);
+    pool_destroy(pool);
+    double elapsed = now_seconds() - start;
+    steg_log_level = saved_level;
+
+    int failed = 0;
+    LOG_INFO("shard\tcarrier\toutput\toffset\tbytes\tstatus\n");
+    for (int i = 0; i < ncarriers; i++)
+    {
+        ShardJob *job = &jobs[i];
+        if (job->status != e_success)
+            failed++;
+        LOG_INFO("%d\t%s\t%s\t%llu\t%llu\t%s\n", i, carriers[i], job->output,
+               (unsigned long long)job->enc.slice_offset, (unsigned long long)job->enc.slice_len,
+               job->status == e_success ? "ok" : "FAILED");
+    }
+    LOG_INFO("Shard: %llu bytes in %d shards, %d failed in %.3f s (%d threads)\n",
+           (unsigned long long)total, ncarriers, failed, elapsed, threads);
+
+    free(jobs);
+    return failed ? e_failure : e_success;
+}
+
+/* Decode one shard in memory and write its slice at the slice offset */
+static void run_join_job(void *arg)
+{
+    JoinJob *job = arg;
+    FILE *fptr = fopen(job->fname, "rb");
+    MappedFile map = {0};
+    StegHeader hdr;
+    unsigned char *payload = NULL;
+    size_t payload_len = 0;
+
+    job->status = e_failure;
+    if (fptr == NULL || map_file_read(fptr, &map) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to read shard %s\n", job->fname);
+        goto out;
+    }
+
+    StegStatus st = steg_read_header_key((const unsigned char *)map.addr, map.len, job->key, &hdr);
+    if (st != steg_ok || !(hdr.flags & STEG_F_SHARD))
+    {
+        fprintf(stderr, "ERROR: %s: %s\n", job->fname, st != steg_ok ? steg_strerror(st) : "not a shard image");
+        goto out;
+    }
+
+    payload = malloc(hdr.payload_len ? hdr.payload_len : 1);
+    if (payload == NULL)
+    {
+        fprintf(stderr, "ERROR: %s: out of memory for %zu payload bytes\n", job->fname, hdr.payload_len);
+        goto out;
+    }
+    st = steg_decrypt_buffer((const unsigned char *)map.addr, map.len, job->key, payload, hdr.payload_len,
+                             &payload_len, &hdr);
+    if (st != steg_ok || shard_read_header(payload, payload_len, &job->hdr) != e_success)
+    {
+        fprintf(stderr, "ERROR: %s: %s\n", job->fname, st != steg_ok ? steg_strerror(st) : "corrupt shard header");
+        goto out;
+    }
+
+    job->slice_len = payload_len - SHARD_HEADER_LEN;
+    if (pwrite_full(job->fd, payload + SHARD_HEADER_LEN, job->slice_len, (off_t)job->hdr.offset) != e_success)
+    {
+        perror("pwrite");
+        fprintf(stderr, "ERROR: %s: unable to write %llu bytes at offset %llu\n", job->fname,
+                (unsigned long long)job->slice_len, (unsigned long long)job->hdr.offset);
+        goto out;
+    }
+    job->status = e_success;
+
+out:
+    free(payload);
+    unmap_file(&map);
+    if (fptr)
+        fclose(fptr);
+}
+
+/* Check that the decoded shards are the whole of one payload: in seq order, each slice starts where the last ended */
+static Status check_shard_set(const JoinJob *jobs, int n)
+{
+    const ShardHeader *first = &jobs[0].hdr;
+    int *by_seq = malloc((size_t)n * sizeof(*by_seq));
+    uint64_t next = 0;
+    Status ret = e_failure;
+
+    if (by_seq == NULL)
+        return e_failure;
+    for (int s = 0; s < n; s++)
+        by_seq[s] = -1;
+    if (first->count != (uint32_t)n)
+    {
+        fprintf(stderr, "ERROR: Payload was split into %u shards, %d given\n", first->count, n);
+        goto out;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        const ShardHeader *hdr = &jobs[i].hdr;
+        if (memcmp(hdr->id, first->id, SHARD_ID_LEN) != 0 || hdr->count != first->count || hdr->total != first->total)
+        {
+            fprintf(stderr, "ERROR: %s is a shard of a different payload than %s\n", jobs[i].fname, jobs[0].fname);
+            goto out;
+        }
+        if (by_seq[hdr->seq] >= 0)
+        {
+            fprintf(stderr, "ERROR: Shard %u given twice (%s)\n", hdr->seq, jobs[i].fname);
+            goto out;
+        }
+        by_seq[hdr->seq] = i;
+    }
+    // seq < count == n for every shard and none repeats, so every seq has its job
+    for (int s = 0; s < n; s++)
+    {
+        const JoinJob *job = &jobs[by_seq[s]];
+        if (job->hdr.offset != next)
+        {
+            fprintf(stderr, "ERROR: Shard %d (%s) starts at byte %llu, expected %llu\n", s, job->fname,
+                    (unsigned long long)job->hdr.offset, (unsigned long long)next);
+            goto out;
+        }
+        next += job->slice_len;
+    }
+    if (next != first->total)
+    {
+        fprintf(stderr, "ERROR: Shards cover %llu of %llu payload bytes\n", (unsigned long long)next,
+                (unsigned long long)first->total);
+        goto out;
+    }
+    ret = e_success;
+
+out:
+    free(by_seq);
+    return ret;
+}
+
+Status run_join(const char *output, char **shards, int nshards, const unsigned char *key, int threads)
+{
+    if (is_stdio_name(output))
+    {
+        fprintf(stderr, "ERROR: Shards are written at their offsets, so --join needs a regular output file\n");
+        return e_failure;
+    }
+
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to create %s\n", output);
+        return e_failure;
+    }
+
+    JoinJob *jobs = calloc((size_t)nshards, sizeof(*jobs));
+    if (jobs == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        close(fd);
+        unlink(output);
+        return e_failure;
+    }
+    for (int i = 0; i < nshards; i++)
+    {
+        jobs[i].fname = shards[i];
+        jobs[i].key = key;
+        jobs[i].fd = fd;
+        jobs[i].status = e_failure;
+    }
+
+    Status ret = e_failure;
+    threads = default_threads(threads);
+    double start = now_seconds();
+    ThreadPool *pool = pool_create(threads);
+    if (pool == NULL)
+        fprintf(stderr, "ERROR: Unable to start %d worker threads\n", threads);
+    else
+    {
+        // Shards land in the output in whatever order they finish decoding
+        for (int i = 0; i < nshards; i++)
+        {
+            if (pool_submit(pool, run_join_job, &jobs[i]) != e_success)
+                run_join_job(&jobs[i]);
+        }
+        pool_wait(pool);
+        pool_destroy(pool);
+
+        ret = e_success;
+        for (int i = 0; i < nshards; i++)
+            if (jobs[i].status != e_success)
+                ret = e_failure;
+        if (ret == e_success)
+            ret = check_shard_set(jobs, nshards);
+        if (ret == e_success && ftruncate(fd, (off_t)jobs[0].hdr.total) != 0)
+        {
+            perror("ftruncate");
+            ret = e_failure;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    if (close(fd) != 0)
+        ret = e_failure;
+    if (ret == e_success)
+        LOG_INFO("Join: %d shards, %llu bytes written to %s in %.3f s (%d threads)\n", nshards,
+               (unsigned long long)jobs[0].hdr.total, output, elapsed, threads);
+    else
+    {
+        unlink(output);
+        fprintf(stderr, "ERROR: Unable to join the shards; %s removed\n", output);
+    }
+
+    free(jobs);
+    return ret;
+}
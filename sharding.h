@@ -0,0 +1,26 @@
+#ifndef SHARDING_H
+#define SHARDING_H
+
+#include "types.h"
+#include "encode.h"
+
+/*
+ * Stripe a secret file over a pool of carriers. Each carrier receives one
+ * slice, sized in proportion to its capacity, behind a shard header (see
+ * shard.h); shard i is written to <prefix>.<iii>.bmp, i in three digits
+ * (out.000.bmp, out.001.bmp, ...). proto supplies the
+ * format options (depth, skip_alpha, crc, key). The shards are encoded on
+ * a worker pool; threads < 1 uses one per CPU.
+ */
+Status run_shard(const char *secret, const char *prefix, char **carriers, int ncarriers,
+                 const EncodeInfo *proto, int threads);
+
+/*
+ * Decode the shards of one payload concurrently, each worker writing its
+ * slice straight to its final offset in output as soon as it is decoded.
+ * key may be NULL for cleartext shards. Fails, removing output, unless the
+ * shards are exactly the full set of one payload.
+ */
+Status run_join(const char *output, char **shards, int nshards, const unsigned char *key, int threads);
+
+#endif
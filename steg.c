@@ -0,0 +1,1075 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "steg.h"
+#include "common.h"
+#include "format.h"
+#include "lsb_kernels.h"
+#include "lz.h"
+#include "bmp.h"
+#include "crc32c.h"
+#include "aead.h"
+#include "scatter.h"
+
+/* Stack buffer for carrier bytes gathered from a non-flat layout */
+#define STEG_BOUNCE_SIZE (16 * 1024)
+
+/* A carrier image seen through its layout */
+typedef struct
+{
+    const unsigned char *carrier;   // Source image
+    unsigned char *out;             // Stego image being written (may be carrier)
+    const BmpLayout *layout;
+    CrcChunks *crc;                 // Checksums of the stored payload, or NULL
+    Aead *aead;                     // Seals the stored payload, or NULL
+    unsigned char *scratch;         // STEG_CRC_CHUNK bytes to encrypt into (with aead)
+    ScatterMap *map;                // Payload positions of a scattered image, or NULL
+} Canvas;
+
+/* Layout kinds a decoder tries, most specific first */
+static const BmpLayoutKind probe_order[] = {bmp_layout_pixels, bmp_layout_no_alpha, bmp_layout_flat};
+
+/* Carrier bytes used by the magic string, extension word, extension and size field */
+static size_t header_bytes(size_t extn_len, int size_bits)
+{
+    return (strlen(MAGIC_STRING) + extn_len) * 8 + 32 + (size_t)size_bits;
+}
+
+/* Copy the n carrier bytes at logical offset off between image and a contiguous run */
+static void move_carrier(const BmpLayout *layout, unsigned char *image, uint64_t off, size_t n,
+                         unsigned char *run, int to_image)
+{
+    if (layout->identity)
+    {
+        if (to_image)
+            memcpy(image + BMP_HEADER_SIZE + off, run, n);
+        else
+            memcpy(run, image + BMP_HEADER_SIZE + off, n);
+    }
+    else if (to_image)
+        bmp_scatter(layout, image, 0, off, n, run);
+    else
+        bmp_gather(layout, image, 0, off, n, run);
+}
+
+/* move_carrier for carrier bytes that may lie in the scattered region: one block at a time, a line per copy */
+static void move_scattered(const BmpLayout *layout, const ScatterMap *map, unsigned char *image, uint64_t off,
+                           size_t n, unsigned char *run, int to_image)
+{
+    const uint64_t region_end = map->base + map->nblocks * SCATTER_BLOCK;
+    while (n > 0)
+    {
+        if (off < map->base || off >= region_end)
+        {
+            size_t take = off < map->base && map->base - off < n ? (size_t)(map->base - off) : n;
+            move_carrier(layout, image, off, take, run, to_image);
+            off += take;
+            run += take;
+            n -= take;
+            continue;
+        }
+
+        // The block's placement and line mask are worked out once for all of its lines
+        uint64_t rel = off - map->base, b = rel / SCATTER_BLOCK;
+        uint64_t phys = map->base + scatter_block(map, b) * SCATTER_BLOCK;
+        unsigned mask = scatter_line_mask(map, b);
+        for (uint64_t in = rel % SCATTER_BLOCK; n > 0 && in < SCATTER_BLOCK; )
+        {
+            size_t take = SCATTER_LINE - in % SCATTER_LINE < n ? SCATTER_LINE - in % SCATTER_LINE : n;
+            uint64_t line = (in / SCATTER_LINE) ^ mask;
+            move_carrier(layout, image, phys + line * SCATTER_LINE + in % SCATTER_LINE, take, run, to_image);
+            in += take;
+            off += take;
+            run += take;
+            n -= take;
+        }
+    }
+}
+
+/* Embed len data bytes at logical carrier offset off; returns the offset after them */
+static uint64_t embed_bytes(const Canvas *cv, const unsigned char *data, size_t len, uint64_t off, int depth)
+{
+    const BmpLayout *layout = cv->layout;
+
+    if (!layout->identity || cv->map)
+    {
+        // out already holds the whole carrier: gather each block, embed and put it back
+        unsigned char bounce[STEG_BOUNCE_SIZE];
+        const size_t block = STEG_BOUNCE_SIZE / 8;
+        for (size_t done = 0; done < len; )
+        {
+            size_t n = len - done < block ? len - done : block;
+            size_t span = lsb_carrier_bytes(n, depth);
+            if (cv->map)
+                move_scattered(layout, cv->map, cv->out, off, span, bounce, 0);
+            else
+                bmp_gather(layout, cv->out, 0, off, span, bounce);
+            lsb_embed_bits(data + done, n, bounce, depth);
+            if (cv->map)
+                move_scattered(layout, cv->map, cv->out, off, span, bounce, 1);
+            else
+                bmp_scatter(layout, cv->out, 0, off, span, bounce);
+            off += span;
+            done += n;
+        }
+        return off;
+    }
+
+    // Block-sized steps keep the copied carrier bytes cache-hot for the embed
+    const size_t block = STEG_CHUNK_SIZE / 8;
+    for (size_t done = 0; done < len; )
+    {
+        size_t n = len - done < block ? len - done : block;
+        size_t span = lsb_carrier_bytes(n, depth);
+        size_t pos = BMP_HEADER_SIZE + off;
+        if (cv->out != cv->carrier)
+            memcpy(cv->out + pos, cv->carrier + pos, span);
+        lsb_embed_bits(data + done, n, cv->out + pos, depth);
+        off += span;
+        done += n;
+    }
+    return off;
+}
+
+/* Extract len data bytes from logical carrier offset off (through map, if the image is scattered) */
+static void extract_bytes(const BmpLayout *layout, const ScatterMap *map, const unsigned char *stego, uint64_t off,
+                          size_t len, unsigned char *out, int depth)
+{
+    if (layout->identity && map == NULL)
+    {
+        lsb_extract_bits(stego + BMP_HEADER_SIZE + off, len, out, depth);
+        return;
+    }
+
+    unsigned char bounce[STEG_BOUNCE_SIZE];
+    const size_t block = STEG_BOUNCE_SIZE / 8;
+    for (size_t done = 0; done < len; )
+    {
+        size_t n = len - done < block ? len - done : block;
+        size_t span = lsb_carrier_bytes(n, depth);
+        if (map)
+            move_scattered(layout, map, (unsigned char *)stego, off, span, bounce, 0);
+        else
+            bmp_gather(layout, stego, 0, off, span, bounce);
+        lsb_extract_bits(bounce, n, out + done, depth);
+        off += span;
+        done += n;
+    }
+}
+
+/* Bytes of a piece at done..done+n that fall in the first clear bytes of its buffer */
+static size_t clear_part(size_t clear, size_t done, size_t n)
+{
+    return clear <= done ? 0 : (clear - done < n ? clear - done : n);
+}
+
+/*
+ * Embed stored payload bytes a chunk at a time: encrypt the chunk (leaving the first
+ * clear bytes readable), checksum it and embed it while it is still in cache.
+ */
+static uint64_t embed_payload(const Canvas *cv, const unsigned char *data, size_t len, size_t clear,
+                              uint64_t off, int depth)
+{
+    if (cv->crc == NULL && cv->aead == NULL)
+        return embed_bytes(cv, data, len, off, depth);
+
+    for (size_t done = 0; done < len; )
+    {
+        size_t n = len - done < STEG_CRC_CHUNK ? len - done : STEG_CRC_CHUNK;
+        const unsigned char *chunk = data + done;
+        if (cv->aead)
+        {
+            // The payload belongs to the caller, so encrypt a copy
+            memcpy(cv->scratch, chunk, n);
+            aead_seal(cv->aead, cv->scratch, n, clear_part(clear, done, n));
+            chunk = cv->scratch;
+        }
+        if (cv->crc)
+            crc_chunks_update(cv->crc, chunk, n);
+        off = embed_bytes(cv, chunk, n, off, depth);
+        done += n;
+    }
+    return off;
+}
+
+/* Extract stored payload bytes a chunk at a time, checksumming and decrypting each while it is in cache */
+static void extract_payload(const BmpLayout *layout, const ScatterMap *map, const unsigned char *stego, uint64_t off, size_t len,
+                            unsigned char *out, int depth, CrcChunks *crc, Aead *aead, size_t clear)
+{
+    if (crc == NULL && aead == NULL)
+    {
+        extract_bytes(layout, map, stego, off, len, out, depth);
+        return;
+    }
+
+    for (size_t done = 0; done < len; )
+    {
+        size_t n = len - done < STEG_CRC_CHUNK ? len - done : STEG_CRC_CHUNK;
+        extract_bytes(layout, map, stego, off, n, out + done, depth);
+        if (crc)
+            crc_chunks_update(crc, out + done, n);
+        if (aead)
+            aead_open(aead, out + done, n, clear_part(clear, done, n));
+        off += lsb_carrier_bytes(n, depth);
+        done += n;
+    }
+}
+
+/* Checksums moved through the carrier per step (4 bytes each) */
+#define CRC_TABLE_BATCH 256
+
+/* Embed the checksum table of the stored payload at off */
+static StegStatus embed_crc_table(const Canvas *cv, uint64_t off, int depth)
+{
+    CrcChunks *acc = cv->crc;
+    if (crc_chunks_finish(acc) != e_success)
+        return steg_err_nomem;
+
+    unsigned char be[CRC_TABLE_BATCH * 4];
+    for (size_t i = 0; i < acc->count; )
+    {
+        size_t n = acc->count - i < CRC_TABLE_BATCH ? acc->count - i : CRC_TABLE_BATCH;
+        for (size_t k = 0; k < n; k++)
+        {
+            uint32_t c = acc->crcs[i + k];
+            be[4 * k] = c >> 24;
+            be[4 * k + 1] = c >> 16;
+            be[4 * k + 2] = c >> 8;
+            be[4 * k + 3] = c;
+        }
+        off = embed_bytes(cv, be, n * 4, off, depth);
+        i += n;
+    }
+    return steg_ok;
+}
+
+/* Read checksums [first, first + count) of the table starting at logical offset table_off */
+static void extract_crc_table(const BmpLayout *layout, const ScatterMap *map, const unsigned char *stego,
+                              uint64_t table_off, size_t first, size_t count, int depth, uint32_t *crcs)
+{
+    unsigned char be[CRC_TABLE_BATCH * 4];
+    uint64_t off = table_off + lsb_carrier_bytes(first * 4, depth);
+    for (size_t i = 0; i < count; )
+    {
+        size_t n = count - i < CRC_TABLE_BATCH ? count - i : CRC_TABLE_BATCH;
+        extract_bytes(layout, map, stego, off, n * 4, be, depth);
+        for (size_t k = 0; k < n; k++)
+            crcs[i + k] = (uint32_t)be[4 * k] << 24 | (uint32_t)be[4 * k + 1] << 16 | (uint32_t)be[4 * k + 2] << 8 |
+                          be[4 * k + 3];
+        off += lsb_carrier_bytes(n * 4, depth);
+        i += n;
+    }
+}
+
+/* Compare the checksums gathered while extracting with the table at table_off */
+static StegStatus check_crc_table(const BmpLayout *layout, const ScatterMap *map, const unsigned char *stego,
+                                  uint64_t table_off, int depth, CrcChunks *acc)
+{
+    if (crc_chunks_finish(acc) != e_success)
+        return steg_err_nomem;
+
+    uint32_t stored[CRC_TABLE_BATCH];
+    for (size_t i = 0; i < acc->count; )
+    {
+        size_t n = acc->count - i < CRC_TABLE_BATCH ? acc->count - i : CRC_TABLE_BATCH;
+        extract_crc_table(layout, map, stego, table_off, i, n, depth, stored);
+        if (memcmp(stored, acc->crcs + i, n * sizeof(*stored)) != 0)
+            return steg_err_checksum;
+        i += n;
+    }
+    return steg_ok;
+}
+
+/* Embed a 32-bit header value, most significant byte first */
+static uint64_t embed_u32(const Canvas *cv, uint32_t value, uint64_t off)
+{
+    unsigned char be[4] = {value >> 24, value >> 16, value >> 8, value};
+    return embed_bytes(cv, be, 4, off, 1);
+}
+
+static uint32_t extract_u32(const BmpLayout *layout, const unsigned char *stego, uint64_t off)
+{
+    unsigned char be[4];
+    extract_bytes(layout, NULL, stego, off, 4, be, 1);
+    return (uint32_t)be[0] << 24 | (uint32_t)be[1] << 16 | (uint32_t)be[2] << 8 | be[3];
+}
+
+/* LSB depth requested by opts; 0 if it is not supported */
+static int options_depth(const StegEncodeOptions *opts)
+{
+    int depth = opts && opts->depth ? opts->depth : 1;
+    return steg_valid_depth(depth) ? depth : 0;
+}
+
+/* Embed the payload size field: 32 bits, or the high then low word with STEG_F_SIZE64 */
+static uint64_t embed_size(const Canvas *cv, uint64_t value, uint32_t flags, uint64_t off)
+{
+    if (flags & STEG_F_SIZE64)
+        off = embed_u32(cv, (uint32_t)(value >> 32), off);
+    return embed_u32(cv, (uint32_t)value, off);
+}
+
+/* Embed payload as a stream of LZ frames; *stored receives the embedded length */
+static StegStatus embed_compressed(const Canvas *cv, const unsigned char *payload, size_t len,
+                                   uint64_t off, size_t capacity, int depth, uint32_t flags, size_t *stored)
+{
+    unsigned char *frame = malloc(LZ_FRAME_MAX);
+    if (frame == NULL)
+        return steg_err_nomem;
+
+    StegStatus status = steg_ok;
+    size_t total = 0;
+    for (size_t done = 0; ; )
+    {
+        size_t n = len - done < LZ_BLOCK_SIZE ? len - done : LZ_BLOCK_SIZE;
+        size_t frame_len = LZ_FRAME_HEADER;
+
+        // An empty frame terminates the stream
+        if (n > 0)
+            frame_len = lz_encode_frame(payload + done, n, frame);
+        else
+            lz_put_frame_header(frame, 0, 0);
+
+        // The tag and checksum table come after the stored stream and have to fit too
+        if (frame_len > capacity - total || steg_trailer_len(total + frame_len, flags) > capacity - total - frame_len)
+        {
+            status = steg_err_capacity;
+            break;
+        }
+        off = embed_payload(cv, frame, frame_len, LZ_FRAME_HEADER, off, depth);
+        total += frame_len;
+        done += n;
+        if (n == 0)
+            break;
+    }
+
+    free(frame);
+    *stored = total;
+    return status;
+}
+
+/*
+ * Walk the frame headers of a framed payload starting at off, reading at most limit
+ * stored bytes. Gives the decompressed length and the stored length up to the end frame.
+ */
+static StegStatus frame_stream_length(const BmpLayout *layout, const ScatterMap *map, const unsigned char *stego,
+                                      uint64_t off, size_t limit, int depth, size_t *raw, size_t *stored)
+{
+    size_t total = 0, pos = 0;
+    for (;;)
+    {
+        unsigned char fh[LZ_FRAME_HEADER];
+        uint32_t raw_len, stored_len;
+
+        if (limit - pos < LZ_FRAME_HEADER)
+            return steg_err_corrupt;
+        extract_bytes(layout, map, stego, off + lsb_carrier_bytes(pos, depth), LZ_FRAME_HEADER, fh, depth);
+        if (!lz_get_frame_header(fh, &raw_len, &stored_len))
+            return steg_err_corrupt;
+        pos += LZ_FRAME_HEADER;
+        if (raw_len == 0)
+            break;
+        if (stored_len > limit - pos)
+            return steg_err_corrupt;
+        pos += stored_len;
+        total += raw_len;
+    }
+
+    *raw = total;
+    *stored = pos;
+    return steg_ok;
+}
+
+/* Extract and decompress the frames of a payload already checked by frame_stream_length */
+static StegStatus extract_frames(const BmpLayout *layout, const ScatterMap *map, const unsigned char *stego,
+                                 uint64_t off, int depth, unsigned char *out, CrcChunks *crc, Aead *aead)
+{
+    unsigned char *stored = malloc(LZ_BLOCK_SIZE);
+    if (stored == NULL)
+        return steg_err_nomem;
+
+    StegStatus status = steg_ok;
+    for (size_t pos = 0; ; )
+    {
+        unsigned char fh[LZ_FRAME_HEADER];
+        uint32_t raw_len, stored_len;
+
+        extract_payload(layout, map, stego, off, LZ_FRAME_HEADER, fh, depth, crc, aead, LZ_FRAME_HEADER);
+        lz_get_frame_header(fh, &raw_len, &stored_len);
+        off += lsb_carrier_bytes(LZ_FRAME_HEADER, depth);
+        if (raw_len == 0)
+            break;
+
+        // Raw frames extract straight into place
+        if (stored_len == raw_len)
+            extract_payload(layout, map, stego, off, raw_len, out + pos, depth, crc, aead, 0);
+        else
+        {
+            extract_payload(layout, map, stego, off, stored_len, stored, depth, crc, aead, 0);
+            if (lz_decompress(stored, stored_len, out + pos, raw_len) != e_success)
+            {
+                status = steg_err_corrupt;
+                break;
+            }
+        }
+        off += lsb_carrier_bytes(stored_len, depth);
+        pos += raw_len;
+    }
+
+    free(stored);
+    return status;
+}
+
+/* Payload bytes that fit after a header with the given size field width */
+static size_t payload_capacity(const BmpLayout *layout, size_t extn_len, int depth, int size_bits)
+{
+    uint64_t header = header_bytes(extn_len, size_bits);
+    return layout->capacity > header ? (size_t)((layout->capacity - header) / lsb_carrier_bytes(1, depth)) : 0;
+}
+
+/* Does a payload of payload_len bytes (stored with the given flags) need the 64-bit size field? */
+static int needs_size64(size_t payload_len, uint32_t flags)
+{
+    uint64_t stored = payload_len;
+    if (flags & STEG_F_COMPRESSED)
+        stored += (stored / LZ_BLOCK_SIZE + 2) * LZ_FRAME_HEADER;
+    return stored > STEG_SIZE32_MAX;
+}
+
+StegStatus steg_carrier_layout(const unsigned char *carrier, size_t len, uint64_t file_len,
+                               const StegEncodeOptions *opts, BmpLayout *layout)
+{
+    // Images without 24/32-bpp pixel rows keep the flat layout
+    BmpLayoutKind kind = opts && opts->skip_alpha ? bmp_layout_no_alpha : bmp_layout_pixels;
+    if (carrier == NULL || layout == NULL)
+        return steg_err_invalid;
+    if (bmp_parse(carrier, len, file_len, kind, layout) == e_success)
+        return steg_ok;
+    bmp_free(layout);
+    if (kind == bmp_layout_pixels && bmp_parse(carrier, len, file_len, bmp_layout_flat, layout) == e_success)
+        return steg_ok;
+    bmp_free(layout);
+    return steg_err_format;
+}
+
+uint32_t steg_layout_flags(const BmpLayout *layout)
+{
+    if (layout->kind == bmp_layout_no_alpha)
+        return STEG_F_SPANS | STEG_F_NO_ALPHA;
+    return layout->identity ? 0 : STEG_F_SPANS;
+}
+
+/* Was an image with these header flags written with this layout? */
+static int layout_matches(const BmpLayout *layout, uint32_t flags)
+{
+    switch (layout->kind)
+    {
+    case bmp_layout_flat:
+        return !(flags & (STEG_F_SPANS | STEG_F_NO_ALPHA));
+    case bmp_layout_pixels:
+        return !(flags & STEG_F_NO_ALPHA) && (layout->identity || (flags & STEG_F_SPANS));
+    case bmp_layout_no_alpha:
+        return (flags & STEG_F_NO_ALPHA) != 0;
+    }
+    return 0;
+}
+
+/* Does the image (first len bytes) hold a header written with this layout? */
+static StegStatus probe_layout(const BmpLayout *layout, const unsigned char *image, size_t len, uint32_t *word)
+{
+    const size_t magic_len = strlen(MAGIC_STRING);
+    const size_t probe = magic_len * 8 + 32;
+    unsigned char magic[8];
+    uint32_t extn_len, version, flags;
+
+    if (layout->capacity < probe || bmp_file_offset(layout, probe - 1) >= len)
+        return steg_err_no_payload;
+    extract_bytes(layout, NULL, image, 0, magic_len, magic, 1);
+    if (memcmp(magic, MAGIC_STRING, magic_len) != 0)
+        return steg_err_no_payload;
+    *word = extract_u32(layout, image, magic_len * 8);
+    if (!steg_unpack_extn_word(*word, &extn_len, &version, &flags))
+        return steg_err_corrupt;
+    return layout_matches(layout, flags) ? steg_ok : steg_err_no_payload;
+}
+
+StegStatus steg_detect_layout(const unsigned char *image, size_t len, uint64_t file_len, BmpLayout *layout,
+                              uint32_t *word)
+{
+    StegStatus status = steg_err_no_payload;
+
+    if (image == NULL || layout == NULL || word == NULL)
+        return steg_err_invalid;
+    if (len < BMP_HEADER_SIZE || image[0] != 'B' || image[1] != 'M')
+        return steg_err_format;
+
+    for (size_t k = 0; k < sizeof(probe_order) / sizeof(probe_order[0]); k++)
+    {
+        if (bmp_parse(image, len, file_len, probe_order[k], layout) == e_success)
+        {
+            StegStatus found = probe_layout(layout, image, len, word);
+            if (found == steg_ok)
+                return steg_ok;
+            if (found == steg_err_corrupt)
+                status = found;
+        }
+        bmp_free(layout);
+    }
+    return status;
+}
+
+/* File bytes up to the last of the first carrier_bytes carrier bytes, in whichever layout reaches furthest */
+static uint64_t probe_extent(const unsigned char *image, size_t len, uint64_t file_len, size_t carrier_bytes)
+{
+    uint64_t need = BMP_HEADER_SIZE;
+
+    for (size_t k = 0; k < sizeof(probe_order) / sizeof(probe_order[0]); k++)
+    {
+        BmpLayout layout;
+        if (bmp_parse(image, len, file_len, probe_order[k], &layout) == e_success && layout.capacity >= carrier_bytes)
+        {
+            uint64_t end = bmp_file_offset(&layout, carrier_bytes - 1) + 1;
+            if (end > need)
+                need = end;
+        }
+        bmp_free(&layout);
+    }
+    return need;
+}
+
+/* Largest probe prefix steg_detect_layout needs for an image with this BMP header */
+uint64_t steg_probe_length(const unsigned char *image, size_t len, uint64_t file_len)
+{
+    return probe_extent(image, len, file_len, strlen(MAGIC_STRING) * 8 + 32);
+}
+
+uint64_t steg_header_length(const unsigned char *image, size_t len, uint64_t file_len)
+{
+    return probe_extent(image, len, file_len, header_bytes(sizeof(((StegHeader *)0)->extn) - 1, 64));
+}
+
+size_t steg_capacity(const unsigned char *carrier, size_t carrier_len, size_t extn_len,
+                     const StegEncodeOptions *opts)
+{
+    BmpLayout layout;
+    int depth = options_depth(opts);
+    if (depth == 0 || steg_carrier_layout(carrier, carrier_len, carrier_len, opts, &layout) != steg_ok)
+        return 0;
+
+    // Past the 32-bit limit the header grows by the 64-bit size field
+    size_t capacity = payload_capacity(&layout, extn_len, depth, 32);
+    if (capacity > STEG_SIZE32_MAX)
+        capacity = payload_capacity(&layout, extn_len, depth, 64);
+    bmp_free(&layout);
+
+    // A sealed payload carries its nonce and tag
+    if (opts && opts->key)
+        capacity = capacity > STEG_NONCE_LEN + STEG_TAG_LEN ? capacity - STEG_NONCE_LEN - STEG_TAG_LEN : 0;
+
+    // Every full or partial chunk of payload costs 4 bytes of checksum table
+    if (opts && opts->crc)
+    {
+        size_t full = capacity / (STEG_CRC_CHUNK + 4), rem = capacity % (STEG_CRC_CHUNK + 4);
+        capacity = full * STEG_CRC_CHUNK + (rem > 4 ? rem - 4 : 0);
+    }
+    return capacity;
+}
+
+StegStatus steg_encode_buffer(const unsigned char *carrier, size_t carrier_len,
+                              const unsigned char *payload, size_t payload_len,
+                              const char *extn, unsigned char *out)
+{
+    return steg_encode_buffer_opts(carrier, carrier_len, payload, payload_len, extn, NULL, out);
+}
+
+static StegStatus encode_with_layout(const Canvas *cv, size_t carrier_len, const unsigned char *payload,
+                                     size_t payload_len, const char *extn, size_t extn_len, int depth,
+                                     const StegEncodeOptions *opts)
+{
+    const BmpLayout *layout = cv->layout;
+    int compress = opts && opts->compress;
+    uint32_t flags = (uint32_t)(depth - 1) | (compress ? STEG_F_COMPRESSED : 0) | (cv->crc ? STEG_F_CRC : 0) |
+                     (cv->aead ? STEG_F_ENCRYPTED : 0) | (cv->map ? STEG_F_SCATTER : 0) | steg_layout_flags(layout);
+    if (needs_size64(payload_len, flags))
+        flags |= STEG_F_SIZE64;
+
+    // The nonce comes out of the payload room; the tag and checksum table follow the stored bytes
+    size_t capacity = payload_capacity(layout, extn_len, depth, steg_size_bits(flags));
+    capacity = capacity > steg_nonce_len(flags) ? capacity - (size_t)steg_nonce_len(flags) : 0;
+    if (!compress && (payload_len > capacity || steg_trailer_len(payload_len, flags) > capacity - payload_len))
+        return steg_err_capacity;
+    if (cv->aead && payload_len + (payload_len / LZ_BLOCK_SIZE + 2) * LZ_FRAME_HEADER > STEG_SEALED_MAX)
+        return steg_err_capacity;
+
+    // Flat carriers are copied block by block as they are embedded, the others (and scattered ones) up front
+    int streamed = layout->identity && cv->map == NULL;
+    if (cv->out != cv->carrier)
+        memcpy(cv->out, cv->carrier, streamed ? BMP_HEADER_SIZE : carrier_len);
+
+    // The scattered region starts right after the nonce, where the stored bytes begin
+    if (cv->map)
+        scatter_init(cv->map, opts->key, header_bytes(extn_len, steg_size_bits(flags)) +
+                     lsb_carrier_bytes(STEG_NONCE_LEN, depth), layout->capacity);
+
+    uint32_t word = steg_pack_extn_word((uint32_t)extn_len, flags);
+    uint64_t off = 0;
+    off = embed_bytes(cv, (const unsigned char *)MAGIC_STRING, strlen(MAGIC_STRING), off, 1);
+    off = embed_u32(cv, word, off);
+    off = embed_bytes(cv, (const unsigned char *)(extn ? extn : ""), extn_len, off, 1);
+    if (cv->aead)
+    {
+        unsigned char aad[4 + sizeof(((StegHeader *)0)->extn)];
+        aead_init(cv->aead, opts->key, opts->nonce, aad, steg_header_aad(word, extn ? extn : "", extn_len, aad));
+    }
+
+    // The stored length of a compressed payload is only known afterwards, so its size field is filled in last
+    uint64_t size_off = off;
+    off = compress ? off + (uint64_t)steg_size_bits(flags) : embed_size(cv, payload_len, flags, off);
+    if (cv->aead)
+        off = embed_bytes(cv, opts->nonce, STEG_NONCE_LEN, off, depth);
+
+    size_t stored = payload_len;
+    if (compress)
+    {
+        StegStatus status = embed_compressed(cv, payload, payload_len, off, capacity, depth, flags, &stored);
+        if (status != steg_ok)
+            return status;
+        embed_size(cv, stored, flags, size_off);
+        off += lsb_carrier_bytes(stored, depth);
+    }
+    else
+        off = embed_payload(cv, payload, payload_len, 0, off, depth);
+
+    if (cv->aead)
+    {
+        unsigned char tag[STEG_TAG_LEN];
+        aead_tag(cv->aead, tag);
+        off = embed_bytes(cv, tag, sizeof(tag), off, depth);
+    }
+    if (cv->crc)
+    {
+        StegStatus status = embed_crc_table(cv, off, depth);
+        if (status != steg_ok)
+            return status;
+        off += lsb_carrier_bytes(cv->crc->count * 4, depth);
+    }
+
+    if (cv->out != cv->carrier && streamed)
+    {
+        size_t pos = BMP_HEADER_SIZE + off;
+        memcpy(cv->out + pos, cv->carrier + pos, carrier_len - pos);
+    }
+    return steg_ok;
+}
+
+StegStatus steg_encode_buffer_opts(const unsigned char *carrier, size_t carrier_len,
+                                   const unsigned char *payload, size_t payload_len,
+                                   const char *extn, const StegEncodeOptions *opts,
+                                   unsigned char *out)
+{
+    BmpLayout layout;
+    if (carrier == NULL)
+        return steg_err_invalid;
+    StegStatus status = steg_carrier_layout(carrier, carrier_len, carrier_len, opts, &layout);
+    if (status != steg_ok)
+        return status;
+    status = steg_encode_layout(carrier, carrier_len, &layout, payload, payload_len, extn, opts, out);
+    bmp_free(&layout);
+    return status;
+}
+
+StegStatus steg_encode_layout(const unsigned char *carrier, size_t carrier_len, const BmpLayout *layout,
+                              const unsigned char *payload, size_t payload_len,
+                              const char *extn, const StegEncodeOptions *opts,
+                              unsigned char *out)
+{
+    int depth = options_depth(opts);
+    if (carrier == NULL || layout == NULL || out == NULL || (payload == NULL && payload_len > 0) || depth == 0)
+        return steg_err_invalid;
+    if (opts && ((opts->key && opts->nonce == NULL) || (opts->scatter && opts->key == NULL)))
+        return steg_err_invalid;
+    if ((opts && opts->skip_alpha) != (layout->kind == bmp_layout_no_alpha))
+        return steg_err_invalid;
+
+    size_t extn_len = extn ? strlen(extn) : 0;
+    if (extn_len >= sizeof(((StegHeader *)0)->extn))
+        return steg_err_invalid;
+
+    CrcChunks crc;
+    Aead aead;
+    ScatterMap map;
+    unsigned char *scratch = NULL;
+    crc_chunks_init(&crc, STEG_CRC_CHUNK);
+    if (opts && opts->key && (scratch = malloc(STEG_CRC_CHUNK)) == NULL)
+        return steg_err_nomem;
+
+    Canvas cv = {carrier, out, layout, opts && opts->crc ? &crc : NULL, scratch ? &aead : NULL, scratch,
+                 opts && opts->scatter ? &map : NULL};
+    StegStatus status = encode_with_layout(&cv, carrier_len, payload, payload_len, extn, extn_len, depth, opts);
+    crc_chunks_free(&crc);
+    if (scratch)
+    {
+        // Do not leave key-derived state or plaintext behind
+        memset(&aead, 0, sizeof(aead));
+        memset(&map, 0, sizeof(map));
+        memset(scratch, 0, STEG_CRC_CHUNK);
+        free(scratch);
+    }
+    return status;
+}
+
+/*
+ * steg_read_header that also hands back the layout and the logical offset of the payload.
+ * For a scattered image, map is set up from key; without a key only plain payloads can be sized.
+ * With a given layout (borrowed: *layout is a copy the caller must not free) nothing is detected.
+ */
+static StegStatus read_header(const unsigned char *stego, size_t stego_len, const unsigned char *key,
+                              const BmpLayout *given, StegHeader *hdr, BmpLayout *layout, uint64_t *data_off,
+                              ScatterMap *map)
+{
+    uint32_t word;
+    StegStatus status;
+    if (given)
+    {
+        status = probe_layout(given, stego, stego_len, &word);
+        *layout = *given;
+    }
+    else
+        status = steg_detect_layout(stego, stego_len, stego_len, layout, &word);
+    if (status != steg_ok)
+        return status;
+
+    uint32_t extn_len, version, flags;
+    steg_unpack_extn_word(word, &extn_len, &version, &flags);
+    uint64_t off = strlen(MAGIC_STRING) * 8 + 32;
+    uint64_t capacity = layout->capacity;
+
+    status = steg_err_corrupt;
+    if (extn_len >= sizeof(hdr->extn) || capacity - off < extn_len * 8 + 32)
+        goto fail;
+    extract_bytes(layout, NULL, stego, off, extn_len, (unsigned char *)hdr->extn, 1);
+    hdr->extn[extn_len] = '\0';
+    off += extn_len * 8;
+
+    int depth = steg_flags_depth(flags);
+    int size_bits = steg_size_bits(flags);
+    if (capacity - off < (uint64_t)size_bits)
+        goto fail;
+    uint64_t size = extract_u32(layout, stego, off);
+    if (size_bits == 64)
+        size = size << 32 | extract_u32(layout, stego, off + 32);
+    off += (uint64_t)size_bits;
+    uint64_t room = (capacity - off) / lsb_carrier_bytes(1, depth);
+    uint64_t nonce = steg_nonce_len(flags);
+    if ((size_bits == 32 && size > STEG_SIZE32_MAX) || room < nonce || room - nonce < size)
+        goto fail;
+
+    // A sealed payload starts after its nonce
+    off += lsb_carrier_bytes((size_t)nonce, depth);
+    room -= nonce;
+
+    // Everything from here on may be scattered; frames can only be walked with the key
+    const ScatterMap *scattered = NULL;
+    if ((flags & STEG_F_SCATTER) && key)
+    {
+        scatter_init(map, key, off, capacity);
+        scattered = map;
+    }
+    else if ((flags & STEG_F_SCATTER) && (flags & STEG_F_FRAMED))
+    {
+        status = steg_err_key;
+        goto fail;
+    }
+
+    hdr->payload_len = size;
+    hdr->stored_len = size;
+    if (flags & STEG_F_FRAMED)
+    {
+        // A chunked stream runs until its end frame, anywhere within the image
+        size_t limit = (flags & STEG_F_CHUNKED) ? room : size;
+        status = frame_stream_length(layout, scattered, stego, off, limit, depth, &hdr->payload_len, &hdr->stored_len);
+        if (status != steg_ok)
+            goto fail;
+        status = steg_err_corrupt;
+        if (!(flags & STEG_F_CHUNKED) && hdr->stored_len != size)
+            goto fail;
+    }
+    if (steg_trailer_len(hdr->stored_len, flags) > room - hdr->stored_len)
+        goto fail;
+    hdr->data_offset = off < capacity ? bmp_file_offset(layout, off) : stego_len;
+    hdr->version = (int)version;
+    hdr->flags = flags;
+    hdr->depth = depth;
+    *data_off = off;
+    return steg_ok;
+
+fail:
+    if (given == NULL)
+        bmp_free(layout);
+    return status;
+}
+
+StegStatus steg_read_header(const unsigned char *stego, size_t stego_len, StegHeader *hdr)
+{
+    return steg_read_header_key(stego, stego_len, NULL, hdr);
+}
+
+StegStatus steg_read_header_key(const unsigned char *stego, size_t stego_len, const unsigned char *key,
+                                StegHeader *hdr)
+{
+    BmpLayout layout;
+    ScatterMap map;
+    uint64_t off;
+    if (stego == NULL || hdr == NULL)
+        return steg_err_invalid;
+
+    StegStatus status = read_header(stego, stego_len, key, NULL, hdr, &layout, &off, &map);
+    if (status == steg_ok)
+        bmp_free(&layout);
+    memset(&map, 0, sizeof(map));
+    return status;
+}
+
+/* Logical offset of the checksum table of a payload whose stored bytes start at off */
+static uint64_t crc_table_offset(const StegHeader *hdr, uint64_t off)
+{
+    uint64_t tag = (hdr->flags & STEG_F_ENCRYPTED) ? STEG_TAG_LEN : 0;
+    return off + lsb_carrier_bytes((size_t)(hdr->stored_len + tag), hdr->depth);
+}
+
+StegStatus steg_decode_buffer(const unsigned char *stego, size_t stego_len,
+                              unsigned char *out, size_t out_cap, size_t *out_len,
+                              StegHeader *hdr)
+{
+    return steg_decrypt_buffer(stego, stego_len, NULL, out, out_cap, out_len, hdr);
+}
+
+StegStatus steg_decrypt_buffer(const unsigned char *stego, size_t stego_len, const unsigned char *key,
+                               unsigned char *out, size_t out_cap, size_t *out_len, StegHeader *hdr)
+{
+    return steg_decrypt_layout(stego, stego_len, NULL, key, out, out_cap, out_len, hdr);
+}
+
+StegStatus steg_decrypt_layout(const unsigned char *stego, size_t stego_len, const BmpLayout *given,
+                               const unsigned char *key, unsigned char *out, size_t out_cap, size_t *out_len,
+                               StegHeader *hdr)
+{
+    StegHeader local;
+    BmpLayout layout;
+    uint64_t off;
+    if (hdr == NULL)
+        hdr = &local;
+    if (stego == NULL || out_len == NULL || (out == NULL && out_cap > 0))
+        return steg_err_invalid;
+
+    ScatterMap scatter;
+    StegStatus status = read_header(stego, stego_len, key, given, hdr, &layout, &off, &scatter);
+    if (status != steg_ok)
+        return status;
+    const ScatterMap *map = (hdr->flags & STEG_F_SCATTER) ? &scatter : NULL;
+
+    CrcChunks crc;
+    crc_chunks_init(&crc, STEG_CRC_CHUNK);
+    CrcChunks *acc = (hdr->flags & STEG_F_CRC) ? &crc : NULL;
+
+    // The nonce sits just before the stored bytes; header fields are the associated data
+    Aead aead;
+    Aead *sealed = NULL;
+    if ((hdr->flags & STEG_F_ENCRYPTED) && key)
+    {
+        unsigned char nonce[STEG_NONCE_LEN], aad[4 + sizeof(hdr->extn)];
+        size_t extn_len = strlen(hdr->extn);
+        extract_bytes(&layout, map, stego, off - lsb_carrier_bytes(STEG_NONCE_LEN, hdr->depth), STEG_NONCE_LEN, nonce,
+                      hdr->depth);
+        aead_init(&aead, key, nonce,
+                  aad, steg_header_aad(steg_pack_extn_word((uint32_t)extn_len, hdr->flags), hdr->extn, extn_len, aad));
+        sealed = &aead;
+    }
+
+    *out_len = hdr->payload_len;
+    if ((hdr->flags & (STEG_F_ENCRYPTED | STEG_F_SCATTER)) && key == NULL)
+        status = steg_err_key;
+    else if (out_cap < hdr->payload_len)
+        status = steg_err_buffer;
+    else if (hdr->flags & STEG_F_FRAMED)
+        status = extract_frames(&layout, map, stego, off, hdr->depth, out, acc, sealed);
+    else if (hdr->payload_len > 0)
+        extract_payload(&layout, map, stego, off, hdr->payload_len, out, hdr->depth, acc, sealed, 0);
+
+    if (status == steg_ok && acc)
+        status = check_crc_table(&layout, map, stego, crc_table_offset(hdr, off), hdr->depth, acc);
+    if (status == steg_ok && sealed)
+    {
+        unsigned char tag[STEG_TAG_LEN], expect[STEG_TAG_LEN];
+        aead_tag(sealed, tag);
+        extract_bytes(&layout, map, stego, off + lsb_carrier_bytes(hdr->stored_len, hdr->depth), STEG_TAG_LEN, expect,
+                      hdr->depth);
+        if (!aead_tag_equal(tag, expect))
+            status = steg_err_auth;
+    }
+
+    // Never hand back plaintext that did not authenticate
+    if (sealed && status != steg_ok && status != steg_err_buffer)
+        memset(out, 0, hdr->payload_len);
+    memset(&aead, 0, sizeof(aead));
+    memset(&scatter, 0, sizeof(scatter));
+    crc_chunks_free(&crc);
+    if (given == NULL)
+        bmp_free(&layout);
+    return status;
+}
+
+/*
+ * Check the chunks of a plain payload that overlap the extracted bytes out = [offset, offset + length):
+ * chunks wholly inside are checksummed from out, the partial ones at either end are extracted in full
+ */
+static StegStatus check_range_crcs(const BmpLayout *layout, const unsigned char *stego, const StegHeader *hdr,
+                                   uint64_t off, uint64_t offset, uint64_t length, const unsigned char *out)
+{
+    uint64_t table_off = crc_table_offset(hdr, off);
+    unsigned char *chunk = NULL;
+    StegStatus status = steg_ok;
+
+    for (uint64_t i = offset / STEG_CRC_CHUNK; status == steg_ok && i <= (offset + length - 1) / STEG_CRC_CHUNK; i++)
+    {
+        uint64_t pos = i * STEG_CRC_CHUNK;
+        size_t n = hdr->stored_len - pos < STEG_CRC_CHUNK ? (size_t)(hdr->stored_len - pos) : STEG_CRC_CHUNK;
+        const unsigned char *data = chunk;
+        uint32_t expect;
+        if (pos >= offset && pos + n <= offset + length)
+            data = out + (pos - offset);
+        else
+        {
+            if (chunk == NULL && (data = chunk = malloc(STEG_CRC_CHUNK)) == NULL)
+                return steg_err_nomem;
+            extract_bytes(layout, NULL, stego, off + lsb_carrier_bytes((size_t)pos, hdr->depth), n, chunk, hdr->depth);
+        }
+        extract_crc_table(layout, NULL, stego, table_off, (size_t)i, 1, hdr->depth, &expect);
+        if (crc32c(0, data, n) != expect)
+            status = steg_err_checksum;
+    }
+    free(chunk);
+    return status;
+}
+
+StegStatus steg_decode_range(const unsigned char *stego, size_t stego_len, uint64_t offset, uint64_t length,
+                             unsigned char *out, size_t out_cap, size_t *out_len, StegHeader *hdr)
+{
+    StegHeader local;
+    BmpLayout layout;
+    uint64_t off;
+    if (hdr == NULL)
+        hdr = &local;
+    if (stego == NULL || out_len == NULL || (out == NULL && out_cap > 0))
+        return steg_err_invalid;
+
+    ScatterMap map;
+    StegStatus status = read_header(stego, stego_len, NULL, NULL, hdr, &layout, &off, &map);
+    if (status != steg_ok)
+        return status;
+
+    // Plain payload byte i sits at a fixed carrier offset; frame streams have no such mapping,
+    // and a sealed (or scattered) payload only authenticates as a whole
+    if ((hdr->flags & (STEG_F_FRAMED | STEG_F_ENCRYPTED | STEG_F_SCATTER)) || offset > hdr->payload_len)
+    {
+        bmp_free(&layout);
+        return steg_err_invalid;
+    }
+    if (length == 0 || length > hdr->payload_len - offset)
+        length = hdr->payload_len - offset;
+
+    *out_len = (size_t)length;
+    if (out_cap < length)
+        status = steg_err_buffer;
+    else if (length > 0)
+    {
+        extract_bytes(&layout, NULL, stego, off + lsb_carrier_bytes((size_t)offset, hdr->depth), (size_t)length, out,
+                      hdr->depth);
+        if (hdr->flags & STEG_F_CRC)
+            status = check_range_crcs(&layout, stego, hdr, off, offset, length, out);
+    }
+    bmp_free(&layout);
+    return status;
+}
+
+StegStatus steg_verify_buffer(const unsigned char *stego, size_t stego_len, size_t first, size_t count,
+                              size_t *bad, StegHeader *hdr)
+{
+    StegHeader local;
+    BmpLayout layout;
+    uint64_t off;
+    if (hdr == NULL)
+        hdr = &local;
+    if (stego == NULL || bad == NULL)
+        return steg_err_invalid;
+
+    ScatterMap map;
+    StegStatus status = read_header(stego, stego_len, NULL, NULL, hdr, &layout, &off, &map);
+    if (status != steg_ok)
+        return status;
+
+    size_t chunks = (size_t)steg_crc_count(hdr->stored_len);
+    unsigned char *chunk = malloc(STEG_CRC_CHUNK);
+    if (hdr->flags & STEG_F_SCATTER)
+        status = steg_err_key;
+    else if (!(hdr->flags & STEG_F_CRC) || first > chunks)
+        status = steg_err_invalid;
+    else if (chunk == NULL)
+        status = steg_err_nomem;
+    if (status != steg_ok)
+    {
+        free(chunk);
+        bmp_free(&layout);
+        return status;
+    }
+
+    // Each chunk is checked on its own: extract it, checksum it, compare with its table entry
+    if (count == 0 || count > chunks - first)
+        count = chunks - first;
+    uint64_t table_off = crc_table_offset(hdr, off);
+    *bad = 0;
+    for (size_t i = first; i < first + count; i++)
+    {
+        size_t pos = i * (size_t)STEG_CRC_CHUNK;
+        size_t n = hdr->stored_len - pos < STEG_CRC_CHUNK ? hdr->stored_len - pos : STEG_CRC_CHUNK;
+        uint32_t expect;
+        extract_bytes(&layout, NULL, stego, off + lsb_carrier_bytes(pos, hdr->depth), n, chunk, hdr->depth);
+        extract_crc_table(&layout, NULL, stego, table_off, i, 1, hdr->depth, &expect);
+        if (crc32c(0, chunk, n) != expect)
+            (*bad)++;
+    }
+
+    free(chunk);
+    bmp_free(&layout);
+    return *bad ? steg_err_checksum : steg_ok;
+}
+
+const char *steg_strerror(StegStatus status)
+{
+    switch (status)
+    {
+    case steg_ok:
+        return "success";
+    case steg_err_invalid:
+        return "invalid argument";
+    case steg_err_format:
+        return "not a supported BMP image";
+    case steg_err_capacity:
+        return "insufficient image capacity";
+    case steg_err_no_payload:
+        return "magic string mismatch, no hidden data found";
+    case steg_err_corrupt:
+        return "embedded header is corrupt or image is truncated";
+    case steg_err_buffer:
+        return "output buffer too small";
+    case steg_err_nomem:
+        return "out of memory";
+    case steg_err_checksum:
+        return "payload checksum mismatch, image data was modified";
+    case steg_err_key:
+        return "payload is encrypted, a key is needed";
+    case steg_err_auth:
+        return "payload did not authenticate: wrong key or modified image";
+    }
+    return "unknown error";
+}
@@ -0,0 +1,175 @@
+#ifndef STEG_H
+#define STEG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bmp.h"
+
+/*
+ * libsteg: in-memory LSB steganography on 24 and 32-bit BMP images.
+ *
+ * All functions work on caller-owned buffers, perform no file or console
+ * I/O and keep no mutable global state beyond the LSB kernel choice
+ * (lsb_select_kernel, set atomically), so they may be called from any
+ * number of threads at once. Errors are reported through StegStatus.
+ */
+
+typedef enum
+{
+    steg_ok,
+    steg_err_invalid,       // NULL pointer or otherwise unusable argument
+    steg_err_format,        // Carrier is not a BMP image we can handle
+    steg_err_capacity,      // Payload does not fit in the carrier
+    steg_err_no_payload,    // Magic string not found: image carries no payload
+    steg_err_corrupt,       // Header fields are out of range or the image is truncated
+    steg_err_buffer,        // Caller's output buffer is too small
+    steg_err_nomem,         // Could not allocate a work buffer
+    steg_err_checksum,      // Payload does not match its embedded checksums
+    steg_err_key,           // Payload is encrypted and no key was given
+    steg_err_auth           // Encrypted payload failed authentication (wrong key or modified image)
+} StegStatus;
+
+/* Fields decoded from the embedded header */
+typedef struct _StegHeader
+{
+    char extn[10];          // Secret file extension, NUL-terminated (may be empty)
+    size_t payload_len;     // Payload size in bytes (after decompression)
+    size_t stored_len;      // Payload bytes embedded in the image (compressed size, if compressed)
+    size_t data_offset;     // File offset of the first payload carrier byte
+    int version;            // Format version (1 or 2)
+    unsigned int flags;     // v2 feature flags (STEG_F_* in format.h)
+    int depth;              // LSBs per carrier byte used by the payload
+} StegHeader;
+
+/* Optional encode settings; a zeroed struct (or NULL) selects the defaults */
+typedef struct _StegEncodeOptions
+{
+    int depth;              // LSBs per carrier byte for the payload: 1 (default), 2 or 4
+    int compress;           // Non-zero: LZ-compress the payload before embedding
+    int skip_alpha;         // Non-zero: leave the alpha bytes of 32-bpp carriers untouched
+    int crc;                // Non-zero: store a CRC32C per STEG_CRC_CHUNK payload bytes
+    const unsigned char *key;   // 32-byte key: seal the payload with ChaCha20-Poly1305 (NULL = cleartext)
+    const unsigned char *nonce; // 12 bytes, never reused with the same key (required with key)
+    int scatter;            // Non-zero: spread the payload over the image in key-permuted blocks (needs key)
+} StegEncodeOptions;
+
+/*
+ * Largest payload (bytes) that fits in carrier with the given extension length and options.
+ * With compression this bounds the compressed stream, not the raw payload.
+ */
+size_t steg_capacity(const unsigned char *carrier, size_t carrier_len, size_t extn_len,
+                     const StegEncodeOptions *opts);
+
+/*
+ * Hide payload in carrier. The stego image (carrier_len bytes) is written to out,
+ * which may be the carrier buffer itself for in-place embedding.
+ * extn is the secret file extension (without dot, up to 9 chars) or NULL.
+ */
+StegStatus steg_encode_buffer(const unsigned char *carrier, size_t carrier_len,
+                              const unsigned char *payload, size_t payload_len,
+                              const char *extn, unsigned char *out);
+
+/*
+ * steg_encode_buffer with explicit options (NULL = defaults).
+ * A compressed payload is only known not to fit once it has been partly
+ * embedded, so on steg_err_capacity out may already be modified.
+ */
+StegStatus steg_encode_buffer_opts(const unsigned char *carrier, size_t carrier_len,
+                                   const unsigned char *payload, size_t payload_len,
+                                   const char *extn, const StegEncodeOptions *opts,
+                                   unsigned char *out);
+
+/* Decode only the embedded header of a stego image */
+StegStatus steg_read_header(const unsigned char *stego, size_t stego_len, StegHeader *hdr);
+
+/*
+ * steg_read_header with the payload key. Sizing a compressed or chunked payload of a
+ * scattered image means walking its frames, which are only found with the key;
+ * without one that gives steg_err_key.
+ */
+StegStatus steg_read_header_key(const unsigned char *stego, size_t stego_len, const unsigned char *key,
+                                StegHeader *hdr);
+
+/*
+ * Extract the payload of a stego image into out (out_cap bytes).
+ * On success *out_len is the payload size; hdr (may be NULL) receives the header.
+ * If out is too small, steg_err_buffer is returned and *out_len holds the size needed.
+ * A STEG_F_CONTAINER payload comes back whole; container.h parses its table of contents.
+ * With STEG_F_CRC every chunk is checked as it is extracted; a mismatch gives steg_err_checksum
+ * (out then holds the damaged payload). Encrypted payloads give steg_err_key.
+ */
+StegStatus steg_decode_buffer(const unsigned char *stego, size_t stego_len,
+                              unsigned char *out, size_t out_cap, size_t *out_len,
+                              StegHeader *hdr);
+
+/*
+ * steg_decode_buffer for payloads sealed with a 32-byte key (key may be NULL for cleartext ones).
+ * Decryption runs in the extract loop; if the tag does not match, steg_err_auth is returned
+ * and out is zeroed rather than left holding unauthenticated plaintext. Scattered images
+ * (STEG_F_SCATTER) are read through the key's position map.
+ */
+StegStatus steg_decrypt_buffer(const unsigned char *stego, size_t stego_len, const unsigned char *key,
+                               unsigned char *out, size_t out_cap, size_t *out_len, StegHeader *hdr);
+
+/*
+ * steg_encode_buffer_opts and steg_decrypt_buffer with a layout the caller keeps
+ * across calls instead of parsing the BMP header every time. For encoding it comes
+ * from steg_carrier_layout with the same skip_alpha option (else steg_err_invalid);
+ * for decoding, from steg_detect_layout on the image (NULL detects it, as
+ * steg_decrypt_buffer does). The layout is only read, never freed.
+ */
+StegStatus steg_encode_layout(const unsigned char *carrier, size_t carrier_len, const BmpLayout *layout,
+                              const unsigned char *payload, size_t payload_len,
+                              const char *extn, const StegEncodeOptions *opts,
+                              unsigned char *out);
+StegStatus steg_decrypt_layout(const unsigned char *stego, size_t stego_len, const BmpLayout *layout,
+                               const unsigned char *key, unsigned char *out, size_t out_cap, size_t *out_len,
+                               StegHeader *hdr);
+
+/*
+ * Carrier layouts for callers that stream images instead of holding them in memory.
+ *
+ * steg_carrier_layout picks the layout an encoder uses for a carrier from its
+ * BMP header (len >= BMP_HEADER_SIZE bytes); file_len is as for steg_detect_layout.
+ * steg_layout_flags gives the header flags an encoder sets for a layout.
+ * steg_detect_layout finds the layout a stego image was written with from its
+ * first len bytes (at least steg_probe_length of them) and returns the raw
+ * extension word; file_len is the image size or UINT64_MAX if unknown.
+ * On success the caller releases layout with bmp_free.
+ * steg_header_length is the prefix that holds the whole embedded header
+ * (longest extension, 64-bit size field) in any layout. Both take file_len as
+ * steg_detect_layout does and never reach past it.
+ */
+StegStatus steg_carrier_layout(const unsigned char *carrier, size_t len, uint64_t file_len,
+                               const StegEncodeOptions *opts, BmpLayout *layout);
+uint32_t steg_layout_flags(const BmpLayout *layout);
+uint64_t steg_probe_length(const unsigned char *image, size_t len, uint64_t file_len);
+uint64_t steg_header_length(const unsigned char *image, size_t len, uint64_t file_len);
+StegStatus steg_detect_layout(const unsigned char *image, size_t len, uint64_t file_len, BmpLayout *layout,
+                              uint32_t *word);
+
+/*
+ * Extract payload bytes [offset, offset + length) of a stego image without touching the rest.
+ * length 0 (or past the end) means up to the end of the payload; *out_len receives the count.
+ * Only plain payloads map bytes to fixed carrier offsets: compressed or chunked ones, and
+ * offsets past the end, give steg_err_invalid, as do encrypted payloads (they only
+ * authenticate as a whole). With STEG_F_CRC the checksum chunks the range touches are
+ * read in full and checked; a mismatch gives steg_err_checksum (out then holds the range).
+ */
+StegStatus steg_decode_range(const unsigned char *stego, size_t stego_len, uint64_t offset, uint64_t length,
+                             unsigned char *out, size_t out_cap, size_t *out_len, StegHeader *hdr);
+
+/*
+ * Check the checksums of a STEG_F_CRC image without writing the payload anywhere.
+ * Covers chunks [first, first + count) of the stored payload (count 0 = to the last one;
+ * there are steg_crc_count(hdr->stored_len) in all), so callers can split the work across
+ * threads. *bad receives the number of mismatching chunks, and steg_err_checksum is returned
+ * if there are any. Images without checksums give steg_err_invalid.
+ */
+StegStatus steg_verify_buffer(const unsigned char *stego, size_t stego_len, size_t first, size_t count,
+                              size_t *bad, StegHeader *hdr);
+
+/* Human readable text for a status code */
+const char *steg_strerror(StegStatus status);
+
+#endif
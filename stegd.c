@@ -0,0 +1,742 @@
+/*
+ * stegd: encode/decode server on a local Unix domain socket.
+ *
+ * Keeps the carrier images it has served in an LRU cache (carrier_cache.h),
+ * so repeated requests against the same carriers skip the file read and the
+ * header parse and run straight from memory through libsteg.
+ *
+ * A connection carries any number of requests, one after another. Each is a
+ * text line, then <length> bytes of body:
+ *
+ *   <op> <carrier> <length> [option ...]\n<body>
+ *
+ *   encode  carrier = image path or ID, body = payload.
+ *           Options: extn=EXT bits=K z crc skip-alpha key=FILE scatter out=FILE
+ *   decode  carrier = stego image path or ID, or "-" with the image as body.
+ *           Options: key=FILE out=FILE
+ *   stats   carrier "-", length 0. Replies with one JSON line of counters.
+ *
+ * An ID is a bare file name looked up in the --carriers directory. The reply
+ * is "ok <length> [extn]\n" and <length> bytes (the stego image, the payload
+ * or the stats), or "error <message>\n". With out=FILE the daemon writes the
+ * result to FILE itself and replies "ok 0". A malformed request line ends
+ * the connection after the error reply, as does a body over --max-body-mb.
+ *
+ * The main thread polls the listening socket and the idle connections; a
+ * connection with a request waiting is handed to the pool for that one
+ * request and comes back to the poll set afterwards, so idle clients hold
+ * no worker. A client that stalls mid-request for STEGD_IO_TIMEOUT seconds
+ * is dropped.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "steg.h"
+#include "aead.h"
+#include "carrier_cache.h"
+#include "threadpool.h"
+#include "pio.h"
+
+#define STEGD_LINE_MAX 4096
+#define STEGD_MAX_TOKENS 16
+#define STEGD_DEFAULT_CACHE_MB 256
+#define STEGD_DEFAULT_MAX_BODY_MB 1024
+#define STEGD_IO_TIMEOUT 30             // Seconds a started request may stall
+#define STEGD_ACCEPT_BACKOFF_MS 100     // Pause after accept fails for lack of descriptors or memory
+
+typedef struct _Conn
+{
+    int fd;
+    unsigned char buf[STEGD_LINE_MAX];
+    size_t pos, have;           // Unread bytes are buf[pos, have)
+    struct _Conn *prev, *next;  // Open connections, so shutdown can wake busy ones
+    struct _Conn *link;         // Idle or handed-back list
+} Conn;
+
+/* One parsed request line */
+typedef struct
+{
+    char *op;
+    char *carrier;
+    size_t length;
+    const char *extn;
+    const char *key_file;
+    const char *out;
+    StegEncodeOptions opts;
+} Request;
+
+static CarrierCache *cache;
+static ThreadPool *pool;
+static const char *carrier_dir;
+static size_t max_body = (size_t)STEGD_DEFAULT_MAX_BODY_MB << 20;
+static volatile sig_atomic_t stopping;
+static unsigned long long requests, failures;
+static int wake_fds[2] = {-1, -1};      // Self-pipe: workers and signals wake the poll loop
+
+static pthread_mutex_t conns_lock = PTHREAD_MUTEX_INITIALIZER;
+static Conn *conns;
+static Conn *returned;                  // Served connections waiting to go back into the poll set
+
+static void wake_main(void)
+{
+    int saved = errno;
+    ssize_t n = write(wake_fds[1], "", 1);
+    (void)n;                            // A full pipe already has a wakeup pending
+    errno = saved;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stopping = 1;
+    wake_main();
+}
+
+static void conn_track(Conn *c, int add)
+{
+    pthread_mutex_lock(&conns_lock);
+    if (add)
+    {
+        c->prev = NULL;
+        c->next = conns;
+        if (conns)
+            conns->prev = c;
+        conns = c;
+    }
+    else
+    {
+        if (c->prev)
+            c->prev->next = c->next;
+        else
+            conns = c->next;
+        if (c->next)
+            c->next->prev = c->prev;
+    }
+    pthread_mutex_unlock(&conns_lock);
+}
+
+/* Fill the connection buffer; 0 at end of stream or on error */
+static int conn_fill(Conn *c)
+{
+    if (c->pos == c->have)
+        c->pos = c->have = 0;
+    for (;;)
+    {
+        ssize_t n = read(c->fd, c->buf + c->have, sizeof(c->buf) - c->have);
+        if (n > 0)
+        {
+            c->have += (size_t)n;
+            return 1;
+        }
+        if (n < 0 && errno == EINTR && !stopping)
+            continue;
+        return 0;
+    }
+}
+
+/* Read one request line (without the newline); 0 at end of stream or if it is too long */
+static int conn_line(Conn *c, char *line)
+{
+    size_t len = 0;
+    for (;;)
+    {
+        while (c->pos < c->have)
+        {
+            unsigned char ch = c->buf[c->pos++];
+            if (ch == '\n')
+            {
+                line[len] = '\0';
+                return 1;
+            }
+            if (len + 1 >= STEGD_LINE_MAX)
+                return 0;
+            line[len++] = (char)ch;
+        }
+        if (!conn_fill(c))
+            return 0;
+    }
+}
+
+/* Read exactly len body bytes */
+static int conn_read(Conn *c, unsigned char *dst, size_t len)
+{
+    while (len > 0)
+    {
+        if (c->pos == c->have && !conn_fill(c))
+            return 0;
+        size_t n = c->have - c->pos < len ? c->have - c->pos : len;
+        memcpy(dst, c->buf + c->pos, n);
+        c->pos += n;
+        dst += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int conn_write(Conn *c, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    while (len > 0)
+    {
+        ssize_t n = send(c->fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+static int reply_error(Conn *c, const char *msg)
+{
+    char line[256];
+    __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+    int n = snprintf(line, sizeof(line), "error %s\n", msg);
+    return conn_write(c, line, (size_t)n);
+}
+
+/* Send a result, or write it to the out= file and send an empty one */
+static int reply_data(Conn *c, const Request *req, const unsigned char *data, size_t len, const char *extn)
+{
+    char line[64];
+    if (req->out)
+    {
+        int fd = open(req->out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return reply_error(c, "cannot open output file");
+        Status written = pwrite_full(fd, data, len, 0);
+        if (close(fd) != 0 || written != e_success)
+            return reply_error(c, "cannot write output file");
+        len = 0;
+    }
+    int n = snprintf(line, sizeof(line), "ok %zu%s%s\n", len, extn ? " " : "", extn ? extn : "");
+    return conn_write(c, line, (size_t)n) && conn_write(c, data, len);
+}
+
+/* Carrier path of a request: IDs (bare names) live in the --carriers directory */
+static int resolve_carrier(const char *carrier, char *path, size_t cap)
+{
+    if (carrier_dir == NULL || strchr(carrier, '/') != NULL)
+        return snprintf(path, cap, "%s", carrier) < (int)cap;
+    if (strcmp(carrier, ".") == 0 || strcmp(carrier, "..") == 0)
+        return 0;
+    return snprintf(path, cap, "%s/%s", carrier_dir, carrier) < (int)cap;
+}
+
+/* Split the request line on spaces and read its options; 0 if it is malformed */
+static int parse_request(char *line, Request *req)
+{
+    char *tokens[STEGD_MAX_TOKENS], *save = NULL;
+    int n = 0;
+    for (char *t = strtok_r(line, " \t\r", &save); t && n < STEGD_MAX_TOKENS; t = strtok_r(NULL, " \t\r", &save))
+        tokens[n++] = t;
+    if (n < 3)
+        return 0;
+
+    memset(req, 0, sizeof(*req));
+    req->op = tokens[0];
+    req->carrier = tokens[1];
+    char *end;
+    errno = 0;
+    unsigned long long length = strtoull(tokens[2], &end, 10);
+    if (*end != '\0' || errno != 0 || tokens[2][0] == '-' || length > SIZE_MAX)
+        return 0;
+    req->length = (size_t)length;
+
+    for (int i = 3; i < n; i++)
+    {
+        char *t = tokens[i];
+        if (strncmp(t, "extn=", 5) == 0)
+            req->extn = t + 5;
+        else if (strncmp(t, "bits=", 5) == 0)
+            req->opts.depth = atoi(t + 5);
+        else if (strcmp(t, "z") == 0 || strcmp(t, "compress") == 0)
+            req->opts.compress = 1;
+        else if (strcmp(t, "crc") == 0)
+            req->opts.crc = 1;
+        else if (strcmp(t, "skip-alpha") == 0)
+            req->opts.skip_alpha = 1;
+        else if (strcmp(t, "scatter") == 0)
+            req->opts.scatter = 1;
+        else if (strncmp(t, "key=", 4) == 0)
+            req->key_file = t + 4;
+        else if (strncmp(t, "out=", 4) == 0)
+            req->out = t + 4;
+        else
+            return 0;
+    }
+    return 1;
+}
+
+static CarrierEntry *get_carrier(Conn *c, const Request *req)
+{
+    char path[STEGD_LINE_MAX + 256];
+    StegStatus status;
+    if (!resolve_carrier(req->carrier, path, sizeof(path)))
+    {
+        reply_error(c, "bad carrier name");
+        return NULL;
+    }
+    CarrierEntry *entry = carrier_cache_get(cache, path, &status);
+    if (entry == NULL)
+        reply_error(c, status == steg_err_invalid ? "cannot read carrier" : steg_strerror(status));
+    return entry;
+}
+
+/* Key bytes must not outlive the request on a worker stack; explicit_bzero is not optimised away */
+static int do_encode(Conn *c, const Request *req, const unsigned char *payload)
+{
+    unsigned char key[AEAD_KEY_LEN], nonce[AEAD_NONCE_LEN];
+    StegEncodeOptions opts = req->opts;
+    if (req->key_file)
+    {
+        if (load_key_file(req->key_file, key, sizeof(key)) != e_success ||
+            random_bytes(nonce, sizeof(nonce)) != e_success)
+        {
+            explicit_bzero(key, sizeof(key));
+            return reply_error(c, "cannot load key");
+        }
+        opts.key = key;
+        opts.nonce = nonce;
+    }
+
+    CarrierEntry *entry = get_carrier(c, req);
+    if (entry == NULL)
+    {
+        explicit_bzero(key, sizeof(key));
+        return 1;
+    }
+    StegStatus status;
+    const BmpLayout *layout = carrier_entry_layout(entry, &opts, &status);
+    unsigned char *out = NULL;
+    if (layout && (out = malloc(entry->len)) == NULL)
+        status = steg_err_nomem;
+    if (status == steg_ok)
+        status = steg_encode_layout(entry->data, entry->len, layout, payload, req->length, req->extn, &opts, out);
+    explicit_bzero(key, sizeof(key));
+    int ok = status == steg_ok ? reply_data(c, req, out, entry->len, NULL) : reply_error(c, steg_strerror(status));
+    carrier_cache_release(cache, entry);
+    free(out);
+    return ok;
+}
+
+static int do_decode(Conn *c, const Request *req, const unsigned char *body)
+{
+    unsigned char key[AEAD_KEY_LEN];
+    if (req->key_file && load_key_file(req->key_file, key, sizeof(key)) != e_success)
+    {
+        explicit_bzero(key, sizeof(key));
+        return reply_error(c, "cannot load key");
+    }
+
+    CarrierEntry *entry = NULL;
+    const BmpLayout *layout = NULL;
+    const unsigned char *image = body;
+    size_t image_len = req->length;
+    StegStatus status = steg_ok;
+    if (!is_stdio_name(req->carrier))
+    {
+        if ((entry = get_carrier(c, req)) == NULL)
+        {
+            explicit_bzero(key, sizeof(key));
+            return 1;
+        }
+        image = entry->data;
+        image_len = entry->len;
+        layout = carrier_entry_stego_layout(entry, &status);
+    }
+
+    // A first pass without a buffer sizes the payload
+    StegHeader hdr;
+    const unsigned char *k = req->key_file ? key : NULL;
+    unsigned char *out = NULL;
+    size_t out_len = 0;
+    if (status == steg_ok)
+        status = steg_decrypt_layout(image, image_len, layout, k, NULL, 0, &out_len, &hdr);
+    if (status == steg_err_buffer)
+        status = (out = malloc(out_len)) ? steg_ok : steg_err_nomem;
+    if (status == steg_ok && out)
+        status = steg_decrypt_layout(image, image_len, layout, k, out, out_len, &out_len, &hdr);
+    explicit_bzero(key, sizeof(key));
+    int ok = status == steg_ok ? reply_data(c, req, out, out_len, hdr.extn[0] ? hdr.extn : "-")
+                               : reply_error(c, steg_strerror(status));
+    if (entry)
+        carrier_cache_release(cache, entry);
+    free(out);
+    return ok;
+}
+
+static int do_stats(Conn *c, const Request *req)
+{
+    CarrierCacheStats st;
+    char json[512];
+    carrier_cache_stats(cache, &st);
+    int n = snprintf(json, sizeof(json),
+                     "{\"requests\":%llu,\"failures\":%llu,\"hits\":%llu,\"misses\":%llu,\"evictions\":%llu,"
+                     "\"entries\":%llu,\"bytes\":%llu,\"budget\":%llu}\n",
+                     __atomic_load_n(&requests, __ATOMIC_RELAXED), __atomic_load_n(&failures, __ATOMIC_RELAXED),
+                     (unsigned long long)st.hits, (unsigned long long)st.misses,
+                     (unsigned long long)st.evictions, (unsigned long long)st.entries,
+                     (unsigned long long)st.bytes, (unsigned long long)st.budget);
+    return reply_data(c, req, (const unsigned char *)json, (size_t)n, NULL);
+}
+
+/* Serve one request; 0 ends the connection */
+static int serve_request(Conn *c, char *line)
+{
+    Request req;
+    __atomic_fetch_add(&requests, 1, __ATOMIC_RELAXED);
+    if (!parse_request(line, &req))
+    {
+        reply_error(c, "malformed request");
+        return 0;
+    }
+
+    if (req.length > max_body)
+    {
+        reply_error(c, "request body too large");
+        return 0;
+    }
+    unsigned char *body = malloc(req.length ? req.length : 1);
+    if (body == NULL)
+    {
+        reply_error(c, steg_strerror(steg_err_nomem));
+        return 0;
+    }
+    if (!conn_read(c, body, req.length))
+    {
+        free(body);
+        return 0;
+    }
+
+    int ok;
+    if (strcmp(req.op, "encode") == 0)
+        ok = do_encode(c, &req, body);
+    else if (strcmp(req.op, "decode") == 0)
+        ok = do_decode(c, &req, body);
+    else if (strcmp(req.op, "stats") == 0)
+        ok = do_stats(c, &req);
+    else
+        ok = reply_error(c, "unknown operation");
+    free(body);
+    return ok;
+}
+
+static void conn_close(Conn *c)
+{
+    conn_track(c, 0);
+    close(c->fd);
+    free(c);
+}
+
+/* Pool task: serve the request waiting on a connection, then hand it back to the poll loop */
+static void serve_conn(void *arg)
+{
+    Conn *c = arg;
+    char line[STEGD_LINE_MAX];
+    if (stopping || !conn_line(c, line) || !serve_request(c, line))
+    {
+        conn_close(c);
+        return;
+    }
+    pthread_mutex_lock(&conns_lock);
+    c->link = returned;
+    returned = c;
+    pthread_mutex_unlock(&conns_lock);
+    wake_main();
+}
+
+/* Hand a connection with input waiting to the pool */
+static void dispatch(Conn *c)
+{
+    if (pool_submit(pool, serve_conn, c) != e_success)
+        serve_conn(c);
+}
+
+static Conn *accept_conn(int lfd)
+{
+    int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    // Blocking reads and writes, bounded so a stalled client cannot pin a worker
+    struct timeval tv = {STEGD_IO_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    Conn *c = calloc(1, sizeof(*c));
+    if (c == NULL)
+    {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    c->fd = fd;
+    conn_track(c, 1);
+    return c;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Poll the listening socket and idle connections until a signal stops the daemon */
+static void serve(int lfd)
+{
+    Conn *idle = NULL;
+    size_t nidle = 0, cap = 0;
+    struct pollfd *fds = NULL;
+    double paused_until = 0;
+    int starved = 0;                    // accept is failing; logged once until it recovers
+
+    while (!stopping)
+    {
+        // Connections back from the pool: straight to the next request if one is buffered already
+        pthread_mutex_lock(&conns_lock);
+        Conn *back = returned;
+        returned = NULL;
+        pthread_mutex_unlock(&conns_lock);
+        while (back)
+        {
+            Conn *c = back;
+            back = c->link;
+            if (c->pos < c->have)
+                dispatch(c);
+            else
+            {
+                c->link = idle;
+                idle = c;
+                nidle++;
+            }
+        }
+
+        if (nidle + 2 > cap)
+        {
+            size_t grown = (nidle + 2) * 2;
+            struct pollfd *p = realloc(fds, grown * sizeof(*p));
+            if (p == NULL)
+            {
+                poll(NULL, 0, STEGD_ACCEPT_BACKOFF_MS);
+                continue;
+            }
+            fds = p;
+            cap = grown;
+        }
+        double now = now_ms();
+        int accepting = now >= paused_until;
+        size_t n = 0;
+        fds[n++] = (struct pollfd){wake_fds[0], POLLIN, 0};
+        fds[n++] = (struct pollfd){accepting ? lfd : -1, POLLIN, 0};
+        for (Conn *c = idle; c != NULL; c = c->link)
+            fds[n++] = (struct pollfd){c->fd, POLLIN, 0};
+
+        int timeout = accepting ? -1 : (int)(paused_until - now) + 1;
+        if (poll(fds, n, timeout) < 0)
+            continue;                   // EINTR: recheck stopping
+
+        if (fds[0].revents)
+        {
+            char drain[64];
+            while (read(wake_fds[0], drain, sizeof(drain)) > 0)
+                ;
+        }
+
+        // Readable (or hung up) connections go to the pool; fds[] follows the idle list order
+        Conn **pp = &idle;
+        for (size_t i = 2; i < n; i++)
+        {
+            Conn *c = *pp;
+            if (fds[i].revents)
+            {
+                *pp = c->link;
+                nidle--;
+                dispatch(c);
+            }
+            else
+                pp = &c->link;
+        }
+
+        if (fds[1].revents)
+        {
+            for (;;)
+            {
+                Conn *c = accept_conn(lfd);
+                if (c)
+                {
+                    starved = 0;
+                    c->link = idle;
+                    idle = c;
+                    nidle++;
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+                    break;
+
+                // Out of descriptors or memory: the pending connection stays queued, so stop
+                // polling the socket for a while rather than spin on it
+                if (!starved)
+                    fprintf(stderr, "stegd: accept: %s; pausing new connections\n", strerror(errno));
+                starved = 1;
+                paused_until = now_ms() + STEGD_ACCEPT_BACKOFF_MS;
+                break;
+            }
+        }
+    }
+
+    while (idle)
+    {
+        Conn *c = idle;
+        idle = c->link;
+        conn_close(c);
+    }
+    free(fds);
+}
+
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "ERROR: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // A socket left behind by an earlier run is replaced; any other file is not
+    if (lstat(path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            fprintf(stderr, "ERROR: %s exists and is not a socket\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    mode_t old_mask = umask(077);       // Owner only: requests name files with the daemon's rights
+    int bound = fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    umask(old_mask);
+    if (!bound || listen(fd, 64) != 0)
+    {
+        perror("bind");
+        fprintf(stderr, "ERROR: Unable to listen on %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s <socket> [--carriers DIR] [--cache-mb N] [--max-body-mb N] [-j N]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socket_path = NULL;
+    long cache_mb = STEGD_DEFAULT_CACHE_MB;
+    long body_mb = STEGD_DEFAULT_MAX_BODY_MB;
+    int threads = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--carriers") == 0 && i + 1 < argc)
+            carrier_dir = argv[++i];
+        else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc)
+            cache_mb = atol(argv[++i]);
+        else if (strcmp(argv[i], "--max-body-mb") == 0 && i + 1 < argc)
+            body_mb = atol(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0')
+            threads = atoi(argv[i] + 2);
+        else if (argv[i][0] != '-' && socket_path == NULL)
+            socket_path = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (socket_path == NULL || cache_mb < 0 || body_mb < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    max_body = (size_t)body_mb << 20;
+    if (threads < 1)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    if (pipe2(wake_fds, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int lfd = listen_on(socket_path);
+    if (lfd < 0)
+        return 1;
+    cache = carrier_cache_create((size_t)cache_mb << 20);
+    pool = cache ? pool_create(threads) : NULL;
+    if (pool == NULL)
+    {
+        close(lfd);
+        unlink(socket_path);
+        carrier_cache_destroy(cache);
+        return 1;
+    }
+    fprintf(stderr, "stegd: listening on %s (%d threads, %ld MB carrier cache)\n", socket_path, threads, cache_mb);
+
+    serve(lfd);
+
+    // Requests in progress finish; a client still sending one is cut off
+    close(lfd);
+    unlink(socket_path);
+    pthread_mutex_lock(&conns_lock);
+    for (Conn *c = conns; c != NULL; c = c->next)
+        shutdown(c->fd, SHUT_RD);
+    pthread_mutex_unlock(&conns_lock);
+    pool_destroy(pool);
+    while (returned)
+    {
+        Conn *c = returned;
+        returned = c->link;
+        conn_close(c);
+    }
+
+    CarrierCacheStats st;
+    carrier_cache_stats(cache, &st);
+    fprintf(stderr, "stegd: %llu requests, %llu failed; cache %llu hits, %llu misses, %llu evictions\n",
+            requests, failures, (unsigned long long)st.hits, (unsigned long long)st.misses,
+            (unsigned long long)st.evictions);
+    carrier_cache_destroy(cache);
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * mkbmp: write a synthetic BMP carrier for the tests.
+ *
+ *   mkbmp <out.bmp> <width> <height> [bpp [offbits [truncate]]]
+ *
+ * A negative height gives a top-down image. bpp is 24 (default) or 32, and
+ * offbits (default 54) moves the pixel array behind extra header bytes.
+ * The pixels are noise. truncate > 0 stops the file after that many bytes,
+ * which together with an absurd width or height makes a crafted header that
+ * claims far more pixels than the file holds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "Usage: %s <out.bmp> <width> <height> [bpp [offbits [truncate]]]\n", argv[0]);
+        return 2;
+    }
+    uint32_t width = (uint32_t)strtoul(argv[2], NULL, 0);
+    int64_t height = strtoll(argv[3], NULL, 0);
+    int bpp = argc > 4 ? atoi(argv[4]) : 24;
+    uint32_t offbits = argc > 5 ? (uint32_t)strtoul(argv[5], NULL, 0) : 54;
+    uint64_t truncate = argc > 6 ? strtoull(argv[6], NULL, 0) : 0;
+
+    uint64_t stride = ((uint64_t)width * (bpp / 8) + 3) & ~(uint64_t)3;
+    uint64_t rows = height < 0 ? (uint64_t)-height : (uint64_t)height;
+    uint64_t total = offbits + stride * rows;
+    if (truncate > 0 && truncate < total)
+        total = truncate;
+
+    unsigned char hdr[54];
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 'B';
+    hdr[1] = 'M';
+    put_le32(hdr + 2, (uint32_t)(offbits + stride * rows));
+    put_le32(hdr + 10, offbits);
+    put_le32(hdr + 14, 40);
+    put_le32(hdr + 18, width);
+    put_le32(hdr + 22, (uint32_t)height);
+    hdr[26] = 1;
+    hdr[28] = (unsigned char)bpp;
+    put_le32(hdr + 34, (uint32_t)(stride * rows));
+
+    FILE *fptr = fopen(argv[1], "wb");
+    if (fptr == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    uint64_t written = total < sizeof(hdr) ? total : sizeof(hdr);
+    fwrite(hdr, 1, (size_t)written, fptr);
+
+    // Extra header bytes and pixels: xorshift noise
+    uint64_t x = 0x9E3779B97F4A7C15ULL ^ (width * 31ULL + rows);
+    unsigned char buf[65536];
+    while (written < total)
+    {
+        size_t n = total - written < sizeof(buf) ? (size_t)(total - written) : sizeof(buf);
+        for (size_t i = 0; i < n; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            buf[i] = (unsigned char)(x >> 24);
+        }
+        fwrite(buf, 1, n, fptr);
+        written += n;
+    }
+    return fclose(fptr) == 0 ? 0 : 1;
+}
@@ -0,0 +1,333 @@
+#!/bin/sh
+#
+# Behaviour tests for the steg command line tool (run with make test).
+#
+# Each check encodes synthetic carriers from tests/mkbmp and random
+# payloads, decodes them again and compares, or checks that a bad input
+# fails the way it should; stegd is driven over its socket by tests/stegc.
+# Prints one line per failure and a summary; exits non-zero if anything
+# failed.
+
+STEG=${STEG:-./steg}
+MKBMP=${MKBMP:-tests/mkbmp}
+STEGD=${STEGD:-./stegd}
+STEGC=${STEGC:-tests/stegc}
+T=$(mktemp -d "${TMPDIR:-/tmp}/steg_test.XXXXXX") || exit 1
+stegd_pid=
+trap '[ -n "$stegd_pid" ] && kill $stegd_pid 2>/dev/null; rm -rf "$T"' EXIT
+
+passed=0
+failed=0
+
+pass() { passed=$((passed + 1)); }
+fail() { failed=$((failed + 1)); echo "FAIL: $1"; }
+
+# check NAME CMD...: CMD must succeed
+check() {
+    name=$1
+    shift
+    if "$@" >"$T/last.log" 2>&1; then pass; else fail "$name"; sed 's/^/    /' "$T/last.log"; fi
+}
+
+# check_fails NAME CMD...: CMD must exit non-zero
+check_fails() {
+    name=$1
+    shift
+    if "$@" >"$T/last.log" 2>&1; then fail "$name (succeeded)"; else pass; fi
+}
+
+# roundtrip NAME CARRIER PAYLOAD "ENCODE OPTIONS" ["DECODE OPTIONS"]
+# (the decoded file takes the payload's extension, as decode names it)
+roundtrip() {
+    out="$T/rt.${3##*.}"
+    rm -f "$T/rt.bmp" "$out"
+    # shellcheck disable=SC2086
+    if $STEG -e "$2" "$3" "$T/rt.bmp" -q $4 >"$T/last.log" 2>&1 &&
+       $STEG -d "$T/rt.bmp" "$out" -q $5 >>"$T/last.log" 2>&1 &&
+       cmp -s "$3" "$out"; then
+        pass
+    else
+        fail "$1"
+        sed 's/^/    /' "$T/last.log"
+    fi
+}
+
+# check_bounded NAME CMD...: CMD must finish within 10 s and 256 MB without a crash
+# (its exit status does not matter)
+check_bounded() {
+    name=$1
+    shift
+    ( ulimit -v 262144; exec timeout 10 "$@" ) >"$T/last.log" 2>&1
+    rc=$?
+    if [ $rc -lt 124 ]; then pass; else fail "$name (status $rc)"; fi
+}
+
+# flip_byte FILE OFFSET: invert the low bit of one byte in place
+flip_byte() {
+    b=$(od -An -tu1 -j "$2" -N1 "$1" | tr -d ' ')
+    printf "$(printf '\\%03o' $((b ^ 1)))" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+# ---------------- fixtures ----------------
+
+$MKBMP "$T/c24.bmp" 640 480 || exit 1          # unpadded 24-bit, plain header (v1 layout)
+$MKBMP "$T/pad.bmp" 333 1001 || exit 1         # padded rows
+$MKBMP "$T/td32.bmp" 512 -300 32 || exit 1     # top-down 32-bit
+$MKBMP "$T/off.bmp" 400 400 24 138 || exit 1   # extra header bytes before the pixels
+$MKBMP "$T/tiny.bmp" 64 64 || exit 1
+head -c 20000 /dev/urandom >"$T/small.bin"
+head -c 100000 /dev/urandom >"$T/p.bin"
+: >"$T/empty.bin"
+i=0
+while [ $i -lt 4000 ]; do echo "line $i of a compressible text payload"; i=$((i + 1)); done >"$T/text.txt"
+head -c 32 /dev/urandom >"$T/k.key"
+head -c 32 /dev/urandom >"$T/k2.key"
+
+# ---------------- round trips ----------------
+
+for c in c24 pad td32 off; do
+    roundtrip "plain $c" "$T/$c.bmp" "$T/small.bin" ""
+    for k in 2 4; do
+        roundtrip "--bits $k $c" "$T/$c.bmp" "$T/p.bin" "--bits $k"
+    done
+done
+roundtrip "empty payload" "$T/c24.bmp" "$T/empty.bin" ""
+roundtrip "--skip-alpha" "$T/td32.bmp" "$T/small.bin" "--skip-alpha"
+roundtrip "-z" "$T/c24.bmp" "$T/text.txt" "-z"
+roundtrip "-z --bits 2 --crc" "$T/pad.bmp" "$T/text.txt" "-z --bits 2 --crc"
+roundtrip "--crc" "$T/pad.bmp" "$T/p.bin" "--crc"
+roundtrip "--key" "$T/c24.bmp" "$T/p.bin" "--key $T/k.key" "--key $T/k.key"
+roundtrip "--key --crc --bits 4" "$T/off.bmp" "$T/p.bin" "--key $T/k.key --crc --bits 4" "--key $T/k.key"
+roundtrip "--key --scatter" "$T/pad.bmp" "$T/p.bin" "--key $T/k.key --scatter" "--key $T/k.key"
+roundtrip "--key --scatter -z" "$T/c24.bmp" "$T/text.txt" "--key $T/k.key --scatter -z" "--key $T/k.key"
+roundtrip "--mmap" "$T/pad.bmp" "$T/p.bin" "--mmap --crc" "--mmap"
+roundtrip "-j 4" "$T/td32.bmp" "$T/p.bin" "-j 4 --bits 2" "-j 4"
+for io in stdio threads; do
+    roundtrip "--io=$io" "$T/c24.bmp" "$T/p.bin" "--io=$io --crc" "--io=$io"
+done
+
+# All I/O strategies write the same image
+$STEG -e "$T/pad.bmp" "$T/p.bin" "$T/a.bmp" -q --io=stdio
+$STEG -e "$T/pad.bmp" "$T/p.bin" "$T/b.bmp" -q --mmap
+$STEG -e "$T/pad.bmp" "$T/p.bin" "$T/c.bmp" -q -j 3
+check "stdio and mmap images match" cmp "$T/a.bmp" "$T/b.bmp"
+check "stdio and -j images match" cmp "$T/a.bmp" "$T/c.bmp"
+
+# Pipes: a piped payload is embedded as a chunked stream
+rm -f "$T/pipe.bin"
+check "pipe encode" sh -c "cat '$T/p.bin' | $STEG -e '$T/c24.bmp' - - > '$T/pipe.bmp'"
+check "pipe decode" sh -c "$STEG -d '$T/pipe.bmp' - > '$T/pipe.bin'"
+check "pipe round trip" cmp "$T/p.bin" "$T/pipe.bin"
+
+# Keys and damage
+$STEG -e "$T/c24.bmp" "$T/p.bin" "$T/k.bmp" -q --key "$T/k.key"
+check_fails "decode without the key" $STEG -d "$T/k.bmp" "$T/x.bin" -q
+check_fails "decode with the wrong key" $STEG -d "$T/k.bmp" "$T/x.bin" -q --key "$T/k2.key"
+check "wrong key leaves no output" test ! -e "$T/x.bin"
+$STEG -e "$T/c24.bmp" "$T/p.bin" "$T/crc.bmp" -q --crc
+check "--verify on an intact image" $STEG --verify "$T/crc.bmp"
+flip_byte "$T/crc.bmp" 200000
+check_fails "--verify on a damaged image" $STEG --verify "$T/crc.bmp"
+check_fails "decode of a damaged --crc image" $STEG -d "$T/crc.bmp" "$T/x.bin" -q
+check_fails "payload larger than the carrier" $STEG -e "$T/tiny.bmp" "$T/p.bin" "$T/x.bmp" -q
+
+# Ranges and entries of --crc images check the chunks they touch
+head -c 300000 /dev/urandom >"$T/big.bin"
+$STEG -e "$T/c24.bmp" "$T/big.bin" "$T/r.bmp" -q --bits 4 --crc
+for m in "" "--mmap" "-j 3"; do
+    rm -f "$T/r.bin"
+    check "range decode $m" $STEG -d "$T/r.bmp" "$T/r.bin" -q --offset 70000 --length 100000 $m
+    tail -c +70001 "$T/big.bin" | head -c 100000 >"$T/r.want"
+    check "range decode $m output" cmp "$T/r.want" "$T/r.bin"
+done
+flip_byte "$T/r.bmp" $((54 + 104 + 2 * 200000))         # stored byte ~200000: chunk 3
+for m in "" "--mmap"; do
+    check "range clear of a damaged chunk $m" $STEG -d "$T/r.bmp" "$T/r.bin" -q --offset 0 --length 1000 $m
+    check_fails "range over a damaged chunk $m" $STEG -d "$T/r.bmp" "$T/r.bin" -q --offset 199000 --length 2000 $m
+done
+$STEG -c "$T/c24.bmp" "$T/box.bmp" "$T/small.bin" "$T/p.bin" -q --bits 2 --crc
+check "entry decode" $STEG -d "$T/box.bmp" "$T/e.bin" -q --entry p.bin
+check "entry decode output" cmp "$T/p.bin" "$T/e.bin"
+flip_byte "$T/box.bmp" $((54 + 104 + 4 * 70050))        # inside p.bin, chunk 1
+check "entry clear of a damaged chunk" $STEG -d "$T/box.bmp" "$T/e.bin" -q --entry small.bin
+check_fails "entry over a damaged chunk" $STEG -d "$T/box.bmp" "$T/e.bin" -q --entry p.bin
+
+# In place: refused payloads leave the carrier as it was
+cp "$T/c24.bmp" "$T/ip.bmp"
+check "--in-place encode" $STEG -e "$T/ip.bmp" "$T/small.bin" --in-place -q --crc
+check "--in-place decode" $STEG -d "$T/ip.bmp" "$T/ip.bin" -q
+check "--in-place output" cmp "$T/small.bin" "$T/ip.bin"
+head -c 20000 /dev/urandom >"$T/small2.bin"
+check "--same-size encode" $STEG -e "$T/ip.bmp" "$T/small2.bin" --same-size -q --crc
+check "--same-size decode" $STEG -d "$T/ip.bmp" "$T/ip.bin" -q
+check "--same-size output" cmp "$T/small2.bin" "$T/ip.bin"
+cp "$T/ip.bmp" "$T/ip.orig"
+check_fails "--in-place -z" $STEG -e "$T/ip.bmp" "$T/text.txt" --in-place -q -z
+check_fails "--in-place piped secret" sh -c "cat '$T/small.bin' | $STEG -e '$T/ip.bmp' - --in-place -q"
+check_fails "--in-place over capacity" $STEG -e "$T/ip.bmp" "$T/big.bin" --in-place -q
+check_fails "--same-size with another size" $STEG -e "$T/ip.bmp" "$T/p.bin" --same-size -q --crc
+check "failed --in-place leaves the carrier" cmp "$T/ip.orig" "$T/ip.bmp"
+
+# Crafted headers: a few KB of file claiming up to 2^31 rows
+mkdir "$T/crafted"
+$MKBMP "$T/crafted/h26.bmp" 1 -67108864 24 54 4000
+$MKBMP "$T/crafted/h31.bmp" 1 -2147483648 24 54 4000
+$MKBMP "$T/crafted/w32.bmp" 3 2147483647 32 54 4000
+for f in h26 h31 w32; do
+    check_bounded "-i on crafted $f" $STEG -i "$T/crafted/$f.bmp"
+    check_bounded "-d on crafted $f" $STEG -d "$T/crafted/$f.bmp" "$T/x.bin" -q
+    check_bounded "piped -d on crafted $f" sh -c "$STEG -d - '$T/x.bin' -q < '$T/crafted/$f.bmp'"
+done
+check_bounded "--scan over crafted headers" $STEG --scan "$T/crafted"
+$MKBMP "$T/tall.bmp" 7 -2147483648 24 54 40000
+roundtrip "truncated carrier claiming 2^31 rows" "$T/tall.bmp" "$T/empty.bin" ""
+head -c 500 /dev/urandom >"$T/s500.bin"
+roundtrip "payload in a truncated tall carrier" "$T/tall.bmp" "$T/s500.bin" "" "--mmap"
+check "-i on it within 256 MB" sh -c "ulimit -v 262144; $STEG -i '$T/rt.bmp'"
+check "piped -d of it within 256 MB" sh -c "ulimit -v 262144; $STEG -d - '$T/x.bin' -q < '$T/rt.bmp'"
+
+# -i: 0 when every image holds a payload, 1 when some hold none, 2 when one is unreadable
+probe_status() {
+    $STEG -i "$@" >"$T/probe.out" 2>/dev/null
+    echo $?
+}
+check "-i on a stego image" test "$(probe_status "$T/crc.bmp")" = 0
+check "-i on a plain image" test "$(probe_status "$T/c24.bmp")" = 1
+check "-i reports no payload" grep -q "magic=none.*no payload" "$T/probe.out"
+check "-i on a mix" test "$(probe_status "$T/crc.bmp" "$T/c24.bmp")" = 1
+check "-i on a non-BMP" test "$(probe_status "$T/p.bin" "$T/crc.bmp")" = 2
+check "-i on a missing file" test "$(probe_status "$T/nosuch.bmp")" = 2
+
+# Shard and join
+check "--shard" $STEG --shard "$T/big.bin" "$T/sh" "$T/c24.bmp" "$T/pad.bmp" "$T/td32.bmp" -q --crc
+check "--join" $STEG --join "$T/joined.bin" "$T/sh.002.bmp" "$T/sh.000.bmp" "$T/sh.001.bmp" -q -j 2
+check "--join output" cmp "$T/big.bin" "$T/joined.bin"
+check "-q keeps --shard off stdout" test -z "$($STEG --shard "$T/big.bin" "$T/sq" "$T/c24.bmp" "$T/pad.bmp" "$T/td32.bmp" -q)"
+check_fails "--join with a shard missing" $STEG --join "$T/part.bin" "$T/sh.000.bmp" "$T/sh.002.bmp" -q
+check "failed --join removes its output" test ! -e "$T/part.bin"
+check_fails "--join with a shard twice" $STEG --join "$T/part.bin" "$T/sh.000.bmp" "$T/sh.000.bmp" "$T/sh.001.bmp" -q
+check_fails "--join without shards" $STEG --join "$T/part.bin"
+check_fails "--shard without carriers" $STEG --shard "$T/big.bin" "$T/sh"
+check_fails "-d of a single shard" $STEG -d "$T/sh.000.bmp" "$T/x.bin" -q
+
+# Batch jobs: good lines run, bad lines fail on their own, and nothing falls back to a default output name
+case $STEG in /*) steg_abs=$STEG ;; *) steg_abs=$(pwd)/$STEG ;; esac
+mkdir "$T/batch"
+tab=$(printf '\t')
+{
+    echo "# op carrier payload output"
+    echo "encode$tab$T/c24.bmp$tab$T/small.bin$tab$T/b1.bmp"
+    echo "-e$tab$T/pad.bmp$tab$T/p.bin$tab$T/b2.bmp"
+    echo "frobnicate$tab$T/c24.bmp$tab$T/small.bin$tab$T/b3.bmp"
+    echo "encode$tab$T/nosuch.bmp$tab$T/small.bin$tab$T/b4.bmp"
+    echo "encode$tab$T/tiny.bmp$tab$T/small.bin"
+    echo "encode$tab$T/tiny.bmp$tab$T/small.bin$tab-"
+    echo "encode$tab$T/td32.bmp$tab$T/small.bin$tab$T/b1.bmp"
+} >"$T/jobs.tsv"
+( cd "$T/batch" && "$steg_abs" --batch "$T/jobs.tsv" -j 2 ) >"$T/batch.out" 2>&1
+check "--batch exits non-zero when a job fails" test $? -ne 0
+check "--batch encode" $STEG -d "$T/b1.bmp" "$T/bd1.bin" -q
+check "--batch encode output" cmp "$T/small.bin" "$T/bd1.bin"
+check "--batch -e" $STEG -d "$T/b2.bmp" "$T/bd2.bin" -q
+check "--batch -e output" cmp "$T/p.bin" "$T/bd2.bin"
+for l in 4 5 6 7 8; do
+    check "--batch line $l reported FAILED" grep -q "^$l$tab.*${tab}FAILED$tab" "$T/batch.out"
+done
+check "--batch good lines ok" test "$(grep -c "${tab}ok$tab" "$T/batch.out")" -eq 2
+check "--batch writes no default output" test -z "$(ls -A "$T/batch")"
+check "--batch summary" grep -q "^Batch: 7 jobs, 2 ok, 5 failed" "$T/batch.out"
+printf 'decode\t%s\t-\t%s\n' "$T/b1.bmp" "$T/bd3.bin" >"$T/jobs2.tsv"
+check "--batch decode" $STEG --batch "$T/jobs2.tsv"
+check "--batch decode output" cmp "$T/small.bin" "$T/bd3.bin"
+check_fails "--batch with a missing jobs file" $STEG --batch "$T/nosuch.tsv"
+
+# stegd: requests over the socket against a daemon of our own
+mkdir "$T/carriers"
+cp "$T/c24.bmp" "$T/carriers/c24.bmp"
+$STEGD "$T/d.sock" --carriers "$T/carriers" --max-body-mb 1 -j 2 2>"$T/stegd.log" &
+stegd_pid=$!
+i=0
+while [ ! -S "$T/d.sock" ] && [ $i -lt 50 ]; do sleep 0.1; i=$((i + 1)); done
+check "stegd starts" test -S "$T/d.sock"
+
+# reply_body REPLY OUT: drop the "ok ..." line of a reply
+reply_body() {
+    hdr=$(head -n 1 "$1")
+    tail -c +$((${#hdr} + 2)) "$1" >"$2"
+}
+
+$STEGC "$T/d.sock" "encode c24.bmp 20000 extn=bin" "$T/small.bin" >"$T/r1" 2>&1
+check "stegd encode reply" test "$(head -n 1 "$T/r1")" = "ok $(wc -c <"$T/c24.bmp")"
+reply_body "$T/r1" "$T/sd1.bmp"
+check "stegd encode output" $STEG -d "$T/sd1.bmp" "$T/sd1.bin" -q
+check "stegd encode round trip" cmp "$T/small.bin" "$T/sd1.bin"
+$STEGC "$T/d.sock" "encode c24.bmp 100000 crc out=$T/sd2.bmp" "$T/p.bin" \
+    "stats - 0" "" >"$T/r2" 2>&1
+check "stegd encode out=" test "$(head -n 1 "$T/r2")" = "ok 0"
+check "stegd stats after a repeated carrier" grep -q '"hits":1,"misses":1,' "$T/r2"
+$STEGC "$T/d.sock" "decode $T/sd2.bmp 0 out=$T/sd2.bin" "" >"$T/r3" 2>&1
+check "stegd decode by path" test "$(cat "$T/r3")" = "ok 0 -"
+check "stegd decode by path output" cmp "$T/p.bin" "$T/sd2.bin"
+$STEGC "$T/d.sock" "decode - $(wc -c <"$T/sd1.bmp")" "$T/sd1.bmp" >"$T/r4" 2>&1
+check "stegd decode of the body" test "$(head -n 1 "$T/r4")" = "ok 20000 bin"
+reply_body "$T/r4" "$T/sd4.bin"
+check "stegd decode of the body output" cmp "$T/small.bin" "$T/sd4.bin"
+
+# Rejected requests: an error reply, and a bad request line or body ends the connection
+head -c 1100000 /dev/urandom >"$T/big1m.bin"
+$STEGC "$T/d.sock" "encode c24.bmp 1100000" "$T/big1m.bin" "stats - 0" "" >"$T/r5" 2>&1
+check "stegd body over --max-body-mb" test "$(cat "$T/r5")" = "error request body too large"
+$STEGC "$T/d.sock" "encode c24.bmp many" "" "stats - 0" "" >"$T/r6" 2>&1
+check "stegd malformed request" test "$(cat "$T/r6")" = "error malformed request"
+$STEGC "$T/d.sock" "encode .. 0" "" "encode . 0" "" "encode ../c24.bmp 0" "" "encode nosuch.bmp 0" "" >"$T/r7" 2>&1
+check "stegd .. and . IDs" test "$(grep -c '^error bad carrier name$' "$T/r7")" -eq 2
+check "stegd ../ and missing carriers" test "$(grep -c '^error cannot read carrier$' "$T/r7")" -eq 2
+$STEGC "$T/d.sock" "frobnicate - 0" "" "stats - 0" "" >"$T/r8" 2>&1
+check "stegd unknown operation keeps the connection" grep -q '"requests":' "$T/r8"
+
+kill -TERM $stegd_pid
+wait $stegd_pid
+check "stegd exits cleanly on SIGTERM" test $? -eq 0
+check "stegd removes its socket" test ! -e "$T/d.sock"
+
+# --kernel=: every kernel this CPU runs writes what scalar reads, and reads what scalar writes
+kernels=$($STEG --kernel=list -e "$T/c24.bmp" "$T/p.bin" "$T/kn.bmp" 2>&1 | sed -n 's/.*Available://p')
+check "--kernel lists the kernels" test -n "$kernels"
+for k in $kernels; do
+    if $STEG --kernel="$k" -e "$T/c24.bmp" "$T/p.bin" "$T/kn.bmp" -q 2>&1 | grep -q "not supported"; then
+        continue
+    fi
+    roundtrip "--kernel=$k encode, scalar decode" "$T/c24.bmp" "$T/p.bin" "--kernel=$k" "--kernel=scalar"
+    roundtrip "scalar encode, --kernel=$k decode" "$T/pad.bmp" "$T/p.bin" "--kernel=scalar" "--kernel=$k"
+done
+check_fails "unknown --kernel" $STEG --kernel=bogus -e "$T/c24.bmp" "$T/p.bin" "$T/kn.bmp" -q
+
+# --stats=json: one JSON record per operation, on stdout unless the payload goes there
+# json_record NAME FILE OK: FILE holds exactly one JSON line with "ok":OK, "kernel" and "phases"
+json_record() {
+    if [ "$(wc -l <"$2")" -eq 1 ] && head -c 1 "$2" | grep -q '{' &&
+       grep -q "\"ok\":$3," "$2" && grep -q '"kernel":"[a-z0-9]*",' "$2" && grep -q '"phases":{"' "$2" &&
+       { ! command -v python3 >/dev/null || python3 -c 'import json, sys; json.loads(sys.stdin.read())' <"$2"; }; then
+        pass
+    else
+        fail "$1"
+        sed 's/^/    /' "$2"
+    fi
+}
+
+$STEG -e "$T/c24.bmp" "$T/small.bin" "$T/st.bmp" --stats=json >"$T/st.json" 2>"$T/st.err"
+check "--stats=json encode" test $? -eq 0
+json_record "--stats=json encode record" "$T/st.json" true
+$STEG -d "$T/st.bmp" "$T/st.bin" --stats=json >"$T/st.json" 2>"$T/st.err"
+json_record "--stats=json decode record" "$T/st.json" true
+check "--stats=json decode output" cmp "$T/small.bin" "$T/st.bin"
+$STEG -d "$T/st.bmp" - --stats=json >"$T/st.out" 2>"$T/st.json"
+check "--stats=json with -d to stdout keeps the payload intact" cmp "$T/small.bin" "$T/st.out"
+json_record "--stats=json with -d to stdout goes to stderr" "$T/st.json" true
+$STEG -d "$T/c24.bmp" "$T/st2.bin" --stats=json >"$T/st.json" 2>"$T/st.err"
+check "--stats=json failed decode exits non-zero" test $? -ne 0
+json_record "--stats=json failed decode record" "$T/st.json" false
+check_fails "--stats=xml" $STEG -e "$T/c24.bmp" "$T/small.bin" "$T/st.bmp" --stats=xml
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,107 @@
+/*
+ * stegc: send requests to stegd over its socket for the tests.
+ *
+ *   stegc <socket> [<request line> <body file>]...
+ *
+ * Each request line gets a newline and is followed by the bytes of its body
+ * file ("" for no body); the requests go out back to back on one connection,
+ * which is then shut down for writing. Everything the daemon replies, up to
+ * its end of the connection, is copied to stdout. A child process does the
+ * sending, so a large reply cannot block a request still being written.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+static int write_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return 0;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+static int send_requests(int fd, int argc, char *argv[])
+{
+    char buf[65536];
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (!write_all(fd, argv[i], strlen(argv[i])) || !write_all(fd, "\n", 1))
+            return 0;
+        if (argv[i + 1][0] == '\0')
+            continue;
+        FILE *fptr = fopen(argv[i + 1], "rb");
+        if (fptr == NULL)
+        {
+            perror(argv[i + 1]);
+            return 0;
+        }
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fptr)) > 0)
+        {
+            if (!write_all(fd, buf, n))
+            {
+                fclose(fptr);
+                return 0;
+            }
+        }
+        fclose(fptr);
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc % 2 != 0)
+    {
+        fprintf(stderr, "Usage: %s <socket> [<request line> <body file>]...\n", argv[0]);
+        return 2;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[1]);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0)
+    {
+        // The daemon may close early (e.g. on a rejected request): the rest just goes unsent
+        int sent = send_requests(fd, argc, argv);
+        shutdown(fd, SHUT_WR);
+        _exit(sent ? 0 : 1);
+    }
+
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        if (!write_all(STDOUT_FILENO, buf, (size_t)n))
+            break;
+    }
+    close(fd);
+    int status;
+    waitpid(pid, &status, 0);
+    return n == 0 ? 0 : 1;
+}
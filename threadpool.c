@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "threadpool.h"
+
+typedef struct _PoolTask
+{
+    pool_task_fn fn;
+    void *arg;
+    struct _PoolTask *next;
+} PoolTask;
+
+struct _ThreadPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // Signalled when a task is queued or on shutdown
+    pthread_cond_t idle;        // Signalled when the pending count drops to zero
+    PoolTask *head, *tail;
+    int pending;                // Queued plus running tasks
+    int stop;
+    int nthreads;
+    pthread_t *threads;
+};
+
+static void *pool_worker(void *arg)
+{
+    ThreadPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->head == NULL && !pool->stop)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->head == NULL)
+            break;
+
+        PoolTask *task = pool->head;
+        pool->head = task->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->fn(task->arg);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool *pool_create(int nthreads)
+{
+    if (nthreads < 1)
+        nthreads = 1;
+
+    ThreadPool *pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+    pool->threads = calloc((size_t)nthreads, sizeof(pthread_t));
+    if (!pool->threads)
+    {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0)
+        {
+            fprintf(stderr, "ERROR: Unable to start worker thread %d\n", i);
+            break;
+        }
+        pool->nthreads++;
+    }
+    if (pool->nthreads == 0)
+    {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+Status pool_submit(ThreadPool *pool, pool_task_fn fn, void *arg)
+{
+    PoolTask *task = malloc(sizeof(*task));
+    if (!task)
+        return e_failure;
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pool->pending++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return e_success;
+}
+
+void pool_wait(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_destroy(ThreadPool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
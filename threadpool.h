@@ -0,0 +1,23 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "types.h"
+
+/* Work item run on a pool thread */
+typedef void (*pool_task_fn)(void *arg);
+
+typedef struct _ThreadPool ThreadPool;
+
+/* Start a pool with nthreads workers (at least 1) */
+ThreadPool *pool_create(int nthreads);
+
+/* Queue a task; it runs on the first free worker */
+Status pool_submit(ThreadPool *pool, pool_task_fn fn, void *arg);
+
+/* Block until every submitted task has finished */
+void pool_wait(ThreadPool *pool);
+
+/* Finish queued work, stop the workers and free the pool */
+void pool_destroy(ThreadPool *pool);
+
+#endif
@@ -21,6 +21,9 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_probe,
+    e_container,
+    e_list,
     e_unsupported
 } OperationType;
 